@@ -0,0 +1,130 @@
+/**********************************************************************
+Compares a reduced-precision tracking mode with float tracking: fixed
+point ("fixed", the default) or bfloat16 pyramids ("half").  The best
+features of the first image are tracked through the sequence; at every
+frame, the same features are tracked from the same locations in both
+modes, and the differences in status and location are reported.  Both
+trackers then continue from the float result, so that the errors of
+one frame do not carry over into the next.
+
+Usage: klt_accuracy [fixed|half] [nFeatures nFrames]
+**********************************************************************/
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "pnmio.h"
+#include "klt.h"
+
+static void copyFeatureArrays(KLT_FeatureArrays from, KLT_FeatureArrays to)
+{
+    memcpy(to->x, from->x, from->nFeatures * sizeof(KLT_locType));
+    memcpy(to->y, from->y, from->nFeatures * sizeof(KLT_locType));
+    memcpy(to->val, from->val, from->nFeatures * sizeof(int));
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned char *img1, *img2, *tmp;
+    char fnamein[100];
+    const char *mode = "fixed";
+    KLT_TrackingContext tcFloat, tcFixed;
+    KLT_FeatureArrays faFloat, faFixed;
+    int nFeatures;
+    int nFrames;
+    int ncols, nrows;
+    int nFloat, nFixed, nBoth, nMismatch, nOver;
+    int totFloat = 0, totFixed = 0, totBoth = 0, totMismatch = 0, totOver = 0;
+    double sum, sum2, maxerr, totsum = 0.0, totsum2 = 0.0, totmax = 0.0;
+    int i, j;
+
+    if(argc == 2 || argc == 4)
+    {
+        mode = argv[1];
+        argc--;  argv++;
+    }
+    if(argc == 3)
+    {
+        nFeatures = atoi(argv[1]);
+        nFrames = atoi(argv[2]);
+    }
+    else
+    {
+        nFeatures = 512;
+        nFrames = 10;
+    }
+
+    KLTSetVerbosity(0);
+    tcFloat = KLTCreateTrackingContext();
+    tcFixed = KLTCreateTrackingContext();
+    tcFloat->sequentialMode = tcFixed->sequentialMode = TRUE;
+    if (strcmp(mode, "half") == 0)
+        tcFixed->halfPrecisionPyramids = TRUE;
+    else
+        tcFixed->fixedPointTracking = TRUE;
+    faFloat = KLTCreateFeatureArrays(nFeatures);
+    faFixed = KLTCreateFeatureArrays(nFeatures);
+
+    img1 = pgmReadFile("img0.pgm", NULL, &ncols, &nrows);
+    img2 = (unsigned char *) malloc(ncols*nrows*sizeof(unsigned char));
+
+    KLTSelectGoodFeatureArrays(tcFloat, img1, ncols, nrows, faFloat);
+
+    printf("%s against float\n", mode);
+    printf("frame  float  %5s   both  status  mean err   rms err   max err  >0.1px\n", mode);
+    for (i = 1 ; i < nFrames ; i++)
+    {
+        sprintf(fnamein, "img%d.pgm", i);
+        pgmReadFile(fnamein, img2, &ncols, &nrows);
+
+        copyFeatureArrays(faFloat, faFixed);
+        KLTTrackFeatureArrays(tcFloat, img1, img2, ncols, nrows, faFloat);
+        KLTTrackFeatureArrays(tcFixed, img1, img2, ncols, nrows, faFixed);
+
+        nFloat = nFixed = nBoth = nMismatch = nOver = 0;
+        sum = sum2 = maxerr = 0.0;
+        for (j = 0 ; j < nFeatures ; j++)
+        {
+            if (faFloat->val[j] >= 0)  nFloat++;
+            if (faFixed->val[j] >= 0)  nFixed++;
+            if (faFloat->val[j] != faFixed->val[j])  nMismatch++;
+            if (faFloat->val[j] >= 0 && faFixed->val[j] >= 0)
+            {
+                double dx = faFixed->x[j] - faFloat->x[j];
+                double dy = faFixed->y[j] - faFloat->y[j];
+                double err = sqrt(dx*dx + dy*dy);
+                nBoth++;
+                sum += err;
+                sum2 += err*err;
+                if (err > maxerr)  maxerr = err;
+                if (err > 0.1)  nOver++;
+            }
+        }
+        printf("%5d  %5d  %5d  %5d  %6d  %8.4f  %8.4f  %8.4f  %6d\n",
+               i, nFloat, nFixed, nBoth, nMismatch,
+               nBoth ? sum / nBoth : 0.0, nBoth ? sqrt(sum2 / nBoth) : 0.0,
+               maxerr, nOver);
+
+        totFloat += nFloat;  totFixed += nFixed;  totBoth += nBoth;
+        totMismatch += nMismatch;  totOver += nOver;
+        totsum += sum;  totsum2 += sum2;
+        if (maxerr > totmax)  totmax = maxerr;
+
+        KLTReplaceLostFeatureArrays(tcFloat, img2, ncols, nrows, faFloat);
+        tmp = img1;  img1 = img2;  img2 = tmp;
+    }
+    printf("total  %5d  %5d  %5d  %6d  %8.4f  %8.4f  %8.4f  %6d\n",
+           totFloat, totFixed, totBoth, totMismatch,
+           totBoth ? totsum / totBoth : 0.0, totBoth ? sqrt(totsum2 / totBoth) : 0.0,
+           totmax, totOver);
+
+    KLTFreeFeatureArrays(faFloat);
+    KLTFreeFeatureArrays(faFixed);
+    KLTFreeTrackingContext(tcFloat);
+    KLTFreeTrackingContext(tcFixed);
+    free(img1);
+    free(img2);
+
+    return 0;
+}
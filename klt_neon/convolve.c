@@ -21,10 +21,10 @@ typedef struct  {
   float data[MAX_KERNEL_WIDTH];
 }  ConvolutionKernel;
 
-/* Kernels */
-static ConvolutionKernel gauss_kernel;
-static ConvolutionKernel gaussderiv_kernel;
-static float sigma_last = -10.0;
+/* Kernels are computed on the caller's stack rather than cached in */
+/* static storage, so that several threads (or tracking contexts)    */
+/* may convolve images concurrently.  Computing a kernel costs a few */
+/* dozen exp()s, which is negligible compared to convolving an image. */
 
 
 /*********************************************************************
@@ -107,8 +107,6 @@ static void _computeKernels(
     for (i = -hw ; i <= hw ; i++)  den -= i*gaussderiv->data[i+hw];
     for (i = -hw ; i <= hw ; i++)  gaussderiv->data[i+hw] /= den;
   }
-
-  sigma_last = sigma;
 }
 	
 
@@ -122,6 +120,8 @@ void _KLTGetKernelWidths(
   int *gauss_width,
   int *gaussderiv_width)
 {
+  ConvolutionKernel gauss_kernel, gaussderiv_kernel;
+
   _computeKernels(sigma, &gauss_kernel, &gaussderiv_kernel);
   *gauss_width = gauss_kernel.width;
   *gaussderiv_width = gaussderiv_kernel.width;
@@ -129,114 +129,89 @@ void _KLTGetKernelWidths(
 
 
 /*********************************************************************
- * _convolveImageHoriz
+ * _convolveRegion
+ *
+ * Convolves imgin with horiz_kernel along the rows and vert_kernel
+ * along the columns, writing only the pixels [x0,x1) x [y0,y1) of
+ * imgout.  The pixels within a kernel radius of the border of the
+ * image are zeroed, as if the whole image had been convolved, and each
+ * pixel is summed in the same order whatever the region, so convolving
+ * an image region by region gives exactly the same result as
+ * convolving it at once.  imgin must be valid within a kernel radius
+ * of the region.
  */
 
-static void _convolveImageHoriz(
+static void _convolveRegion(
   _KLT_FloatImage imgin,
-  ConvolutionKernel kernel,
-  _KLT_FloatImage imgout)
+  ConvolutionKernel horiz_kernel,
+  ConvolutionKernel vert_kernel,
+  _KLT_FloatImage imgout,
+  int x0, int y0,
+  int x1, int y1)
 {
-  float *ptrrow = imgin->data;           /* Points to row's first pixel */
-  register float *ptrout = imgout->data, /* Points to next output pixel */
-    *ppp;
+  int hradius = horiz_kernel.width / 2, vradius = vert_kernel.width / 2;
+  int ncols = imgin->ncols, nrows = imgin->nrows;
+  int ty0 = max(y0 - vradius, 0), ty1 = min(y1 + vradius, nrows);
+  int width = x1 - x0;
+  float *tmp, *ptrout, *ppp;
   register float sum;
-  register int radius = kernel.width / 2;
-  register int ncols = imgin->ncols, nrows = imgin->nrows;
   register int i, j, k;
 
-  /* Kernel width must be odd */
-  assert(kernel.width % 2 == 1);
+  /* Kernel widths must be odd */
+  assert(horiz_kernel.width % 2 == 1);
+  assert(vert_kernel.width % 2 == 1);
 
   /* Must read from and write to different images */
   assert(imgin != imgout);
 
-  /* Output image must be large enough to hold result */
-  assert(imgout->ncols >= imgin->ncols);
+  /* Output image must be as wide as the input */
+  assert(imgout->ncols == imgin->ncols);
   assert(imgout->nrows >= imgin->nrows);
-
-  /* For each row, do ... */
-  for (j = 0 ; j < nrows ; j++)  {
-
-    /* Zero leftmost columns */
-    for (i = 0 ; i < radius ; i++)
-      *ptrout++ = 0.0;
-
-    /* Convolve middle columns with kernel */
-    for ( ; i < ncols - radius ; i++)  {
-      ppp = ptrrow + i - radius;
+  assert(x0 >= 0 && y0 >= 0 && x1 <= ncols && y1 <= nrows);
+
+  if (x0 >= x1 || y0 >= y1)  return;
+
+  /* Rows ty0 to ty1 of the region, convolved horizontally */
+  tmp = (float *) malloc(width * (ty1 - ty0) * sizeof(float));
+  if (tmp == NULL)
+    KLTError("(_convolveRegion) Out of memory");
+
+  ptrout = tmp;
+  for (j = ty0 ; j < ty1 ; j++)  {
+    float *ptrrow = imgin->data + j * ncols;
+    for (i = x0 ; i < x1 ; i++)  {
+      if (i < hradius || i >= ncols - hradius)  {
+        *ptrout++ = 0.0;      /* leftmost and rightmost columns */
+        continue;
+      }
+      ppp = ptrrow + i - hradius;
       sum = 0.0;
-      for (k = kernel.width-1 ; k >= 0 ; k--)
-        sum += *ppp++ * kernel.data[k];
+      for (k = horiz_kernel.width-1 ; k >= 0 ; k--)
+        sum += *ppp++ * horiz_kernel.data[k];
       *ptrout++ = sum;
     }
-
-    /* Zero rightmost columns */
-    for ( ; i < ncols ; i++)
-      *ptrout++ = 0.0;
-
-    ptrrow += ncols;
   }
-}
-
 
-/*********************************************************************
- * _convolveImageVert
- */
-
-static void _convolveImageVert(
-  _KLT_FloatImage imgin,
-  ConvolutionKernel kernel,
-  _KLT_FloatImage imgout)
-{
-  float *ptrcol = imgin->data;            /* Points to row's first pixel */
-  register float *ptrout = imgout->data,  /* Points to next output pixel */
-    *ppp;
-  register float sum;
-  register int radius = kernel.width / 2;
-  register int ncols = imgin->ncols, nrows = imgin->nrows;
-  register int i, j, k;
-
-  /* Kernel width must be odd */
-  assert(kernel.width % 2 == 1);
-
-  /* Must read from and write to different images */
-  assert(imgin != imgout);
-
-  /* Output image must be large enough to hold result */
-  assert(imgout->ncols >= imgin->ncols);
-  assert(imgout->nrows >= imgin->nrows);
-
-  /* For each column, do ... */
-  for (i = 0 ; i < ncols ; i++)  {
-
-    /* Zero topmost rows */
-    for (j = 0 ; j < radius ; j++)  {
-      *ptrout = 0.0;
-      ptrout += ncols;
+  /* Convolve the columns */
+  for (j = y0 ; j < y1 ; j++)  {
+    ptrout = imgout->data + j * ncols + x0;
+    if (j < vradius || j >= nrows - vradius)  {
+      for (i = 0 ; i < width ; i++)
+        *ptrout++ = 0.0;      /* topmost and bottommost rows */
+      continue;
     }
-
-    /* Convolve middle rows with kernel */
-    for ( ; j < nrows - radius ; j++)  {
-      ppp = ptrcol + ncols * (j - radius);
+    for (i = 0 ; i < width ; i++)  {
+      ppp = tmp + (j - vradius - ty0) * width + i;
       sum = 0.0;
-      for (k = kernel.width-1 ; k >= 0 ; k--)  {
-        sum += *ppp * kernel.data[k];
-        ppp += ncols;
+      for (k = vert_kernel.width-1 ; k >= 0 ; k--)  {
+        sum += *ppp * vert_kernel.data[k];
+        ppp += width;
       }
-      *ptrout = sum;
-      ptrout += ncols;
-    }
-
-    /* Zero bottommost rows */
-    for ( ; j < nrows ; j++)  {
-      *ptrout = 0.0;
-      ptrout += ncols;
+      *ptrout++ = sum;
     }
-
-    ptrcol++;
-    ptrout -= nrows * ncols - 1;
   }
+
+  free(tmp);
 }
 
 
@@ -250,17 +225,8 @@ static void _convolveSeparate(
   ConvolutionKernel vert_kernel,
   _KLT_FloatImage imgout)
 {
-  /* Create temporary image */
-  _KLT_FloatImage tmpimg;
-  tmpimg = _KLTCreateFloatImage(imgin->ncols, imgin->nrows);
-  
-  /* Do convolution */
-  _convolveImageHoriz(imgin, horiz_kernel, tmpimg);
-
-  _convolveImageVert(tmpimg, vert_kernel, imgout);
-
-  /* Free memory */
-  _KLTFreeFloatImage(tmpimg);
+  _convolveRegion(imgin, horiz_kernel, vert_kernel, imgout,
+                  0, 0, imgin->ncols, imgin->nrows);
 }
 
 	
@@ -274,17 +240,16 @@ void _KLTComputeGradients(
   _KLT_FloatImage gradx,
   _KLT_FloatImage grady)
 {
-				
+  ConvolutionKernel gauss_kernel, gaussderiv_kernel;
+
   /* Output images must be large enough to hold result */
   assert(gradx->ncols >= img->ncols);
   assert(gradx->nrows >= img->nrows);
   assert(grady->ncols >= img->ncols);
   assert(grady->nrows >= img->nrows);
 
-  /* Compute kernels, if necessary */
-  if (fabs(sigma - sigma_last) > 0.05)
-    _computeKernels(sigma, &gauss_kernel, &gaussderiv_kernel);
-	
+  _computeKernels(sigma, &gauss_kernel, &gaussderiv_kernel);
+
   _convolveSeparate(img, gaussderiv_kernel, gauss_kernel, gradx);
   _convolveSeparate(img, gauss_kernel, gaussderiv_kernel, grady);
 
@@ -300,16 +265,55 @@ void _KLTComputeSmoothedImage(
   float sigma,
   _KLT_FloatImage smooth)
 {
+  ConvolutionKernel gauss_kernel, gaussderiv_kernel;
+
   /* Output image must be large enough to hold result */
   assert(smooth->ncols >= img->ncols);
   assert(smooth->nrows >= img->nrows);
 
-  /* Compute kernel, if necessary; gauss_deriv is not used */
-  if (fabs(sigma - sigma_last) > 0.05)
-    _computeKernels(sigma, &gauss_kernel, &gaussderiv_kernel);
+  /* Compute kernel; gauss_deriv is not used */
+  _computeKernels(sigma, &gauss_kernel, &gaussderiv_kernel);
 
   _convolveSeparate(img, gauss_kernel, gauss_kernel, smooth);
 }
 
 
+/*********************************************************************
+ * _KLTComputeGradientsRegion
+ * _KLTComputeSmoothedRegion
+ *
+ * Same as _KLTComputeGradients and _KLTComputeSmoothedImage, for the
+ * pixels [x0,x1) x [y0,y1) only.  The input must be valid within a
+ * kernel radius of the region (see _KLTGetKernelWidths).
+ */
 
+void _KLTComputeGradientsRegion(
+  _KLT_FloatImage img,
+  float sigma,
+  _KLT_FloatImage gradx,
+  _KLT_FloatImage grady,
+  int x0, int y0,
+  int x1, int y1)
+{
+  ConvolutionKernel gauss_kernel, gaussderiv_kernel;
+
+  _computeKernels(sigma, &gauss_kernel, &gaussderiv_kernel);
+
+  _convolveRegion(img, gaussderiv_kernel, gauss_kernel, gradx, x0, y0, x1, y1);
+  _convolveRegion(img, gauss_kernel, gaussderiv_kernel, grady, x0, y0, x1, y1);
+}
+
+
+void _KLTComputeSmoothedRegion(
+  _KLT_FloatImage img,
+  float sigma,
+  _KLT_FloatImage smooth,
+  int x0, int y0,
+  int x1, int y1)
+{
+  ConvolutionKernel gauss_kernel, gaussderiv_kernel;
+
+  _computeKernels(sigma, &gauss_kernel, &gaussderiv_kernel);
+
+  _convolveRegion(img, gauss_kernel, gauss_kernel, smooth, x0, y0, x1, y1);
+}
@@ -29,4 +29,19 @@ void _KLTComputeSmoothedImage(
   float sigma,
   _KLT_FloatImage smooth);
 
+void _KLTComputeGradientsRegion(
+  _KLT_FloatImage img,
+  float sigma,
+  _KLT_FloatImage gradx,
+  _KLT_FloatImage grady,
+  int x0, int y0,
+  int x1, int y1);
+
+void _KLTComputeSmoothedRegion(
+  _KLT_FloatImage img,
+  float sigma,
+  _KLT_FloatImage smooth,
+  int x0, int y0,
+  int x1, int y1);
+
 #endif
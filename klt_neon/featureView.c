@@ -0,0 +1,149 @@
+/*********************************************************************
+ * featureView.c
+ *
+ *********************************************************************/
+
+/* Standard includes */
+#include <stddef.h>   /* offsetof() */
+#include <stdlib.h>   /* NULL */
+
+/* Our includes */
+#include "error.h"
+#include "featureView.h"
+#include "klt.h"
+
+
+/*********************************************************************
+ * _KLTViewFeatureArrays
+ *
+ * Views feature arrays; the fields of consecutive features are
+ * adjacent.
+ */
+
+void _KLTViewFeatureArrays(
+  KLT_FeatureArrays fa,
+  _KLT_FeatureView view)
+{
+  view->nFeatures = fa->nFeatures;
+  view->x = (char *) fa->x;
+  view->y = (char *) fa->y;
+  view->val = (char *) fa->val;
+  view->aff_img = (char *) fa->aff_img;
+  view->aff_img_gradx = (char *) fa->aff_img_gradx;
+  view->aff_img_grady = (char *) fa->aff_img_grady;
+  view->aff_x = (char *) fa->aff_x;
+  view->aff_y = (char *) fa->aff_y;
+  view->aff_Axx = (char *) fa->aff_Axx;
+  view->aff_Ayx = (char *) fa->aff_Ayx;
+  view->aff_Axy = (char *) fa->aff_Axy;
+  view->aff_Ayy = (char *) fa->aff_Ayy;
+  view->stride = sizeof(KLT_locType);
+  view->pstride = sizeof(_KLT_FloatImage);
+  view->slab = (_KLT_AffineSlab *) &fa->aff_slab;
+  view->rec = NULL;
+}
+
+
+/*********************************************************************
+ * _KLTOpenFeatureListView
+ *
+ * Views a feature list, in place.  The records of lists created by
+ * KLTCreateFeatureList are contiguous, and are strided over.  If the
+ * caller has rearranged the feature pointers, the records are reached
+ * through them instead.
+ */
+
+void _KLTOpenFeatureListView(
+  KLT_FeatureList fl,
+  _KLT_FeatureView view)
+{
+  KLT_Feature first = (fl->nFeatures > 0) ? fl->feature[0] : NULL;
+  KLT_BOOL contiguous = TRUE;
+  int i;
+
+  for (i = 1 ; i < fl->nFeatures && contiguous ; i++)
+    contiguous = (fl->feature[i] == first + i);
+
+  view->nFeatures = fl->nFeatures;
+  view->x = (char *) first + offsetof(KLT_FeatureRec, x);
+  view->y = (char *) first + offsetof(KLT_FeatureRec, y);
+  view->val = (char *) first + offsetof(KLT_FeatureRec, val);
+  view->aff_img = (char *) first + offsetof(KLT_FeatureRec, aff_img);
+  view->aff_img_gradx = (char *) first + offsetof(KLT_FeatureRec, aff_img_gradx);
+  view->aff_img_grady = (char *) first + offsetof(KLT_FeatureRec, aff_img_grady);
+  view->aff_x = (char *) first + offsetof(KLT_FeatureRec, aff_x);
+  view->aff_y = (char *) first + offsetof(KLT_FeatureRec, aff_y);
+  view->aff_Axx = (char *) first + offsetof(KLT_FeatureRec, aff_Axx);
+  view->aff_Ayx = (char *) first + offsetof(KLT_FeatureRec, aff_Ayx);
+  view->aff_Axy = (char *) first + offsetof(KLT_FeatureRec, aff_Axy);
+  view->aff_Ayy = (char *) first + offsetof(KLT_FeatureRec, aff_Ayy);
+  view->stride = sizeof(KLT_FeatureRec);
+  view->pstride = sizeof(KLT_FeatureRec);
+  view->slab = (_KLT_AffineSlab *) &fl->aff_slab;
+  view->rec = contiguous ? NULL : fl->feature;
+}
+
+
+/*********************************************************************
+ * _KLTLoadFeature
+ * _KLTStoreFeature
+ *
+ * Copy all fields of feature i of a view to or from a record.
+ */
+
+void _KLTLoadFeature(
+  _KLT_FeatureView view,
+  int i,
+  KLT_Feature feat)
+{
+  feat->x = FV_X(view, i);
+  feat->y = FV_Y(view, i);
+  feat->val = FV_VAL(view, i);
+  feat->aff_img = FV_AFF_IMG(view, i);
+  feat->aff_img_gradx = FV_AFF_IMG_GRADX(view, i);
+  feat->aff_img_grady = FV_AFF_IMG_GRADY(view, i);
+  feat->aff_x = FV_AFF_X(view, i);
+  feat->aff_y = FV_AFF_Y(view, i);
+  feat->aff_Axx = FV_AFF_AXX(view, i);
+  feat->aff_Ayx = FV_AFF_AYX(view, i);
+  feat->aff_Axy = FV_AFF_AXY(view, i);
+  feat->aff_Ayy = FV_AFF_AYY(view, i);
+}
+
+
+void _KLTStoreFeature(
+  _KLT_FeatureView view,
+  int i,
+  KLT_Feature feat)
+{
+  FV_X(view, i) = feat->x;
+  FV_Y(view, i) = feat->y;
+  FV_VAL(view, i) = feat->val;
+  FV_AFF_IMG(view, i) = feat->aff_img;
+  FV_AFF_IMG_GRADX(view, i) = feat->aff_img_gradx;
+  FV_AFF_IMG_GRADY(view, i) = feat->aff_img_grady;
+  FV_AFF_X(view, i) = feat->aff_x;
+  FV_AFF_Y(view, i) = feat->aff_y;
+  FV_AFF_AXX(view, i) = feat->aff_Axx;
+  FV_AFF_AYX(view, i) = feat->aff_Ayx;
+  FV_AFF_AXY(view, i) = feat->aff_Axy;
+  FV_AFF_AYY(view, i) = feat->aff_Ayy;
+}
+
+
+/*********************************************************************
+ * _KLTCountRemainingFeatures
+ */
+
+int _KLTCountRemainingFeatures(
+  _KLT_FeatureView view)
+{
+  int count = 0;
+  int i;
+
+  for (i = 0 ; i < view->nFeatures ; i++)
+    if (FV_VAL(view, i) >= 0)
+      count++;
+
+  return count;
+}
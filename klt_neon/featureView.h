@@ -0,0 +1,73 @@
+/*********************************************************************
+ * featureView.h
+ *
+ * A feature view gives uniform, strided access to the fields of a
+ * feature list (KLT_FeatureList, array of structures) or of feature
+ * arrays (KLT_FeatureArrays, structure of arrays), without copying
+ * either.  The internal routines that walk over all features
+ * (tracking, selection, storing, writing) work on views.
+ *
+ * A list whose records are not contiguous (its feature pointers
+ * have been rearranged by the caller) is viewed through its pointers
+ * instead: the field pointers then lie in the first record, and give
+ * the offsets of the fields in every record.
+ *********************************************************************/
+
+#ifndef _FEATUREVIEW_H_
+#define _FEATUREVIEW_H_
+
+#include "klt.h"
+
+typedef struct  {
+  int nFeatures;
+  char *x, *y, *val;        /* hot fields */
+  char *aff_img, *aff_img_gradx, *aff_img_grady;
+  char *aff_x, *aff_y;
+  char *aff_Axx, *aff_Ayx, *aff_Axy, *aff_Ayy;
+  int stride;               /* bytes between the scalar fields of two features */
+  int pstride;              /* bytes between the image pointers of two features */
+  _KLT_AffineSlab *slab;    /* storage of the affine templates (may be NULL) */
+  KLT_Feature *rec;         /* records of a list that is not contiguous, else NULL */
+}  _KLT_FeatureViewRec, *_KLT_FeatureView;
+
+#define _FVADDR(v, field, i, s)  ((v)->rec == NULL ? \
+  (v)->field + (i) * (v)->s : \
+  (char *) (v)->rec[i] + ((v)->field - (char *) (v)->rec[0]))
+#define _FV(v, field, type, i)  (*(type *) _FVADDR(v, field, i, stride))
+#define _FVP(v, field, i)  (*(_KLT_FloatImage *) _FVADDR(v, field, i, pstride))
+
+#define FV_X(v, i)        _FV(v, x, KLT_locType, i)
+#define FV_Y(v, i)        _FV(v, y, KLT_locType, i)
+#define FV_VAL(v, i)      _FV(v, val, int, i)
+#define FV_AFF_X(v, i)    _FV(v, aff_x, KLT_locType, i)
+#define FV_AFF_Y(v, i)    _FV(v, aff_y, KLT_locType, i)
+#define FV_AFF_AXX(v, i)  _FV(v, aff_Axx, KLT_locType, i)
+#define FV_AFF_AYX(v, i)  _FV(v, aff_Ayx, KLT_locType, i)
+#define FV_AFF_AXY(v, i)  _FV(v, aff_Axy, KLT_locType, i)
+#define FV_AFF_AYY(v, i)  _FV(v, aff_Ayy, KLT_locType, i)
+#define FV_AFF_IMG(v, i)        _FVP(v, aff_img, i)
+#define FV_AFF_IMG_GRADX(v, i)  _FVP(v, aff_img_gradx, i)
+#define FV_AFF_IMG_GRADY(v, i)  _FVP(v, aff_img_grady, i)
+
+void _KLTViewFeatureArrays(
+  KLT_FeatureArrays fa,
+  _KLT_FeatureView view);
+
+void _KLTOpenFeatureListView(
+  KLT_FeatureList fl,
+  _KLT_FeatureView view);
+
+void _KLTLoadFeature(
+  _KLT_FeatureView view,
+  int i,
+  KLT_Feature feat);
+
+void _KLTStoreFeature(
+  _KLT_FeatureView view,
+  int i,
+  KLT_Feature feat);
+
+int _KLTCountRemainingFeatures(
+  _KLT_FeatureView view);
+
+#endif
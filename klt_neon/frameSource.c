@@ -0,0 +1,692 @@
+/*********************************************************************
+ * frameSource.c
+ *
+ * Reads the frames of a sequence ahead of the tracker.  A reader
+ * thread fills free buffers and queues them in frame order; the
+ * caller takes frames from the queue and hands the buffers back once
+ * done with them, so that no memory is allocated per frame and the
+ * file I/O overlaps with tracking.
+ *********************************************************************/
+
+/* Standard includes */
+#include <ctype.h>    /* isspace() */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>   /* malloc(), atoi() */
+#include <string.h>   /* strcmp(), strcspn() */
+#include <unistd.h>   /* access() */
+
+/* Our includes */
+#include "error.h"
+#include "klt.h"
+#include "pnmio.h"
+#include "frameSource.h"
+
+
+struct _FrameSourceRec  {
+  FrameReader reader;
+  void *state;
+  int ncols, nrows;
+  int nFrames;                /* # of frames left to read; < 0 = all */
+
+  int nBuffers;
+  unsigned char **buffers;    /* NULL when free, if frames are mapped */
+  void **mappings;
+  int *queue;                 /* buffers read, in frame order (ring) */
+  int head, count;
+  int *freelist;              /* buffers ready to be read into */
+  int nFree;
+
+  pthread_mutex_t lock;
+  pthread_cond_t readable;    /* signalled when a frame is queued */
+  pthread_cond_t writable;    /* signalled when a buffer is released */
+  KLT_BOOL done;              /* whether the reader reached the end */
+  KLT_BOOL closing;
+  pthread_t thread;
+};
+
+
+/*********************************************************************
+ * _readerThread
+ */
+
+static void *_readerThread(
+  void *arg)
+{
+  FrameSource fs = (FrameSource) arg;
+  unsigned char *img = NULL;
+  void *mapping = NULL;
+  int b, ok;
+
+  for (;;)  {
+    /* The end is known without a free buffer once the count runs */
+    /* out, and the caller may be holding every buffer by then */
+    pthread_mutex_lock(&fs->lock);
+    while (fs->nFree == 0 && !fs->closing && fs->nFrames != 0)
+      pthread_cond_wait(&fs->writable, &fs->lock);
+    if (fs->closing || fs->nFrames == 0)  break;
+    b = fs->freelist[--fs->nFree];
+    pthread_mutex_unlock(&fs->lock);
+
+    /* Read without holding the lock */
+    if (fs->reader.map != NULL)  {
+      img = fs->reader.map(fs->state, fs->ncols, fs->nrows, &mapping);
+      ok = (img != NULL);
+    } else
+      ok = fs->reader.read(fs->state, fs->buffers[b], fs->ncols, fs->nrows);
+
+    pthread_mutex_lock(&fs->lock);
+    if (fs->reader.map != NULL && ok)  {
+      fs->buffers[b] = img;
+      fs->mappings[b] = mapping;
+    }
+    if (!ok)  {
+      fs->freelist[fs->nFree++] = b;
+      break;
+    }
+    fs->queue[(fs->head + fs->count) % fs->nBuffers] = b;
+    fs->count++;
+    if (fs->nFrames > 0)  fs->nFrames--;
+    pthread_cond_signal(&fs->readable);
+    pthread_mutex_unlock(&fs->lock);
+  }
+
+  /* Lock is held here */
+  fs->done = TRUE;
+  pthread_cond_broadcast(&fs->readable);
+  pthread_mutex_unlock(&fs->lock);
+  return NULL;
+}
+
+
+/*********************************************************************
+ * frameSourceOpen
+ *
+ * Starts reading frames with the given backend.  The frame size must
+ * be known beforehand.
+ */
+
+FrameSource frameSourceOpen(
+  const FrameReader *reader,
+  void *state,
+  int ncols,
+  int nrows,
+  int nFrames,
+  int nBuffers)
+{
+  FrameSource fs;
+  int i;
+
+  if (nBuffers < 1)
+    KLTError("(frameSourceOpen) At least one buffer is needed, not %d",
+             nBuffers);
+
+  fs = (FrameSource) malloc(sizeof(struct _FrameSourceRec));
+  if (fs == NULL)
+    KLTError("(frameSourceOpen) Memory not allocated");
+  fs->reader = *reader;
+  fs->state = state;
+  fs->ncols = ncols;
+  fs->nrows = nrows;
+  fs->nFrames = nFrames;
+  fs->nBuffers = nBuffers;
+  fs->buffers = (unsigned char **) malloc(nBuffers * sizeof(unsigned char *));
+  fs->mappings = (void **) malloc(nBuffers * sizeof(void *));
+  fs->queue = (int *) malloc(nBuffers * sizeof(int));
+  fs->freelist = (int *) malloc(nBuffers * sizeof(int));
+  if (fs->buffers == NULL || fs->mappings == NULL ||
+      fs->queue == NULL || fs->freelist == NULL)
+    KLTError("(frameSourceOpen) Memory not allocated");
+  for (i = 0 ; i < nBuffers ; i++)  {
+    fs->buffers[i] = NULL;
+    fs->mappings[i] = NULL;
+    if (reader->map == NULL)  {
+      fs->buffers[i] = (unsigned char *) malloc(ncols * nrows * sizeof(unsigned char));
+      if (fs->buffers[i] == NULL)
+        KLTError("(frameSourceOpen) Memory not allocated");
+    }
+    /* Reversed, so that the buffers are first filled in order */
+    fs->freelist[i] = nBuffers - 1 - i;
+  }
+  fs->head = fs->count = 0;
+  fs->nFree = nBuffers;
+  fs->done = FALSE;
+  fs->closing = FALSE;
+
+  pthread_mutex_init(&fs->lock, NULL);
+  pthread_cond_init(&fs->readable, NULL);
+  pthread_cond_init(&fs->writable, NULL);
+  if (pthread_create(&fs->thread, NULL, _readerThread, fs) != 0)
+    KLTError("(frameSourceOpen) Cannot start the reader thread");
+
+  return fs;
+}
+
+
+/*********************************************************************
+ * frameSourceSize
+ */
+
+void frameSourceSize(
+  FrameSource fs,
+  int *ncols,
+  int *nrows)
+{
+  *ncols = fs->ncols;
+  *nrows = fs->nrows;
+}
+
+
+/*********************************************************************
+ * frameSourceNext
+ *
+ * Returns the next frame, waiting for it to be read if necessary,
+ * or NULL once all the frames have been returned.
+ */
+
+unsigned char* frameSourceNext(
+  FrameSource fs)
+{
+  unsigned char *img = NULL;
+  int b;
+
+  pthread_mutex_lock(&fs->lock);
+  while (fs->count == 0 && !fs->done)
+    pthread_cond_wait(&fs->readable, &fs->lock);
+  if (fs->count > 0)  {
+    b = fs->queue[fs->head];
+    fs->head = (fs->head + 1) % fs->nBuffers;
+    fs->count--;
+    img = fs->buffers[b];
+  }
+  pthread_mutex_unlock(&fs->lock);
+
+  return img;
+}
+
+
+/*********************************************************************
+ * frameSourceRelease
+ *
+ * Hands a frame returned by frameSourceNext back to the reader.
+ */
+
+void frameSourceRelease(
+  FrameSource fs,
+  unsigned char *img)
+{
+  void *mapping = NULL;
+  int b;
+
+  pthread_mutex_lock(&fs->lock);
+  for (b = 0 ; b < fs->nBuffers && fs->buffers[b] != img ; b++) ;
+  if (b == fs->nBuffers || img == NULL)
+    KLTError("(frameSourceRelease) Image was not returned by this source");
+  if (fs->reader.map != NULL)  {
+    mapping = fs->mappings[b];
+    fs->buffers[b] = NULL;
+  }
+  fs->freelist[fs->nFree++] = b;
+  pthread_cond_signal(&fs->writable);
+  pthread_mutex_unlock(&fs->lock);
+
+  if (mapping != NULL)  fs->reader.unmap(mapping);
+}
+
+
+/*********************************************************************
+ * frameSourceClose
+ *
+ * Stops the reader, once it has finished the frame it is reading,
+ * and frees (or unmaps) all the buffers.
+ */
+
+void frameSourceClose(
+  FrameSource fs)
+{
+  int i;
+
+  pthread_mutex_lock(&fs->lock);
+  fs->closing = TRUE;
+  pthread_cond_signal(&fs->writable);
+  pthread_mutex_unlock(&fs->lock);
+  pthread_join(fs->thread, NULL);
+
+  /* Frames still mapped were read ahead, or not released */
+  for (i = 0 ; i < fs->nBuffers ; i++)
+    if (fs->reader.map == NULL)
+      free(fs->buffers[i]);
+    else if (fs->buffers[i] != NULL)
+      fs->reader.unmap(fs->mappings[i]);
+  if (fs->reader.close != NULL)  fs->reader.close(fs->state);
+  pthread_mutex_destroy(&fs->lock);
+  pthread_cond_destroy(&fs->readable);
+  pthread_cond_destroy(&fs->writable);
+  free(fs->buffers);
+  free(fs->mappings);
+  free(fs->queue);
+  free(fs->freelist);
+  free(fs);
+}
+
+
+/*********************************************************************
+ * Backends
+ *
+ * _readPixels reads the pixels of an 8-bit image stored row after
+ * row, as in a PGM file once its header is read.
+ */
+
+static int _readPixels(
+  FILE *fp,
+  unsigned char *img,
+  int ncols,
+  int nrows)
+{
+  return fread(img, ncols, nrows, fp) == (size_t) nrows;
+}
+
+
+/**********
+ * Sequence of PGM files, named after a printf format, either read
+ * into the buffers or mapped (see pgmMapFile)
+ */
+
+typedef struct  {
+  char *fmt;
+  int index;
+}  _PGMSequence;
+
+static int _readPGMSequence(
+  void *state,
+  unsigned char *img,
+  int ncols,
+  int nrows)
+{
+  _PGMSequence *seq = (_PGMSequence *) state;
+  char fname[1024];
+  int magic, ncols2, nrows2, maxval;
+  FILE *fp;
+
+  snprintf(fname, sizeof(fname), seq->fmt, seq->index);
+  if ( (fp = fopen(fname, "rb")) == NULL)  return 0;   /* end of sequence */
+  pgmReadHeader(fp, &magic, &ncols2, &nrows2, &maxval);
+  if (ncols2 != ncols || nrows2 != nrows)
+    KLTError("(frameSource) Image '%s' is %d x %d instead of %d x %d",
+             fname, ncols2, nrows2, ncols, nrows);
+  if (!_readPixels(fp, img, ncols, nrows))
+    KLTError("(frameSource) Image '%s' is truncated", fname);
+  fclose(fp);
+  seq->index++;
+  return 1;
+}
+
+static unsigned char *_mapPGMSequence(
+  void *state,
+  int ncols,
+  int nrows,
+  void **mapping)
+{
+  _PGMSequence *seq = (_PGMSequence *) state;
+  char fname[1024];
+  int ncols2, nrows2;
+  unsigned char *img;
+
+  snprintf(fname, sizeof(fname), seq->fmt, seq->index);
+  if (access(fname, R_OK) != 0)  return NULL;   /* end of sequence */
+  img = pgmMapFile(fname, &ncols2, &nrows2, mapping);
+  if (ncols2 != ncols || nrows2 != nrows)
+    KLTError("(frameSource) Image '%s' is %d x %d instead of %d x %d",
+             fname, ncols2, nrows2, ncols, nrows);
+  seq->index++;
+  return img;
+}
+
+static void _closePGMSequence(
+  void *state)
+{
+  _PGMSequence *seq = (_PGMSequence *) state;
+
+  free(seq->fmt);
+  free(seq);
+}
+
+static FrameSource _openPGMSequence(
+  const FrameReader *reader,
+  const char *fmt,
+  int first,
+  int nFrames,
+  int nBuffers)
+{
+  _PGMSequence *seq;
+  char fname[1024];
+  int magic, ncols, nrows, maxval;
+
+  snprintf(fname, sizeof(fname), fmt, first);
+  pgmReadHeaderFile(fname, &magic, &ncols, &nrows, &maxval);
+
+  seq = (_PGMSequence *) malloc(sizeof(_PGMSequence));
+  if (seq == NULL)
+    KLTError("(frameSourceOpenPGMSequence) Memory not allocated");
+  seq->fmt = (char *) malloc(strlen(fmt) + 1);
+  if (seq->fmt == NULL)
+    KLTError("(frameSourceOpenPGMSequence) Memory not allocated");
+  strcpy(seq->fmt, fmt);
+  seq->index = first;
+
+  return frameSourceOpen(reader, seq, ncols, nrows, nFrames, nBuffers);
+}
+
+FrameSource frameSourceOpenPGMSequence(
+  const char *fmt,
+  int first,
+  int nFrames,
+  int nBuffers)
+{
+  static const FrameReader reader =
+    { _readPGMSequence, NULL, NULL, _closePGMSequence };
+
+  return _openPGMSequence(&reader, fmt, first, nFrames, nBuffers);
+}
+
+FrameSource frameSourceOpenMappedPGMSequence(
+  const char *fmt,
+  int first,
+  int nFrames,
+  int nBuffers)
+{
+  static const FrameReader reader =
+    { NULL, _mapPGMSequence, pgmUnmapFile, _closePGMSequence };
+
+  return _openPGMSequence(&reader, fmt, first, nFrames, nBuffers);
+}
+
+
+/**********
+ * PGM files concatenated in a stream, such as a pipe.  The header of
+ * the first one is read when the source is opened.
+ */
+
+typedef struct  {
+  FILE *fp;
+  KLT_BOOL headerRead;
+}  _PGMStream;
+
+static int _readPGMStream(
+  void *state,
+  unsigned char *img,
+  int ncols,
+  int nrows)
+{
+  _PGMStream *stream = (_PGMStream *) state;
+  int magic, ncols2, nrows2, maxval;
+  int c;
+
+  if (!stream->headerRead)  {
+    /* End of stream, unless another header follows */
+    do  c = getc(stream->fp);  while (c != EOF && isspace(c));
+    if (c == EOF)  return 0;
+    ungetc(c, stream->fp);
+    pgmReadHeader(stream->fp, &magic, &ncols2, &nrows2, &maxval);
+    if (ncols2 != ncols || nrows2 != nrows)
+      KLTError("(frameSource) Image in stream is %d x %d instead of %d x %d",
+               ncols2, nrows2, ncols, nrows);
+  }
+  stream->headerRead = FALSE;
+  if (!_readPixels(stream->fp, img, ncols, nrows))
+    KLTError("(frameSource) Image in stream is truncated");
+  return 1;
+}
+
+static void _closePGMStream(
+  void *state)
+{
+  free(state);    /* the stream belongs to the caller */
+}
+
+FrameSource frameSourceOpenPGMStream(
+  FILE *fp,
+  int nFrames,
+  int nBuffers)
+{
+  static const FrameReader reader =
+    { _readPGMStream, NULL, NULL, _closePGMStream };
+  _PGMStream *stream;
+  int magic, ncols, nrows, maxval;
+
+  pgmReadHeader(fp, &magic, &ncols, &nrows, &maxval);
+
+  stream = (_PGMStream *) malloc(sizeof(_PGMStream));
+  if (stream == NULL)
+    KLTError("(frameSourceOpenPGMStream) Memory not allocated");
+  stream->fp = fp;
+  stream->headerRead = TRUE;
+
+  return frameSourceOpen(&reader, stream, ncols, nrows, nFrames, nBuffers);
+}
+
+
+/**********
+ * _skipBytes skips data that is not needed, such as the chroma planes
+ * of YUV frames: by seeking if possible, otherwise (e.g., in a pipe)
+ * by reading and discarding it.  Returns 0 if the data is cut short.
+ */
+
+static int _skipBytes(
+  FILE *fp,
+  long n)
+{
+  char buf[4096];
+  size_t len;
+
+  if (n == 0 || fseek(fp, n, SEEK_CUR) == 0)  return 1;
+  while (n > 0)  {
+    len = (n < (long) sizeof(buf)) ? (size_t) n : sizeof(buf);
+    if (fread(buf, 1, len, fp) != len)  return 0;
+    n -= (long) len;
+  }
+  return 1;
+}
+
+
+/**********
+ * File of raw 8-bit frames, without headers; "-" is stdin.  Planar
+ * YUV 4:2:0 frames are read the same way, skipping the chroma planes
+ * that follow the luma plane of each frame.
+ */
+
+typedef struct  {
+  FILE *fp;
+  long skip;            /* # of bytes after each frame */
+}  _RawFile;
+
+static int _readRawFile(
+  void *state,
+  unsigned char *img,
+  int ncols,
+  int nrows)
+{
+  _RawFile *raw = (_RawFile *) state;
+
+  return _readPixels(raw->fp, img, ncols, nrows) &&
+         _skipBytes(raw->fp, raw->skip);
+}
+
+static void _closeRawFile(
+  void *state)
+{
+  _RawFile *raw = (_RawFile *) state;
+
+  if (raw->fp != stdin)  fclose(raw->fp);
+  free(raw);
+}
+
+static FrameSource _openRawFile(
+  const char *fname,
+  int ncols,
+  int nrows,
+  long skip,
+  int nFrames,
+  int nBuffers)
+{
+  static const FrameReader reader =
+    { _readRawFile, NULL, NULL, _closeRawFile };
+  _RawFile *raw;
+
+  raw = (_RawFile *) malloc(sizeof(_RawFile));
+  if (raw == NULL)
+    KLTError("(frameSourceOpenRawFile) Memory not allocated");
+  if (strcmp(fname, "-") == 0)
+    raw->fp = stdin;
+  else if ( (raw->fp = fopen(fname, "rb")) == NULL)
+    KLTError("(frameSourceOpenRawFile) Can't open file named '%s' for reading",
+             fname);
+  raw->skip = skip;
+
+  return frameSourceOpen(&reader, raw, ncols, nrows, nFrames, nBuffers);
+}
+
+FrameSource frameSourceOpenRawFile(
+  const char *fname,
+  int ncols,
+  int nrows,
+  int nFrames,
+  int nBuffers)
+{
+  return _openRawFile(fname, ncols, nrows, 0, nFrames, nBuffers);
+}
+
+FrameSource frameSourceOpenRawYUV420(
+  const char *fname,
+  int ncols,
+  int nrows,
+  int nFrames,
+  int nBuffers)
+{
+  long chroma = 2L * ((ncols + 1) / 2) * ((nrows + 1) / 2);
+
+  return _openRawFile(fname, ncols, nrows, chroma, nFrames, nBuffers);
+}
+
+
+/**********
+ * YUV4MPEG2 (Y4M) stream, as written by video decoders; only the
+ * luma plane of each frame is kept.  The stream header is read when
+ * the source is opened.
+ */
+
+typedef struct  {
+  FILE *fp;
+  long chroma;          /* # of bytes of chroma after each luma plane */
+}  _Y4MStream;
+
+/* Colour spaces of 8-bit samples, with the subsampling of their two */
+/* chroma planes; 'mono' has none.  High bit depths (e.g. 'C420p10') */
+/* and alpha planes are not supported. */
+static const struct  {
+  const char *tag;
+  int hsub, vsub;
+}  _y4mColourSpaces[] =  {
+  { "420", 2, 2 },  { "420jpeg", 2, 2 },  { "420paldv", 2, 2 },
+  { "420mpeg2", 2, 2 },  { "411", 4, 1 },  { "422", 2, 1 },
+  { "444", 1, 1 },  { "mono", 0, 0 },  { NULL, 0, 0 }
+};
+
+static int _readY4MStream(
+  void *state,
+  unsigned char *img,
+  int ncols,
+  int nrows)
+{
+  _Y4MStream *stream = (_Y4MStream *) state;
+  char tag[6];
+  int c;
+
+  /* "FRAME", then parameters up to the end of the line */
+  if (fread(tag, 1, 5, stream->fp) != 5)  return 0;   /* end of stream */
+  tag[5] = '\0';
+  if (strcmp(tag, "FRAME") != 0)
+    KLTError("(frameSource) Y4M frame does not begin with 'FRAME'");
+  do  c = getc(stream->fp);  while (c != EOF && c != '\n');
+
+  if (!_readPixels(stream->fp, img, ncols, nrows) ||
+      !_skipBytes(stream->fp, stream->chroma))
+    KLTError("(frameSource) Y4M frame is truncated");
+  return 1;
+}
+
+static void _closeY4MStream(
+  void *state)
+{
+  free(state);    /* the stream belongs to the caller */
+}
+
+FrameSource frameSourceOpenY4M(
+  FILE *fp,
+  int nFrames,
+  int nBuffers)
+{
+  static const FrameReader reader =
+    { _readY4MStream, NULL, NULL, _closeY4MStream };
+  _Y4MStream *stream;
+  char line[1024], *tag;
+  int ncols = -1, nrows = -1;
+  long chromaBytes = -1;
+  const char *chroma = "420";
+  int i;
+
+  /* Header line: "YUV4MPEG2" and tags separated by spaces */
+  if (fgets(line, sizeof(line), fp) == NULL ||
+      strncmp(line, "YUV4MPEG2", 9) != 0)
+    KLTError("(frameSourceOpenY4M) Stream does not begin with 'YUV4MPEG2'");
+  for (tag = line + 9 ; *tag != '\0' ; tag += strcspn(tag, " \n"))  {
+    while (*tag == ' ' || *tag == '\n')  *tag++ = '\0';
+    if (tag[0] == 'W')  ncols = atoi(tag + 1);
+    else if (tag[0] == 'H')  nrows = atoi(tag + 1);
+    else if (tag[0] == 'C')  chroma = tag + 1;
+  }
+  if (ncols <= 0 || nrows <= 0 || ncols > 10000 || nrows > 10000)
+    KLTError("(frameSourceOpenY4M) The dimensions %d x %d are unacceptable",
+             ncols, nrows);
+
+  /* Size of the chroma planes */
+  for (i = 0 ; _y4mColourSpaces[i].tag != NULL ; i++)
+    if (strcmp(chroma, _y4mColourSpaces[i].tag) == 0)  {
+      int hsub = _y4mColourSpaces[i].hsub, vsub = _y4mColourSpaces[i].vsub;
+
+      chromaBytes = (hsub == 0) ? 0 :
+        2L * ((ncols + hsub - 1) / hsub) * ((nrows + vsub - 1) / vsub);
+      break;
+    }
+  if (chromaBytes < 0)
+    KLTError("(frameSourceOpenY4M) Colour space 'C%s' is not supported", chroma);
+
+  stream = (_Y4MStream *) malloc(sizeof(_Y4MStream));
+  if (stream == NULL)
+    KLTError("(frameSourceOpenY4M) Memory not allocated");
+  stream->fp = fp;
+  stream->chroma = chromaBytes;
+
+  return frameSourceOpen(&reader, stream, ncols, nrows, nFrames, nBuffers);
+}
+
+
+/**********
+ * Stream of either kind, told apart by its first character
+ */
+
+FrameSource frameSourceOpenStream(
+  FILE *fp,
+  int nFrames,
+  int nBuffers)
+{
+  int c = getc(fp);
+
+  if (c == EOF)
+    KLTError("(frameSourceOpenStream) Stream is empty");
+  ungetc(c, fp);
+  if (c == 'Y')
+    return frameSourceOpenY4M(fp, nFrames, nBuffers);
+  else
+    return frameSourceOpenPGMStream(fp, nFrames, nBuffers);
+}
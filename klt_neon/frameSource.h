@@ -0,0 +1,97 @@
+/*********************************************************************
+ * frameSource.h
+ *********************************************************************/
+
+#ifndef _FRAMESOURCE_H_
+#define _FRAMESOURCE_H_
+
+#include <stdio.h>
+
+/**********
+ * A frame source reads the frames of a sequence on a thread of its
+ * own, into a fixed set of buffers.  frameSourceNext returns the
+ * buffers in frame order, and waits only if the reader has fallen
+ * behind; each buffer must be handed back with frameSourceRelease
+ * once the frame is no longer needed.  At most nBuffers frames are
+ * read ahead of, or held by, the caller.
+ */
+typedef struct _FrameSourceRec *FrameSource;
+
+/**********
+ * Backend of a frame source, which either copies or maps frames.
+ * read fills img with the next frame of ncols x nrows pixels, and
+ * returns 0 at the end of the sequence.  Instead, map may return
+ * the pixels of the next frame where they already are (NULL at the
+ * end), together with a handle that is passed to unmap once the
+ * frame is released.  Both are called from the reader thread only.
+ * close (may be NULL) releases the state once the reader thread
+ * has stopped.
+ */
+typedef struct  {
+  int (*read)(void *state, unsigned char *img, int ncols, int nrows);
+  unsigned char *(*map)(void *state, int ncols, int nrows, void **mapping);
+  void (*unmap)(void *mapping);
+  void (*close)(void *state);
+}  FrameReader;
+
+/**********
+ * Opening; nFrames < 0 reads up to the end of the sequence
+ */
+FrameSource frameSourceOpen(
+  const FrameReader *reader,
+  void *state,
+  int ncols,
+  int nrows,
+  int nFrames,
+  int nBuffers);
+FrameSource frameSourceOpenPGMSequence(   /* e.g., "img%d.pgm" */
+  const char *fmt,
+  int first,
+  int nFrames,
+  int nBuffers);
+FrameSource frameSourceOpenMappedPGMSequence( /* same, without copying */
+  const char *fmt,
+  int first,
+  int nFrames,
+  int nBuffers);
+FrameSource frameSourceOpenPGMStream(     /* concatenated PGMs, e.g. stdin */
+  FILE *fp,
+  int nFrames,
+  int nBuffers);
+FrameSource frameSourceOpenY4M(           /* luma of a YUV4MPEG2 stream */
+  FILE *fp,
+  int nFrames,
+  int nBuffers);
+FrameSource frameSourceOpenStream(        /* either of the above */
+  FILE *fp,
+  int nFrames,
+  int nBuffers);
+FrameSource frameSourceOpenRawFile(       /* 8-bit frames, back to back */
+  const char *fname,
+  int ncols,
+  int nrows,
+  int nFrames,
+  int nBuffers);
+FrameSource frameSourceOpenRawYUV420(     /* luma of planar YUV 4:2:0 */
+  const char *fname,
+  int ncols,
+  int nrows,
+  int nFrames,
+  int nBuffers);
+
+/**********
+ * Reading
+ */
+void frameSourceSize(
+  FrameSource fs,
+  int *ncols,
+  int *nrows);
+unsigned char* frameSourceNext(           /* NULL at the end */
+  FrameSource fs);
+void frameSourceRelease(
+  FrameSource fs,
+  unsigned char *img);
+void frameSourceClose(
+  FrameSource fs);
+
+#endif
@@ -13,8 +13,12 @@
 #include "base.h"
 #include "convolve.h"
 #include "error.h"
+#include "featureView.h"
 #include "klt.h"
+#include "prepareFrame.h"
+#include "profile.h"
 #include "pyramid.h"
+#include "threadPool.h"
 
 
 static const int mindist = 5;
@@ -30,6 +34,12 @@ static const float pyramid_sigma_fact = 0.9f;
 static const float step_factor = 1.0f;
 static const KLT_BOOL sequentialMode = FALSE;
 static const KLT_BOOL lighting_insensitive = FALSE;
+static const int nThreads = 1;
+static const KLT_BOOL lockstepTracking = FALSE;
+static const KLT_BOOL fixedPointTracking = FALSE;
+static const KLT_BOOL halfPrecisionPyramids = FALSE;
+static const KLT_BOOL roiPyramids = FALSE;
+static const KLT_BOOL lazyGradients = FALSE;
 /* for affine mapping*/
 static const int affineConsistencyCheck = -1;
 static const int affine_window_size = 15;
@@ -102,6 +112,13 @@ KLT_TrackingContext KLTCreateTrackingContext()
   tc->smoothBeforeSelecting = smoothBeforeSelecting;
   tc->writeInternalImages = writeInternalImages;
   tc->lighting_insensitive = lighting_insensitive;
+  tc->nThreads = nThreads;
+  tc->verbose = KLT_verbose;
+  tc->lockstepTracking = lockstepTracking;
+  tc->fixedPointTracking = fixedPointTracking;
+  tc->halfPrecisionPyramids = halfPrecisionPyramids;
+  tc->roiPyramids = roiPyramids;
+  tc->lazyGradients = lazyGradients;
   tc->min_eigenvalue = min_eigenvalue;
   tc->min_determinant = min_determinant;
   tc->max_iterations = max_iterations;
@@ -115,6 +132,12 @@ KLT_TrackingContext KLTCreateTrackingContext()
   tc->pyramid_last = NULL;
   tc->pyramid_last_gradx = NULL;
   tc->pyramid_last_grady = NULL;
+  tc->fixed_last = NULL;
+  tc->fixed_last_gradx = NULL;
+  tc->fixed_last_grady = NULL;
+  tc->thread_pool = NULL;
+  tc->frame_preparer = NULL;
+  tc->profile = _KLTCreateProfile();
   /* for affine mapping */
   tc->affineConsistencyCheck = affineConsistencyCheck;
   tc->affine_window_width = affine_window_size;
@@ -165,11 +188,62 @@ KLT_FeatureList KLTCreateFeatureList(
     fl->feature[i]->aff_img_gradx = NULL;
     fl->feature[i]->aff_img_grady = NULL;
   }
+  fl->aff_slab = NULL;    /* created on first use */
   /* Return feature list */
   return(fl);
 }
 
 
+/*********************************************************************
+ * KLTCreateFeatureArrays
+ *
+ * All arrays share a single allocation; the image pointers come
+ * first so that every array stays aligned.
+ */
+
+KLT_FeatureArrays KLTCreateFeatureArrays(
+  int nFeatures)
+{
+  KLT_FeatureArrays fa;
+  int nbytes = sizeof(KLT_FeatureArraysRec) +
+    3 * nFeatures * sizeof(_KLT_FloatImage) +
+    8 * nFeatures * sizeof(KLT_locType) +
+    nFeatures * sizeof(int);
+  int i;
+
+  /* Allocate memory for feature arrays */
+  fa = (KLT_FeatureArrays)  malloc(nbytes);
+  if (fa == NULL)
+    KLTError("(KLTCreateFeatureArrays) Out of memory");
+
+  /* Set parameters */
+  fa->nFeatures = nFeatures;
+
+  /* Set pointers */
+  fa->aff_img = (_KLT_FloatImage *) (fa + 1);
+  fa->aff_img_gradx = fa->aff_img + nFeatures;
+  fa->aff_img_grady = fa->aff_img_gradx + nFeatures;
+  fa->x = (KLT_locType *) (fa->aff_img_grady + nFeatures);
+  fa->y = fa->x + nFeatures;
+  fa->aff_x = fa->y + nFeatures;
+  fa->aff_y = fa->aff_x + nFeatures;
+  fa->aff_Axx = fa->aff_y + nFeatures;
+  fa->aff_Ayx = fa->aff_Axx + nFeatures;
+  fa->aff_Axy = fa->aff_Ayx + nFeatures;
+  fa->aff_Ayy = fa->aff_Axy + nFeatures;
+  fa->val = (int *) (fa->aff_Ayy + nFeatures);
+  for (i = 0 ; i < nFeatures ; i++)  {
+    fa->aff_img[i] = NULL;
+    fa->aff_img_gradx[i] = NULL;
+    fa->aff_img_grady[i] = NULL;
+  }
+  fa->aff_slab = NULL;    /* created on first use */
+
+  /* Return feature arrays */
+  return(fa);
+}
+
+
 /*********************************************************************
  * KLTCreateFeatureHistory
  *
@@ -263,6 +337,18 @@ void KLTPrintTrackingContext(
   fprintf(stderr, "\tsmooth_sigma_fact = %f\n", tc->smooth_sigma_fact);
   fprintf(stderr, "\tpyramid_sigma_fact = %f\n", tc->pyramid_sigma_fact);
   fprintf(stderr, "\tnSkippedPixels = %d\n", tc->nSkippedPixels);
+  fprintf(stderr, "\tnThreads = %d\n", tc->nThreads);
+  fprintf(stderr, "\tverbose = %d\n", tc->verbose);
+  fprintf(stderr, "\tlockstepTracking = %s\n",
+          tc->lockstepTracking ? "TRUE" : "FALSE");
+  fprintf(stderr, "\tfixedPointTracking = %s\n",
+          tc->fixedPointTracking ? "TRUE" : "FALSE");
+  fprintf(stderr, "\thalfPrecisionPyramids = %s\n",
+          tc->halfPrecisionPyramids ? "TRUE" : "FALSE");
+  fprintf(stderr, "\troiPyramids = %s\n",
+          tc->roiPyramids ? "TRUE" : "FALSE");
+  fprintf(stderr, "\tlazyGradients = %s\n",
+          tc->lazyGradients ? "TRUE" : "FALSE");
   fprintf(stderr, "\tborderx = %d\n", tc->borderx);
   fprintf(stderr, "\tbordery = %d\n", tc->bordery);
   fprintf(stderr, "\tnPyramidLevels = %d\n", tc->nPyramidLevels);
@@ -434,6 +520,7 @@ void KLTUpdateTCBorder(
 /*********************************************************************
  * KLTFreeTrackingContext
  * KLTFreeFeatureList
+ * KLTFreeFeatureArrays
  * KLTFreeFeatureHistory
  * KLTFreeFeatureTable
  */
@@ -447,6 +534,15 @@ void KLTFreeTrackingContext(
     _KLTFreePyramid((_KLT_Pyramid) tc->pyramid_last_gradx);
   if (tc->pyramid_last_grady)  
     _KLTFreePyramid((_KLT_Pyramid) tc->pyramid_last_grady);
+  if (tc->fixed_last)  {
+    _KLTFreeFixedPyramid((_KLT_FixedPyramid) tc->fixed_last);
+    _KLTFreeFixedPyramid((_KLT_FixedPyramid) tc->fixed_last_gradx);
+    _KLTFreeFixedPyramid((_KLT_FixedPyramid) tc->fixed_last_grady);
+  }
+  if (tc->thread_pool)
+    _KLTFreeThreadPool((_KLT_ThreadPool) tc->thread_pool);
+  _KLTFreeFramePreparer(tc);
+  free(tc->profile);
   free(tc);
 }
 
@@ -454,20 +550,20 @@ void KLTFreeFeatureList(
   KLT_FeatureList fl)
 {
   /* for affine mapping */
-  int indx;
-  for (indx = 0 ; indx < fl->nFeatures ; indx++)  {
-    /* free image and gradient  */
-    _KLTFreeFloatImage(fl->feature[indx]->aff_img);
-    _KLTFreeFloatImage(fl->feature[indx]->aff_img_gradx);
-    _KLTFreeFloatImage(fl->feature[indx]->aff_img_grady);
-    fl->feature[indx]->aff_img = NULL;
-    fl->feature[indx]->aff_img_gradx = NULL;
-    fl->feature[indx]->aff_img_grady = NULL;
-  }
+  _KLTFreeAffineSlab((_KLT_AffineSlab) fl->aff_slab);
   
   free(fl);
 }
 
+void KLTFreeFeatureArrays(
+  KLT_FeatureArrays fa)
+{
+  /* for affine mapping */
+  _KLTFreeAffineSlab((_KLT_AffineSlab) fa->aff_slab);
+
+  free(fa);
+}
+
 void KLTFreeFeatureHistory(
   KLT_FeatureHistory fh)
 {
@@ -497,28 +593,46 @@ void KLTStopSequentialMode(
   tc->pyramid_last = NULL;
   tc->pyramid_last_gradx = NULL;
   tc->pyramid_last_grady = NULL;
+  if (tc->fixed_last)  {
+    _KLTFreeFixedPyramid((_KLT_FixedPyramid) tc->fixed_last);
+    _KLTFreeFixedPyramid((_KLT_FixedPyramid) tc->fixed_last_gradx);
+    _KLTFreeFixedPyramid((_KLT_FixedPyramid) tc->fixed_last_grady);
+  }
+  tc->fixed_last = NULL;
+  tc->fixed_last_gradx = NULL;
+  tc->fixed_last_grady = NULL;
 }
 
 
 /*********************************************************************
  * KLTCountRemainingFeatures
+ * KLTCountRemainingFeatureArrays
  */
 
 int KLTCountRemainingFeatures(
   KLT_FeatureList fl)
 {
-  int count = 0;
-  int i;
+  _KLT_FeatureViewRec view;
 
-  for (i = 0 ; i < fl->nFeatures ; i++)
-    if (fl->feature[i]->val >= 0)
-      count++;
+  _KLTOpenFeatureListView(fl, &view);
+  return _KLTCountRemainingFeatures(&view);
+}
 
-  return count;
+int KLTCountRemainingFeatureArrays(
+  KLT_FeatureArrays fa)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTViewFeatureArrays(fa, &view);
+  return _KLTCountRemainingFeatures(&view);
 }
 
 /*********************************************************************
  * KLTSetVerbosity
+ *
+ * Sets the verbosity of the file writers and readers, and the default
+ * verbosity of tracking contexts created afterwards.  The verbosity
+ * of an existing context is changed through tc->verbose.
  */
 
 void KLTSetVerbosity(
@@ -32,6 +32,7 @@ typedef unsigned char KLT_PixelType;
 #define KLT_OOB              -4
 #define KLT_LARGE_RESIDUE    -5
 
+#include <stdio.h>    /* FILE, for KLTWriteProfileJSON */
 #include "klt_util.h" /* for affine mapping */
 
 /*******************
@@ -50,6 +51,23 @@ typedef struct  {
   KLT_BOOL writeInternalImages;	/* whether to write internal images */
   /* tracking features */
   KLT_BOOL lighting_insensitive;  /* whether to normalize for gain and bias (not in original algorithm) */
+  int nThreads;			/* # of threads used for tracking features; */
+  /* 1 = track in calling thread, 0 = use all cores */
+  int verbose;			/* verbosity of this context; initialized */
+  /* from KLTSetVerbosity() */
+  KLT_BOOL lockstepTracking;	/* whether to track four features at a time, */
+  /* one per SIMD lane (not with lighting_insensitive) */
+  KLT_BOOL fixedPointTracking;	/* whether to track with 16-bit fixed-point */
+  /* images and integer arithmetic (not with lighting_insensitive) */
+  KLT_BOOL halfPrecisionPyramids;	/* whether to store the pyramids used for */
+  /* tracking, and the affine templates, as bfloat16 */
+  KLT_BOOL roiPyramids;		/* whether to compute the pyramids only around */
+  /* the features being tracked (not with fixedPointTracking, */
+  /* halfPrecisionPyramids or affineConsistencyCheck) */
+  /* the search range follows nPyramidLevels and subsampling; in */
+  /* sequential mode, img1 must be the frame tracked into last */
+  KLT_BOOL lazyGradients;	/* whether to compute the gradient pyramids */
+  /* tile by tile, as windows first read them (same restrictions) */
   
   /* Available, but hopefully can ignore */
   int min_eigenvalue;		/* smallest eigenvalue allowed for selecting */
@@ -86,8 +104,45 @@ typedef struct  {
   void *pyramid_last;
   void *pyramid_last_gradx;
   void *pyramid_last_grady;
+  void *fixed_last;		/* fixed-point copies of the pyramids of the */
+  void *fixed_last_gradx;	/* last image, if it was tracked in fixed point */
+  void *fixed_last_grady;
+  void *thread_pool;
+  void *frame_preparer;		/* thread building frames for KLTPrepareFrame */
+  void *profile;		/* stage timers, if compiled with KLT_PROFILE */
 }  KLT_TrackingContextRec, *KLT_TrackingContext;
 
+/* Stages timed when compiled with KLT_PROFILE (see KLTGetProfile) */
+typedef enum  {
+  KLT_STAGE_TO_FLOAT,		/* conversion of the 8-bit image */
+  KLT_STAGE_SMOOTH,
+  KLT_STAGE_PYRAMID,		/* including the tiles of ROI pyramids */
+  KLT_STAGE_GRADIENTS,
+  KLT_STAGE_TRACKABILITY,	/* eigenvalues of the candidate windows */
+  KLT_STAGE_SORT,
+  KLT_STAGE_MIN_DISTANCE,
+  KLT_STAGE_AFFINE,		/* affine consistency check */
+  KLT_STAGE_OUTPUT,		/* timed by the caller (see KLTAddStageTime) */
+  KLT_NSTAGES
+}  KLT_ProfileStage;
+
+#define KLT_PROFILE_LEVELS  8	/* deeper levels count as the last one */
+
+typedef struct  {
+  double stage[KLT_NSTAGES];		/* msec, summed over threads */
+  double trackLevel[KLT_PROFILE_LEVELS];	/* msec tracking at each level */
+}  KLT_ProfileRec, *KLT_Profile;
+
+/* Frame whose pyramids are built ahead of tracking (see KLTPrepareFrame) */
+typedef struct _KLT_PreparedFrameRec *KLT_PreparedFrame;
+
+/* Thread writing feature overlays (see KLTQueueFeatureListToPPM) */
+typedef struct _KLT_OverlayWriterRec *KLT_OverlayWriter;
+
+/* Compressed trajectory file (see KLTCreateTrajectoryWriter) */
+typedef struct _KLT_TrajectoryWriterRec *KLT_TrajectoryWriter;
+typedef struct _KLT_TrajectoryReaderRec *KLT_TrajectoryReader;
+
 
 typedef struct  {
   KLT_locType x;
@@ -108,8 +163,34 @@ typedef struct  {
 typedef struct  {
   int nFeatures;
   KLT_Feature *feature;
+
+  /* User must not touch this */
+  void *aff_slab;		/* storage of the features' affine templates */
 }  KLT_FeatureListRec, *KLT_FeatureList;
 
+/* Same features as a list, stored as one array per field.  The */
+/* tracker reads x, y and val of every feature; the affine state */
+/* is only touched for features that use affine consistency      */
+typedef struct  {
+  int nFeatures;
+  KLT_locType *x;
+  KLT_locType *y;
+  int *val;
+  /* for affine mapping */
+  _KLT_FloatImage *aff_img;
+  _KLT_FloatImage *aff_img_gradx;
+  _KLT_FloatImage *aff_img_grady;
+  KLT_locType *aff_x;
+  KLT_locType *aff_y;
+  KLT_locType *aff_Axx;
+  KLT_locType *aff_Ayx;
+  KLT_locType *aff_Axy;
+  KLT_locType *aff_Ayy;
+
+  /* User must not touch this */
+  void *aff_slab;		/* storage of the features' affine templates */
+}  KLT_FeatureArraysRec, *KLT_FeatureArrays;
+
 typedef struct  {
   int nFrames;
   KLT_Feature *feature;
@@ -121,6 +202,55 @@ typedef struct  {
   KLT_Feature **feature;
 }  KLT_FeatureTableRec, *KLT_FeatureTable;
 
+/* Feature table of unbounded length: only the last nFrames frames */
+/* are kept in memory, as (x,y)=val; older ones are appended to a  */
+/* file, which KLTReadFeatureTable reads back                       */
+typedef struct  {
+  int nFrames;			/* # of frames kept in memory */
+  int nFeatures;
+  int nStored;			/* # of frames stored so far */
+  int nEvicted;			/* # of frames no longer in memory */
+
+  /* User must not touch these */
+  void *points;			/* (x,y)=val of the frames kept, in a ring */
+  void *fp;			/* file evicted frames are appended to */
+}  KLT_FeatureStreamRec, *KLT_FeatureStream;
+
+/* Columnar feature file, mapped into memory (see KLTOpenFeatureFile) */
+typedef struct  {
+  int nFrames;
+  int nFeatures;
+
+  /* User must not touch this */
+  void *mapping;
+}  KLT_FeatureFileRec, *KLT_FeatureFile;
+
+/* Frames of a sequence tracked in one call (see KLTTrackFeatureSource); */
+/* with a feature table, no more frames are read than it has columns    */
+typedef KLT_PixelType *(*KLT_NextFrameFunc)(
+  void *arg);
+typedef void (*KLT_ReleaseFrameFunc)(
+  void *arg,
+  KLT_PixelType *img);
+
+/* Several streams tracked on one pool of threads (see KLTAddStream) */
+typedef struct _KLT_TrackingServerRec *KLT_TrackingServer;
+
+typedef void (*KLT_StreamCallback)(
+  void *arg,
+  int frame,
+  KLT_PixelType *img,
+  KLT_FeatureList fl);
+
+typedef struct  {
+  int nFrames;			/* # of frames tracked */
+  int nPending;			/* # of frames submitted, not yet tracked */
+  double meanLatency;		/* msec from submission to end of callback */
+  double maxLatency;
+  double busyTime;		/* msec spent by the workers on the stream */
+  double framesPerSecond;
+}  KLT_StreamStatsRec, *KLT_StreamStats;
+
 
 
 /*******************
@@ -131,21 +261,48 @@ typedef struct  {
 KLT_TrackingContext KLTCreateTrackingContext(void);
 KLT_FeatureList KLTCreateFeatureList(
   int nFeatures);
+KLT_FeatureArrays KLTCreateFeatureArrays(
+  int nFeatures);
 KLT_FeatureHistory KLTCreateFeatureHistory(
   int nFrames);
 KLT_FeatureTable KLTCreateFeatureTable(
   int nFrames,
   int nFeatures);
+KLT_FeatureStream KLTCreateFeatureStream(
+  int nFrames,
+  int nFeatures,
+  char *fname);
+KLT_OverlayWriter KLTCreateOverlayWriter(
+  int ncols,
+  int nrows,
+  int nBuffers,
+  KLT_BOOL dropFrames);
+KLT_TrajectoryWriter KLTCreateTrajectoryWriter(
+  char *fname,
+  int nFeatures,
+  int fractionBits);
+KLT_TrackingServer KLTCreateTrackingServer(
+  int nThreads);
 
 /* Free */
 void KLTFreeTrackingContext(
   KLT_TrackingContext tc);
 void KLTFreeFeatureList(
   KLT_FeatureList fl);
+void KLTFreeFeatureArrays(
+  KLT_FeatureArrays fa);
 void KLTFreeFeatureHistory(
   KLT_FeatureHistory fh);
 void KLTFreeFeatureTable(
   KLT_FeatureTable ft);
+void KLTFreeFeatureStream(
+  KLT_FeatureStream fs);
+void KLTFreeOverlayWriter(
+  KLT_OverlayWriter ow);
+void KLTFreeTrajectoryWriter(
+  KLT_TrajectoryWriter tw);
+void KLTFreeTrackingServer(
+  KLT_TrackingServer ts);
 
 /* Processing */
 void KLTSelectGoodFeatures(
@@ -167,10 +324,92 @@ void KLTReplaceLostFeatures(
   int ncols,
   int nrows,
   KLT_FeatureList fl);
+void KLTSelectGoodFeatureArrays(
+  KLT_TrackingContext tc,
+  KLT_PixelType *img,
+  int ncols,
+  int nrows,
+  KLT_FeatureArrays fa);
+void KLTTrackFeatureArrays(
+  KLT_TrackingContext tc,
+  KLT_PixelType *img1,
+  KLT_PixelType *img2,
+  int ncols,
+  int nrows,
+  KLT_FeatureArrays fa);
+void KLTReplaceLostFeatureArrays(
+  KLT_TrackingContext tc,
+  KLT_PixelType *img,
+  int ncols,
+  int nrows,
+  KLT_FeatureArrays fa);
+KLT_PreparedFrame KLTPrepareFrame(
+  KLT_TrackingContext tc,
+  KLT_PixelType *img,
+  int ncols,
+  int nrows);
+void KLTDiscardPreparedFrame(
+  KLT_TrackingContext tc,
+  KLT_PreparedFrame frame);
+int KLTTrackFeatureSequence(
+  KLT_TrackingContext tc,
+  KLT_PixelType **imgs,
+  int nImages,
+  int ncols,
+  int nrows,
+  KLT_FeatureList fl,
+  KLT_FeatureTable ft,
+  KLT_BOOL replace);
+int KLTTrackFeatureSource(
+  KLT_TrackingContext tc,
+  KLT_NextFrameFunc next,
+  KLT_ReleaseFrameFunc release,
+  void *arg,
+  int ncols,
+  int nrows,
+  KLT_FeatureList fl,
+  KLT_FeatureTable ft,
+  KLT_BOOL replace);
+int KLTAddStream(
+  KLT_TrackingServer ts,
+  KLT_TrackingContext tc,
+  KLT_FeatureList fl,
+  int ncols,
+  int nrows,
+  int maxPending,
+  KLT_StreamCallback callback,
+  void *arg);
+void KLTSubmitFrame(
+  KLT_TrackingServer ts,
+  int stream,
+  KLT_PixelType *img);
+void KLTWaitStream(
+  KLT_TrackingServer ts,
+  int stream);
+void KLTGetStreamStats(
+  KLT_TrackingServer ts,
+  int stream,
+  KLT_StreamStats stats);
+
+/* Profiling */
+double KLTProfileClock(void);
+void KLTAddStageTime(
+  KLT_TrackingContext tc,
+  KLT_ProfileStage stage,
+  double msec);
+void KLTGetProfile(
+  KLT_TrackingContext tc,
+  KLT_Profile profile);
+void KLTWriteProfileJSON(
+  KLT_TrackingContext tc,
+  FILE *fp,
+  int frame);
 
 /* Utilities */
 int KLTCountRemainingFeatures(
   KLT_FeatureList fl);
+int KLTCountRemainingFeatureArrays(
+  KLT_FeatureArrays fa);
 void KLTPrintTrackingContext(
   KLT_TrackingContext tc);
 void KLTChangeTCPyramid(
@@ -190,6 +429,10 @@ void KLTStoreFeatureList(
   KLT_FeatureList fl,
   KLT_FeatureTable ft,
   int frame);
+void KLTStoreFeatureArrays(
+  KLT_FeatureArrays fa,
+  KLT_FeatureTable ft,
+  int frame);
 void KLTExtractFeatureList(
   KLT_FeatureList fl,
   KLT_FeatureTable ft,
@@ -202,6 +445,16 @@ void KLTExtractFeatureHistory(
   KLT_FeatureHistory fh,
   KLT_FeatureTable ft,
   int feat);
+void KLTAppendFeatureList(
+  KLT_FeatureList fl,
+  KLT_FeatureStream fs);
+void KLTAppendFeatureArrays(
+  KLT_FeatureArrays fa,
+  KLT_FeatureStream fs);
+void KLTExtractStreamedFeatureList(
+  KLT_FeatureList fl,
+  KLT_FeatureStream fs,
+  int frame);
 
 /* Writing/Reading */
 void KLTWriteFeatureListToPPM(
@@ -214,6 +467,26 @@ void KLTWriteFeatureList(
   KLT_FeatureList fl,
   char *filename,
   char *fmt);
+void KLTWriteFeatureArraysToPPM(
+  KLT_FeatureArrays fa,
+  KLT_PixelType *greyimg,
+  int ncols,
+  int nrows,
+  char *filename);
+void KLTWriteFeatureArrays(
+  KLT_FeatureArrays fa,
+  char *filename,
+  char *fmt);
+void KLTQueueFeatureListToPPM(
+  KLT_OverlayWriter ow,
+  KLT_FeatureList fl,
+  KLT_PixelType *greyimg,
+  char *filename);
+void KLTQueueFeatureArraysToPPM(
+  KLT_OverlayWriter ow,
+  KLT_FeatureArrays fa,
+  KLT_PixelType *greyimg,
+  char *filename);
 void KLTWriteFeatureHistory(
   KLT_FeatureHistory fh,
   char *filename,
@@ -231,6 +504,37 @@ KLT_FeatureHistory KLTReadFeatureHistory(
 KLT_FeatureTable KLTReadFeatureTable(
   KLT_FeatureTable ft,
   char *filename);
+void KLTWriteFeatureTableColumnar(
+  KLT_FeatureTable ft,
+  char *filename);
+KLT_FeatureFile KLTOpenFeatureFile(
+  char *filename);
+void KLTCloseFeatureFile(
+  KLT_FeatureFile ff);
+void KLTExtractFeatureFileList(
+  KLT_FeatureList fl,
+  KLT_FeatureFile ff,
+  int frame);
+void KLTExtractFeatureFileHistory(
+  KLT_FeatureHistory fh,
+  KLT_FeatureFile ff,
+  int feat);
+void KLTEncodeFeatureList(
+  KLT_FeatureList fl,
+  KLT_TrajectoryWriter tw);
+void KLTEncodeFeatureArrays(
+  KLT_FeatureArrays fa,
+  KLT_TrajectoryWriter tw);
+KLT_TrajectoryReader KLTOpenTrajectoryReader(
+  char *fname);
+void KLTCloseTrajectoryReader(
+  KLT_TrajectoryReader tr);
+KLT_BOOL KLTDecodeFeatureList(
+  KLT_FeatureList fl,
+  KLT_TrajectoryReader tr);
+KLT_BOOL KLTDecodeFeatureArrays(
+  KLT_FeatureArrays fa,
+  KLT_TrajectoryReader tr);
 #ifdef __cplusplus
 }
 #endif
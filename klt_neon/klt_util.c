@@ -5,6 +5,7 @@
 /* Standard includes */
 #include <assert.h>
 #include <stdlib.h>  /* malloc() */
+#include <string.h>  /* memcpy() */
 #include <math.h>		/* fabs() */
 
 /* Our includes */
@@ -42,11 +43,80 @@ _KLT_FloatImage _KLTCreateFloatImage(
   floatimg->ncols = ncols;
   floatimg->nrows = nrows;
   floatimg->data = (float *)  (floatimg + 1);
+  floatimg->half = NULL;
 
   return(floatimg);
 }
 
 
+/*********************************************************************
+ * _KLTCreateHalfImage
+ *
+ * Creates an image whose pixels are stored as bfloat16, in half the
+ * memory of a float image.
+ */
+
+_KLT_FloatImage _KLTCreateHalfImage(
+  int ncols,
+  int nrows)
+{
+  _KLT_FloatImage halfimg;
+  int nbytes = sizeof(_KLT_FloatImageRec) +
+    ncols * nrows * sizeof(_KLT_Half);
+
+  halfimg = (_KLT_FloatImage)  malloc(nbytes);
+  if (halfimg == NULL)
+    KLTError("(_KLTCreateHalfImage)  Out of memory");
+  halfimg->ncols = ncols;
+  halfimg->nrows = nrows;
+  halfimg->data = NULL;
+  halfimg->half = (_KLT_Half *)  (halfimg + 1);
+
+  return(halfimg);
+}
+
+
+/*********************************************************************
+ * _KLTToHalfImage
+ * _KLTHalfToFloatImage
+ *
+ * Convert between float and bfloat16 images of the same size.
+ */
+
+void _KLTToHalfImage(
+  _KLT_FloatImage floatimg,
+  _KLT_FloatImage halfimg)
+{
+  int npixs = floatimg->ncols * floatimg->nrows;
+  float *ptrin = floatimg->data;
+  _KLT_Half *ptrout = halfimg->half;
+  int i;
+
+  assert(halfimg->ncols == floatimg->ncols);
+  assert(halfimg->nrows == floatimg->nrows);
+
+  for (i = 0 ; i < npixs ; i++)
+    *ptrout++ = _KLTFloatToHalf(*ptrin++);
+}
+
+
+void _KLTHalfToFloatImage(
+  _KLT_FloatImage halfimg,
+  _KLT_FloatImage floatimg)
+{
+  int npixs = halfimg->ncols * halfimg->nrows;
+  _KLT_Half *ptrin = halfimg->half;
+  float *ptrout = floatimg->data;
+  int i;
+
+  assert(halfimg->ncols == floatimg->ncols);
+  assert(halfimg->nrows == floatimg->nrows);
+
+  for (i = 0 ; i < npixs ; i++)
+    *ptrout++ = _KLTHalfToFloat(*ptrin++);
+}
+
+
 /*********************************************************************
  * _KLTFreeFloatImage
  */
@@ -58,6 +128,71 @@ void _KLTFreeFloatImage(
 }
 
 
+/*********************************************************************
+ * _KLTCreateFixedImage
+ */
+
+_KLT_FixedImage _KLTCreateFixedImage(
+  int ncols,
+  int nrows)
+{
+  _KLT_FixedImage fixedimg;
+  int nbytes = sizeof(_KLT_FixedImageRec) +
+    ncols * nrows * sizeof(short);
+
+  fixedimg = (_KLT_FixedImage)  malloc(nbytes);
+  if (fixedimg == NULL)
+    KLTError("(_KLTCreateFixedImage)  Out of memory");
+  fixedimg->ncols = ncols;
+  fixedimg->nrows = nrows;
+  fixedimg->data = (short *)  (fixedimg + 1);
+
+  return(fixedimg);
+}
+
+
+/*********************************************************************
+ * _KLTFreeFixedImage
+ */
+
+void _KLTFreeFixedImage(
+  _KLT_FixedImage fixedimg)
+{
+  free(fixedimg);
+}
+
+
+/*********************************************************************
+ * _KLTToFixedImage
+ *
+ * Converts a float (or bfloat16) image to fixed point with fracbits
+ * fractional bits, rounding to nearest and saturating to the range of a short.
+ */
+
+void _KLTToFixedImage(
+  _KLT_FloatImage floatimg,
+  int fracbits,
+  _KLT_FixedImage fixedimg)
+{
+  int npixs = floatimg->ncols * floatimg->nrows;
+  float scale = (float) (1 << fracbits);
+  short *ptrout = fixedimg->data;
+  float v;
+  int i;
+
+  assert(fixedimg->ncols == floatimg->ncols);
+  assert(fixedimg->nrows == floatimg->nrows);
+
+  for (i = 0 ; i < npixs ; i++)  {
+    v = (floatimg->half ? _KLTHalfToFloat(floatimg->half[i]) : floatimg->data[i]) * scale;
+    v = (v < 0.0f) ? v - 0.5f : v + 0.5f;
+    if (v > 32767.0f)  v = 32767.0f;
+    if (v < -32768.0f)  v = -32768.0f;
+    *ptrout++ = (short) v;
+  }
+}
+
+
 /*********************************************************************
  * _KLTPrintSubFloatImage
  */
@@ -103,6 +238,15 @@ void _KLTWriteFloatImageToPGM(
   uchar *byteimg, *ptrout;
   int i;
 
+  /* Write a bfloat16 image through a float copy */
+  if (img->half)  {
+    _KLT_FloatImage floatimg = _KLTCreateFloatImage(img->ncols, img->nrows);
+    _KLTHalfToFloatImage(img, floatimg);
+    _KLTWriteFloatImageToPGM(floatimg, filename);
+    _KLTFreeFloatImage(floatimg);
+    return;
+  }
+
   /* Calculate minimum and maximum values of float image */
   ptr = img->data;
   for (i = 0 ; i < npixs ; i++)  {
@@ -163,3 +307,142 @@ void _KLTWriteAbsFloatImageToPGM(
   /* Free memory */
   free(byteimg);
 }
+
+
+/*********************************************************************
+ * _KLTCreateAffineSlab
+ *
+ * Creates a slab with nSlots slots, each large enough for three
+ * templates of ncols by nrows.
+ */
+
+_KLT_AffineSlab _KLTCreateAffineSlab(
+  int nSlots,
+  int ncols,
+  int nrows)
+{
+  _KLT_AffineSlab slab;
+  int i;
+
+  slab = (_KLT_AffineSlab) malloc(sizeof(_KLT_AffineSlabRec) +
+                                  3 * nSlots * sizeof(_KLT_FloatImageRec));
+  if (slab == NULL)
+    KLTError("(_KLTCreateAffineSlab)  Out of memory");
+  slab->nSlots = nSlots;
+  slab->capacity = ncols * nrows;
+  slab->headers = (_KLT_FloatImageRec *) (slab + 1);
+  slab->data = (float *) malloc(3 * nSlots * slab->capacity * sizeof(float));
+  if (slab->data == NULL && nSlots > 0)
+    KLTError("(_KLTCreateAffineSlab)  Out of memory");
+
+  for (i = 0 ; i < 3 * nSlots ; i++)  {
+    slab->headers[i].ncols = 0;
+    slab->headers[i].nrows = 0;
+    slab->headers[i].data = slab->data + i * slab->capacity;
+    slab->headers[i].half = NULL;
+  }
+
+  return slab;
+}
+
+
+/*********************************************************************
+ * _KLTFreeAffineSlab
+ *
+ * The slab may be NULL (never created).
+ */
+
+void _KLTFreeAffineSlab(
+  _KLT_AffineSlab slab)
+{
+  if (slab == NULL)  return;
+  free(slab->data);
+  free(slab);
+}
+
+
+/*********************************************************************
+ * _KLTReserveAffineSlab
+ *
+ * Makes room for templates of ncols by nrows in *pslab, creating the
+ * slab with nSlots slots if it is NULL; lists and arrays only get one
+ * when they are first tracked with the affine check.  The headers do
+ * not move, so features keep pointing at their templates, whose
+ * contents are preserved.
+ */
+
+void _KLTReserveAffineSlab(
+  _KLT_AffineSlab *pslab,
+  int nSlots,
+  int ncols,
+  int nrows)
+{
+  _KLT_AffineSlab slab = *pslab;
+  int capacity = ncols * nrows;
+  float *data;
+  int i;
+
+  if (slab == NULL)  {
+    *pslab = _KLTCreateAffineSlab(nSlots, ncols, nrows);
+    return;
+  }
+  if (capacity <= slab->capacity)  return;
+
+  data = (float *) malloc(3 * slab->nSlots * capacity * sizeof(float));
+  if (data == NULL)
+    KLTError("(_KLTReserveAffineSlab)  Out of memory");
+
+  for (i = 0 ; i < 3 * slab->nSlots ; i++)  {
+    _KLT_FloatImage img = slab->headers + i;
+    if (img->half)  {
+      memcpy(data + i * capacity, img->half,
+             img->ncols * img->nrows * sizeof(_KLT_Half));
+      img->half = (_KLT_Half *) (data + i * capacity);
+    } else  {
+      memcpy(data + i * capacity, img->data,
+             img->ncols * img->nrows * sizeof(float));
+      img->data = data + i * capacity;
+    }
+  }
+
+  free(slab->data);
+  slab->data = data;
+  slab->capacity = capacity;
+}
+
+
+/*********************************************************************
+ * _KLTTakeAffineSlot
+ *
+ * Returns the templates of a slot, sized ncols by nrows and stored
+ * as bfloat16 if half is set.  The slab must have been reserved for
+ * that size; a bfloat16 template uses half of its slot.
+ */
+
+void _KLTTakeAffineSlot(
+  _KLT_AffineSlab slab,
+  int slot,
+  int ncols,
+  int nrows,
+  int half,
+  _KLT_FloatImage *img,
+  _KLT_FloatImage *gradx,
+  _KLT_FloatImage *grady)
+{
+  _KLT_FloatImage headers = slab->headers + 3 * slot;
+  int i;
+
+  assert(slot >= 0 && slot < slab->nSlots);
+  assert(ncols * nrows <= slab->capacity);
+
+  for (i = 0 ; i < 3 ; i++)  {
+    float *storage = slab->data + (3 * slot + i) * slab->capacity;
+    headers[i].ncols = ncols;
+    headers[i].nrows = nrows;
+    headers[i].data = half ? NULL : storage;
+    headers[i].half = half ? (_KLT_Half *) storage : NULL;
+  }
+  *img = headers;
+  *gradx = headers + 1;
+  *grady = headers + 2;
+}
@@ -5,18 +5,51 @@
 #ifndef _KLT_UTIL_H_
 #define _KLT_UTIL_H_
 
+/* bfloat16: the upper half of the bits of a float */
+typedef unsigned short _KLT_Half;
+
 typedef struct  {
   int ncols;
   int nrows;
   float *data;
+  _KLT_Half *half;    /* storage instead of data, if not NULL */
 }  _KLT_FloatImageRec, *_KLT_FloatImage;
 
+inline static float _KLTHalfToFloat(
+  _KLT_Half h)
+{
+  union { unsigned int u; float f; } v;
+  v.u = (unsigned int) h << 16;
+  return v.f;
+}
+
+inline static _KLT_Half _KLTFloatToHalf(
+  float f)
+{
+  union { unsigned int u; float f; } v;
+  v.f = f;
+  /* Round to nearest, ties to even */
+  return (_KLT_Half) ((v.u + 0x7fff + ((v.u >> 16) & 1)) >> 16);
+}
+
 _KLT_FloatImage _KLTCreateFloatImage(
   int ncols, 
   int nrows);
 
 void _KLTFreeFloatImage(
   _KLT_FloatImage);
+
+_KLT_FloatImage _KLTCreateHalfImage(
+  int ncols,
+  int nrows);
+
+void _KLTToHalfImage(
+  _KLT_FloatImage floatimg,
+  _KLT_FloatImage halfimg);
+
+void _KLTHalfToFloatImage(
+  _KLT_FloatImage halfimg,
+  _KLT_FloatImage floatimg);
 	
 void _KLTPrintSubFloatImage(
   _KLT_FloatImage floatimg,
@@ -32,6 +65,62 @@ void _KLTWriteAbsFloatImageToPGM(
   _KLT_FloatImage img,
   char *filename,float scale);
 
+/* Image of 16-bit fixed-point values, for fixed-point tracking */
+typedef struct  {
+  int ncols;
+  int nrows;
+  short *data;
+}  _KLT_FixedImageRec, *_KLT_FixedImage;
+
+_KLT_FixedImage _KLTCreateFixedImage(
+  int ncols,
+  int nrows);
+
+void _KLTFreeFixedImage(
+  _KLT_FixedImage);
+
+void _KLTToFixedImage(
+  _KLT_FloatImage floatimg,
+  int fracbits,
+  _KLT_FixedImage fixedimg);
+
+/* Border added around the affine window of a feature's templates, */
+/* for interpolation                                                */
+#define _KLT_AFFINE_BORDER 2
+
+/* Affine templates (image and gradients) of all features of a list, */
+/* one slot per feature.  The three images of a slot are adjacent.  */
+typedef struct  {
+  int nSlots;
+  int capacity;                 /* # of floats per image */
+  _KLT_FloatImageRec *headers;  /* 3 per slot: image, gradx, grady */
+  float *data;
+}  _KLT_AffineSlabRec, *_KLT_AffineSlab;
+
+_KLT_AffineSlab _KLTCreateAffineSlab(
+  int nSlots,
+  int ncols,
+  int nrows);
+
+void _KLTFreeAffineSlab(
+  _KLT_AffineSlab slab);
+
+void _KLTReserveAffineSlab(
+  _KLT_AffineSlab *pslab,
+  int nSlots,
+  int ncols,
+  int nrows);
+
+void _KLTTakeAffineSlot(
+  _KLT_AffineSlab slab,
+  int slot,
+  int ncols,
+  int nrows,
+  int half,
+  _KLT_FloatImage *img,
+  _KLT_FloatImage *gradx,
+  _KLT_FloatImage *grady);
+
 #endif
 
 
@@ -1,12 +1,24 @@
 /**********************************************************************
 Finds the 150 best features in an image and tracks them through the 
 next two images.  The sequential mode is set in order to speed
-processing.  The features are stored in a feature table, which is then
-saved to a text file; each feature list is also written to a PPM file.
+processing, and the pyramids of each image are prepared while the
+features are tracked into the previous one.  The features are stored
+in a feature table, which is then saved to a text file; each feature
+list is also written to a PPM file, by a thread of its own.  If built
+with -DKLT_PROFILE, the time spent in each stage of every frame is
+written to profile.json.  The images are read ahead by a
+frame source, either mapped from img0.pgm, img1.pgm, ... or read from
+a stream given as the last argument ("-" for stdin): a Y4M stream, as
+written by "ffmpeg -i video -f yuv4mpegpipe -", of which only the luma
+is used, or PGM images concatenated.
+
+Usage: klt [nFeatures nFrames] [stream]
 **********************************************************************/
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include "frameSource.h"
 #include "pnmio.h"
 #include "klt.h"
 #include "Timer.h"
@@ -18,8 +30,10 @@ int main(int argc, char ** argv)
     Timer appTimer;
     initTimer(&appTimer, "APP Time");
 
-    unsigned char *img1, *img2;
-    char fnamein[100], fnameout[100];
+    unsigned char *img1, *img2, *img3;
+    char fnameout[100];
+    FrameSource fs;
+    KLT_OverlayWriter ow;
     KLT_TrackingContext tc;
     KLT_FeatureList fl;
     KLT_FeatureTable ft;
@@ -27,7 +41,23 @@ int main(int argc, char ** argv)
     int nFrames;
     int ncols, nrows;
     int i;
+    FILE *stream = NULL;
+#ifdef KLT_PROFILE
+    double t;
+    FILE *profile = fopen("profile.json", "w");
+#endif
 
+    if(argc == 2 || argc == 4)
+    {
+        if (strcmp(argv[argc-1], "-") == 0)
+            stream = stdin;
+        else if ((stream = fopen(argv[argc-1], "rb")) == NULL)
+        {
+            fprintf(stderr, "Can't open '%s'\n", argv[argc-1]);
+            return 1;
+        }
+        argc--;
+    }
     if(argc == 3)
     {
         nFeatures = atoi(argv[1]);
@@ -45,41 +75,80 @@ int main(int argc, char ** argv)
     tc->sequentialMode = TRUE;
     tc->writeInternalImages = FALSE;
     tc->affineConsistencyCheck = -1;  /* set this to 2 to turn on affine consistency check */
+    tc->nThreads = 0;                 /* track features on all cores */
 
     startTimer(&appTimer);
-    img1 = pgmReadFile("img0.pgm", NULL, &ncols, &nrows);
-    img2 = (unsigned char *) malloc(ncols*nrows*sizeof(unsigned char));
+    /* Holds the previous, current and next frames, plus two read ahead */
+    if (stream != NULL)
+        fs = frameSourceOpenStream(stream, nFrames, 5);
+    else
+        fs = frameSourceOpenMappedPGMSequence("img%d.pgm", 0, nFrames, 5);
+    frameSourceSize(fs, &ncols, &nrows);
+    ow = KLTCreateOverlayWriter(ncols, nrows, 3, FALSE);  /* TRUE to drop overlays rather than wait */
+    img1 = frameSourceNext(fs);
+    img2 = frameSourceNext(fs);
+    if (img2 != NULL)
+        KLTPrepareFrame(tc, img2, ncols, nrows);
 
     KLTSelectGoodFeatures(tc, img1, ncols, nrows, fl);
+#ifdef KLT_PROFILE
+    t = KLTProfileClock();
+#endif
     KLTStoreFeatureList(fl, ft, 0);
-    KLTWriteFeatureListToPPM(fl, img1, ncols, nrows, "feat0.ppm");
+    KLTQueueFeatureListToPPM(ow, fl, img1, "feat0.ppm");
+#ifdef KLT_PROFILE
+    KLTAddStageTime(tc, KLT_STAGE_OUTPUT, KLTProfileClock() - t);
+    KLTWriteProfileJSON(tc, profile, 0);
+#endif
 
-    for (i = 1 ; i < nFrames ; i++)
+    for (i = 1 ; img2 != NULL ; i++)
     {
-        sprintf(fnamein, "img%d.pgm", i);
-        pgmReadFile(fnamein, img2, &ncols, &nrows);
+        /* Prepare the next image while tracking into this one */
+        img3 = frameSourceNext(fs);
+        if (img3 != NULL)
+            KLTPrepareFrame(tc, img3, ncols, nrows);
         KLTTrackFeatures(tc, img1, img2, ncols, nrows, fl);
 
         #ifdef REPLACE
         KLTReplaceLostFeatures(tc, img2, ncols, nrows, fl);
         #endif
 
+#ifdef KLT_PROFILE
+        t = KLTProfileClock();
+#endif
         KLTStoreFeatureList(fl, ft, i);
         sprintf(fnameout, "feat%d.ppm", i);
-        KLTWriteFeatureListToPPM(fl, img2, ncols, nrows, fnameout);
+        KLTQueueFeatureListToPPM(ow, fl, img2, fnameout);
+#ifdef KLT_PROFILE
+        KLTAddStageTime(tc, KLT_STAGE_OUTPUT, KLTProfileClock() - t);
+        KLTWriteProfileJSON(tc, profile, i);
+#endif
+        frameSourceRelease(fs, img1);
+        img1 = img2;  img2 = img3;
     }
+    frameSourceRelease(fs, img1);
+    KLTFreeOverlayWriter(ow);
     stopTimer(&appTimer);
     printTime(appTimer);
     printf("Frames per second = %4.2f\n", nFrames / getTime(appTimer) *1000 );
 
+#ifdef KLT_PROFILE
+    t = KLTProfileClock();
+#endif
     KLTWriteFeatureTable(ft, "features.txt", "%5.1f");
     KLTWriteFeatureTable(ft, "features.ft", NULL);
+#ifdef KLT_PROFILE
+    KLTAddStageTime(tc, KLT_STAGE_OUTPUT, KLTProfileClock() - t);
+    KLTWriteProfileJSON(tc, profile, -1);   /* totals */
+    fclose(profile);
+#endif
 
     KLTFreeFeatureTable(ft);
     KLTFreeFeatureList(fl);
     KLTFreeTrackingContext(tc);
-    free(img1);
-    free(img2);
+    frameSourceClose(fs);
+    if (stream != NULL && stream != stdin)
+        fclose(stream);
 
     return 0;
 }
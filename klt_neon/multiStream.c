@@ -0,0 +1,121 @@
+/**********************************************************************
+Tracks several streams at once on a shared pool of threads.  Every
+stream reads img0.pgm, img1.pgm, ... through a frame source of its
+own, as if from separate cameras, and is tracked with its own context;
+its features are stored in a feature table by the callback, which also
+replaces the lost ones and hands the previous frame back to the frame
+source.  The counters of each stream are printed at the end, and the
+tables are checked to be the same for all streams.
+
+Usage: klt_streams [nStreams [nThreads [nFeatures nFrames]]]
+**********************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "frameSource.h"
+#include "klt.h"
+
+typedef struct
+{
+    FrameSource fs;
+    KLT_TrackingContext tc;
+    KLT_FeatureTable ft;
+    unsigned char *prev;
+    int ncols, nrows;
+} Stream;
+
+static void frameTracked(void *arg, int frame, KLT_PixelType *img, KLT_FeatureList fl)
+{
+    Stream *s = (Stream *) arg;
+
+    if (frame > 0)
+        KLTReplaceLostFeatures(s->tc, img, s->ncols, s->nrows, fl);
+    KLTStoreFeatureList(fl, s->ft, frame);
+
+    /* The previous frame is no longer needed */
+    if (s->prev != NULL)
+        frameSourceRelease(s->fs, s->prev);
+    s->prev = img;
+}
+
+static int sameTables(KLT_FeatureTable a, KLT_FeatureTable b)
+{
+    int i, j;
+
+    for (j = 0 ; j < a->nFeatures ; j++)
+        for (i = 0 ; i < a->nFrames ; i++)
+            if (a->feature[j][i]->x != b->feature[j][i]->x ||
+                a->feature[j][i]->y != b->feature[j][i]->y ||
+                a->feature[j][i]->val != b->feature[j][i]->val)
+                return 0;
+    return 1;
+}
+
+int main(int argc, char ** argv)
+{
+    int nStreams = (argc > 1) ? atoi(argv[1]) : 4;
+    int nThreads = (argc > 2) ? atoi(argv[2]) : 0;
+    int nFeatures = (argc > 4) ? atoi(argv[3]) : 512;
+    int nFrames = (argc > 4) ? atoi(argv[4]) : 10;
+    const int maxPending = 2;
+    KLT_TrackingServer ts;
+    KLT_StreamStatsRec stats;
+    KLT_FeatureList *fl;
+    Stream *streams;
+    unsigned char *img;
+    int nSame = 0;
+    int i, k;
+
+    streams = (Stream *) malloc(nStreams * sizeof(Stream));
+    fl = (KLT_FeatureList *) malloc(nStreams * sizeof(KLT_FeatureList));
+    ts = KLTCreateTrackingServer(nThreads);
+
+    for (k = 0 ; k < nStreams ; k++)
+    {
+        Stream *s = &streams[k];
+
+        /* The frames being tracked and tracked last, plus those pending */
+        s->fs = frameSourceOpenMappedPGMSequence("img%d.pgm", 0, nFrames, maxPending + 2);
+        frameSourceSize(s->fs, &s->ncols, &s->nrows);
+        s->tc = KLTCreateTrackingContext();
+        s->tc->sequentialMode = TRUE;
+        s->tc->verbose = 0;
+        s->ft = KLTCreateFeatureTable(nFrames, nFeatures);
+        s->prev = NULL;
+        fl[k] = KLTCreateFeatureList(nFeatures);
+        KLTAddStream(ts, s->tc, fl[k], s->ncols, s->nrows, maxPending, frameTracked, s);
+    }
+
+    /* Frames arrive from all cameras in turn */
+    for (i = 0 ; i < nFrames ; i++)
+        for (k = 0 ; k < nStreams ; k++)
+            if ((img = frameSourceNext(streams[k].fs)) != NULL)
+                KLTSubmitFrame(ts, k, img);
+
+    for (k = 0 ; k < nStreams ; k++)
+    {
+        KLTWaitStream(ts, k);
+        KLTGetStreamStats(ts, k, &stats);
+        printf("stream %d: %d frames, %.2f frames/s, latency %.2f msec "
+               "(max %.2f), busy %.2f msec\n", k, stats.nFrames,
+               stats.framesPerSecond, stats.meanLatency, stats.maxLatency,
+               stats.busyTime);
+        nSame += sameTables(streams[0].ft, streams[k].ft);
+    }
+    printf("%d of %d streams tracked the same as stream 0\n", nSame, nStreams);
+    KLTFreeTrackingServer(ts);
+
+    for (k = 0 ; k < nStreams ; k++)
+    {
+        if (streams[k].prev != NULL)
+            frameSourceRelease(streams[k].fs, streams[k].prev);
+        frameSourceClose(streams[k].fs);
+        KLTFreeFeatureTable(streams[k].ft);
+        KLTFreeFeatureList(fl[k]);
+        KLTFreeTrackingContext(streams[k].tc);
+    }
+    free(streams);
+    free(fl);
+
+    return (nSame == nStreams) ? 0 : 1;
+}
@@ -6,8 +6,13 @@
 
 
 /* Standard includes */
+#include <ctype.h>   /* isspace(), isdigit() */
+#include <fcntl.h>   /* open() */
 #include <stdio.h>   /* FILE  */
 #include <stdlib.h>  /* malloc(), atoi() */
+#include <sys/mman.h>  /* mmap(), madvise() */
+#include <sys/stat.h>  /* fstat() */
+#include <unistd.h>  /* close() */
 
 /* Our includes */
 #include "error.h"
@@ -229,6 +234,117 @@ unsigned char* pgmReadFile(
 }
 
 
+typedef struct  {
+  void *addr;
+  size_t length;
+}  _PGMMapping;
+
+
+/*********************************************************************
+ * _parseNumber
+ *
+ * Parses the next decimal number of a PNM header held in memory,
+ * skipping whitespace and comments; returns -1 if there is none.
+ */
+
+static int _parseNumber(
+  const unsigned char *buf,
+  size_t length,
+  size_t *pos)
+{
+  size_t i = *pos;
+  int n = 0;
+
+  for (;;)  {
+    while (i < length && isspace(buf[i]))  i++;
+    if (i < length && buf[i] == '#')
+      while (i < length && buf[i] != '\n')  i++;
+    else
+      break;
+  }
+  if (i == length || !isdigit(buf[i]))  return -1;
+  while (i < length && isdigit(buf[i]) && n < 100000)
+    n = 10 * n + (buf[i++] - '0');
+  *pos = i;
+  return n;
+}
+
+
+/*********************************************************************
+ * pgmMapFile
+ *
+ * Maps a PGM file into memory and returns a pointer to its pixels,
+ * without copying them; the header is parsed in place.  The pixels
+ * are read-only, and stay valid until pgmUnmapFile is called with
+ * the handle returned in *mapping.  The kernel is told that the
+ * file will be read sequentially and soon, so that it reads ahead.
+ */
+
+unsigned char* pgmMapFile(
+  char *fname,
+  int *ncols, int *nrows,
+  void **mapping)
+{
+  _PGMMapping *map;
+  const unsigned char *buf;
+  struct stat st;
+  size_t pos = 2;
+  int fd, maxval;
+
+  /* Map file */
+  if ( (fd = open(fname, O_RDONLY)) < 0)
+    KLTError("(pgmMapFile) Can't open file named '%s' for reading\n", fname);
+  if (fstat(fd, &st) != 0 || st.st_size < 2)
+    KLTError("(pgmMapFile) File '%s' is too short", fname);
+  map = (_PGMMapping *) malloc(sizeof(_PGMMapping));
+  if (map == NULL)
+    KLTError("(pgmMapFile) Memory not allocated");
+  map->length = (size_t) st.st_size;
+  map->addr = mmap(NULL, map->length, PROT_READ, MAP_PRIVATE
+#ifdef MAP_POPULATE
+                   | MAP_POPULATE
+#endif
+                   , fd, 0);
+  close(fd);
+  if (map->addr == MAP_FAILED)
+    KLTError("(pgmMapFile) Can't map file named '%s'", fname);
+  madvise(map->addr, map->length, MADV_SEQUENTIAL);
+  madvise(map->addr, map->length, MADV_WILLNEED);
+  buf = (const unsigned char *) map->addr;
+
+  /* Parse header */
+  if (buf[0] != 'P' || buf[1] != '5')
+    KLTError("(pgmMapFile) Magic number of '%s' is not 'P5'", fname);
+  *ncols = _parseNumber(buf, map->length, &pos);
+  *nrows = _parseNumber(buf, map->length, &pos);
+  maxval = _parseNumber(buf, map->length, &pos);
+  if (*ncols < 0 || *nrows < 0 || *ncols > 10000 || *nrows > 10000 || maxval < 0)
+    KLTError("(pgmMapFile) The header of '%s' is unacceptable", fname);
+  if (maxval != 255)
+    KLTWarning("(pgmMapFile) Maxval is not 255, but %d", maxval);
+  pos++;    /* newline which follows maxval */
+  if (pos + (size_t) *ncols * *nrows > map->length)
+    KLTError("(pgmMapFile) File '%s' is truncated", fname);
+
+  *mapping = map;
+  return (unsigned char *) buf + pos;
+}
+
+
+/*********************************************************************
+ * pgmUnmapFile
+ */
+
+void pgmUnmapFile(
+  void *mapping)
+{
+  _PGMMapping *map = (_PGMMapping *) mapping;
+
+  munmap(map->addr, map->length);
+  free(map);
+}
+
+
 /*********************************************************************
  * pgmWrite
  */
@@ -335,3 +451,47 @@ void ppmWriteFileRGB(
 }
 
 
+
+
+/*********************************************************************
+ * ppmWriteInterleaved
+ * ppmWriteFileInterleaved
+ *
+ * Same as ppmWrite and ppmWriteFileRGB, from a single image whose
+ * pixels are stored as RGB triplets, written in one go.
+ */
+
+void ppmWriteInterleaved(
+  FILE *fp,
+  unsigned char *rgbimg,
+  int ncols, 
+  int nrows)
+{
+  /* Write header */
+  fprintf(fp, "P6\n");
+  fprintf(fp, "%d %d\n", ncols, nrows);
+  fprintf(fp, "255\n");
+
+  /* Write binary data */
+  fwrite(rgbimg, 3 * ncols, nrows, fp);
+}
+
+
+void ppmWriteFileInterleaved(
+  char *fname, 
+  unsigned char *rgbimg,
+  int ncols, 
+  int nrows)
+{
+  FILE *fp;
+
+  /* Open file */
+  if ( (fp = fopen(fname, "wb")) == NULL)
+    KLTError("(ppmWriteFileInterleaved) Can't open file named '%s' for writing\n", fname);
+
+  /* Write to file */
+  ppmWriteInterleaved(fp, rgbimg, ncols, nrows);
+
+  /* Close file */
+  fclose(fp);
+}
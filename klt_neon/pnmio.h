@@ -32,10 +32,38 @@ void ppmWriteFileRGB(
   unsigned char *blueimg,
   int ncols,
   int nrows);
+void ppmWriteFileInterleaved(   /* rgbimg holds RGB triplets */
+  char *fname,
+  unsigned char *rgbimg,
+  int ncols,
+  int nrows);
+
+
+/**********
+ * Maps the pixels of a PGM file without copying them; they are
+ * read-only and valid until pgmUnmapFile(*mapping)
+ */
+unsigned char* pgmMapFile(
+  char *fname,
+  int *ncols,
+  int *nrows,
+  void **mapping);
+void pgmUnmapFile(
+  void *mapping);
+void pgmReadHeaderFile(
+  char *fname,
+  int *magic,
+  int *ncols, int *nrows,
+  int *maxval);
 
 /**********
  * used for communicating with stdin and stdout
  */
+void pgmReadHeader(
+  FILE *fp,
+  int *magic,
+  int *ncols, int *nrows,
+  int *maxval);
 unsigned char* pgmRead(
   FILE *fp,
   unsigned char *img,
@@ -52,5 +80,10 @@ void ppmWrite(
   unsigned char *blueimg,
   int ncols,
   int nrows);
+void ppmWriteInterleaved(
+  FILE *fp,
+  unsigned char *rgbimg,
+  int ncols,
+  int nrows);
 
 #endif
@@ -0,0 +1,424 @@
+/*********************************************************************
+ * prepareFrame.c
+ *
+ * Builds the pyramids of a frame on a thread kept by the tracking
+ * context, while the features are being tracked into the previous
+ * frame.  The pyramids
+ * are handed over to the call to KLTTrackFeatures (or
+ * KLTTrackFeatureArrays) that tracks into the frame.
+ *********************************************************************/
+
+/* Standard includes */
+#include <pthread.h>
+#include <stdint.h>   /* uint64_t */
+#include <stdlib.h>   /* malloc() */
+#include <string.h>   /* memcpy() */
+
+/* Our includes */
+#include "base.h"
+#include "error.h"
+#include "convolve.h"
+#include "klt.h"
+#include "klt_util.h"
+#include "profile.h"
+#include "pyramid.h"
+#include "prepareFrame.h"
+
+
+/* What has become of a frame */
+#define FRAME_QUEUED    0     /* waiting for the preparer */
+#define FRAME_BUILDING  1     /* being built by the preparer */
+#define FRAME_BUILT     2     /* pyramids ready */
+
+struct _KLT_PreparedFrameRec  {
+  KLT_PixelType *img;
+  int ncols, nrows;
+  uint64_t checksum;          /* of img when it was prepared */
+  /* Parameters the pyramids are built with */
+  float smooth_sigma;
+  float pyramid_sigma_fact;
+  float grad_sigma;
+  int subsampling;
+  int nPyramidLevels;
+  KLT_BOOL halfPrecisionPyramids;
+  void *profile;              /* of the context, timed from the thread */
+  /* Pyramids, valid once the frame is built */
+  _KLT_Pyramid pyramid, pyramid_gradx, pyramid_grady;
+  int state;
+  KLT_PreparedFrame next;
+};
+
+
+/* The thread that builds the frames of a context, one at a time, in */
+/* the order they were prepared; it is started by the first call to */
+/* KLTPrepareFrame and lives as long as the context */
+typedef struct  {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;     /* a frame was queued or built, or stop set */
+  pthread_t thread;
+  KLT_BOOL threaded;          /* whether thread has been started */
+  KLT_BOOL stop;
+  KLT_PreparedFrame frames;   /* prepared and not yet taken */
+}  _FramePreparer;
+
+
+/*********************************************************************
+ * _checksum
+ *
+ * FNV-1a hash of the pixels of img, eight at a time; tells a prepared
+ * image from another frame read into the same buffer since.
+ */
+
+static uint64_t _checksum(
+  const KLT_PixelType *img,
+  int n)
+{
+  uint64_t h = 14695981039346656037ULL, w;
+  int i;
+
+  for (i = 0 ; i + 8 <= n ; i += 8)  {
+    memcpy(&w, img + i, 8);
+    h = (h ^ w) * 1099511628211ULL;
+  }
+  for ( ; i < n ; i++)
+    h = (h ^ img[i]) * 1099511628211ULL;
+  return h;
+}
+
+
+/*********************************************************************
+ * _buildPyramids
+ *
+ * Same as KLTTrackFeatures does for the second image.
+ */
+
+static void *_buildPyramids(
+  void *arg)
+{
+  KLT_PreparedFrame frame = (KLT_PreparedFrame) arg;
+  int ncols = frame->ncols, nrows = frame->nrows;
+  _KLT_FloatImage tmpimg, floatimg;
+  int i;
+
+  tmpimg = _KLTCreateFloatImage(ncols, nrows);
+  floatimg = _KLTCreateFloatImage(ncols, nrows);
+  _KLT_PROFILE_START(tfloat);
+  _KLTToFloatImage(frame->img, ncols, nrows, tmpimg);
+  _KLT_PROFILE_STOP(frame->profile, KLT_STAGE_TO_FLOAT, tfloat);
+  _KLT_PROFILE_START(tsmooth);
+  _KLTComputeSmoothedImage(tmpimg, frame->smooth_sigma, floatimg);
+  _KLT_PROFILE_STOP(frame->profile, KLT_STAGE_SMOOTH, tsmooth);
+  _KLTFreeFloatImage(tmpimg);
+  if (frame->halfPrecisionPyramids)  {
+    frame->pyramid = _KLTCreateHalfPyramid(ncols, nrows, frame->subsampling,
+                                           frame->nPyramidLevels);
+    frame->pyramid_gradx = _KLTCreateHalfPyramid(ncols, nrows, frame->subsampling,
+                                                 frame->nPyramidLevels);
+    frame->pyramid_grady = _KLTCreateHalfPyramid(ncols, nrows, frame->subsampling,
+                                                 frame->nPyramidLevels);
+    _KLTComputeHalfPyramids(floatimg, frame->pyramid_sigma_fact, frame->grad_sigma,
+                            frame->pyramid, frame->pyramid_gradx,
+                            frame->pyramid_grady, frame->profile);
+  } else  {
+    frame->pyramid = _KLTCreatePyramid(ncols, nrows, frame->subsampling,
+                                       frame->nPyramidLevels);
+    _KLT_PROFILE_START(tpyr);
+    _KLTComputePyramid(floatimg, frame->pyramid, frame->pyramid_sigma_fact);
+    _KLT_PROFILE_STOP(frame->profile, KLT_STAGE_PYRAMID, tpyr);
+    frame->pyramid_gradx = _KLTCreatePyramid(ncols, nrows, frame->subsampling,
+                                             frame->nPyramidLevels);
+    frame->pyramid_grady = _KLTCreatePyramid(ncols, nrows, frame->subsampling,
+                                             frame->nPyramidLevels);
+    _KLT_PROFILE_START(tgrad);
+    for (i = 0 ; i < frame->nPyramidLevels ; i++)
+      _KLTComputeGradients(frame->pyramid->img[i], frame->grad_sigma,
+                           frame->pyramid_gradx->img[i],
+                           frame->pyramid_grady->img[i]);
+    _KLT_PROFILE_STOP(frame->profile, KLT_STAGE_GRADIENTS, tgrad);
+  }
+  _KLTFreeFloatImage(floatimg);
+
+  return NULL;
+}
+
+
+/*********************************************************************
+ * _preparerMain
+ *
+ * Builds the queued frames, oldest first, until told to stop.
+ */
+
+static void *_preparerMain(
+  void *arg)
+{
+  _FramePreparer *fp = (_FramePreparer *) arg;
+  KLT_PreparedFrame frame;
+
+  pthread_mutex_lock(&fp->lock);
+  for (;;)  {
+    frame = fp->frames;
+    while (frame != NULL && frame->state != FRAME_QUEUED)
+      frame = frame->next;
+    if (frame == NULL)  {
+      if (fp->stop)  break;
+      pthread_cond_wait(&fp->changed, &fp->lock);
+      continue;
+    }
+    frame->state = FRAME_BUILDING;
+    pthread_mutex_unlock(&fp->lock);
+    _buildPyramids(frame);
+    pthread_mutex_lock(&fp->lock);
+    frame->state = FRAME_BUILT;
+    pthread_cond_broadcast(&fp->changed);
+  }
+  pthread_mutex_unlock(&fp->lock);
+
+  return NULL;
+}
+
+
+/*********************************************************************
+ * _getPreparer
+ *
+ * Returns the preparer of tc, starting it if need be.  Without a
+ * thread, the frames are built when they are taken.
+ */
+
+static _FramePreparer *_getPreparer(
+  KLT_TrackingContext tc)
+{
+  _FramePreparer *fp = (_FramePreparer *) tc->frame_preparer;
+
+  if (fp != NULL)  return fp;
+  fp = (_FramePreparer *) malloc(sizeof(_FramePreparer));
+  if (fp == NULL)
+    KLTError("(KLTPrepareFrame) Out of memory");
+  pthread_mutex_init(&fp->lock, NULL);
+  pthread_cond_init(&fp->changed, NULL);
+  fp->stop = FALSE;
+  fp->frames = NULL;
+  fp->threaded = (pthread_create(&fp->thread, NULL, _preparerMain, fp) == 0);
+  tc->frame_preparer = fp;
+  return fp;
+}
+
+
+/*********************************************************************
+ * _unlinkFrame
+ *
+ * Takes frame off the list of fp, which must be locked, and returns
+ * FALSE if it is not on it.  Once unlinked, a frame is never started
+ * by the preparer; one being built is waited for.
+ */
+
+static KLT_BOOL _unlinkFrame(
+  _FramePreparer *fp,
+  KLT_PreparedFrame frame)
+{
+  KLT_PreparedFrame *link = &fp->frames;
+
+  while (*link != NULL && *link != frame)
+    link = &(*link)->next;
+  if (*link == NULL)  return FALSE;
+  *link = frame->next;
+  while (frame->state == FRAME_BUILDING)
+    pthread_cond_wait(&fp->changed, &fp->lock);
+  return TRUE;
+}
+
+
+/*********************************************************************
+ * _freeFrame
+ *
+ * Frees an unlinked frame, and its pyramids if they were built.
+ */
+
+static void _freeFrame(
+  KLT_PreparedFrame frame)
+{
+  if (frame->state == FRAME_BUILT)  {
+    _KLTFreePyramid(frame->pyramid);
+    _KLTFreePyramid(frame->pyramid_gradx);
+    _KLTFreePyramid(frame->pyramid_grady);
+  }
+  free(frame);
+}
+
+
+/*********************************************************************
+ * KLTPrepareFrame
+ *
+ * Queues img for the pyramids to be built, with the current
+ * parameters of tc, on a thread kept by tc, and returns at once.
+ * The next call to KLTTrackFeatures (or KLTTrackFeatureArrays) whose
+ * first or second image is img, with the same size and pyramid
+ * parameters, waits for the pyramids and uses them instead of
+ * building its own; in sequential mode, this lets frame N+1 be
+ * prepared while the features are tracked into frame N.  img must not
+ * be changed until then: a buffer that is released and refilled with
+ * another frame in between is told apart by a checksum of its pixels,
+ * and its stale pyramids are discarded with a warning.  The pyramids
+ * are built in full, even with roiPyramids or lazyGradients.
+ */
+
+KLT_PreparedFrame KLTPrepareFrame(
+  KLT_TrackingContext tc,
+  KLT_PixelType *img,
+  int ncols,
+  int nrows)
+{
+  _FramePreparer *fp = _getPreparer(tc);
+  KLT_PreparedFrame frame, *link;
+
+  frame = (KLT_PreparedFrame) malloc(sizeof(struct _KLT_PreparedFrameRec));
+  if (frame == NULL)
+    KLTError("(KLTPrepareFrame) Out of memory");
+  frame->img = img;
+  frame->ncols = ncols;
+  frame->nrows = nrows;
+  frame->checksum = _checksum(img, ncols * nrows);
+  frame->smooth_sigma = _KLTComputeSmoothSigma(tc);
+  frame->pyramid_sigma_fact = tc->pyramid_sigma_fact;
+  frame->grad_sigma = tc->grad_sigma;
+  frame->subsampling = tc->subsampling;
+  frame->nPyramidLevels = tc->nPyramidLevels;
+  frame->halfPrecisionPyramids = (tc->halfPrecisionPyramids != FALSE);
+  frame->profile = tc->profile;
+  frame->state = FRAME_QUEUED;
+  frame->next = NULL;
+
+  /* Frames are built and taken in the order they were prepared */
+  pthread_mutex_lock(&fp->lock);
+  link = &fp->frames;
+  while (*link != NULL)
+    link = &(*link)->next;
+  *link = frame;
+  pthread_cond_broadcast(&fp->changed);
+  pthread_mutex_unlock(&fp->lock);
+
+  return frame;
+}
+
+
+/*********************************************************************
+ * KLTDiscardPreparedFrame
+ *
+ * Discards a frame that will not be tracked into.
+ */
+
+void KLTDiscardPreparedFrame(
+  KLT_TrackingContext tc,
+  KLT_PreparedFrame frame)
+{
+  _FramePreparer *fp = (_FramePreparer *) tc->frame_preparer;
+  KLT_BOOL linked;
+
+  if (fp != NULL)  {
+    pthread_mutex_lock(&fp->lock);
+    linked = _unlinkFrame(fp, frame);
+    pthread_mutex_unlock(&fp->lock);
+  } else
+    linked = FALSE;
+  if (!linked)
+    KLTError("(KLTDiscardPreparedFrame) Frame was not prepared with this "
+             "tracking context, or has already been used");
+  _freeFrame(frame);
+}
+
+
+/*********************************************************************
+ * _KLTTakePreparedFrame
+ *
+ * If a frame has been prepared for img, waits for its pyramids and
+ * hands them over; if the preparer has not started on it, builds them
+ * here instead.  Frames prepared for the same buffer while it held
+ * other pixels are discarded.  Returns FALSE if there is no such
+ * frame, or if its pyramids are to be built with parameters that have
+ * changed since.
+ */
+
+KLT_BOOL _KLTTakePreparedFrame(
+  KLT_TrackingContext tc,
+  KLT_PixelType *img,
+  int ncols,
+  int nrows,
+  _KLT_Pyramid *pyramid,         /* output */
+  _KLT_Pyramid *pyramid_gradx,
+  _KLT_Pyramid *pyramid_grady)
+{
+  _FramePreparer *fp = (_FramePreparer *) tc->frame_preparer;
+  KLT_PreparedFrame frame;
+  KLT_BOOL checked = FALSE;
+  uint64_t checksum = 0;
+
+  if (fp == NULL)  return FALSE;
+  for (;;)  {
+    pthread_mutex_lock(&fp->lock);
+    frame = fp->frames;
+    while (frame != NULL &&
+           (frame->img != img || frame->ncols != ncols || frame->nrows != nrows))
+      frame = frame->next;
+    if (frame != NULL)
+      _unlinkFrame(fp, frame);
+    pthread_mutex_unlock(&fp->lock);
+    if (frame == NULL)  return FALSE;
+
+    if (!checked)  {
+      checksum = _checksum(img, ncols * nrows);
+      checked = TRUE;
+    }
+    if (frame->checksum == checksum)  break;
+    KLTWarning("(KLTTrackFeatures) Image %p has changed since it was "
+               "prepared; its pyramids are built again", (void *) img);
+    _freeFrame(frame);
+  }
+
+  if (frame->smooth_sigma != _KLTComputeSmoothSigma(tc) ||
+      frame->pyramid_sigma_fact != tc->pyramid_sigma_fact ||
+      frame->grad_sigma != tc->grad_sigma ||
+      frame->subsampling != tc->subsampling ||
+      frame->nPyramidLevels != tc->nPyramidLevels ||
+      frame->halfPrecisionPyramids != (tc->halfPrecisionPyramids != FALSE))  {
+    _freeFrame(frame);
+    return FALSE;
+  }
+
+  if (frame->state == FRAME_QUEUED)
+    _buildPyramids(frame);
+  *pyramid = frame->pyramid;
+  *pyramid_gradx = frame->pyramid_gradx;
+  *pyramid_grady = frame->pyramid_grady;
+  free(frame);
+  return TRUE;
+}
+
+
+/*********************************************************************
+ * _KLTFreeFramePreparer
+ *
+ * Discards all frames prepared with tc, and stops its thread.
+ */
+
+void _KLTFreeFramePreparer(
+  KLT_TrackingContext tc)
+{
+  _FramePreparer *fp = (_FramePreparer *) tc->frame_preparer;
+  KLT_PreparedFrame frame;
+
+  if (fp == NULL)  return;
+  pthread_mutex_lock(&fp->lock);
+  while (fp->frames != NULL)  {
+    frame = fp->frames;
+    _unlinkFrame(fp, frame);
+    _freeFrame(frame);
+  }
+  fp->stop = TRUE;
+  pthread_cond_broadcast(&fp->changed);
+  pthread_mutex_unlock(&fp->lock);
+  if (fp->threaded)
+    pthread_join(fp->thread, NULL);
+  pthread_cond_destroy(&fp->changed);
+  pthread_mutex_destroy(&fp->lock);
+  free(fp);
+  tc->frame_preparer = NULL;
+}
@@ -0,0 +1,23 @@
+/*********************************************************************
+ * prepareFrame.h
+ *********************************************************************/
+
+#ifndef _PREPAREFRAME_H_
+#define _PREPAREFRAME_H_
+
+#include "klt.h"
+#include "pyramid.h"
+
+KLT_BOOL _KLTTakePreparedFrame(
+  KLT_TrackingContext tc,
+  KLT_PixelType *img,
+  int ncols,
+  int nrows,
+  _KLT_Pyramid *pyramid,         /* output */
+  _KLT_Pyramid *pyramid_gradx,
+  _KLT_Pyramid *pyramid_grady);
+
+void _KLTFreeFramePreparer(
+  KLT_TrackingContext tc);
+
+#endif
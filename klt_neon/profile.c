@@ -0,0 +1,182 @@
+/*********************************************************************
+ * profile.c
+ *
+ * Per-stage timers of a tracking context.  Times are added from any
+ * thread (the workers tracking features, or the threads preparing
+ * frames) with atomic additions, and kept twice: since the creation
+ * of the context, and since the last call to KLTWriteProfileJSON,
+ * which reports the stages of one frame at a time.  Stages that run
+ * on several threads at once are summed over the threads.
+ *********************************************************************/
+
+/* Standard includes */
+#include <stdio.h>
+#include <stdlib.h>   /* malloc() */
+#include <time.h>     /* clock_gettime() */
+
+/* Our includes */
+#include "error.h"
+#include "klt.h"
+#include "profile.h"
+
+typedef struct  {
+  int64_t total[_KLT_PROFILE_SLOTS];    /* nanoseconds */
+  int64_t frame[_KLT_PROFILE_SLOTS];
+}  _KLT_ProfileRec, *_KLT_Profile;
+
+static const char *stageNames[KLT_NSTAGES] = {
+  "to_float", "smooth", "pyramid", "gradients", "trackability",
+  "sort", "min_distance", "affine", "output"
+};
+
+
+/*********************************************************************
+ * _KLTProfileClock
+ */
+
+int64_t _KLTProfileClock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*********************************************************************
+ * _KLTCreateProfile
+ */
+
+void *_KLTCreateProfile(void)
+{
+#ifdef KLT_PROFILE
+  _KLT_Profile p = (_KLT_Profile) calloc(1, sizeof(_KLT_ProfileRec));
+
+  if (p == NULL)
+    KLTError("(_KLTCreateProfile) Out of memory");
+  return p;
+#else
+  return NULL;
+#endif
+}
+
+
+/*********************************************************************
+ * _KLTProfileAdd
+ */
+
+void _KLTProfileAdd(
+  void *profile,
+  int slot,
+  int64_t nsec)
+{
+  _KLT_Profile p = (_KLT_Profile) profile;
+
+  if (p == NULL)  return;
+  __atomic_fetch_add(&p->total[slot], nsec, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&p->frame[slot], nsec, __ATOMIC_RELAXED);
+}
+
+
+/*********************************************************************
+ * _KLTProfileFlush
+ *
+ * Adds the times summed in times to the profile, and clears them.
+ */
+
+void _KLTProfileFlush(
+  void *profile,
+  _KLT_ProfileTimes *times)
+{
+  int i;
+
+  for (i = 0 ; i < _KLT_PROFILE_SLOTS ; i++)
+    if (times->nsec[i] != 0)  {
+      _KLTProfileAdd(profile, i, times->nsec[i]);
+      times->nsec[i] = 0;
+    }
+}
+
+
+/*********************************************************************
+ * KLTProfileClock
+ * KLTAddStageTime
+ *
+ * Let the caller time stages of its own, such as the output of the
+ * features, into the profile of a context.
+ */
+
+double KLTProfileClock(void)
+{
+  return _KLTProfileClock() * 1e-6;
+}
+
+
+void KLTAddStageTime(
+  KLT_TrackingContext tc,
+  KLT_ProfileStage stage,
+  double msec)
+{
+  if (stage < 0 || stage >= KLT_NSTAGES)
+    KLTError("(KLTAddStageTime) No stage %d", (int) stage);
+  _KLTProfileAdd(tc->profile, stage, (int64_t) (msec * 1e6));
+}
+
+
+/*********************************************************************
+ * KLTGetProfile
+ *
+ * Returns the times, in milliseconds, spent in each stage since the
+ * context was created (all zero unless compiled with KLT_PROFILE).
+ */
+
+void KLTGetProfile(
+  KLT_TrackingContext tc,
+  KLT_Profile profile)
+{
+  _KLT_Profile p = (_KLT_Profile) tc->profile;
+  int i;
+
+  for (i = 0 ; i < KLT_NSTAGES ; i++)
+    profile->stage[i] = (p == NULL) ? 0.0 :
+      __atomic_load_n(&p->total[i], __ATOMIC_RELAXED) * 1e-6;
+  for (i = 0 ; i < KLT_PROFILE_LEVELS ; i++)
+    profile->trackLevel[i] = (p == NULL) ? 0.0 :
+      __atomic_load_n(&p->total[KLT_NSTAGES + i], __ATOMIC_RELAXED) * 1e-6;
+}
+
+
+/*********************************************************************
+ * KLTWriteProfileJSON
+ *
+ * Writes, as one line of JSON, the times in milliseconds spent in
+ * each stage since the previous call, and starts over; e.g., once
+ * per frame, with the number of the frame.  If frame is negative,
+ * the totals since the context was created are written instead,
+ * with "frame": "total".
+ */
+
+void KLTWriteProfileJSON(
+  KLT_TrackingContext tc,
+  FILE *fp,
+  int frame)
+{
+  _KLT_Profile p = (_KLT_Profile) tc->profile;
+  int64_t t[_KLT_PROFILE_SLOTS];
+  int i;
+
+  for (i = 0 ; i < _KLT_PROFILE_SLOTS ; i++)  {
+    if (p == NULL)  t[i] = 0;
+    else if (frame < 0)  t[i] = __atomic_load_n(&p->total[i], __ATOMIC_RELAXED);
+    else  t[i] = __atomic_exchange_n(&p->frame[i], 0, __ATOMIC_RELAXED);
+  }
+
+  if (frame < 0)  fprintf(fp, "{\"frame\": \"total\"");
+  else  fprintf(fp, "{\"frame\": %d", frame);
+  for (i = 0 ; i < KLT_NSTAGES ; i++)
+    fprintf(fp, ", \"%s\": %.3f", stageNames[i], t[i] * 1e-6);
+  fprintf(fp, ", \"track_level\": [");
+  for (i = 0 ; i < KLT_PROFILE_LEVELS ; i++)
+    fprintf(fp, "%s%.3f", (i > 0) ? ", " : "", t[KLT_NSTAGES + i] * 1e-6);
+  fprintf(fp, "]}\n");
+}
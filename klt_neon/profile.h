@@ -0,0 +1,59 @@
+/*********************************************************************
+ * profile.h
+ *
+ * Timers of the stages of selection and tracking, compiled in only
+ * when KLT_PROFILE is defined.  _KLT_PROFILE_START declares a start
+ * time; _KLT_PROFILE_STOP adds the time since then to a slot of the
+ * profile of a tracking context.  Slots are the KLT_ProfileStage
+ * values, followed by one per pyramid level (_KLT_PROFILE_LEVEL).
+ * Stages timed many times over, such as the tracking of each feature,
+ * are summed with _KLT_PROFILE_LAP into _KLT_ProfileTimes of their
+ * own, which _KLTProfileFlush adds to the profile at once.
+ *********************************************************************/
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>   /* int64_t */
+#include "klt.h"
+
+#define _KLT_PROFILE_LEVEL(r)  (KLT_NSTAGES + \
+  ((r) < KLT_PROFILE_LEVELS ? (r) : KLT_PROFILE_LEVELS - 1))
+#define _KLT_PROFILE_SLOTS  (KLT_NSTAGES + KLT_PROFILE_LEVELS)
+
+typedef struct  {
+  int64_t nsec[_KLT_PROFILE_SLOTS];
+}  _KLT_ProfileTimes;
+
+#ifdef KLT_PROFILE
+#define _KLT_PROFILE_START(t)  int64_t t = _KLTProfileClock()
+#define _KLT_PROFILE_STOP(profile, slot, t)  \
+  _KLTProfileAdd(profile, slot, _KLTProfileClock() - (t))
+#define _KLT_PROFILE_LAP(times, slot, t)  \
+  ((times)->nsec[slot] += _KLTProfileClock() - (t))
+/* Counts the time since t in slot to, rather than in slot from */
+#define _KLT_PROFILE_MOVE(times, from, to, t)  do  {  \
+  int64_t _dt = _KLTProfileClock() - (t);  \
+  (times)->nsec[from] -= _dt;  (times)->nsec[to] += _dt;  \
+} while (0)
+#else
+#define _KLT_PROFILE_START(t)
+#define _KLT_PROFILE_STOP(profile, slot, t)
+#define _KLT_PROFILE_LAP(times, slot, t)
+#define _KLT_PROFILE_MOVE(times, from, to, t)
+#endif
+
+int64_t _KLTProfileClock(void);   /* nanoseconds, monotonic */
+
+void *_KLTCreateProfile(void);    /* NULL unless KLT_PROFILE is defined */
+
+void _KLTProfileAdd(
+  void *profile,
+  int slot,
+  int64_t nsec);
+
+void _KLTProfileFlush(
+  void *profile,
+  _KLT_ProfileTimes *times);
+
+#endif
@@ -8,23 +8,29 @@
 #include <stdlib.h>		/* malloc() ? */
 #include <string.h>		/* memset() ? */
 #include <math.h>		/* */
+#include <pthread.h>
 
 /* Our includes */
 #include "base.h"
 #include "error.h"
 #include "convolve.h"	/* for computing pyramid */
+#include "profile.h"
 #include "pyramid.h"
 
 
 /*********************************************************************
+ * _createPyramid
  *
+ * Creates a pyramid whose levels are stored as float, or as bfloat16
+ * if half is TRUE.
  */
 
-_KLT_Pyramid _KLTCreatePyramid(
+static _KLT_Pyramid _createPyramid(
   int ncols,
   int nrows,
   int subsampling,
-  int nlevels)
+  int nlevels,
+  KLT_BOOL half)
 {
   _KLT_Pyramid pyramid;
   int nbytes = sizeof(_KLT_PyramidRec) +	
@@ -50,10 +56,12 @@ _KLT_Pyramid _KLTCreatePyramid(
   pyramid->img = (_KLT_FloatImage *) (pyramid + 1);
   pyramid->ncols = (int *) (pyramid->img + nlevels);
   pyramid->nrows = (int *) (pyramid->ncols + nlevels);
+  pyramid->tiles = NULL;
 
   /* Allocate memory for each level of pyramid and assign pointers */
   for (i = 0 ; i < nlevels ; i++)  {
-    pyramid->img[i] =  _KLTCreateFloatImage(ncols, nrows);
+    pyramid->img[i] = half ? _KLTCreateHalfImage(ncols, nrows)
+                           : _KLTCreateFloatImage(ncols, nrows);
     pyramid->ncols[i] = ncols;  pyramid->nrows[i] = nrows;
     ncols /= subsampling;  nrows /= subsampling;
   }
@@ -62,6 +70,31 @@ _KLT_Pyramid _KLTCreatePyramid(
 }
 
 
+/*********************************************************************
+ * _KLTCreatePyramid
+ * _KLTCreateHalfPyramid
+ */
+
+_KLT_Pyramid _KLTCreatePyramid(
+  int ncols,
+  int nrows,
+  int subsampling,
+  int nlevels)
+{
+  return _createPyramid(ncols, nrows, subsampling, nlevels, FALSE);
+}
+
+
+_KLT_Pyramid _KLTCreateHalfPyramid(
+  int ncols,
+  int nrows,
+  int subsampling,
+  int nlevels)
+{
+  return _createPyramid(ncols, nrows, subsampling, nlevels, TRUE);
+}
+
+
 /*********************************************************************
  *
  */
@@ -74,12 +107,38 @@ void _KLTFreePyramid(
   /* Free images */
   for (i = 0 ; i < pyramid->nLevels ; i++)
     _KLTFreeFloatImage(pyramid->img[i]);
+  free(pyramid->tiles);
 
   /* Free structure */
   free(pyramid);
 }
 
 
+/*********************************************************************
+ * _subsample
+ *
+ * Smoothes an image and subsamples it into the next level.
+ */
+
+static void _subsample(
+  _KLT_FloatImage img,
+  float sigma,
+  int subsampling,
+  _KLT_FloatImage out)
+{
+  _KLT_FloatImage tmpimg = _KLTCreateFloatImage(img->ncols, img->nrows);
+  int subhalf = subsampling / 2;
+  int x, y;
+
+  _KLTComputeSmoothedImage(img, sigma, tmpimg);
+  for (y = 0 ; y < out->nrows ; y++)
+    for (x = 0 ; x < out->ncols ; x++)
+      out->data[y*out->ncols+x] = tmpimg->data[(subsampling*y+subhalf)*img->ncols +
+                                               (subsampling*x+subhalf)];
+  _KLTFreeFloatImage(tmpimg);
+}
+
+
 /*********************************************************************
  *
  */
@@ -90,13 +149,10 @@ void _KLTComputePyramid(
 						float sigma_fact
 						)
 {
-  _KLT_FloatImage currimg, tmpimg;
   int ncols = img->ncols, nrows = img->nrows;
   int subsampling = pyramid->subsampling;
-  int subhalf = subsampling / 2;
   float sigma = subsampling * sigma_fact;  /* empirically determined */
-  int oldncols;
-  int i, x, y;
+  int i;
 	
   if (subsampling != 2 && subsampling != 4 && 
       subsampling != 8 && subsampling != 16 && subsampling != 32)
@@ -109,37 +165,442 @@ void _KLTComputePyramid(
   /* Copy original image to level 0 of pyramid */
   memcpy(pyramid->img[0]->data, img->data, ncols*nrows*sizeof(float));
 
-  currimg = img;
-	for (i = 1 ; i < pyramid->nLevels ; i++)  
-	{
-		tmpimg = _KLTCreateFloatImage(ncols, nrows);
-		_KLTComputeSmoothedImage(currimg, sigma, tmpimg);
+  for (i = 1 ; i < pyramid->nLevels ; i++)
+    _subsample(pyramid->img[i-1], sigma, subsampling, pyramid->img[i]);
+}
+
+
+/*********************************************************************
+ * _KLTComputeHalfPyramids
+ *
+ * Computes the pyramid of a smoothed image and its gradients, as
+ * _KLTComputePyramid and _KLTComputeGradients do, into pyramids
+ * created by _KLTCreateHalfPyramid.  Each level is narrowed to
+ * bfloat16 as soon as it has been computed, so that only the level at
+ * hand (and its gradients) is ever held in float.  The stages are
+ * timed into profile (may be NULL).
+ */
 
-		/* Subsample */
-		oldncols = ncols;
-		ncols = ncols / subsampling;  
-		nrows = nrows / subsampling;
+void _KLTComputeHalfPyramids(
+  _KLT_FloatImage img,
+  float sigma_fact,
+  float grad_sigma,
+  _KLT_Pyramid pyramid,
+  _KLT_Pyramid pyramid_gradx,
+  _KLT_Pyramid pyramid_grady,
+  void *profile)
+{
+  int subsampling = pyramid->subsampling;
+  float sigma = subsampling * sigma_fact;  /* empirically determined */
+  _KLT_FloatImage currimg = img, nextimg, gradx, grady;
+  int i;
 
-		for (y = 0 ; y < nrows ; y++)
-			for (x = 0 ; x < ncols ; x++)
-				pyramid->img[i]->data[y*ncols+x] = tmpimg->data[(subsampling*y+subhalf)*oldncols +
-													(subsampling*x+subhalf)];
+  (void) profile;   /* unused unless KLT_PROFILE is defined */
+  assert(pyramid->ncols[0] == img->ncols);
+  assert(pyramid->nrows[0] == img->nrows);
 
-		/* Reassign current image */
-		currimg = pyramid->img[i];
-					
-		_KLTFreeFloatImage(tmpimg);
-	}
+  for (i = 0 ; i < pyramid->nLevels ; i++)  {
+    _KLT_PROFILE_START(tgrad);
+    gradx = _KLTCreateFloatImage(currimg->ncols, currimg->nrows);
+    grady = _KLTCreateFloatImage(currimg->ncols, currimg->nrows);
+    _KLTComputeGradients(currimg, grad_sigma, gradx, grady);
+    _KLTToHalfImage(gradx, pyramid_gradx->img[i]);
+    _KLTToHalfImage(grady, pyramid_grady->img[i]);
+    _KLTFreeFloatImage(gradx);
+    _KLTFreeFloatImage(grady);
+    _KLT_PROFILE_STOP(profile, KLT_STAGE_GRADIENTS, tgrad);
+
+    _KLT_PROFILE_START(tpyr);
+    _KLTToHalfImage(currimg, pyramid->img[i]);
+    if (i + 1 < pyramid->nLevels)  {
+      nextimg = _KLTCreateFloatImage(pyramid->ncols[i+1], pyramid->nrows[i+1]);
+      _subsample(currimg, sigma, subsampling, nextimg);
+    } else
+      nextimg = NULL;
+    if (currimg != img)  _KLTFreeFloatImage(currimg);
+    currimg = nextimg;
+    _KLT_PROFILE_STOP(profile, KLT_STAGE_PYRAMID, tpyr);
+  }
 }
- 
 
 
+/*********************************************************************
+ * _KLTTilePyramid
+ *
+ * Marks every tile of every level of a pyramid as not computed.  The
+ * tiles are then computed on demand by _KLTComputePyramidRegions.
+ */
 
+void _KLTTilePyramid(
+  _KLT_Pyramid pyramid)
+{
+  int ntiles = 0;
+  unsigned char *flags;
+  int i;
 
+  for (i = 0 ; i < pyramid->nLevels ; i++)
+    ntiles += ((pyramid->ncols[i] + _KLT_TILE_SIZE - 1) / _KLT_TILE_SIZE) *
+              ((pyramid->nrows[i] + _KLT_TILE_SIZE - 1) / _KLT_TILE_SIZE);
+
+  free(pyramid->tiles);
+  pyramid->tiles = (unsigned char **)
+    malloc(pyramid->nLevels * sizeof(unsigned char *) + ntiles);
+  if (pyramid->tiles == NULL)
+    KLTError("(_KLTTilePyramid)  Out of memory");
+
+  flags = (unsigned char *) (pyramid->tiles + pyramid->nLevels);
+  memset(flags, 0, ntiles);
+  for (i = 0 ; i < pyramid->nLevels ; i++)  {
+    pyramid->tiles[i] = flags;
+    flags += ((pyramid->ncols[i] + _KLT_TILE_SIZE - 1) / _KLT_TILE_SIZE) *
+             ((pyramid->nrows[i] + _KLT_TILE_SIZE - 1) / _KLT_TILE_SIZE);
+  }
+}
 
 
+/*********************************************************************
+ * TILED PYRAMIDS
+ *
+ * A tile of level 0 is the smoothed image; a tile of level i is
+ * subsampled from level i-1 smoothed around it, which needs the tiles
+ * of level i-1 within the smoothing kernel of it, and so on down to
+ * the image.  The gradients of a tile need the level within the
+ * gradient kernel of it.  Every pixel is computed exactly as by
+ * _KLTComputePyramid and _KLTComputeGradients.
+ *
+ * The image pyramid may be complete while its gradients are tiled.
+ * Tiles may be checked by a thread while another one computes them
+ * under the lock of the builder, so a tile is flagged as computed
+ * only once its pixels are stored.
+ */
 
+#define _TILE_COMPUTED(flags, i)  __atomic_load_n(&(flags)[i], __ATOMIC_ACQUIRE)
+#define _SET_TILE_COMPUTED(flags, i)  __atomic_store_n(&(flags)[i], 1, __ATOMIC_RELEASE)
 
 
+/*********************************************************************
+ * _KLTCreateTileBuilder
+ * _KLTFreeTileBuilder
+ *
+ * A builder computes the tiles of a pyramid, and of its gradients, on
+ * demand.  img is the image the pyramid is of, and must not change
+ * while the builder is used.
+ */
+
+_KLT_TileBuilder _KLTCreateTileBuilder(
+  KLT_PixelType *img,
+  float smooth_sigma,
+  float pyramid_sigma_fact,
+  float grad_sigma,
+  _KLT_Pyramid pyramid,
+  _KLT_Pyramid pyramid_gradx,
+  _KLT_Pyramid pyramid_grady)
+{
+  _KLT_TileBuilder b;
+  int gauss_width, gaussderiv_width;
+  int i;
+
+  /* Tiles are computed in float */
+  assert(pyramid->img[0]->half == NULL);
+
+  b = (_KLT_TileBuilder) malloc(sizeof(_KLT_TileBuilderRec) +
+                                pyramid->nLevels * sizeof(_KLT_FloatImage));
+  if (b == NULL)
+    KLTError("(_KLTCreateTileBuilder)  Out of memory");
+
+  b->img = img;
+  b->pyramid = pyramid;
+  b->gradx = pyramid_gradx;
+  b->grady = pyramid_grady;
+  b->smooth_sigma = smooth_sigma;
+  b->pyramid_sigma = pyramid->subsampling * pyramid_sigma_fact;
+  b->grad_sigma = grad_sigma;
+  _KLTGetKernelWidths(smooth_sigma, &gauss_width, &gaussderiv_width);
+  b->smooth_radius = gauss_width / 2;
+  _KLTGetKernelWidths(b->pyramid_sigma, &gauss_width, &gaussderiv_width);
+  b->pyramid_radius = gauss_width / 2;
+  _KLTGetKernelWidths(grad_sigma, &gauss_width, &gaussderiv_width);
+  b->grad_radius = max(gauss_width, gaussderiv_width) / 2;
+
+  /* Scratch images are created when first needed, and are only */
+  /* touched where tiles are computed */
+  b->raw = NULL;
+  b->smoothed = (_KLT_FloatImage *) (b + 1);
+  for (i = 0 ; i < pyramid->nLevels ; i++)
+    b->smoothed[i] = NULL;
+  pthread_mutex_init(&b->lock, NULL);
+
+  return b;
+}
 
 
+void _KLTFreeTileBuilder(
+  _KLT_TileBuilder b)
+{
+  int i;
+
+  if (b->raw != NULL)  _KLTFreeFloatImage(b->raw);
+  for (i = 0 ; i < b->pyramid->nLevels ; i++)
+    if (b->smoothed[i] != NULL)  _KLTFreeFloatImage(b->smoothed[i]);
+  pthread_mutex_destroy(&b->lock);
+  free(b);
+}
+
+
+static void _computeImageTiles(
+  _KLT_TileBuilder b,
+  int level,
+  int x0, int y0,
+  int x1, int y1)
+{
+  _KLT_Pyramid pyramid = b->pyramid;
+  _KLT_FloatImage out = pyramid->img[level];
+  int ncols = pyramid->ncols[level], nrows = pyramid->nrows[level];
+  int tcols = (ncols + _KLT_TILE_SIZE - 1) / _KLT_TILE_SIZE;
+  int tx, ty, x, y;
+
+  if (pyramid->tiles == NULL)  return;   /* complete */
+
+  x0 = max(x0, 0);  y0 = max(y0, 0);
+  x1 = min(x1, ncols);  y1 = min(y1, nrows);
+  if (x0 >= x1 || y0 >= y1)  return;
+
+  for (ty = y0 / _KLT_TILE_SIZE ; ty <= (y1 - 1) / _KLT_TILE_SIZE ; ty++)
+    for (tx = x0 / _KLT_TILE_SIZE ; tx <= (x1 - 1) / _KLT_TILE_SIZE ; tx++)  {
+      int cx0 = tx * _KLT_TILE_SIZE, cy0 = ty * _KLT_TILE_SIZE;
+      int cx1 = min(cx0 + _KLT_TILE_SIZE, ncols);
+      int cy1 = min(cy0 + _KLT_TILE_SIZE, nrows);
+
+      if (pyramid->tiles[level][ty * tcols + tx])  continue;
+
+      if (level == 0)  {
+        /* Smooth the image */
+        int sx0 = max(cx0 - b->smooth_radius, 0);
+        int sy0 = max(cy0 - b->smooth_radius, 0);
+        int sx1 = min(cx1 + b->smooth_radius, ncols);
+        int sy1 = min(cy1 + b->smooth_radius, nrows);
+
+        if (b->raw == NULL)
+          b->raw = _KLTCreateFloatImage(ncols, nrows);
+        for (y = sy0 ; y < sy1 ; y++)
+          for (x = sx0 ; x < sx1 ; x++)
+            b->raw->data[y * ncols + x] = (float) b->img[y * ncols + x];
+        _KLTComputeSmoothedRegion(b->raw, b->smooth_sigma, out,
+                                  cx0, cy0, cx1, cy1);
+      } else  {
+        /* Smooth the level below where it is sampled, and subsample */
+        int subsampling = pyramid->subsampling;
+        int subhalf = subsampling / 2;
+        int oldncols = pyramid->ncols[level-1];
+        int sx0 = subsampling * cx0 + subhalf;
+        int sy0 = subsampling * cy0 + subhalf;
+        int sx1 = subsampling * (cx1 - 1) + subhalf + 1;
+        int sy1 = subsampling * (cy1 - 1) + subhalf + 1;
+        _KLT_FloatImage smoothed;
+
+        _computeImageTiles(b, level - 1,
+                           sx0 - b->pyramid_radius, sy0 - b->pyramid_radius,
+                           sx1 + b->pyramid_radius, sy1 + b->pyramid_radius);
+        if (b->smoothed[level] == NULL)
+          b->smoothed[level] = _KLTCreateFloatImage(oldncols,
+                                                    pyramid->nrows[level-1]);
+        smoothed = b->smoothed[level];
+        _KLTComputeSmoothedRegion(pyramid->img[level-1], b->pyramid_sigma,
+                                  smoothed, sx0, sy0, sx1, sy1);
+        for (y = cy0 ; y < cy1 ; y++)
+          for (x = cx0 ; x < cx1 ; x++)
+            out->data[y*ncols+x] = smoothed->data[(subsampling*y+subhalf)*oldncols +
+                                                  (subsampling*x+subhalf)];
+      }
+
+      _SET_TILE_COMPUTED(pyramid->tiles[level], ty * tcols + tx);
+    }
+}
+
+
+static void _computeGradientTiles(
+  _KLT_TileBuilder b,
+  int level,
+  int x0, int y0,
+  int x1, int y1)
+{
+  int ncols = b->pyramid->ncols[level], nrows = b->pyramid->nrows[level];
+  int tcols = (ncols + _KLT_TILE_SIZE - 1) / _KLT_TILE_SIZE;
+  int r = b->grad_radius;
+  int tx, ty;
+
+  if (b->gradx->tiles == NULL)  return;   /* complete */
+
+  x0 = max(x0, 0);  y0 = max(y0, 0);
+  x1 = min(x1, ncols);  y1 = min(y1, nrows);
+  if (x0 >= x1 || y0 >= y1)  return;
+
+  for (ty = y0 / _KLT_TILE_SIZE ; ty <= (y1 - 1) / _KLT_TILE_SIZE ; ty++)
+    for (tx = x0 / _KLT_TILE_SIZE ; tx <= (x1 - 1) / _KLT_TILE_SIZE ; tx++)  {
+      int cx0 = tx * _KLT_TILE_SIZE, cy0 = ty * _KLT_TILE_SIZE;
+      int cx1 = min(cx0 + _KLT_TILE_SIZE, ncols);
+      int cy1 = min(cy0 + _KLT_TILE_SIZE, nrows);
+
+      if (b->gradx->tiles[level][ty * tcols + tx])  continue;
+
+      _computeImageTiles(b, level, cx0 - r, cy0 - r, cx1 + r, cy1 + r);
+      _KLTComputeGradientsRegion(b->pyramid->img[level], b->grad_sigma,
+                                 b->gradx->img[level], b->grady->img[level],
+                                 cx0, cy0, cx1, cy1);
+      _SET_TILE_COMPUTED(b->grady->tiles[level], ty * tcols + tx);
+      _SET_TILE_COMPUTED(b->gradx->tiles[level], ty * tcols + tx);
+    }
+}
+
+
+/*********************************************************************
+ * _KLTFetchTiles
+ *
+ * Makes sure that the gradients, and the image, of the pixels
+ * [x0,x1) x [y0,y1) of a level have been computed, computing the
+ * missing tiles.  May be called by several threads at once.
+ */
+
+void _KLTFetchTiles(
+  _KLT_TileBuilder b,
+  int level,
+  int x0, int y0,
+  int x1, int y1)
+{
+  unsigned char *flags;
+  int ncols, nrows, tcols;
+  int tx, ty;
+
+  if (b->gradx->tiles == NULL)  return;
+
+  /* Most windows lie on tiles that have already been computed */
+  ncols = b->pyramid->ncols[level];
+  nrows = b->pyramid->nrows[level];
+  tcols = (ncols + _KLT_TILE_SIZE - 1) / _KLT_TILE_SIZE;
+  flags = b->gradx->tiles[level];
+  x0 = max(x0, 0);  y0 = max(y0, 0);
+  x1 = min(x1, ncols);  y1 = min(y1, nrows);
+  if (x0 >= x1 || y0 >= y1)  return;
+  for (ty = y0 / _KLT_TILE_SIZE ; ty <= (y1 - 1) / _KLT_TILE_SIZE ; ty++)
+    for (tx = x0 / _KLT_TILE_SIZE ; tx <= (x1 - 1) / _KLT_TILE_SIZE ; tx++)
+      if (!_TILE_COMPUTED(flags, ty * tcols + tx))  {
+        pthread_mutex_lock(&b->lock);
+        _computeGradientTiles(b, level, x0, y0, x1, y1);
+        pthread_mutex_unlock(&b->lock);
+        return;
+      }
+}
+
+
+/*********************************************************************
+ * _KLTComputePyramidRegions
+ *
+ * Computes the tiles of a tiled pyramid, and of its gradients, that
+ * cover the given regions and have not been computed yet.  img is the
+ * image the pyramid is of.  Does nothing if the pyramid is complete.
+ */
+
+void _KLTComputePyramidRegions(
+  KLT_PixelType *img,
+  float smooth_sigma,
+  float pyramid_sigma_fact,
+  float grad_sigma,
+  _KLT_Pyramid pyramid,
+  _KLT_Pyramid pyramid_gradx,
+  _KLT_Pyramid pyramid_grady,
+  const int *regions,   /* level, x0, y0, x1, y1 of each region */
+  int nregions)
+{
+  _KLT_TileBuilder b;
+  int i;
+
+  if (pyramid_gradx->tiles == NULL)  return;
+  assert(pyramid_grady->tiles != NULL);
+
+  b = _KLTCreateTileBuilder(img, smooth_sigma, pyramid_sigma_fact, grad_sigma,
+                            pyramid, pyramid_gradx, pyramid_grady);
+  for (i = 0 ; i < nregions ; i++, regions += 5)
+    _computeGradientTiles(b, regions[0],
+                          regions[1], regions[2], regions[3], regions[4]);
+  _KLTFreeTileBuilder(b);
+}
+
+
+/*********************************************************************
+ * _KLTCompletePyramids
+ *
+ * Computes the tiles of a tiled pyramid, and of its gradients, that
+ * have not been computed yet, after which the pyramids are complete.
+ */
+
+void _KLTCompletePyramids(
+  KLT_PixelType *img,
+  float smooth_sigma,
+  float pyramid_sigma_fact,
+  float grad_sigma,
+  _KLT_Pyramid pyramid,
+  _KLT_Pyramid pyramid_gradx,
+  _KLT_Pyramid pyramid_grady)
+{
+  _KLT_TileBuilder b;
+  int i;
+
+  if (pyramid_gradx->tiles == NULL)  return;
+
+  b = _KLTCreateTileBuilder(img, smooth_sigma, pyramid_sigma_fact, grad_sigma,
+                            pyramid, pyramid_gradx, pyramid_grady);
+  for (i = 0 ; i < pyramid->nLevels ; i++)
+    _computeGradientTiles(b, i, 0, 0, pyramid->ncols[i], pyramid->nrows[i]);
+  _KLTFreeTileBuilder(b);
+
+  free(pyramid->tiles);
+  free(pyramid_gradx->tiles);
+  free(pyramid_grady->tiles);
+  pyramid->tiles = pyramid_gradx->tiles = pyramid_grady->tiles = NULL;
+}
+
+
+/*********************************************************************
+ * _KLTCreateFixedPyramid
+ *
+ * Converts every level of a pyramid to fixed point with fracbits
+ * fractional bits.
+ */
+
+_KLT_FixedPyramid _KLTCreateFixedPyramid(
+  _KLT_Pyramid pyramid,
+  int fracbits)
+{
+  _KLT_FixedPyramid fixedpyr;
+  int nlevels = pyramid->nLevels;
+  int i;
+
+  fixedpyr = (_KLT_FixedPyramid)  malloc(sizeof(_KLT_FixedPyramidRec) +
+                                         nlevels * sizeof(_KLT_FixedImage));
+  if (fixedpyr == NULL)
+    KLTError("(_KLTCreateFixedPyramid)  Out of memory");
+  fixedpyr->nLevels = nlevels;
+  fixedpyr->img = (_KLT_FixedImage *) (fixedpyr + 1);
+
+  for (i = 0 ; i < nlevels ; i++)  {
+    fixedpyr->img[i] = _KLTCreateFixedImage(pyramid->ncols[i], pyramid->nrows[i]);
+    _KLTToFixedImage(pyramid->img[i], fracbits, fixedpyr->img[i]);
+  }
+
+  return fixedpyr;
+}
+
+
+/*********************************************************************
+ * _KLTFreeFixedPyramid
+ */
+
+void _KLTFreeFixedPyramid(
+  _KLT_FixedPyramid pyramid)
+{
+  int i;
+
+  for (i = 0 ; i < pyramid->nLevels ; i++)
+    _KLTFreeFixedImage(pyramid->img[i]);
+  free(pyramid);
+}
@@ -5,13 +5,20 @@
 #ifndef _PYRAMID_H_
 #define _PYRAMID_H_
 
+#include <pthread.h>
+#include "klt.h"
 #include "klt_util.h"
 
+/* Side of the square tiles in which a pyramid is computed on demand */
+#define _KLT_TILE_SIZE  64
+
 typedef struct  {
   int subsampling;
   int nLevels;
   _KLT_FloatImage *img;
   int *ncols, *nrows;
+  unsigned char **tiles;  /* per level, whether each tile has been computed; */
+                          /* NULL if the whole pyramid has */
 }  _KLT_PyramidRec, *_KLT_Pyramid;
 
 
@@ -29,4 +36,85 @@ void _KLTComputePyramid(
 void _KLTFreePyramid(
   _KLT_Pyramid pyramid);
 
+void _KLTTilePyramid(
+  _KLT_Pyramid pyramid);
+
+/* Computes the tiles of a pyramid and of its gradients on demand */
+typedef struct  {
+  KLT_PixelType *img;         /* image the pyramid is of */
+  _KLT_Pyramid pyramid, gradx, grady;
+  float smooth_sigma, pyramid_sigma, grad_sigma;
+  int smooth_radius, pyramid_radius, grad_radius;
+  _KLT_FloatImage raw;        /* image before smoothing */
+  _KLT_FloatImage *smoothed;  /* level i-1 smoothed, before subsampling */
+  pthread_mutex_t lock;
+}  _KLT_TileBuilderRec, *_KLT_TileBuilder;
+
+_KLT_TileBuilder _KLTCreateTileBuilder(
+  KLT_PixelType *img,
+  float smooth_sigma,
+  float pyramid_sigma_fact,
+  float grad_sigma,
+  _KLT_Pyramid pyramid,
+  _KLT_Pyramid pyramid_gradx,
+  _KLT_Pyramid pyramid_grady);
+
+void _KLTFreeTileBuilder(
+  _KLT_TileBuilder builder);
+
+void _KLTFetchTiles(
+  _KLT_TileBuilder builder,
+  int level,
+  int x0, int y0,
+  int x1, int y1);
+
+void _KLTComputePyramidRegions(
+  KLT_PixelType *img,
+  float smooth_sigma,
+  float pyramid_sigma_fact,
+  float grad_sigma,
+  _KLT_Pyramid pyramid,
+  _KLT_Pyramid pyramid_gradx,
+  _KLT_Pyramid pyramid_grady,
+  const int *regions,   /* level, x0, y0, x1, y1 of each region */
+  int nregions);
+
+void _KLTCompletePyramids(
+  KLT_PixelType *img,
+  float smooth_sigma,
+  float pyramid_sigma_fact,
+  float grad_sigma,
+  _KLT_Pyramid pyramid,
+  _KLT_Pyramid pyramid_gradx,
+  _KLT_Pyramid pyramid_grady);
+
+/* Pyramids stored as bfloat16, narrowed level by level as computed */
+_KLT_Pyramid _KLTCreateHalfPyramid(
+  int ncols,
+  int nrows,
+  int subsampling,
+  int nlevels);
+
+void _KLTComputeHalfPyramids(
+  _KLT_FloatImage img,
+  float sigma_fact,
+  float grad_sigma,
+  _KLT_Pyramid pyramid,
+  _KLT_Pyramid pyramid_gradx,
+  _KLT_Pyramid pyramid_grady,
+  void *profile);
+
+/* Fixed-point copy of a pyramid, for fixed-point tracking */
+typedef struct  {
+  int nLevels;
+  _KLT_FixedImage *img;
+}  _KLT_FixedPyramidRec, *_KLT_FixedPyramid;
+
+_KLT_FixedPyramid _KLTCreateFixedPyramid(
+  _KLT_Pyramid pyramid,
+  int fracbits);
+
+void _KLTFreeFixedPyramid(
+  _KLT_FixedPyramid pyramid);
+
 #endif
@@ -17,8 +17,10 @@
 #include "base.h"
 #include "error.h"
 #include "convolve.h"
+#include "featureView.h"
 #include "klt.h"
 #include "klt_util.h"
+#include "profile.h"
 #include "pyramid.h"
 
 int KLT_verbose = 1;
@@ -118,11 +120,11 @@ static void _fillFeaturemap(
  * Removes features that are within close proximity to better features.
  *
  * INPUTS
- * featurelist:  A list of features.  The nFeatures property
+ * features:     A view of the features.  The nFeatures property
  *               is used.
  *
  * OUTPUTS
- * featurelist:  Is overwritten.  Nearby "redundant" features are removed.
+ * features:     Is overwritten.  Nearby "redundant" features are removed.
  *               Writes -1's into the remaining elements.
  *
  * RETURNS
@@ -132,7 +134,7 @@ static void _fillFeaturemap(
 static void _enforceMinimumDistance(
         int *pointlist,              /* featurepoints */
         int npoints,                 /* number of featurepoints */
-        KLT_FeatureList featurelist, /* features */
+        _KLT_FeatureView features,   /* features */
         int ncols, int nrows,        /* size of images */
         int mindist,                 /* min. dist b/w features */
         int min_eigenvalue,          /* min. eigenvalue */
@@ -155,10 +157,10 @@ static void _enforceMinimumDistance(
 
 	/* If we are keeping all old good features, then add them to the featuremap */
 	if (!overwriteAllFeatures)
-		for (indx = 0 ; indx < featurelist->nFeatures ; indx++)
-			if (featurelist->feature[indx]->val >= 0)  {
-				x   = (int) featurelist->feature[indx]->x;
-				y   = (int) featurelist->feature[indx]->y;
+		for (indx = 0 ; indx < features->nFeatures ; indx++)
+			if (FV_VAL(features, indx) >= 0)  {
+				x   = (int) FV_X(features, indx);
+				y   = (int) FV_Y(features, indx);
 				_fillFeaturemap(x, y, featuremap, mindist, ncols, nrows);
 			}
 
@@ -168,23 +170,23 @@ static void _enforceMinimumDistance(
 	while (1)  {
 
 		/* If we can't add all the points, then fill in the rest
-		   of the featurelist with -1's */
+		   of the features with -1's */
 		if (ptr >= pointlist + 3 * npoints)  {
-			while (indx < featurelist->nFeatures)  {
+			while (indx < features->nFeatures)  {
 				if (overwriteAllFeatures ||
-				    featurelist->feature[indx]->val < 0) {
-					featurelist->feature[indx]->x   = -1;
-					featurelist->feature[indx]->y   = -1;
-					featurelist->feature[indx]->val = KLT_NOT_FOUND;
-					featurelist->feature[indx]->aff_img = NULL;
-					featurelist->feature[indx]->aff_img_gradx = NULL;
-					featurelist->feature[indx]->aff_img_grady = NULL;
-					featurelist->feature[indx]->aff_x = -1.0;
-					featurelist->feature[indx]->aff_y = -1.0;
-					featurelist->feature[indx]->aff_Axx = 1.0;
-					featurelist->feature[indx]->aff_Ayx = 0.0;
-					featurelist->feature[indx]->aff_Axy = 0.0;
-					featurelist->feature[indx]->aff_Ayy = 1.0;
+				    FV_VAL(features, indx) < 0) {
+					FV_X(features, indx)   = -1;
+					FV_Y(features, indx)   = -1;
+					FV_VAL(features, indx) = KLT_NOT_FOUND;
+					FV_AFF_IMG(features, indx) = NULL;
+					FV_AFF_IMG_GRADX(features, indx) = NULL;
+					FV_AFF_IMG_GRADY(features, indx) = NULL;
+					FV_AFF_X(features, indx) = -1.0;
+					FV_AFF_Y(features, indx) = -1.0;
+					FV_AFF_AXX(features, indx) = 1.0;
+					FV_AFF_AYX(features, indx) = 0.0;
+					FV_AFF_AXY(features, indx) = 0.0;
+					FV_AFF_AYY(features, indx) = 1.0;
 				}
 				indx++;
 			}
@@ -202,27 +204,27 @@ static void _enforceMinimumDistance(
 		assert(y < nrows);
 
 		while (!overwriteAllFeatures &&
-		       indx < featurelist->nFeatures &&
-		       featurelist->feature[indx]->val >= 0)
+		       indx < features->nFeatures &&
+		       FV_VAL(features, indx) >= 0)
 			indx++;
 
-		if (indx >= featurelist->nFeatures)  break;
+		if (indx >= features->nFeatures)  break;
 
 		/* If no neighbor has been selected, and if the minimum
 		   eigenvalue is large enough, then add feature to the current list */
 		if (!featuremap[y * ncols + x] && val >= min_eigenvalue)  {
-			featurelist->feature[indx]->x   = (KLT_locType) x;
-			featurelist->feature[indx]->y   = (KLT_locType) y;
-			featurelist->feature[indx]->val = (int) val;
-			featurelist->feature[indx]->aff_img = NULL;
-			featurelist->feature[indx]->aff_img_gradx = NULL;
-			featurelist->feature[indx]->aff_img_grady = NULL;
-			featurelist->feature[indx]->aff_x = -1.0;
-			featurelist->feature[indx]->aff_y = -1.0;
-			featurelist->feature[indx]->aff_Axx = 1.0;
-			featurelist->feature[indx]->aff_Ayx = 0.0;
-			featurelist->feature[indx]->aff_Axy = 0.0;
-			featurelist->feature[indx]->aff_Ayy = 1.0;
+			FV_X(features, indx)   = (KLT_locType) x;
+			FV_Y(features, indx)   = (KLT_locType) y;
+			FV_VAL(features, indx) = (int) val;
+			FV_AFF_IMG(features, indx) = NULL;
+			FV_AFF_IMG_GRADX(features, indx) = NULL;
+			FV_AFF_IMG_GRADY(features, indx) = NULL;
+			FV_AFF_X(features, indx) = -1.0;
+			FV_AFF_Y(features, indx) = -1.0;
+			FV_AFF_AXX(features, indx) = 1.0;
+			FV_AFF_AYX(features, indx) = 0.0;
+			FV_AFF_AXY(features, indx) = 0.0;
+			FV_AFF_AYY(features, indx) = 1.0;
 			indx++;
 
 			/* Fill in surrounding region of feature map, but
@@ -302,7 +304,7 @@ void _KLTSelectGoodFeatures(
         KLT_PixelType *img,
         int ncols,
         int nrows,
-        KLT_FeatureList featurelist,
+        _KLT_FeatureView features,
         selectionMode mode)
 {
 	_KLT_FloatImage floatimg, gradx, grady;
@@ -344,11 +346,35 @@ void _KLTSelectGoodFeatures(
 	/* Create temporary images, etc. */
 	if (mode == REPLACING_SOME &&
 	    tc->sequentialMode && tc->pyramid_last != NULL)  {
+		/* Pyramids computed only around the tracked features are */
+		/* completed at the finest level, where features are selected */
+		int level0[5];
+		level0[0] = 0;  level0[1] = level0[2] = 0;
+		level0[3] = ncols;  level0[4] = nrows;
+		_KLT_PROFILE_START(tpyr);
+		_KLTComputePyramidRegions(img, _KLTComputeSmoothSigma(tc),
+		                          tc->pyramid_sigma_fact, tc->grad_sigma,
+		                          (_KLT_Pyramid) tc->pyramid_last,
+		                          (_KLT_Pyramid) tc->pyramid_last_gradx,
+		                          (_KLT_Pyramid) tc->pyramid_last_grady,
+		                          level0, 1);
+		_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_PYRAMID, tpyr);
 		floatimg = ((_KLT_Pyramid) tc->pyramid_last)->img[0];
 		gradx = ((_KLT_Pyramid) tc->pyramid_last_gradx)->img[0];
 		grady = ((_KLT_Pyramid) tc->pyramid_last_grady)->img[0];
 		assert(gradx != NULL);
 		assert(grady != NULL);
+		/* Widen pyramids stored as bfloat16 */
+		if (floatimg->half)  {
+			_KLT_FloatImage halfimg = floatimg, halfgradx = gradx, halfgrady = grady;
+			floatimages_created = TRUE;
+			floatimg = _KLTCreateFloatImage(ncols, nrows);
+			gradx    = _KLTCreateFloatImage(ncols, nrows);
+			grady    = _KLTCreateFloatImage(ncols, nrows);
+			_KLTHalfToFloatImage(halfimg, floatimg);
+			_KLTHalfToFloatImage(halfgradx, gradx);
+			_KLTHalfToFloatImage(halfgrady, grady);
+		}
 	} else  {
 		floatimages_created = TRUE;
 		floatimg = _KLTCreateFloatImage(ncols, nrows);
@@ -357,13 +383,23 @@ void _KLTSelectGoodFeatures(
 		if (tc->smoothBeforeSelecting)  {
 			_KLT_FloatImage tmpimg;
 			tmpimg = _KLTCreateFloatImage(ncols, nrows);
+			_KLT_PROFILE_START(tfloat);
 			_KLTToFloatImage(img, ncols, nrows, tmpimg);
+			_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_TO_FLOAT, tfloat);
+			_KLT_PROFILE_START(tsmooth);
 			_KLTComputeSmoothedImage(tmpimg, _KLTComputeSmoothSigma(tc), floatimg);
+			_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_SMOOTH, tsmooth);
 			_KLTFreeFloatImage(tmpimg);
-		} else _KLTToFloatImage(img, ncols, nrows, floatimg);
+		} else  {
+			_KLT_PROFILE_START(tfloat);
+			_KLTToFloatImage(img, ncols, nrows, floatimg);
+			_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_TO_FLOAT, tfloat);
+		}
 
 		/* Compute gradient of image in x and y direction */
+		_KLT_PROFILE_START(tgrad);
 		_KLTComputeGradients(floatimg, tc->grad_sigma, gradx, grady);
+		_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_GRADIENTS, tgrad);
 	}
 
 	/* Write internal images */
@@ -375,6 +411,7 @@ void _KLTSelectGoodFeatures(
 
 	/* Compute trackability of each image pixel as the minimum
 	   of the two eigenvalues of the Z matrix */
+	_KLT_PROFILE_START(tscan);
 	{
 		register float gx, gy;
 		register float gxx, gxy, gyy;
@@ -464,8 +501,12 @@ void _KLTSelectGoodFeatures(
 			}
 	}
 
+	_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_TRACKABILITY, tscan);
+
 	/* Sort the features  */
+	_KLT_PROFILE_START(tsort);
 	_sortPointList(pointlist, npoints);
+	_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_SORT, tsort);
 
 	/* Check tc->mindist */
 	if (tc->mindist < 0)  {
@@ -475,14 +516,16 @@ void _KLTSelectGoodFeatures(
 	}
 
 	/* Enforce minimum distance between features */
+	_KLT_PROFILE_START(tdist);
 	_enforceMinimumDistance(
 	        pointlist,
 	        npoints,
-	        featurelist,
+	        features,
 	        ncols, nrows,
 	        tc->mindist,
 	        tc->min_eigenvalue,
 	        overwriteAllFeatures);
+	_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_MIN_DISTANCE, tdist);
 
 	/* Free memory */
 	free(pointlist);
@@ -494,8 +537,71 @@ void _KLTSelectGoodFeatures(
 }
 
 
+/*********************************************************************
+ * _selectGoodFeatures
+ * _replaceLostFeatures
+ */
+
+static void _selectGoodFeatures(
+        KLT_TrackingContext tc,
+        KLT_PixelType *img,
+        int ncols,
+        int nrows,
+        _KLT_FeatureView features)
+{
+	if (tc->verbose >= 1)  {
+		fprintf(stderr,  "(KLT) Selecting the %d best features "
+		        "from a %d by %d image...  ", features->nFeatures, ncols, nrows);
+		fflush(stderr);
+	}
+
+	_KLTSelectGoodFeatures(tc, img, ncols, nrows,
+	                       features, SELECTING_ALL);
+
+	if (tc->verbose >= 1)  {
+		fprintf(stderr,  "\n\t%d features found.\n",
+		        _KLTCountRemainingFeatures(features));
+		if (tc->writeInternalImages)
+			fprintf(stderr,  "\tWrote images to 'kltimg_sgfrlf*.pgm'.\n");
+		fflush(stderr);
+	}
+}
+
+
+static void _replaceLostFeatures(
+        KLT_TrackingContext tc,
+        KLT_PixelType *img,
+        int ncols,
+        int nrows,
+        _KLT_FeatureView features)
+{
+	int nLostFeatures = features->nFeatures - _KLTCountRemainingFeatures(features);
+
+	if (tc->verbose >= 1)  {
+		fprintf(stderr,  "(KLT) Attempting to replace %d features "
+		        "in a %d by %d image...  ", nLostFeatures, ncols, nrows);
+		fflush(stderr);
+	}
+
+	/* If there are any lost features, replace them */
+	if (nLostFeatures > 0)
+		_KLTSelectGoodFeatures(tc, img, ncols, nrows,
+		                       features, REPLACING_SOME);
+
+	if (tc->verbose >= 1)  {
+		fprintf(stderr,  "\n\t%d features replaced.\n",
+		        nLostFeatures - features->nFeatures +
+		        _KLTCountRemainingFeatures(features));
+		if (tc->writeInternalImages)
+			fprintf(stderr,  "\tWrote images to 'kltimg_sgfrlf*.pgm'.\n");
+		fflush(stderr);
+	}
+}
+
+
 /*********************************************************************
  * KLTSelectGoodFeatures
+ * KLTSelectGoodFeatureArrays
  *
  * Main routine, visible to the outside.  Finds the good features in
  * an image.
@@ -517,27 +623,30 @@ void KLTSelectGoodFeatures(
         int nrows,
         KLT_FeatureList fl)
 {
-	if (KLT_verbose >= 1)  {
-		fprintf(stderr,  "(KLT) Selecting the %d best features "
-		        "from a %d by %d image...  ", fl->nFeatures, ncols, nrows);
-		fflush(stderr);
-	}
+	_KLT_FeatureViewRec view;
 
-	_KLTSelectGoodFeatures(tc, img, ncols, nrows,
-	                       fl, SELECTING_ALL);
+	_KLTOpenFeatureListView(fl, &view);
+	_selectGoodFeatures(tc, img, ncols, nrows, &view);
+}
 
-	if (KLT_verbose >= 1)  {
-		fprintf(stderr,  "\n\t%d features found.\n",
-		        KLTCountRemainingFeatures(fl));
-		if (tc->writeInternalImages)
-			fprintf(stderr,  "\tWrote images to 'kltimg_sgfrlf*.pgm'.\n");
-		fflush(stderr);
-	}
+
+void KLTSelectGoodFeatureArrays(
+        KLT_TrackingContext tc,
+        KLT_PixelType *img,
+        int ncols,
+        int nrows,
+        KLT_FeatureArrays fa)
+{
+	_KLT_FeatureViewRec view;
+
+	_KLTViewFeatureArrays(fa, &view);
+	_selectGoodFeatures(tc, img, ncols, nrows, &view);
 }
 
 
 /*********************************************************************
  * KLTReplaceLostFeatures
+ * KLTReplaceLostFeatureArrays
  *
  * Main routine, visible to the outside.  Replaces the lost features
  * in an image.
@@ -559,26 +668,22 @@ void KLTReplaceLostFeatures(
         int nrows,
         KLT_FeatureList fl)
 {
-	int nLostFeatures = fl->nFeatures - KLTCountRemainingFeatures(fl);
+	_KLT_FeatureViewRec view;
 
-	if (KLT_verbose >= 1)  {
-		fprintf(stderr,  "(KLT) Attempting to replace %d features "
-		        "in a %d by %d image...  ", nLostFeatures, ncols, nrows);
-		fflush(stderr);
-	}
-
-	/* If there are any lost features, replace them */
-	if (nLostFeatures > 0)
-		_KLTSelectGoodFeatures(tc, img, ncols, nrows,
-		                       fl, REPLACING_SOME);
-
-	if (KLT_verbose >= 1)  {
-		fprintf(stderr,  "\n\t%d features replaced.\n",
-		        nLostFeatures - fl->nFeatures + KLTCountRemainingFeatures(fl));
-		if (tc->writeInternalImages)
-			fprintf(stderr,  "\tWrote images to 'kltimg_sgfrlf*.pgm'.\n");
-		fflush(stderr);
-	}
+	_KLTOpenFeatureListView(fl, &view);
+	_replaceLostFeatures(tc, img, ncols, nrows, &view);
 }
 
 
+void KLTReplaceLostFeatureArrays(
+        KLT_TrackingContext tc,
+        KLT_PixelType *img,
+        int ncols,
+        int nrows,
+        KLT_FeatureArrays fa)
+{
+	_KLT_FeatureViewRec view;
+
+	_KLTViewFeatureArrays(fa, &view);
+	_replaceLostFeatures(tc, img, ncols, nrows, &view);
+}
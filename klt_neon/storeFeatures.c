@@ -3,17 +3,23 @@
  *
  *********************************************************************/
 
+/* Standard includes */
+#include <stdio.h>		/* fopen(), fwrite() */
+#include <stdlib.h>		/* malloc() */
+
 /* Our includes */
 #include "error.h"
+#include "featureView.h"
 #include "klt.h"
+#include "writeFeatures.h"
 
 
 /*********************************************************************
- *
+ * _storeFeatures
  */
 
-void KLTStoreFeatureList(
-  KLT_FeatureList fl,
+static void _storeFeatures(
+  _KLT_FeatureView view,
   KLT_FeatureTable ft,
   int frame)
 {
@@ -23,18 +29,50 @@ void KLTStoreFeatureList(
     KLTError("(KLTStoreFeatures) Frame number %d is not between 0 and %d",
              frame, ft->nFrames - 1);
 
-  if (fl->nFeatures != ft->nFeatures)
+  if (view->nFeatures != ft->nFeatures)
     KLTError("(KLTStoreFeatures) FeatureList and FeatureTable must "
              "have the same number of features");
 
-  for (feat = 0 ; feat < fl->nFeatures ; feat++)  {
-    ft->feature[feat][frame]->x   = fl->feature[feat]->x;
-    ft->feature[feat][frame]->y   = fl->feature[feat]->y;
-    ft->feature[feat][frame]->val = fl->feature[feat]->val;
+  for (feat = 0 ; feat < view->nFeatures ; feat++)  {
+    ft->feature[feat][frame]->x   = FV_X(view, feat);
+    ft->feature[feat][frame]->y   = FV_Y(view, feat);
+    ft->feature[feat][frame]->val = FV_VAL(view, feat);
   }
 }
 
 
+/*********************************************************************
+ *
+ */
+
+void KLTStoreFeatureList(
+  KLT_FeatureList fl,
+  KLT_FeatureTable ft,
+  int frame)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTOpenFeatureListView(fl, &view);
+  _storeFeatures(&view, ft, frame);
+}
+
+
+/*********************************************************************
+ *
+ */
+
+void KLTStoreFeatureArrays(
+  KLT_FeatureArrays fa,
+  KLT_FeatureTable ft,
+  int frame)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTViewFeatureArrays(fa, &view);
+  _storeFeatures(&view, ft, frame);
+}
+
+
 /*********************************************************************
  *
  */
@@ -115,3 +153,200 @@ void KLTExtractFeatureHistory(
   }
 }
 
+
+
+/*********************************************************************
+ * Feature streams
+ *
+ * The frames kept in memory are stored in a ring of nFrames rows of
+ * (x,y)=val records.  When the ring is full, storing a frame evicts
+ * the oldest one, which is first appended to the file (if any) in
+ * the same format as the binary feature files, so that memory stays
+ * constant however long the sequence is.
+ *
+ * File: "KLTFS1", nFeatures, then nFeatures (x,y)=val records per
+ * frame, in frame order.
+ */
+
+typedef struct  {
+  KLT_locType x;
+  KLT_locType y;
+  int val;
+}  _TrajectoryPoint;
+
+
+static _TrajectoryPoint *_streamRow(
+  KLT_FeatureStream fs,
+  int frame)
+{
+  return (_TrajectoryPoint *) fs->points + (frame % fs->nFrames) * fs->nFeatures;
+}
+
+
+static void _evictFrame(
+  KLT_FeatureStream fs)
+{
+  FILE *fp = (FILE *) fs->fp;
+  _TrajectoryPoint *row = _streamRow(fs, fs->nEvicted);
+  int feat;
+
+  if (fp != NULL)  {
+    for (feat = 0 ; feat < fs->nFeatures ; feat++)
+      if (!_KLTWriteFeatureBin(fp, row[feat].x, row[feat].y, row[feat].val))
+        break;
+    if (feat < fs->nFeatures || fflush(fp) != 0)
+      KLTError("(KLTFeatureStream) Can't append frame %d to file",
+               fs->nEvicted);
+  }
+  fs->nEvicted++;
+}
+
+
+/*********************************************************************
+ * KLTCreateFeatureStream
+ *
+ * fname is the file evicted frames are appended to; if NULL, they
+ * are discarded.
+ */
+
+KLT_FeatureStream KLTCreateFeatureStream(
+  int nFrames,
+  int nFeatures,
+  char *fname)
+{
+  KLT_FeatureStream fs;
+  FILE *fp = NULL;
+
+  if (nFrames < 1)
+    KLTError("(KLTCreateFeatureStream) At least one frame must be kept, not %d",
+             nFrames);
+
+  if (fname != NULL)  {
+    fp = fopen(fname, "wb");
+    if (fp == NULL)
+      KLTError("(KLTCreateFeatureStream) Can't open file '%s' for writing",
+               fname);
+    _KLTWriteFeatureStreamHeader(fp, nFeatures);
+    fflush(fp);
+  }
+
+  fs = (KLT_FeatureStream) malloc(sizeof(KLT_FeatureStreamRec));
+  if (fs == NULL)
+    KLTError("(KLTCreateFeatureStream) Out of memory");
+  fs->nFrames = nFrames;
+  fs->nFeatures = nFeatures;
+  fs->nStored = 0;
+  fs->nEvicted = 0;
+  fs->points = malloc(nFrames * nFeatures * sizeof(_TrajectoryPoint));
+  if (fs->points == NULL)
+    KLTError("(KLTCreateFeatureStream) Out of memory");
+  fs->fp = fp;
+
+  return fs;
+}
+
+
+/*********************************************************************
+ * KLTFreeFeatureStream
+ *
+ * Appends the frames still in memory to the file, and closes it.
+ */
+
+void KLTFreeFeatureStream(
+  KLT_FeatureStream fs)
+{
+  while (fs->nEvicted < fs->nStored)
+    _evictFrame(fs);
+  if (fs->fp != NULL)
+    fclose((FILE *) fs->fp);
+  free(fs->points);
+  free(fs);
+}
+
+
+/*********************************************************************
+ * _appendFeatures
+ */
+
+static void _appendFeatures(
+  _KLT_FeatureView view,
+  KLT_FeatureStream fs)
+{
+  _TrajectoryPoint *row;
+  int feat;
+
+  if (view->nFeatures != fs->nFeatures)
+    KLTError("(KLTAppendFeatures) FeatureList and FeatureStream must "
+             "have the same number of features");
+
+  if (fs->nStored - fs->nEvicted == fs->nFrames)
+    _evictFrame(fs);
+
+  row = _streamRow(fs, fs->nStored);
+  for (feat = 0 ; feat < view->nFeatures ; feat++)  {
+    row[feat].x   = FV_X(view, feat);
+    row[feat].y   = FV_Y(view, feat);
+    row[feat].val = FV_VAL(view, feat);
+  }
+  fs->nStored++;
+}
+
+
+/*********************************************************************
+ * KLTAppendFeatureList
+ * KLTAppendFeatureArrays
+ *
+ * Stores the features as frame number fs->nStored.
+ */
+
+void KLTAppendFeatureList(
+  KLT_FeatureList fl,
+  KLT_FeatureStream fs)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTOpenFeatureListView(fl, &view);
+  _appendFeatures(&view, fs);
+}
+
+
+void KLTAppendFeatureArrays(
+  KLT_FeatureArrays fa,
+  KLT_FeatureStream fs)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTViewFeatureArrays(fa, &view);
+  _appendFeatures(&view, fs);
+}
+
+
+/*********************************************************************
+ * KLTExtractStreamedFeatureList
+ *
+ * Only the frames still in memory can be extracted.
+ */
+
+void KLTExtractStreamedFeatureList(
+  KLT_FeatureList fl,
+  KLT_FeatureStream fs,
+  int frame)
+{
+  _TrajectoryPoint *row;
+  int feat;
+
+  if (frame < fs->nEvicted || frame >= fs->nStored)
+    KLTError("(KLTExtractStreamedFeatureList) Frame number %d is not between "
+             "%d and %d", frame, fs->nEvicted, fs->nStored - 1);
+
+  if (fl->nFeatures != fs->nFeatures)
+    KLTError("(KLTExtractStreamedFeatureList) FeatureList and FeatureStream "
+             "must have the same number of features");
+
+  row = _streamRow(fs, frame);
+  for (feat = 0 ; feat < fl->nFeatures ; feat++)  {
+    fl->feature[feat]->x   = row[feat].x;
+    fl->feature[feat]->y   = row[feat].y;
+    fl->feature[feat]->val = row[feat].val;
+  }
+}
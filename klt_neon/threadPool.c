@@ -0,0 +1,333 @@
+/*********************************************************************
+ * threadPool.c
+ *
+ * Fixed-size pool of worker threads executing parallel loops.  Each
+ * thread owns a range of the loop indices, from which it takes small
+ * chunks; a thread whose range runs dry steals half of the remaining
+ * range of another thread.  Work whose cost varies strongly from
+ * index to index (e.g., features that are lost at once versus those
+ * that iterate at every pyramid level) is therefore balanced without
+ * any static partitioning.
+ *********************************************************************/
+
+/* Standard includes */
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>   /* malloc() */
+#include <unistd.h>   /* sysconf() */
+
+/* Our includes */
+#include "error.h"
+#include "klt.h"
+#include "threadPool.h"
+
+
+typedef struct  {
+  pthread_mutex_t lock;
+  int begin;               /* next index to be processed */
+  int end;                 /* one past the last index */
+}  _WorkRange;
+
+typedef struct  {
+  _KLT_ThreadPool pool;
+  int index;
+}  _WorkerArg;
+
+struct _KLT_ThreadPoolRec  {
+  int nThreads;            /* including the calling thread */
+  pthread_t *threads;
+  _WorkerArg *args;
+  _WorkRange *ranges;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;     /* signalled when a new loop is posted */
+  pthread_cond_t done;     /* signalled when the last worker finishes */
+  unsigned int generation; /* incremented for every loop */
+  int nBusy;               /* # of workers still inside the current loop */
+  KLT_BOOL shutdown;
+
+  /* Current loop */
+  _KLT_RangeFunc func;
+  void *arg;
+  int grain;
+};
+
+
+/*********************************************************************
+ * _takeLocal
+ *
+ * Takes the next chunk of at most 'grain' indices from the front of
+ * the thread's own range.
+ */
+
+static KLT_BOOL _takeLocal(
+  _KLT_ThreadPool pool,
+  int self,
+  int *begin,
+  int *end)
+{
+  _WorkRange *r = pool->ranges + self;
+  KLT_BOOL found = FALSE;
+
+  pthread_mutex_lock(&r->lock);
+  if (r->begin < r->end)  {
+    *begin = r->begin;
+    *end = (r->end - r->begin > pool->grain) ? r->begin + pool->grain : r->end;
+    r->begin = *end;
+    found = TRUE;
+  }
+  pthread_mutex_unlock(&r->lock);
+
+  return found;
+}
+
+
+/*********************************************************************
+ * _steal
+ *
+ * Takes the back half of the first non-empty range found among the
+ * other threads.  The first chunk is returned; the rest becomes the
+ * thread's own range, so that it can in turn be stolen from.  Locks
+ * are never nested.
+ */
+
+static KLT_BOOL _steal(
+  _KLT_ThreadPool pool,
+  int self,
+  int *begin,
+  int *end)
+{
+  int nThreads = pool->nThreads;
+  int k;
+
+  for (k = 1 ; k < nThreads ; k++)  {
+    _WorkRange *victim = pool->ranges + (self + k) % nThreads;
+    int sbegin = 0, send = 0;
+
+    pthread_mutex_lock(&victim->lock);
+    if (victim->begin < victim->end)  {
+      send = victim->end;
+      sbegin = send - (send - victim->begin + 1) / 2;
+      victim->end = sbegin;
+    }
+    pthread_mutex_unlock(&victim->lock);
+
+    if (sbegin < send)  {
+      _WorkRange *own = pool->ranges + self;
+      *begin = sbegin;
+      *end = (send - sbegin > pool->grain) ? sbegin + pool->grain : send;
+      pthread_mutex_lock(&own->lock);
+      own->begin = *end;
+      own->end = send;
+      pthread_mutex_unlock(&own->lock);
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+
+/*********************************************************************
+ * _runLoop
+ *
+ * Executes chunks of the current loop until no work can be found.
+ */
+
+static void _runLoop(
+  _KLT_ThreadPool pool,
+  int self)
+{
+  int begin, end;
+
+  while (_takeLocal(pool, self, &begin, &end) ||
+         _steal(pool, self, &begin, &end))
+    pool->func(pool->arg, begin, end, self);
+}
+
+
+/*********************************************************************
+ * _workerMain
+ */
+
+static void *_workerMain(
+  void *p)
+{
+  _WorkerArg *warg = (_WorkerArg *) p;
+  _KLT_ThreadPool pool = warg->pool;
+  unsigned int seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;)  {
+    while (!pool->shutdown && pool->generation == seen)
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    if (pool->shutdown)  break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    _runLoop(pool, warg->index);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->nBusy == 0)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+
+/*********************************************************************
+ * _KLTNumberOfCores
+ */
+
+int _KLTNumberOfCores(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n < 1) ? 1 : (int) n;
+}
+
+
+/*********************************************************************
+ * _KLTCreateThreadPool
+ *
+ * Creates a pool that runs loops on nThreads threads: the calling
+ * thread plus (nThreads-1) workers.
+ */
+
+_KLT_ThreadPool _KLTCreateThreadPool(
+  int nThreads)
+{
+  _KLT_ThreadPool pool;
+  int i;
+
+  if (nThreads < 1)  nThreads = 1;
+
+  pool = (_KLT_ThreadPool) malloc(sizeof(struct _KLT_ThreadPoolRec));
+  if (pool == NULL)
+    KLTError("(_KLTCreateThreadPool) Out of memory");
+  pool->nThreads = nThreads;
+  pool->threads = (pthread_t *) malloc(nThreads * sizeof(pthread_t));
+  pool->args = (_WorkerArg *) malloc(nThreads * sizeof(_WorkerArg));
+  pool->ranges = (_WorkRange *) malloc(nThreads * sizeof(_WorkRange));
+  if (pool->threads == NULL || pool->args == NULL || pool->ranges == NULL)
+    KLTError("(_KLTCreateThreadPool) Out of memory");
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->generation = 0;
+  pool->nBusy = 0;
+  pool->shutdown = FALSE;
+  pool->func = NULL;
+  pool->arg = NULL;
+  pool->grain = 1;
+
+  for (i = 0 ; i < nThreads ; i++)  {
+    pthread_mutex_init(&pool->ranges[i].lock, NULL);
+    pool->ranges[i].begin = pool->ranges[i].end = 0;
+    pool->args[i].pool = pool;
+    pool->args[i].index = i;
+  }
+
+  /* Thread 0 is the caller of _KLTParallelFor */
+  for (i = 1 ; i < nThreads ; i++)
+    if (pthread_create(&pool->threads[i], NULL, _workerMain, &pool->args[i]))
+      KLTError("(_KLTCreateThreadPool) Unable to create thread %d", i);
+
+  return pool;
+}
+
+
+/*********************************************************************
+ * _KLTFreeThreadPool
+ */
+
+void _KLTFreeThreadPool(
+  _KLT_ThreadPool pool)
+{
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = TRUE;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 1 ; i < pool->nThreads ; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  for (i = 0 ; i < pool->nThreads ; i++)
+    pthread_mutex_destroy(&pool->ranges[i].lock);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->wake);
+  pthread_cond_destroy(&pool->done);
+
+  free(pool->ranges);
+  free(pool->args);
+  free(pool->threads);
+  free(pool);
+}
+
+
+/*********************************************************************
+ * _KLTThreadPoolSize
+ */
+
+int _KLTThreadPoolSize(
+  _KLT_ThreadPool pool)
+{
+  return (pool == NULL) ? 1 : pool->nThreads;
+}
+
+
+/*********************************************************************
+ * _KLTParallelFor
+ *
+ * Calls func on chunks of [0, n) of at most 'grain' indices, on all
+ * threads of the pool, and returns once every index has been
+ * processed.  Each index is processed exactly once, so results that
+ * are written per index do not depend on the scheduling.  With a
+ * NULL pool the whole range is processed by the calling thread.
+ */
+
+void _KLTParallelFor(
+  _KLT_ThreadPool pool,
+  int n,
+  int grain,
+  _KLT_RangeFunc func,
+  void *arg)
+{
+  int nThreads = _KLTThreadPoolSize(pool);
+  int i;
+
+  if (n <= 0)  return;
+  if (grain < 1)  grain = 1;
+
+  if (nThreads == 1 || n <= grain)  {
+    func(arg, 0, n, 0);
+    return;
+  }
+
+  /* Hand every thread an equal share to start from; no worker */
+  /* touches the ranges between two loops */
+  for (i = 0 ; i < nThreads ; i++)  {
+    pool->ranges[i].begin = (int) ((long) n * i / nThreads);
+    pool->ranges[i].end = (int) ((long) n * (i+1) / nThreads);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->func = func;
+  pool->arg = arg;
+  pool->grain = grain;
+  pool->nBusy = nThreads - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  _runLoop(pool, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->nBusy > 0)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
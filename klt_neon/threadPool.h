@@ -0,0 +1,37 @@
+/*********************************************************************
+ * threadPool.h
+ *********************************************************************/
+
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+/* Called by _KLTParallelFor for each chunk [begin, end) of the index */
+/* range; thread is in [0, _KLTThreadPoolSize(pool)) and may be used  */
+/* to select per-thread scratch memory                                 */
+typedef void (*_KLT_RangeFunc)(
+  void *arg,
+  int begin,
+  int end,
+  int thread);
+
+typedef struct _KLT_ThreadPoolRec *_KLT_ThreadPool;
+
+_KLT_ThreadPool _KLTCreateThreadPool(
+  int nThreads);
+
+void _KLTFreeThreadPool(
+  _KLT_ThreadPool pool);
+
+int _KLTThreadPoolSize(
+  _KLT_ThreadPool pool);
+
+int _KLTNumberOfCores(void);
+
+void _KLTParallelFor(
+  _KLT_ThreadPool pool,
+  int n,
+  int grain,
+  _KLT_RangeFunc func,
+  void *arg);
+
+#endif
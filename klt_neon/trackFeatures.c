@@ -5,6 +5,7 @@
 
 /* Standard includes */
 #include <assert.h>
+#include <float.h>              /* FLT_EPSILON */
 #include <math.h>               /* fabs() */
 #include <stdlib.h>             /* malloc() */
 #include <stdio.h>              /* fflush() */
@@ -14,11 +15,13 @@
 #include "base.h"
 #include "error.h"
 #include "convolve.h"   /* for computing pyramid */
+#include "featureView.h"
 #include "klt.h"
 #include "klt_util.h"   /* _KLT_FloatImage */
+#include "prepareFrame.h" /* _KLTTakePreparedFrame() */
+#include "profile.h"    /* _KLT_PROFILE_START() */
 #include "pyramid.h"    /* _KLT_Pyramid */
-
-extern int KLT_verbose;
+#include "threadPool.h" /* _KLTParallelFor() */
 
 typedef float *_FloatWindow;
 
@@ -38,9 +41,18 @@ inline static float _interpolate(
 	int yt = (int) y;
 	float ax = x - xt;
 	float ay = y - yt;
-	float *ptr = img->data + (img->ncols * yt) + xt;
+	float *ptr;
     float axay = ax * ay;
 
+    if (img->half)  {
+        const _KLT_Half *h = img->half + (img->ncols * yt) + xt;
+        return (1 - ay - ax + axay) * _KLTHalfToFloat(h[0]) +
+               (ax - axay) * _KLTHalfToFloat(h[1]) +
+               (ay - axay) * _KLTHalfToFloat(h[img->ncols]) +
+               axay * _KLTHalfToFloat(h[img->ncols + 1]);
+    }
+    ptr = img->data + (img->ncols * yt) + xt;
+
 // #ifndef _DNDEBUG
 //  if (xt < 0 || yt < 0 || xt >= img->ncols - 1 || yt >= img->nrows - 1) {
 //      fprintf(stderr, "(xt,yt)=(%d,%d)  imgsize=(%d,%d)\n"
@@ -157,101 +169,380 @@ inline static void _computeGradientSum(
 }
 
 /*********************************************************************
- * _computeIntensityDifferenceLightingInsensitive
+ * _WindowSampler
  *
- * Given two images and the window center in both images,
- * aligns the images wrt the window and computes the difference
- * between the two overlaid images; normalizes for overall gain and bias.
+ * Bilinear sampling of a window centred at a fractional location.
+ * The weights of the four neighbours are the same for every pixel of
+ * the window, so they are computed once, and each row of the window
+ * is interpolated four pixels at a time.  Images stored as bfloat16
+ * (half is TRUE) are widened to float as they are loaded; half is a
+ * constant in every instantiation of the window kernels (see
+ * _WindowKernels), so the loads do not test it.
  */
 
-static void _computeIntensityDifferenceLightingInsensitive(
+typedef struct  {
+	int offset;                 /* of the upper-left pixel of the window */
+	float w00, w01, w10, w11;   /* weights of the four neighbours */
+}  _WindowSampler;
+
+inline static void _setupWindowSampler(
+        float x, float y,       /* center of window */
+        int hw, int hh,
+        _KLT_FloatImage img,    /* one of the images to be sampled */
+        _WindowSampler *s)      /* output */
+{
+	int ncols = img->ncols;
+	int xt = (int) x;  /* coordinates of top-left corner */
+	int yt = (int) y;
+	float ax = x - xt;
+	float ay = y - yt;
+	float axay = ax * ay;
+
+	s->offset = ncols * (yt - hh) + (xt - hw);
+	s->w00 = 1 - ay - ax + axay;
+	s->w01 = ax - axay;
+	s->w10 = ay - axay;
+	s->w11 = axay;
+}
+
+inline static const void *_windowRow(
+        _KLT_FloatImage img,
+        int offset,
+        int half)
+{
+	return half ? (const void *) (img->half + offset)
+	            : (const void *) (img->data + offset);
+}
+
+inline static float32x4_t _load4(
+        const void *row,
+        int i,
+        int half)
+{
+	/* A bfloat16 is widened by shifting it into the upper half */
+	if (half)
+		return vreinterpretq_f32_u32(vshll_n_u16(vld1_u16((const _KLT_Half *) row + i), 16));
+	return vld1q_f32((const float *) row + i);
+}
+
+inline static float _load1(
+        const void *row,
+        int i,
+        int half)
+{
+	return half ? _KLTHalfToFloat(((const _KLT_Half *) row)[i])
+	            : ((const float *) row)[i];
+}
+
+inline static float32x4_t _sampleWindow4(
+        const void *row,        /* row of the upper-left neighbours */
+        int i,                  /* of the first pixel */
+        int ncols,
+        const _WindowSampler *s,
+        int half)
+{
+	float32x4_t val = vmulq_n_f32(_load4(row, i, half), s->w00);
+	val = vmlaq_n_f32(val, _load4(row, i + 1, half), s->w01);
+	val = vmlaq_n_f32(val, _load4(row, i + ncols, half), s->w10);
+	val = vmlaq_n_f32(val, _load4(row, i + ncols + 1, half), s->w11);
+	return val;
+}
+
+inline static float _sampleWindow1(
+        const void *row,
+        int i,
+        int ncols,
+        const _WindowSampler *s,
+        int half)
+{
+	return s->w00 * _load1(row, i, half) + s->w01 * _load1(row, i + 1, half) +
+	       s->w10 * _load1(row, i + ncols, half) + s->w11 * _load1(row, i + ncols + 1, half);
+}
+
+inline static float _addLanes(
+        float32x4_t v)
+{
+	float32x2_t sum = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+	return vget_lane_f32(vpadd_f32(sum, sum), 0);
+}
+
+
+/*********************************************************************
+ * _computeWindowsLightingInsensitive
+ *
+ * Given the images, their gradients and the window center in both
+ * images, computes the difference between the two overlaid images
+ * and, if gradients is TRUE, the sum of the two overlaid gradients;
+ * both are normalized for overall gain and bias.  Each image window
+ * is sampled only once: the first pass caches the samples (in imgdiff
+ * and grady) while accumulating their sums and sums of squares, the
+ * second pass produces the output windows from the cache.  When
+ * gradients is FALSE, gradx and grady are used as scratch.
+ *
+ * As in the original algorithm, the gain of the intensity difference
+ * is the square root of the ratio of the mean squares, while that of
+ * the gradient sum is the square root of the ratio of the means.
+ */
+
+__attribute__((always_inline)) inline static void _computeWindowsLightingInsensitive(
         _KLT_FloatImage img1,   /* images */
         _KLT_FloatImage img2,
+        _KLT_FloatImage gradx1, /* gradient images */
+        _KLT_FloatImage grady1,
+        _KLT_FloatImage gradx2,
+        _KLT_FloatImage grady2,
         float x1, float y1,     /* center of window in 1st img */
         float x2, float y2,     /* center of window in 2nd img */
         int width, int height,  /* size of window */
-        _FloatWindow imgdiff)   /* output */
+        KLT_BOOL gradients,     /* whether to compute gradx and grady */
+        _FloatWindow imgdiff,   /* output */
+        _FloatWindow gradx,     /*   " */
+        _FloatWindow grady,     /*   " */
+        int half)               /* whether the images are bfloat16 */
 {
-	register int hw = width / 2, hh = height / 2;
-	float g1, g2, sum1_squared = 0, sum2_squared = 0;
-	register int i, j;
-
-	float sum1 = 0, sum2 = 0;
-	float mean1, mean2, alpha, belta;
-	/* Compute values */
-	for (j = -hh ; j <= hh ; j++)
-		for (i = -hw ; i <= hw ; i++)  {
-			g1 = _interpolate(x1 + i, y1 + j, img1);
-			g2 = _interpolate(x2 + i, y2 + j, img2);
+	int hw = width / 2, hh = height / 2;
+	int nc1 = img1->ncols, nc2 = img2->ncols;
+	float *cache1 = imgdiff, *cache2 = grady;
+	_WindowSampler s1, s2;
+	float32x4_t vsum1, vsum2, vsum1_squared, vsum2_squared;
+	float32x4_t valpha, vbelta, valpha_grad;
+	float sum1 = 0, sum2 = 0, sum1_squared = 0, sum2_squared = 0;
+	float mean1, mean2, alpha, belta, alpha_grad;
+	float g1, g2;
+	int i, j, k;
+
+	_setupWindowSampler(x1, y1, hw, hh, img1, &s1);
+	_setupWindowSampler(x2, y2, hw, hh, img2, &s2);
+
+	/* Sample both windows, accumulating sums and sums of squares */
+	vsum1 = vsum2 = vsum1_squared = vsum2_squared = vdupq_n_f32(0.0f);
+	for (j = 0, k = 0 ; j < height ; j++)  {
+		const void *p1 = _windowRow(img1, s1.offset + j * nc1, half);
+		const void *p2 = _windowRow(img2, s2.offset + j * nc2, half);
+		for (i = 0 ; i + 4 <= width ; i += 4, k += 4)  {
+			float32x4_t v1 = _sampleWindow4(p1, i, nc1, &s1, half);
+			float32x4_t v2 = _sampleWindow4(p2, i, nc2, &s2, half);
+			vst1q_f32(cache1 + k, v1);
+			vst1q_f32(cache2 + k, v2);
+			vsum1 = vaddq_f32(vsum1, v1);
+			vsum2 = vaddq_f32(vsum2, v2);
+			vsum1_squared = vmlaq_f32(vsum1_squared, v1, v1);
+			vsum2_squared = vmlaq_f32(vsum2_squared, v2, v2);
+		}
+		for ( ; i < width ; i++, k++)  {
+			g1 = cache1[k] = _sampleWindow1(p1, i, nc1, &s1, half);
+			g2 = cache2[k] = _sampleWindow1(p2, i, nc2, &s2, half);
 			sum1 += g1;    sum2 += g2;
 			sum1_squared += g1 * g1;
 			sum2_squared += g2 * g2;
 		}
+	}
+	sum1 += _addLanes(vsum1);
+	sum2 += _addLanes(vsum2);
+	sum1_squared += _addLanes(vsum1_squared);
+	sum2_squared += _addLanes(vsum2_squared);
+
 	mean1 = sum1_squared / (width * height);
 	mean2 = sum2_squared / (width * height);
 	alpha = (float) sqrt(mean1 / mean2);
 	mean1 = sum1 / (width * height);
 	mean2 = sum2 / (width * height);
 	belta = mean1 - alpha * mean2;
-
-	for (j = -hh ; j <= hh ; j++)
-		for (i = -hw ; i <= hw ; i++)  {
-			g1 = _interpolate(x1 + i, y1 + j, img1);
-			g2 = _interpolate(x2 + i, y2 + j, img2);
-			*imgdiff++ = g1 - g2 * alpha - belta;
+	alpha_grad = (float) sqrt(mean1 / mean2);
+
+	/* Compute values from the cached samples */
+	valpha = vdupq_n_f32(alpha);
+	vbelta = vdupq_n_f32(belta);
+	valpha_grad = vdupq_n_f32(alpha_grad);
+	for (j = 0, k = 0 ; j < height ; j++)  {
+		const void *px1 = _windowRow(gradx1, s1.offset + j * nc1, half);
+		const void *py1 = _windowRow(grady1, s1.offset + j * nc1, half);
+		const void *px2 = _windowRow(gradx2, s2.offset + j * nc2, half);
+		const void *py2 = _windowRow(grady2, s2.offset + j * nc2, half);
+		for (i = 0 ; i + 4 <= width ; i += 4, k += 4)  {
+			float32x4_t v1 = vld1q_f32(cache1 + k);
+			float32x4_t v2 = vld1q_f32(cache2 + k);
+			vst1q_f32(imgdiff + k, vsubq_f32(vmlsq_f32(v1, v2, valpha), vbelta));
+			if (gradients)  {
+				vst1q_f32(gradx + k, vmlaq_f32(_sampleWindow4(px1, i, nc1, &s1, half),
+				                               _sampleWindow4(px2, i, nc2, &s2, half), valpha_grad));
+				vst1q_f32(grady + k, vmlaq_f32(_sampleWindow4(py1, i, nc1, &s1, half),
+				                               _sampleWindow4(py2, i, nc2, &s2, half), valpha_grad));
+			}
 		}
+		for ( ; i < width ; i++, k++)  {
+			g1 = cache1[k];
+			g2 = cache2[k];
+			imgdiff[k] = g1 - g2 * alpha - belta;
+			if (gradients)  {
+				gradx[k] = _sampleWindow1(px1, i, nc1, &s1, half) +
+				           _sampleWindow1(px2, i, nc2, &s2, half) * alpha_grad;
+				grady[k] = _sampleWindow1(py1, i, nc1, &s1, half) +
+				           _sampleWindow1(py2, i, nc2, &s2, half) * alpha_grad;
+			}
+		}
+	}
 }
 
 
 /*********************************************************************
- * _computeGradientSumLightingInsensitive
+ * _accumulateWindows
  *
- * Given two gradients and the window center in both images,
- * aligns the gradients wrt the window and computes the sum of the two
- * overlaid gradients; normalizes for overall gain and bias.
+ * Fused counterpart of _computeIntensityDifference,
+ * _computeGradientSum, _compute2by2GradientMatrix and
+ * _compute2by1ErrorVector: samples the image and gradient windows
+ * four pixels at a time and accumulates gxx, gxy, gyy, ex and ey in
+ * registers, without writing any window to memory.  The error vector
+ * is not yet scaled by the step factor.  The sum of absolute
+ * differences is accumulated as well, for _trackFeature to reuse as
+ * the residue of the last iteration.
+ *
+ * With ACCUMULATE_RESIDUE only the two image windows are sampled, and
+ * the sum of absolute differences is returned in sums[0].
  */
 
-static void _computeGradientSumLightingInsensitive(
-        _KLT_FloatImage gradx1,  /* gradient images */
+#define ACCUMULATE_SYSTEM    0   /* sums = {gxx, gxy, gyy, ex, ey, sum of |imgdiff|} */
+#define ACCUMULATE_RESIDUE   1   /* sums = {sum of |imgdiff|} */
+
+__attribute__((always_inline)) inline static void _accumulateWindows(
+        _KLT_FloatImage img1,   /* images */
+        _KLT_FloatImage img2,
+        _KLT_FloatImage gradx1, /* gradient images */
         _KLT_FloatImage grady1,
         _KLT_FloatImage gradx2,
         _KLT_FloatImage grady2,
-        _KLT_FloatImage img1,   /* images */
-        _KLT_FloatImage img2,
-
-        float x1, float y1,      /* center of window in 1st img */
-        float x2, float y2,      /* center of window in 2nd img */
-        int width, int height,   /* size of window */
-        _FloatWindow gradx,      /* output */
-        _FloatWindow grady)      /*   " */
+        float x1, float y1,     /* center of window in 1st img */
+        float x2, float y2,     /* center of window in 2nd img */
+        int width, int height,  /* size of window */
+        int mode,
+        float *sums,            /* return values */
+        int half)               /* whether the images are bfloat16 */
 {
-	register int hw = width / 2, hh = height / 2;
-	float g1, g2, sum1_squared = 0, sum2_squared = 0;
-	register int i, j;
-
-	float mean1, mean2, alpha;
-	for (j = -hh ; j <= hh ; j++)
-		for (i = -hw ; i <= hw ; i++)  {
-			g1 = _interpolate(x1 + i, y1 + j, img1);
-			g2 = _interpolate(x2 + i, y2 + j, img2);
-			sum1_squared += g1;    sum2_squared += g2;
+	int hw = width / 2, hh = height / 2;
+	int nc1 = img1->ncols, nc2 = img2->ncols;
+	_WindowSampler s1, s2;
+	float32x4_t vgxx, vgxy, vgyy, vex, vey, vsad;
+	float gxx = 0, gxy = 0, gyy = 0, ex = 0, ey = 0, sad = 0;
+	int i, j;
+
+	_setupWindowSampler(x1, y1, hw, hh, img1, &s1);
+	_setupWindowSampler(x2, y2, hw, hh, img2, &s2);
+	vgxx = vgxy = vgyy = vex = vey = vsad = vdupq_n_f32(0.0f);
+
+	if (mode == ACCUMULATE_RESIDUE)  {
+		for (j = 0 ; j < height ; j++)  {
+			const void *p1 = _windowRow(img1, s1.offset + j * nc1, half);
+			const void *p2 = _windowRow(img2, s2.offset + j * nc2, half);
+			for (i = 0 ; i + 4 <= width ; i += 4)
+				vex = vaddq_f32(vex, vabsq_f32(vsubq_f32(_sampleWindow4(p1, i, nc1, &s1, half),
+				                                         _sampleWindow4(p2, i, nc2, &s2, half))));
+			for ( ; i < width ; i++)
+				ex += (float) fabs(_sampleWindow1(p1, i, nc1, &s1, half) -
+				                   _sampleWindow1(p2, i, nc2, &s2, half));
 		}
-	mean1 = sum1_squared / (width * height);
-	mean2 = sum2_squared / (width * height);
-	alpha = (float) sqrt(mean1 / mean2);
+		sums[0] = ex + _addLanes(vex);
+		return;
+	}
 
-	/* Compute values */
-	for (j = -hh ; j <= hh ; j++)
-		for (i = -hw ; i <= hw ; i++)  {
-			g1 = _interpolate(x1 + i, y1 + j, gradx1);
-			g2 = _interpolate(x2 + i, y2 + j, gradx2);
-			*gradx++ = g1 + g2 * alpha;
-			g1 = _interpolate(x1 + i, y1 + j, grady1);
-			g2 = _interpolate(x2 + i, y2 + j, grady2);
-			*grady++ = g1 + g2 * alpha;
+	for (j = 0 ; j < height ; j++)  {
+		const void *p1 = _windowRow(img1, s1.offset + j * nc1, half);
+		const void *p2 = _windowRow(img2, s2.offset + j * nc2, half);
+		const void *px1 = _windowRow(gradx1, s1.offset + j * nc1, half);
+		const void *py1 = _windowRow(grady1, s1.offset + j * nc1, half);
+		const void *px2 = _windowRow(gradx2, s2.offset + j * nc2, half);
+		const void *py2 = _windowRow(grady2, s2.offset + j * nc2, half);
+		for (i = 0 ; i + 4 <= width ; i += 4)  {
+			float32x4_t diff = vsubq_f32(_sampleWindow4(p1, i, nc1, &s1, half),
+			                             _sampleWindow4(p2, i, nc2, &s2, half));
+			float32x4_t gx = vaddq_f32(_sampleWindow4(px1, i, nc1, &s1, half),
+			                           _sampleWindow4(px2, i, nc2, &s2, half));
+			float32x4_t gy = vaddq_f32(_sampleWindow4(py1, i, nc1, &s1, half),
+			                           _sampleWindow4(py2, i, nc2, &s2, half));
+			vgxx = vmlaq_f32(vgxx, gx, gx);
+			vgxy = vmlaq_f32(vgxy, gx, gy);
+			vgyy = vmlaq_f32(vgyy, gy, gy);
+			vex = vmlaq_f32(vex, diff, gx);
+			vey = vmlaq_f32(vey, diff, gy);
+			vsad = vaddq_f32(vsad, vabsq_f32(diff));
 		}
+		for ( ; i < width ; i++)  {
+			float diff = _sampleWindow1(p1, i, nc1, &s1, half) -
+			             _sampleWindow1(p2, i, nc2, &s2, half);
+			float gx = _sampleWindow1(px1, i, nc1, &s1, half) +
+			           _sampleWindow1(px2, i, nc2, &s2, half);
+			float gy = _sampleWindow1(py1, i, nc1, &s1, half) +
+			           _sampleWindow1(py2, i, nc2, &s2, half);
+			gxx += gx * gx;
+			gxy += gx * gy;
+			gyy += gy * gy;
+			ex += diff * gx;
+			ey += diff * gy;
+			sad += (float) fabs(diff);
+		}
+	}
+
+	sums[0] = gxx + _addLanes(vgxx);
+	sums[1] = gxy + _addLanes(vgxy);
+	sums[2] = gyy + _addLanes(vgyy);
+	sums[3] = ex + _addLanes(vex);
+	sums[4] = ey + _addLanes(vey);
+	sums[5] = sad + _addLanes(vsad);
 }
 
+
+/*********************************************************************
+ * Float and bfloat16 instantiations of the window kernels
+ */
+
+static void _computeWindowsLightingInsensitiveFloat(
+        _KLT_FloatImage img1, _KLT_FloatImage img2,
+        _KLT_FloatImage gradx1, _KLT_FloatImage grady1,
+        _KLT_FloatImage gradx2, _KLT_FloatImage grady2,
+        float x1, float y1, float x2, float y2,
+        int width, int height, KLT_BOOL gradients,
+        _FloatWindow imgdiff, _FloatWindow gradx, _FloatWindow grady)
+{
+	_computeWindowsLightingInsensitive(img1, img2, gradx1, grady1, gradx2, grady2,
+	                                   x1, y1, x2, y2, width, height, gradients,
+	                                   imgdiff, gradx, grady, FALSE);
+}
+
+static void _computeWindowsLightingInsensitiveHalf(
+        _KLT_FloatImage img1, _KLT_FloatImage img2,
+        _KLT_FloatImage gradx1, _KLT_FloatImage grady1,
+        _KLT_FloatImage gradx2, _KLT_FloatImage grady2,
+        float x1, float y1, float x2, float y2,
+        int width, int height, KLT_BOOL gradients,
+        _FloatWindow imgdiff, _FloatWindow gradx, _FloatWindow grady)
+{
+	_computeWindowsLightingInsensitive(img1, img2, gradx1, grady1, gradx2, grady2,
+	                                   x1, y1, x2, y2, width, height, gradients,
+	                                   imgdiff, gradx, grady, TRUE);
+}
+
+static void _accumulateWindowsFloat(
+        _KLT_FloatImage img1, _KLT_FloatImage img2,
+        _KLT_FloatImage gradx1, _KLT_FloatImage grady1,
+        _KLT_FloatImage gradx2, _KLT_FloatImage grady2,
+        float x1, float y1, float x2, float y2,
+        int width, int height, int mode, float *sums)
+{
+	_accumulateWindows(img1, img2, gradx1, grady1, gradx2, grady2,
+	                   x1, y1, x2, y2, width, height, mode, sums, FALSE);
+}
+
+static void _accumulateWindowsHalf(
+        _KLT_FloatImage img1, _KLT_FloatImage img2,
+        _KLT_FloatImage gradx1, _KLT_FloatImage grady1,
+        _KLT_FloatImage gradx2, _KLT_FloatImage grady2,
+        float x1, float y1, float x2, float y2,
+        int width, int height, int mode, float *sums)
+{
+	_accumulateWindows(img1, img2, gradx1, grady1, gradx2, grady2,
+	                   x1, y1, x2, y2, width, height, mode, sums, TRUE);
+}
+
+
 /*********************************************************************
  * _compute2by2GradientMatrix
  *
@@ -400,6 +691,110 @@ static float _sumAbsFloatWindow(
 }
 
 
+/*********************************************************************
+ * _residueChangeEstimate
+ *
+ * Estimates the change of the sum of absolute differences of a window
+ * of n pixels when the window in the second image moves by (dx,dy).
+ * To first order the change is at most sum |g.d| <= sqrt(n d'Gd),
+ * where G is the gradient matrix of the window (its gradients are
+ * summed over both images, hence the factor 1/2).  This is not a
+ * bound: the gradients at the new location differ from those at the
+ * old one, by an amount that grows with the step.  Callers therefore
+ * only trust it for steps below the convergence threshold, and with a
+ * margin of RESIDUE_ESTIMATE_MARGIN.
+ */
+
+#define RESIDUE_ESTIMATE_MARGIN  2.0f
+
+static float _residueChangeEstimate(
+        float gxx, float gxy, float gyy,
+        float dx, float dy,
+        int n)
+{
+	float q = dx * dx * gxx + 2 * dx * dy * gxy + dy * dy * gyy;
+
+	return 0.5f * (float) sqrt(n * max(q, 0.0f));
+}
+
+
+/*********************************************************************
+ * _SearchBox
+ *
+ * Region of the second image that a window must stay in while it is
+ * tracked: the whole image, or with roiPyramids the part of the
+ * pyramid level that has been computed around the feature.  A window
+ * that leaves it is out of bounds.
+ */
+
+typedef struct  {
+	float x0, y0, x1, y1;
+}  _SearchBox;
+
+
+/*********************************************************************
+ * _TileFetch
+ *
+ * With lazyGradients, the tiles of the pyramids, and of their
+ * gradients, are computed when a window first reads them.
+ */
+
+typedef struct  {
+	_KLT_TileBuilder tiles1, tiles2;   /* of the first and second images */
+	int level;
+	_KLT_ProfileTimes *times;          /* of the job */
+}  _TileFetch;
+
+inline static void _fetchWindow(
+        const _TileFetch *fetch,
+        _KLT_TileBuilder tiles,     /* fetch->tiles1 or fetch->tiles2 */
+        float x, float y,       /* center of window, inside the level */
+        int hw, int hh)
+{
+	int xt = (int) x;
+	int yt = (int) y;
+
+	/* The window, and the neighbours it is interpolated from; the */
+	/* time spent computing tiles counts as gradients, not tracking */
+	_KLT_PROFILE_START(tfetch);
+	_KLTFetchTiles(tiles, fetch->level, xt - hw, yt - hh, xt + hw + 2, yt + hh + 2);
+	_KLT_PROFILE_MOVE(fetch->times, _KLT_PROFILE_LEVEL(fetch->level),
+	                  KLT_STAGE_GRADIENTS, tfetch);
+}
+
+
+/*********************************************************************
+ * _WindowKernels
+ *
+ * The kernels that sample the windows, in the instantiation for the
+ * precision of the pyramids (_floatKernels or _halfKernels, chosen
+ * once per call to _trackFeatures).
+ */
+
+typedef struct  {
+	void (*computeWindowsLightingInsensitive)(
+	        _KLT_FloatImage img1, _KLT_FloatImage img2,
+	        _KLT_FloatImage gradx1, _KLT_FloatImage grady1,
+	        _KLT_FloatImage gradx2, _KLT_FloatImage grady2,
+	        float x1, float y1, float x2, float y2,
+	        int width, int height, KLT_BOOL gradients,
+	        _FloatWindow imgdiff, _FloatWindow gradx, _FloatWindow grady);
+	void (*accumulateWindows)(
+	        _KLT_FloatImage img1, _KLT_FloatImage img2,
+	        _KLT_FloatImage gradx1, _KLT_FloatImage grady1,
+	        _KLT_FloatImage gradx2, _KLT_FloatImage grady2,
+	        float x1, float y1, float x2, float y2,
+	        int width, int height, int mode, float *sums);
+	void (*trackFeatureLanes)(
+	        const float *x1, const float *y1, float *x2, float *y2, int *status,
+	        _KLT_FloatImage img1, _KLT_FloatImage gradx1, _KLT_FloatImage grady1,
+	        _KLT_FloatImage img2, _KLT_FloatImage gradx2, _KLT_FloatImage grady2,
+	        const _SearchBox *box, const _TileFetch *fetch,
+	        int width, int height, float step_factor, int max_iterations,
+	        float small, float th, float max_residue, KLT_BOOL check_residue);
+}  _WindowKernels;
+
+
 /*********************************************************************
  * _trackFeature
  *
@@ -422,6 +817,9 @@ static int _trackFeature(
         _KLT_FloatImage img2,
         _KLT_FloatImage gradx2,
         _KLT_FloatImage grady2,
+        const _SearchBox *box,  /* region of img2 the window must stay in */
+        const _TileFetch *fetch,  /* tiles to compute on demand, or NULL */
+        const _WindowKernels *kernels,  /* for the precision of the images */
         int width,           /* size of window */
         int height,
         float step_factor, /* 2.0 comes from equations, 1.0 seems to avoid overshooting */
@@ -429,10 +827,14 @@ static int _trackFeature(
         float small,         /* determinant threshold for declaring KLT_SMALL_DET */
         float th,            /* displacement threshold for stopping               */
         float max_residue,   /* residue threshold for declaring KLT_LARGE_RESIDUE */
-        int lighting_insensitive)  /* whether to normalize for gain and bias */
+        int lighting_insensitive,  /* whether to normalize for gain and bias */
+        KLT_BOOL check_residue,    /* whether to check the residue */
+        _FloatWindow imgdiff,      /* scratch windows of width*height */
+        _FloatWindow gradx,
+        _FloatWindow grady)
 {
-	_FloatWindow imgdiff, gradx, grady;
-	float gxx, gxy, gyy, ex, ey, dx, dy;
+	float gxx = 0, gxy = 0, gyy = 0, ex, ey, dx = 0, dy = 0;
+	float residue = 0.0f;      /* of the last iteration, if not lighting insensitive */
 	int iteration = 0;
 	int status;
 	int hw = width / 2;
@@ -441,44 +843,44 @@ static int _trackFeature(
 	int nr = img1->nrows;
 	float one_plus_eps = 1.001f;   /* To prevent rounding errors */
 
-
-	/* Allocate memory for windows */
-	imgdiff = _allocateFloatWindow(width, height);
-	gradx   = _allocateFloatWindow(width, height);
-	grady   = _allocateFloatWindow(width, height);
-
 	/* Iteratively update the window position */
 	do  {
 
 		/* If out of bounds, exit loop */
 		if (  x1 - hw < 0.0f || nc - ( x1 + hw) < one_plus_eps ||
-		      *x2 - hw < 0.0f || nc - (*x2 + hw) < one_plus_eps ||
+		      *x2 - hw < box->x0 || box->x1 - (*x2 + hw) < one_plus_eps ||
 		      y1 - hh < 0.0f || nr - ( y1 + hh) < one_plus_eps ||
-		      *y2 - hh < 0.0f || nr - (*y2 + hh) < one_plus_eps) {
+		      *y2 - hh < box->y0 || box->y1 - (*y2 + hh) < one_plus_eps) {
 			status = KLT_OOB;
 			break;
 		}
 
-		/* Compute gradient and difference windows */
+		if (fetch != NULL)  {
+			_fetchWindow(fetch, fetch->tiles1, x1, y1, hw, hh);
+			_fetchWindow(fetch, fetch->tiles2, *x2, *y2, hw, hh);
+		}
+
+		/* Construct matrices, from gradient and difference windows */
+		/* if normalizing for gain and bias */
 		if (lighting_insensitive) {
-			_computeIntensityDifferenceLightingInsensitive(img1, img2, x1, y1, *x2, *y2,
-			                width, height, imgdiff);
-			_computeGradientSumLightingInsensitive(gradx1, grady1, gradx2, grady2,
-			                                       img1, img2, x1, y1, *x2, *y2, width, height, gradx, grady);
+			kernels->computeWindowsLightingInsensitive(img1, img2, gradx1, grady1, gradx2, grady2,
+			                                           x1, y1, *x2, *y2, width, height, TRUE,
+			                                           imgdiff, gradx, grady);
+			_compute2by2GradientMatrix(gradx, grady, width, height,
+			                           &gxx, &gxy, &gyy);
+			_compute2by1ErrorVector(imgdiff, gradx, grady, width, height, step_factor,
+			                        &ex, &ey);
 		} else {
-			_computeIntensityDifference(img1, img2, x1, y1, *x2, *y2,
-			                            width, height, imgdiff);
-			_computeGradientSum(gradx1, grady1, gradx2, grady2,
-			                    x1, y1, *x2, *y2, width, height, gradx, grady);
+			float sums[6];
+			kernels->accumulateWindows(img1, img2, gradx1, grady1, gradx2, grady2,
+			                           x1, y1, *x2, *y2, width, height,
+			                           ACCUMULATE_SYSTEM, sums);
+			gxx = sums[0];  gxy = sums[1];  gyy = sums[2];
+			ex = sums[3] * step_factor;
+			ey = sums[4] * step_factor;
+			residue = sums[5];
 		}
 
-
-		/* Use these windows to construct matrices */
-		_compute2by2GradientMatrix(gradx, grady, width, height,
-		                           &gxx, &gxy, &gyy);
-		_compute2by1ErrorVector(imgdiff, gradx, grady, width, height, step_factor,
-		                        &ex, &ey);
-
 		/* Using matrices, solve equation for new displacement */
 		status = _solveEquation(gxx, gxy, gyy, ex, ey, small, &dx, &dy);
 		if (status == KLT_SMALL_DET)  break;
@@ -490,24 +892,351 @@ static int _trackFeature(
 	}  while ((fabs(dx) >= th || fabs(dy) >= th) && iteration < max_iterations);
 
 	/* Check whether window is out of bounds */
-	if (*x2 - hw < 0.0f || nc - (*x2 + hw) < one_plus_eps ||
-	    *y2 - hh < 0.0f || nr - (*y2 + hh) < one_plus_eps)
+	if (*x2 - hw < box->x0 || box->x1 - (*x2 + hw) < one_plus_eps ||
+	    *y2 - hh < box->y0 || box->y1 - (*y2 + hh) < one_plus_eps)
 		status = KLT_OOB;
 
-	/* Check whether residue is too large */
-	if (status == KLT_TRACKED)  {
+	/* Check whether residue is too large.  The residue sampled by the */
+	/* last iteration, before the last step, decides if the step was  */
+	/* small and the residue is far enough from the threshold for the */
+	/* step not to matter; otherwise the window is resampled          */
+	if (status == KLT_TRACKED && check_residue)  {
+		float limit = max_residue * (width * height);
 		if (lighting_insensitive)
-			_computeIntensityDifferenceLightingInsensitive(img1, img2, x1, y1, *x2, *y2,
-			                width, height, imgdiff);
-		else
-			_computeIntensityDifference(img1, img2, x1, y1, *x2, *y2,
-			                            width, height, imgdiff);
-		if (_sumAbsFloatWindow(imgdiff, width, height) / (width * height) > max_residue)
+			residue = _sumAbsFloatWindow(imgdiff, width, height);
+		if (fabs(dx) >= th || fabs(dy) >= th ||
+		    fabs(residue - limit) <= RESIDUE_ESTIMATE_MARGIN *
+		    _residueChangeEstimate(gxx, gxy, gyy, dx, dy, width * height))  {
+			if (fetch != NULL)
+				_fetchWindow(fetch, fetch->tiles2, *x2, *y2, hw, hh);
+			if (lighting_insensitive)  {
+				kernels->computeWindowsLightingInsensitive(img1, img2, gradx1, grady1, gradx2, grady2,
+				                                           x1, y1, *x2, *y2, width, height, FALSE,
+				                                           imgdiff, gradx, grady);
+				residue = _sumAbsFloatWindow(imgdiff, width, height);
+			} else
+				kernels->accumulateWindows(img1, img2, gradx1, grady1, gradx2, grady2,
+				                           x1, y1, *x2, *y2, width, height,
+				                           ACCUMULATE_RESIDUE, &residue);
+		}
+		if (residue / (width * height) > max_residue)
 			status = KLT_LARGE_RESIDUE;
 	}
 
-	/* Free memory */
-	free(imgdiff);  free(gradx);  free(grady);
+	/* Return appropriate value */
+	if (status == KLT_SMALL_DET)  return KLT_SMALL_DET;
+	else if (status == KLT_OOB)  return KLT_OOB;
+	else if (status == KLT_LARGE_RESIDUE)  return KLT_LARGE_RESIDUE;
+	else if (iteration >= max_iterations)  return KLT_MAX_ITERATIONS;
+	else  return KLT_TRACKED;
+
+}
+
+
+/*********************************************************************
+ * FIXED-POINT TRACKING
+ *
+ * The following routines track a feature with integer arithmetic
+ * only, on copies of the pyramids with FIXED_IMG_BITS fractional bits
+ * (the smoothed gray levels, at most 255, and their gradients fit in
+ * a short).  Locations are kept with FIXED_LOC_BITS fractional bits,
+ * so that the fractional part of a location directly gives the
+ * bilinear weights.  The products of two windows are accumulated in
+ * 32 bits after dropping FIXED_PRODUCT_SHIFT bits; with saturated
+ * window values this cannot overflow for windows of up to
+ * FIXED_MAX_WINDOW pixels.  Only the 2x2 solve needs 64 bits.
+ */
+
+#define FIXED_IMG_BITS       7   /* Q7 images and gradients */
+#define FIXED_LOC_BITS       8   /* Q8 locations and weights */
+#define FIXED_ONE            (1 << FIXED_LOC_BITS)
+#define FIXED_PRODUCT_SHIFT  8
+#define FIXED_MAX_WINDOW     441 /* pixels, i.e. 21 by 21 */
+#define FIXED_SOLVE_BITS     23  /* magnitude of the system once normalized */
+
+typedef struct  {
+	int offset;                 /* of the upper-left pixel of the window */
+	short w00, w01, w10, w11;   /* Q8 weights of the four neighbours */
+}  _FixedSampler;
+
+inline static int _toFixedLocation(
+        float x)
+{
+	return (int) floor(x * FIXED_ONE + 0.5f);
+}
+
+inline static short _saturate16(
+        int v)
+{
+	return (short) ((v > 32767) ? 32767 : (v < -32768) ? -32768 : v);
+}
+
+inline static void _setupFixedSampler(
+        int x, int y,           /* Q8 center of window */
+        int hw, int hh,
+        int ncols,
+        _FixedSampler *s)       /* output */
+{
+	int ax = x & (FIXED_ONE - 1);
+	int ay = y & (FIXED_ONE - 1);
+	int axay = (ax * ay + FIXED_ONE / 2) >> FIXED_LOC_BITS;
+
+	s->offset = ncols * ((y >> FIXED_LOC_BITS) - hh) + ((x >> FIXED_LOC_BITS) - hw);
+	s->w00 = (short) (FIXED_ONE - ay - ax + axay);
+	s->w01 = (short) (ax - axay);
+	s->w10 = (short) (ay - axay);
+	s->w11 = (short) axay;
+}
+
+inline static int16x4_t _sampleFixed4(
+        const short *p,         /* upper-left neighbour of the first pixel */
+        int ncols,
+        const _FixedSampler *s)
+{
+	int32x4_t val = vmull_n_s16(vld1_s16(p), s->w00);
+	val = vmlal_n_s16(val, vld1_s16(p + 1), s->w01);
+	val = vmlal_n_s16(val, vld1_s16(p + ncols), s->w10);
+	val = vmlal_n_s16(val, vld1_s16(p + ncols + 1), s->w11);
+	return vrshrn_n_s32(val, FIXED_LOC_BITS);
+}
+
+inline static int _sampleFixed1(
+        const short *p,
+        int ncols,
+        const _FixedSampler *s)
+{
+	return (s->w00 * p[0] + s->w01 * p[1] +
+	        s->w10 * p[ncols] + s->w11 * p[ncols + 1] +
+	        FIXED_ONE / 2) >> FIXED_LOC_BITS;
+}
+
+inline static int _addFixedLanes(
+        int32x4_t v)
+{
+	return vgetq_lane_s32(v, 0) + vgetq_lane_s32(v, 1) +
+	       vgetq_lane_s32(v, 2) + vgetq_lane_s32(v, 3);
+}
+
+
+/*********************************************************************
+ * _accumulateFixedWindows
+ *
+ * Fixed-point counterpart of _accumulateWindows, with the same modes.
+ * The sums of products are in units of 2^-(2*FIXED_IMG_BITS -
+ * FIXED_PRODUCT_SHIFT), the sum of absolute differences in units of
+ * 2^-FIXED_IMG_BITS.
+ */
+
+static void _accumulateFixedWindows(
+        _KLT_FixedImage img1,   /* images */
+        _KLT_FixedImage img2,
+        _KLT_FixedImage gradx1, /* gradient images */
+        _KLT_FixedImage grady1,
+        _KLT_FixedImage gradx2,
+        _KLT_FixedImage grady2,
+        int x1, int y1,         /* Q8 center of window in 1st img */
+        int x2, int y2,         /* Q8 center of window in 2nd img */
+        int width, int height,  /* size of window */
+        int mode,
+        int *sums)              /* return values */
+{
+	int hw = width / 2, hh = height / 2;
+	int nc1 = img1->ncols, nc2 = img2->ncols;
+	_FixedSampler s1, s2;
+	int32x4_t vgxx, vgxy, vgyy, vex, vey, vsad;
+	int gxx = 0, gxy = 0, gyy = 0, ex = 0, ey = 0, sad = 0;
+	int i, j;
+
+	_setupFixedSampler(x1, y1, hw, hh, nc1, &s1);
+	_setupFixedSampler(x2, y2, hw, hh, nc2, &s2);
+	vgxx = vgxy = vgyy = vex = vey = vsad = vdupq_n_s32(0);
+
+	if (mode == ACCUMULATE_RESIDUE)  {
+		for (j = 0 ; j < height ; j++)  {
+			const short *p1 = img1->data + s1.offset + j * nc1;
+			const short *p2 = img2->data + s2.offset + j * nc2;
+			for (i = 0 ; i + 4 <= width ; i += 4)
+				vsad = vaddw_s16(vsad, vqabs_s16(vqsub_s16(_sampleFixed4(p1 + i, nc1, &s1),
+				                                           _sampleFixed4(p2 + i, nc2, &s2))));
+			for ( ; i < width ; i++)
+				sad += abs(_saturate16(_sampleFixed1(p1 + i, nc1, &s1) -
+				                       _sampleFixed1(p2 + i, nc2, &s2)));
+		}
+		sums[0] = sad + _addFixedLanes(vsad);
+		return;
+	}
+
+	for (j = 0 ; j < height ; j++)  {
+		const short *p1 = img1->data + s1.offset + j * nc1;
+		const short *p2 = img2->data + s2.offset + j * nc2;
+		const short *px1 = gradx1->data + s1.offset + j * nc1;
+		const short *py1 = grady1->data + s1.offset + j * nc1;
+		const short *px2 = gradx2->data + s2.offset + j * nc2;
+		const short *py2 = grady2->data + s2.offset + j * nc2;
+		for (i = 0 ; i + 4 <= width ; i += 4)  {
+			int16x4_t diff = vqsub_s16(_sampleFixed4(p1 + i, nc1, &s1),
+			                           _sampleFixed4(p2 + i, nc2, &s2));
+			int16x4_t gx = vqadd_s16(_sampleFixed4(px1 + i, nc1, &s1),
+			                         _sampleFixed4(px2 + i, nc2, &s2));
+			int16x4_t gy = vqadd_s16(_sampleFixed4(py1 + i, nc1, &s1),
+			                         _sampleFixed4(py2 + i, nc2, &s2));
+			vgxx = vsraq_n_s32(vgxx, vmull_s16(gx, gx), FIXED_PRODUCT_SHIFT);
+			vgxy = vsraq_n_s32(vgxy, vmull_s16(gx, gy), FIXED_PRODUCT_SHIFT);
+			vgyy = vsraq_n_s32(vgyy, vmull_s16(gy, gy), FIXED_PRODUCT_SHIFT);
+			vex = vsraq_n_s32(vex, vmull_s16(diff, gx), FIXED_PRODUCT_SHIFT);
+			vey = vsraq_n_s32(vey, vmull_s16(diff, gy), FIXED_PRODUCT_SHIFT);
+			vsad = vaddw_s16(vsad, vqabs_s16(diff));
+		}
+		for ( ; i < width ; i++)  {
+			int diff = _saturate16(_sampleFixed1(p1 + i, nc1, &s1) - _sampleFixed1(p2 + i, nc2, &s2));
+			int gx = _saturate16(_sampleFixed1(px1 + i, nc1, &s1) + _sampleFixed1(px2 + i, nc2, &s2));
+			int gy = _saturate16(_sampleFixed1(py1 + i, nc1, &s1) + _sampleFixed1(py2 + i, nc2, &s2));
+			gxx += (gx * gx) >> FIXED_PRODUCT_SHIFT;
+			gxy += (gx * gy) >> FIXED_PRODUCT_SHIFT;
+			gyy += (gy * gy) >> FIXED_PRODUCT_SHIFT;
+			ex += (diff * gx) >> FIXED_PRODUCT_SHIFT;
+			ey += (diff * gy) >> FIXED_PRODUCT_SHIFT;
+			sad += abs(diff);
+		}
+	}
+
+	sums[0] = gxx + _addFixedLanes(vgxx);
+	sums[1] = gxy + _addFixedLanes(vgxy);
+	sums[2] = gyy + _addFixedLanes(vgyy);
+	sums[3] = ex + _addFixedLanes(vex);
+	sums[4] = ey + _addFixedLanes(vey);
+	sums[5] = sad + _addFixedLanes(vsad);
+}
+
+
+/*********************************************************************
+ * _solveFixedEquation
+ *
+ * Fixed-point counterpart of _solveEquation.  The system is first
+ * shifted down to FIXED_SOLVE_BITS bits, so that the products of the
+ * solve fit in 64 bits.  small is the determinant threshold in the
+ * units of the unshifted system, and step the Q8 step factor.
+ * Returns the Q8 displacement, rounded to nearest.
+ */
+
+static long long _roundedDivide(
+        long long n,
+        long long d)    /* > 0 */
+{
+	return (n >= 0) ? (n + d / 2) / d : -((-n + d / 2) / d);
+}
+
+static int _solveFixedEquation(
+        int gxx, int gxy, int gyy,
+        int ex, int ey,
+        long long small,
+        int step,
+        int *dx, int *dy)
+{
+	int m = max(max(gxx, gyy), max(max(abs(gxy), abs(ex)), abs(ey)));
+	long long a, b, c, e, f, det;
+	int shift = 0;
+
+	while ((m >> shift) >= (1 << FIXED_SOLVE_BITS))  shift++;
+	a = gxx >> shift;  b = gxy >> shift;  c = gyy >> shift;
+	e = ex >> shift;  f = ey >> shift;
+
+	det = a * c - b * b;
+	if (det <= 0 || det < (small >> (2 * shift)))  return KLT_SMALL_DET;
+
+	*dx = (int) _roundedDivide((c * e - b * f) * step, det);
+	*dy = (int) _roundedDivide((a * f - b * e) * step, det);
+	return KLT_TRACKED;
+}
+
+
+/*********************************************************************
+ * _trackFeatureFixed
+ *
+ * Fixed-point counterpart of _trackFeature, on fixed-point images.
+ * The thresholds are converted to fixed point once, on entry; the
+ * residue is always resampled at the final location.
+ */
+
+static int _trackFeatureFixed(
+        float x1,  /* location of window in first image */
+        float y1,
+        float *x2, /* starting location of search in second image */
+        float *y2,
+        _KLT_FixedImage img1,
+        _KLT_FixedImage gradx1,
+        _KLT_FixedImage grady1,
+        _KLT_FixedImage img2,
+        _KLT_FixedImage gradx2,
+        _KLT_FixedImage grady2,
+        int width,           /* size of window */
+        int height,
+        float step_factor, /* 2.0 comes from equations, 1.0 seems to avoid overshooting */
+        int max_iterations,
+        float small,         /* determinant threshold for declaring KLT_SMALL_DET */
+        float th,            /* displacement threshold for stopping               */
+        float max_residue,   /* residue threshold for declaring KLT_LARGE_RESIDUE */
+        KLT_BOOL check_residue)    /* whether to check the residue */
+{
+	int X1 = _toFixedLocation(x1), Y1 = _toFixedLocation(y1);
+	int X2 = _toFixedLocation(*x2), Y2 = _toFixedLocation(*y2);
+	int step = _toFixedLocation(step_factor);
+	int thq = _toFixedLocation(th);
+	long long smallq = (long long) (small * (1 << (2 * (2 * FIXED_IMG_BITS - FIXED_PRODUCT_SHIFT))));
+	int dx = 0, dy = 0;
+	int iteration = 0;
+	int status;
+	int hw = (width / 2) << FIXED_LOC_BITS;
+	int hh = (height / 2) << FIXED_LOC_BITS;
+	int nc = img1->ncols << FIXED_LOC_BITS;
+	int nr = img1->nrows << FIXED_LOC_BITS;
+
+	/* Iteratively update the window position */
+	do  {
+
+		/* If out of bounds, exit loop; the margin of one pixel is that */
+		/* of the float path, to within 1/256                            */
+		if ( X1 - hw < 0 || nc - (X1 + hw) <= FIXED_ONE ||
+		     X2 - hw < 0 || nc - (X2 + hw) <= FIXED_ONE ||
+		     Y1 - hh < 0 || nr - (Y1 + hh) <= FIXED_ONE ||
+		     Y2 - hh < 0 || nr - (Y2 + hh) <= FIXED_ONE)  {
+			status = KLT_OOB;
+			break;
+		}
+
+		{
+			int sums[6];
+			_accumulateFixedWindows(img1, img2, gradx1, grady1, gradx2, grady2,
+			                        X1, Y1, X2, Y2, width, height,
+			                        ACCUMULATE_SYSTEM, sums);
+			status = _solveFixedEquation(sums[0], sums[1], sums[2], sums[3], sums[4],
+			                             smallq, step, &dx, &dy);
+		}
+		if (status == KLT_SMALL_DET)  break;
+
+		X2 += dx;
+		Y2 += dy;
+		iteration++;
+
+	}  while ((abs(dx) >= thq || abs(dy) >= thq) && iteration < max_iterations);
+
+	/* Check whether window is out of bounds */
+	if (X2 - hw < 0 || nc - (X2 + hw) <= FIXED_ONE ||
+	    Y2 - hh < 0 || nr - (Y2 + hh) <= FIXED_ONE)
+		status = KLT_OOB;
+
+	/* Check whether residue is too large */
+	if (status == KLT_TRACKED && check_residue)  {
+		int sad;
+		_accumulateFixedWindows(img1, img2, gradx1, grady1, gradx2, grady2,
+		                        X1, Y1, X2, Y2, width, height,
+		                        ACCUMULATE_RESIDUE, &sad);
+		if (sad > (int) (max_residue * (1 << FIXED_IMG_BITS)) * (width * height))
+			status = KLT_LARGE_RESIDUE;
+	}
+
+	*x2 = (float) X2 / FIXED_ONE;
+	*y2 = (float) Y2 / FIXED_ONE;
 
 	/* Return appropriate value */
 	if (status == KLT_SMALL_DET)  return KLT_SMALL_DET;
@@ -515,10 +1244,332 @@ static int _trackFeature(
 	else if (status == KLT_LARGE_RESIDUE)  return KLT_LARGE_RESIDUE;
 	else if (iteration >= max_iterations)  return KLT_MAX_ITERATIONS;
 	else  return KLT_TRACKED;
+}
+
 
+/*********************************************************************
+ * LOCKSTEP TRACKING OF SEVERAL FEATURES
+ *
+ * The following routines track LOCKSTEP_LANES features at once, one
+ * feature per NEON lane.  Each lane has its own location, iteration
+ * count and status; a lane is masked off as soon as its feature
+ * converges, is lost, or runs out of iterations, while the remaining
+ * lanes go on iterating.  Since the bilinear weights of a feature are
+ * the same for every pixel of its window, they are computed once per
+ * iteration; only the four neighbours of each pixel are gathered lane
+ * by lane.
+ */
+
+#define LOCKSTEP_LANES  4
+
+
+/*********************************************************************
+ * _interpolateLanes
+ *
+ * Returns, for each lane, the bilinear interpolation of img at pixel
+ * base[lane] + offset, given the weights of the four neighbours.
+ */
+
+inline static float32x4_t _interpolateLanes(
+        _KLT_FloatImage img,
+        const int *base,          /* [LOCKSTEP_LANES] */
+        int offset,
+        int ncols,
+        float32x4_t w00, float32x4_t w01,
+        float32x4_t w10, float32x4_t w11,
+        int half)                 /* whether img is bfloat16 */
+{
+	float a[LOCKSTEP_LANES], b[LOCKSTEP_LANES];
+	float c[LOCKSTEP_LANES], d[LOCKSTEP_LANES];
+	float32x4_t val;
+	int l;
+
+	for (l = 0 ; l < LOCKSTEP_LANES ; l++)  {
+		const void *p = _windowRow(img, base[l] + offset, half);
+		a[l] = _load1(p, 0, half);
+		b[l] = _load1(p, 1, half);
+		c[l] = _load1(p, ncols, half);
+		d[l] = _load1(p, ncols + 1, half);
+	}
+
+	val = vmulq_f32(w00, vld1q_f32(a));
+	val = vmlaq_f32(val, w01, vld1q_f32(b));
+	val = vmlaq_f32(val, w10, vld1q_f32(c));
+	val = vmlaq_f32(val, w11, vld1q_f32(d));
+	return val;
+}
+
+
+/*********************************************************************
+ * _setupLanes
+ *
+ * For each lane, computes the offset of the upper-left pixel of the
+ * window centred at (x[lane],y[lane]), and the bilinear weights of
+ * the window.
+ * Lanes that are not active are pointed at a window that lies inside
+ * the image, so that they can be gathered from harmlessly.
+ */
+
+static void _setupLanes(
+        const float *x, const float *y,
+        const int *active,
+        int ncols,
+        int hw, int hh,
+        int *base,           /* output */
+        float32x4_t *w00, float32x4_t *w01,
+        float32x4_t *w10, float32x4_t *w11)
+{
+	float a00[LOCKSTEP_LANES], a01[LOCKSTEP_LANES];
+	float a10[LOCKSTEP_LANES], a11[LOCKSTEP_LANES];
+	int l;
+
+	for (l = 0 ; l < LOCKSTEP_LANES ; l++)  {
+		if (active[l])  {
+			int xt = (int) x[l];
+			int yt = (int) y[l];
+			float ax = x[l] - xt;
+			float ay = y[l] - yt;
+			float axay = ax * ay;
+			base[l] = ncols * (yt - hh) + (xt - hw);
+			a00[l] = 1 - ay - ax + axay;
+			a01[l] = ax - axay;
+			a10[l] = ay - axay;
+			a11[l] = axay;
+		} else  {
+			base[l] = 0;
+			a00[l] = a01[l] = a10[l] = a11[l] = 0.0f;
+		}
+	}
+
+	*w00 = vld1q_f32(a00);
+	*w01 = vld1q_f32(a01);
+	*w10 = vld1q_f32(a10);
+	*w11 = vld1q_f32(a11);
 }
 
 
+/*********************************************************************
+ * _trackFeatureLanes
+ *
+ * Lockstep counterpart of _trackFeature.  Tracks the lanes whose
+ * status is KLT_TRACKED on entry from (x1,y1) in the first image,
+ * starting the search at (x2,y2) in the second image; the other lanes
+ * are left untouched.  On exit, status holds the result of each
+ * tracked lane, with the same meaning as the value returned by
+ * _trackFeature.
+ */
+
+__attribute__((always_inline)) inline static void _trackFeatureLanes(
+        const float *x1,  /* [LOCKSTEP_LANES] location of window in first image */
+        const float *y1,
+        float *x2,        /* [LOCKSTEP_LANES] starting location of search in second image */
+        float *y2,
+        int *status,      /* [LOCKSTEP_LANES] */
+        _KLT_FloatImage img1,
+        _KLT_FloatImage gradx1,
+        _KLT_FloatImage grady1,
+        _KLT_FloatImage img2,
+        _KLT_FloatImage gradx2,
+        _KLT_FloatImage grady2,
+        const _SearchBox *box,  /* [LOCKSTEP_LANES] regions of img2 the windows must stay in */
+        const _TileFetch *fetch,  /* tiles to compute on demand, or NULL */
+        int width,           /* size of window */
+        int height,
+        float step_factor, /* 2.0 comes from equations, 1.0 seems to avoid overshooting */
+        int max_iterations,
+        float small,         /* determinant threshold for declaring KLT_SMALL_DET */
+        float th,            /* displacement threshold for stopping               */
+        float max_residue,   /* residue threshold for declaring KLT_LARGE_RESIDUE */
+        KLT_BOOL check_residue,  /* whether to check the residue */
+        int half)            /* whether the images are bfloat16 */
+{
+	int p1[LOCKSTEP_LANES], p2[LOCKSTEP_LANES];   /* window offsets */
+	float32x4_t w00a, w01a, w10a, w11a, w00b, w01b, w10b, w11b;
+	int tracked[LOCKSTEP_LANES];   /* lanes tracked by this call */
+	int active[LOCKSTEP_LANES];    /* lanes still iterating */
+	int iteration[LOCKSTEP_LANES];
+	int hw = width / 2;
+	int hh = height / 2;
+	int nc = img1->ncols;
+	int nr = img1->nrows;
+	float one_plus_eps = 1.001f;   /* To prevent rounding errors */
+	int nactive;
+	int i, j, l;
+
+	for (l = 0 ; l < LOCKSTEP_LANES ; l++)  {
+		tracked[l] = active[l] = (status[l] == KLT_TRACKED);
+		iteration[l] = 0;
+	}
+
+	/* Iteratively update the window positions */
+	for (;;)  {
+		float32x4_t gxx = vdupq_n_f32(0.0f), gxy = vdupq_n_f32(0.0f);
+		float32x4_t gyy = vdupq_n_f32(0.0f);
+		float32x4_t ex = vdupq_n_f32(0.0f), ey = vdupq_n_f32(0.0f);
+		float32x4_t det, inv, dx4, dy4;
+		float dx[LOCKSTEP_LANES], dy[LOCKSTEP_LANES], dt[LOCKSTEP_LANES];
+
+		/* Lanes that are out of bounds stop here */
+		nactive = 0;
+		for (l = 0 ; l < LOCKSTEP_LANES ; l++)  {
+			if (!active[l])  continue;
+			if (  x1[l] - hw < 0.0f || nc - ( x1[l] + hw) < one_plus_eps ||
+			      x2[l] - hw < box[l].x0 || box[l].x1 - ( x2[l] + hw) < one_plus_eps ||
+			      y1[l] - hh < 0.0f || nr - ( y1[l] + hh) < one_plus_eps ||
+			      y2[l] - hh < box[l].y0 || box[l].y1 - ( y2[l] + hh) < one_plus_eps)  {
+				status[l] = KLT_OOB;
+				active[l] = FALSE;
+			} else  {
+				if (fetch != NULL)  {
+					_fetchWindow(fetch, fetch->tiles1, x1[l], y1[l], hw, hh);
+					_fetchWindow(fetch, fetch->tiles2, x2[l], y2[l], hw, hh);
+				}
+				nactive++;
+			}
+		}
+		if (nactive == 0)  break;
+
+		_setupLanes(x1, y1, active, nc, hw, hh, p1, &w00a, &w01a, &w10a, &w11a);
+		_setupLanes(x2, y2, active, nc, hw, hh, p2, &w00b, &w01b, &w10b, &w11b);
+
+		/* Accumulate gradient matrices and error vectors of all lanes */
+		for (j = 0 ; j < height ; j++)
+			for (i = 0 ; i < width ; i++)  {
+				int o = j * nc + i;
+				float32x4_t diff, gx, gy;
+
+				diff = vsubq_f32(
+				         _interpolateLanes(img1, p1, o, nc, w00a, w01a, w10a, w11a, half),
+				         _interpolateLanes(img2, p2, o, nc, w00b, w01b, w10b, w11b, half));
+				gx = vaddq_f32(
+				       _interpolateLanes(gradx1, p1, o, nc, w00a, w01a, w10a, w11a, half),
+				       _interpolateLanes(gradx2, p2, o, nc, w00b, w01b, w10b, w11b, half));
+				gy = vaddq_f32(
+				       _interpolateLanes(grady1, p1, o, nc, w00a, w01a, w10a, w11a, half),
+				       _interpolateLanes(grady2, p2, o, nc, w00b, w01b, w10b, w11b, half));
+
+				gxx = vmlaq_f32(gxx, gx, gx);
+				gxy = vmlaq_f32(gxy, gx, gy);
+				gyy = vmlaq_f32(gyy, gy, gy);
+				ex = vmlaq_f32(ex, diff, gx);
+				ey = vmlaq_f32(ey, diff, gy);
+			}
+		ex = vmulq_n_f32(ex, step_factor);
+		ey = vmulq_n_f32(ey, step_factor);
+
+		/* Solve the 2x2 equations of all lanes; 1/det is refined */
+		/* from the estimate by two Newton-Raphson steps */
+		det = vmlsq_f32(vmulq_f32(gxx, gyy), gxy, gxy);
+		inv = vrecpeq_f32(det);
+		inv = vmulq_f32(inv, vrecpsq_f32(det, inv));
+		inv = vmulq_f32(inv, vrecpsq_f32(det, inv));
+		dx4 = vmulq_f32(vmlsq_f32(vmulq_f32(gyy, ex), gxy, ey), inv);
+		dy4 = vmulq_f32(vmlsq_f32(vmulq_f32(gxx, ey), gxy, ex), inv);
+		vst1q_f32(dt, det);
+		vst1q_f32(dx, dx4);
+		vst1q_f32(dy, dy4);
+
+		/* Update the lanes, and mask off those that are done */
+		for (l = 0 ; l < LOCKSTEP_LANES ; l++)  {
+			if (!active[l])  continue;
+			if (dt[l] < small)  {
+				status[l] = KLT_SMALL_DET;
+				active[l] = FALSE;
+				continue;
+			}
+			x2[l] += dx[l];
+			y2[l] += dy[l];
+			iteration[l]++;
+			if ((fabs(dx[l]) < th && fabs(dy[l]) < th) ||
+			    iteration[l] >= max_iterations)
+				active[l] = FALSE;
+		}
+	}
+
+	/* Check whether windows are out of bounds */
+	nactive = 0;
+	for (l = 0 ; l < LOCKSTEP_LANES ; l++)  {
+		if (!tracked[l])  continue;
+		if (x2[l] - hw < box[l].x0 || box[l].x1 - (x2[l] + hw) < one_plus_eps ||
+		    y2[l] - hh < box[l].y0 || box[l].y1 - (y2[l] + hh) < one_plus_eps)
+			status[l] = KLT_OOB;
+		active[l] = (status[l] == KLT_TRACKED);
+		if (active[l])  {
+			if (fetch != NULL && check_residue)
+				_fetchWindow(fetch, fetch->tiles2, x2[l], y2[l], hw, hh);
+			nactive++;
+		}
+	}
+
+	/* Check whether residues are too large */
+	if (nactive > 0 && check_residue)  {
+		float32x4_t sum = vdupq_n_f32(0.0f);
+		float residue[LOCKSTEP_LANES];
+
+		_setupLanes(x1, y1, active, nc, hw, hh, p1, &w00a, &w01a, &w10a, &w11a);
+		_setupLanes(x2, y2, active, nc, hw, hh, p2, &w00b, &w01b, &w10b, &w11b);
+		for (j = 0 ; j < height ; j++)
+			for (i = 0 ; i < width ; i++)  {
+				int o = j * nc + i;
+				sum = vaddq_f32(sum, vabsq_f32(vsubq_f32(
+				        _interpolateLanes(img1, p1, o, nc, w00a, w01a, w10a, w11a, half),
+				        _interpolateLanes(img2, p2, o, nc, w00b, w01b, w10b, w11b, half))));
+			}
+		vst1q_f32(residue, sum);
+
+		for (l = 0 ; l < LOCKSTEP_LANES ; l++)
+			if (active[l] && residue[l] / (width * height) > max_residue)
+				status[l] = KLT_LARGE_RESIDUE;
+	}
+
+	for (l = 0 ; l < LOCKSTEP_LANES ; l++)
+		if (tracked[l] && status[l] == KLT_TRACKED &&
+		    iteration[l] >= max_iterations)
+			status[l] = KLT_MAX_ITERATIONS;
+}
+
+static void _trackFeatureLanesFloat(
+        const float *x1, const float *y1, float *x2, float *y2, int *status,
+        _KLT_FloatImage img1, _KLT_FloatImage gradx1, _KLT_FloatImage grady1,
+        _KLT_FloatImage img2, _KLT_FloatImage gradx2, _KLT_FloatImage grady2,
+        const _SearchBox *box, const _TileFetch *fetch,
+        int width, int height, float step_factor, int max_iterations,
+        float small, float th, float max_residue, KLT_BOOL check_residue)
+{
+	_trackFeatureLanes(x1, y1, x2, y2, status, img1, gradx1, grady1,
+	                   img2, gradx2, grady2, box, fetch, width, height,
+	                   step_factor, max_iterations, small, th, max_residue,
+	                   check_residue, FALSE);
+}
+
+static void _trackFeatureLanesHalf(
+        const float *x1, const float *y1, float *x2, float *y2, int *status,
+        _KLT_FloatImage img1, _KLT_FloatImage gradx1, _KLT_FloatImage grady1,
+        _KLT_FloatImage img2, _KLT_FloatImage gradx2, _KLT_FloatImage grady2,
+        const _SearchBox *box, const _TileFetch *fetch,
+        int width, int height, float step_factor, int max_iterations,
+        float small, float th, float max_residue, KLT_BOOL check_residue)
+{
+	_trackFeatureLanes(x1, y1, x2, y2, status, img1, gradx1, grady1,
+	                   img2, gradx2, grady2, box, fetch, width, height,
+	                   step_factor, max_iterations, small, th, max_residue,
+	                   check_residue, TRUE);
+}
+
+
+static const _WindowKernels _floatKernels = {
+	_computeWindowsLightingInsensitiveFloat,
+	_accumulateWindowsFloat,
+	_trackFeatureLanesFloat
+};
+
+static const _WindowKernels _halfKernels = {
+	_computeWindowsLightingInsensitiveHalf,
+	_accumulateWindowsHalf,
+	_trackFeatureLanesHalf
+};
+
+
 /*********************************************************************/
 
 static KLT_BOOL _outOfBounds(
@@ -557,83 +1608,88 @@ static KLT_BOOL _outOfBounds(
 * Thanks to Kevin Koeser (koeser@mip.informatik.uni-kiel.de) for fixing a bug
 */
 
-#define SWAP_ME(X,Y) {temp=(X);(X)=(Y);(Y)=temp;}
+/*********************************************************************
+ * _am_solveSymmetric
+ *
+ * Solves T x = e for the symmetric positive definite normal matrices
+ * of the affine tracker, by an LDL^T decomposition.  Only the upper
+ * triangle of T is read; L is stored below the diagonal.  n is a
+ * compile-time constant at every call, so the inlined loops are fully
+ * unrolled for the similarity (4) and affine (6) cases.  e is
+ * overwritten with the solution.
+ *
+ * RETURNS
+ * KLT_SMALL_DET if a pivot is not safely positive (T is singular or
+ * nearly so), KLT_TRACKED otherwise.
+ */
 
-static float **_am_matrix(long nr, long nc)
-{
-	float **m;
-	int a;
-	m = (float **) malloc((size_t)(nr * sizeof(float *)));
-	m[0] = (float *) malloc((size_t)((nr * nc) * sizeof(float)));
-	for (a = 1; a < nr; a++) m[a] = m[a - 1] + nc;
-	return m;
-}
+#define AM_MAX_PARAMS 6
 
-static void _am_free_matrix(float **m)
+inline static int _am_solveSymmetric(
+        float T[][AM_MAX_PARAMS],
+        float *e,
+        int n)
 {
-	free(m[0]);
-	free(m);
+	float d[AM_MAX_PARAMS];
+	float sum;
+	int i, j, k;
+
+	/* T = L D L^T, with L below the diagonal of T */
+	for (j = 0 ; j < n ; j++)  {
+		sum = T[j][j];
+		for (k = 0 ; k < j ; k++)
+			sum -= T[j][k] * T[j][k] * d[k];
+		if (!(sum > FLT_EPSILON * T[j][j]))  return KLT_SMALL_DET;
+		d[j] = sum;
+		for (i = j + 1 ; i < n ; i++)  {
+			sum = T[j][i];
+			for (k = 0 ; k < j ; k++)
+				sum -= T[i][k] * T[j][k] * d[k];
+			T[i][j] = sum / d[j];
+		}
+	}
+
+	/* Forward substitution, scaling, back substitution */
+	for (i = 1 ; i < n ; i++)
+		for (k = 0 ; k < i ; k++)
+			e[i] -= T[i][k] * e[k];
+	for (i = 0 ; i < n ; i++)
+		e[i] /= d[i];
+	for (i = n - 2 ; i >= 0 ; i--)
+		for (k = i + 1 ; k < n ; k++)
+			e[i] -= T[k][i] * e[k];
+
+	return KLT_TRACKED;
 }
 
+/*********************************************************************
+ * _am_residueChangeEstimate
+ *
+ * Affine counterpart of _residueChangeEstimate: estimates the change
+ * of the sum of absolute differences caused by the parameter step a
+ * as sqrt(n a'Ta), which holds to first order only.  T must still
+ * hold its upper triangle, which _am_solveSymmetric leaves untouched.
+ */
 
-static int _am_gauss_jordan_elimination(float **a, int n, float **b, int m)
+static float _am_residueChangeEstimate(
+        float T[][AM_MAX_PARAMS],
+        const float *a,
+        int nparams,
+        int n)
 {
-	/* re-implemented from Numerical Recipes in C */
-	int *indxc, *indxr, *ipiv;
-	int i, j, k, l, ll;
-	float big, dum, pivinv, temp;
-	int col = 0;
-	int row = 0;
+	float q = 0.0f;
+	int i, j;
 
-	indxc = (int *)malloc((size_t) (n * sizeof(int)));
-	indxr = (int *)malloc((size_t) (n * sizeof(int)));
-	ipiv = (int *)malloc((size_t) (n * sizeof(int)));
-	for (j = 0; j < n; j++) ipiv[j] = 0;
-	for (i = 0; i < n; i++) {
-		big = 0.0;
-		for (j = 0; j < n; j++)
-			if (ipiv[j] != 1)
-				for (k = 0; k < n; k++) {
-					if (ipiv[k] == 0) {
-						if (fabs(a[j][k]) >= big) {
-							big = (float) fabs(a[j][k]);
-							row = j;
-							col = k;
-						}
-					} else if (ipiv[k] > 1) return KLT_SMALL_DET;
-				}
-		++(ipiv[col]);
-		if (row != col) {
-			for (l = 0; l < n; l++) SWAP_ME(a[row][l], a[col][l])
-				for (l = 0; l < m; l++) SWAP_ME(b[row][l], b[col][l])
-				}
-		indxr[i] = row;
-		indxc[i] = col;
-		if (a[col][col] == 0.0) return KLT_SMALL_DET;
-		pivinv = 1.0f / a[col][col];
-		a[col][col] = 1.0;
-		for (l = 0; l < n; l++) a[col][l] *= pivinv;
-		for (l = 0; l < m; l++) b[col][l] *= pivinv;
-		for (ll = 0; ll < n; ll++)
-			if (ll != col) {
-				dum = a[ll][col];
-				a[ll][col] = 0.0;
-				for (l = 0; l < n; l++) a[ll][l] -= a[col][l] * dum;
-				for (l = 0; l < m; l++) b[ll][l] -= b[col][l] * dum;
-			}
-	}
-	for (l = n - 1; l >= 0; l--) {
-		if (indxr[l] != indxc[l])
-			for (k = 0; k < n; k++)
-				SWAP_ME(a[k][indxr[l]], a[k][indxc[l]]);
+	for (i = 0 ; i < nparams ; i++)  {
+		q += T[i][i] * a[i] * a[i];
+		for (j = i + 1 ; j < nparams ; j++)
+			q += 2 * T[i][j] * a[i] * a[j];
 	}
-	free(ipiv);
-	free(indxr);
-	free(indxc);
 
-	return KLT_TRACKED;
+	return (float) sqrt(n * max(q, 0.0f));
 }
 
+
 /*********************************************************************
  * _am_getGradientWinAffine
  *
@@ -704,7 +1760,7 @@ static void _am_getSubFloatImage(
 	register int hw = window->ncols / 2, hh = window->nrows / 2;
 	int x0 = (int) x;
 	int y0 = (int) y;
-	float *windata = window->data;
+	int k = 0;
 	int offset;
 	register int i, j;
 
@@ -713,11 +1769,16 @@ static void _am_getSubFloatImage(
 	assert(x0 + hw <= img->ncols);
 	assert(y0 + hh <= img->nrows);
 
-	/* copy values */
+	/* copy values, converting between float and bfloat16 if needed */
 	for (j = -hh ; j <= hh ; j++)
-		for (i = -hw ; i <= hw ; i++)  {
+		for (i = -hw ; i <= hw ; i++, k++)  {
 			offset = (j + y0) * img->ncols + (i + x0);
-			*windata++ = *(img->data + offset);
+			if (window->half)
+				window->half[k] = img->half ? img->half[offset]
+				                            : _KLTFloatToHalf(img->data[offset]);
+			else
+				window->data[k] = img->half ? _KLTHalfToFloat(img->half[offset])
+				                            : img->data[offset];
 		}
 }
 
@@ -766,7 +1827,7 @@ static void _am_compute6by6GradientMatrix(
         _FloatWindow grady,
         int width,   /* size of window */
         int height,
-        float **T)  /* return values */
+        float T[][AM_MAX_PARAMS])  /* return values */
 {
 	register int hw = width / 2, hh = height / 2;
 	register int i, j;
@@ -822,11 +1883,7 @@ static void _am_compute6by6GradientMatrix(
 		}
 	}
 
-	for (j = 0 ; j < 5 ; j++)  {
-		for (i = j + 1 ; i < 6 ; i++)  {
-			T[i][j] = T[j][i];
-		}
-	}
+	/* Only the upper triangle is used by _am_solveSymmetric */
 
 }
 
@@ -843,14 +1900,14 @@ static void _am_compute6by1ErrorVector(
         _FloatWindow grady,
         int width,   /* size of window */
         int height,
-        float **e)  /* return values */
+        float *e)  /* return values */
 {
 	register int hw = width / 2, hh = height / 2;
 	register int i, j;
 	register float diff,  diffgradx,  diffgrady;
 
 	/* Set values to zero */
-	for (i = 0; i < 6; i++) e[i][0] = 0.0;
+	for (i = 0; i < 6; i++) e[i] = 0.0;
 
 	/* Compute values */
 	for (j = -hh ; j <= hh ; j++) {
@@ -858,16 +1915,16 @@ static void _am_compute6by1ErrorVector(
 			diff = *imgdiff++;
 			diffgradx = diff * (*gradx++);
 			diffgrady = diff * (*grady++);
-			e[0][0] += diffgradx * i;
-			e[1][0] += diffgrady * i;
-			e[2][0] += diffgradx * j;
-			e[3][0] += diffgrady * j;
-			e[4][0] += diffgradx;
-			e[5][0] += diffgrady;
+			e[0] += diffgradx * i;
+			e[1] += diffgrady * i;
+			e[2] += diffgradx * j;
+			e[3] += diffgrady * j;
+			e[4] += diffgradx;
+			e[5] += diffgrady;
 		}
 	}
 
-	for (i = 0; i < 6; i++) e[i][0] *= 0.5;
+	for (i = 0; i < 6; i++) e[i] *= 0.5;
 
 }
 
@@ -882,7 +1939,7 @@ static void _am_compute4by4GradientMatrix(
         _FloatWindow grady,
         int width,   /* size of window */
         int height,
-        float **T)  /* return values */
+        float T[][AM_MAX_PARAMS])  /* return values */
 {
 	register int hw = width / 2, hh = height / 2;
 	register int i, j;
@@ -918,11 +1975,7 @@ static void _am_compute4by4GradientMatrix(
 		}
 	}
 
-	for (j = 0 ; j < 3 ; j++)  {
-		for (i = j + 1 ; i < 4 ; i++)  {
-			T[i][j] = T[j][i];
-		}
-	}
+	/* Only the upper triangle is used by _am_solveSymmetric */
 
 }
 
@@ -937,14 +1990,14 @@ static void _am_compute4by1ErrorVector(
         _FloatWindow grady,
         int width,   /* size of window */
         int height,
-        float **e)  /* return values */
+        float *e)  /* return values */
 {
 	register int hw = width / 2, hh = height / 2;
 	register int i, j;
 	register float diff,  diffgradx,  diffgrady;
 
 	/* Set values to zero */
-	for (i = 0; i < 4; i++) e[i][0] = 0.0;
+	for (i = 0; i < 4; i++) e[i] = 0.0;
 
 	/* Compute values */
 	for (j = -hh ; j <= hh ; j++) {
@@ -952,14 +2005,14 @@ static void _am_compute4by1ErrorVector(
 			diff = *imgdiff++;
 			diffgradx = diff * (*gradx++);
 			diffgrady = diff * (*grady++);
-			e[0][0] += diffgradx * i + diffgrady * j;
-			e[1][0] += diffgrady * i - diffgradx * j;
-			e[2][0] += diffgradx;
-			e[3][0] += diffgrady;
+			e[0] += diffgradx * i + diffgrady * j;
+			e[1] += diffgrady * i - diffgradx * j;
+			e[2] += diffgradx;
+			e[3] += diffgrady;
 		}
 	}
 
-	for (i = 0; i < 4; i++) e[i][0] *= 0.5;
+	for (i = 0; i < 4; i++) e[i] *= 0.5;
 
 }
 
@@ -1006,11 +2059,11 @@ static int _am_trackFeatureAffine(
         int affine_map,      /* whether to evaluates the consistency of features with affine mapping */
         float mdd,           /* difference between the displacements */
         float *Axx, float *Ayx,
-        float *Axy, float *Ayy)        /* used affine mapping */
+        float *Axy, float *Ayy,        /* used affine mapping */
+        _FloatWindow imgdiff,          /* scratch windows of width*height */
+        _FloatWindow gradx,
+        _FloatWindow grady)
 {
-
-
-	_FloatWindow imgdiff, gradx, grady;
 	float gxx, gxy, gyy, ex, ey, dx = 0, dy = 0;
 	int iteration = 0;
 	int status = 0;
@@ -1020,12 +2073,15 @@ static int _am_trackFeatureAffine(
 	int nr1 = img1->nrows;
 	int nc2 = img2->ncols;
 	int nr2 = img2->nrows;
-	float **a;
-	float **T;
+	float a[AM_MAX_PARAMS];
+	float T[AM_MAX_PARAMS][AM_MAX_PARAMS];
 	float one_plus_eps = 1.001f;   /* To prevent rounding errors */
 	float old_x2 = *x2;
 	float old_y2 = *y2;
 	KLT_BOOL convergence = FALSE;
+	float change = -1.0f;   /* estimate of the residue change of the last */
+	                        /* step, negative if the last imgdiff cannot be */
+	                        /* reused */
 
 #ifdef DEBUG_AFFINE_MAPPING
 	char fname[80];
@@ -1033,13 +2089,6 @@ static int _am_trackFeatureAffine(
 	printf("starting location x2=%f y2=%f\n", *x2, *y2);
 #endif
 
-	/* Allocate memory for windows */
-	imgdiff = _allocateFloatWindow(width, height);
-	gradx   = _allocateFloatWindow(width, height);
-	grady   = _allocateFloatWindow(width, height);
-	T = _am_matrix(6, 6);
-	a = _am_matrix(6, 1);
-
 	/* Iteratively update the window position */
 	do  {
 		if (!affine_map) {
@@ -1056,10 +2105,14 @@ static int _am_trackFeatureAffine(
 
 			/* Compute gradient and difference windows */
 			if (lighting_insensitive) {
-				_computeIntensityDifferenceLightingInsensitive(img1, img2, x1, y1, *x2, *y2,
-				                width, height, imgdiff);
-				_computeGradientSumLightingInsensitive(gradx1, grady1, gradx2, grady2,
-				                                       img1, img2, x1, y1, *x2, *y2, width, height, gradx, grady);
+				if (img1->half != NULL)
+					_computeWindowsLightingInsensitiveHalf(img1, img2, gradx1, grady1, gradx2, grady2,
+					                                       x1, y1, *x2, *y2, width, height, TRUE,
+					                                       imgdiff, gradx, grady);
+				else
+					_computeWindowsLightingInsensitiveFloat(img1, img2, gradx1, grady1, gradx2, grady2,
+					                                        x1, y1, *x2, *y2, width, height, TRUE,
+					                                        imgdiff, gradx, grady);
 			} else {
 				_computeIntensityDifference(img1, img2, x1, y1, *x2, *y2,
 				                            width, height, imgdiff);
@@ -1085,6 +2138,8 @@ static int _am_trackFeatureAffine(
 			status = _solveEquation(gxx, gxy, gyy, ex, ey, small, &dx, &dy);
 
 			convergence = (fabs(dx) < th && fabs(dy) < th);
+			change = lighting_insensitive ? -1.0f :
+			         _residueChangeEstimate(gxx, gxy, gyy, dx, dy, width * height);
 
 			*x2 += dx;
 			*y2 += dy;
@@ -1150,33 +2205,38 @@ static int _am_trackFeatureAffine(
 				_am_compute4by1ErrorVector(imgdiff, gradx, grady, width, height, a);
 				_am_compute4by4GradientMatrix(gradx, grady, width, height, T);
 
-				status = _am_gauss_jordan_elimination(T, 4, a, 1);
+				status = _am_solveSymmetric(T, a, 4);
+				if (status == KLT_SMALL_DET)  break;
 
-				*Axx += a[0][0];
-				*Ayx += a[1][0];
+				*Axx += a[0];
+				*Ayx += a[1];
 				*Ayy = *Axx;
 				*Axy = -(*Ayx);
 
-				dx = a[2][0];
-				dy = a[3][0];
+				dx = a[2];
+				dy = a[3];
+				change = _am_residueChangeEstimate(T, a, 4, width * height);
 
 				break;
 			case 2:
 				_am_compute6by1ErrorVector(imgdiff, gradx, grady, width, height, a);
 				_am_compute6by6GradientMatrix(gradx, grady, width, height, T);
 
-				status = _am_gauss_jordan_elimination(T, 6, a, 1);
+				status = _am_solveSymmetric(T, a, 6);
+				if (status == KLT_SMALL_DET)  break;
 
-				*Axx += a[0][0];
-				*Ayx += a[1][0];
-				*Axy += a[2][0];
-				*Ayy += a[3][0];
+				*Axx += a[0];
+				*Ayx += a[1];
+				*Axy += a[2];
+				*Ayy += a[3];
 
-				dx = a[4][0];
-				dy = a[5][0];
+				dx = a[4];
+				dy = a[5];
+				change = _am_residueChangeEstimate(T, a, 6, width * height);
 
 				break;
 			}
+			if (status == KLT_SMALL_DET)  break;
 
 			*x2 += dx;
 			*y2 += dy;
@@ -1213,8 +2273,6 @@ static int _am_trackFeatureAffine(
 #endif
 	}  while ( !convergence  && iteration < max_iterations);
 	/*}  while ( (fabs(dx)>=th || fabs(dy)>=th || (affine_map && iteration < 8) ) && iteration < max_iterations); */
-	_am_free_matrix(T);
-	_am_free_matrix(a);
 
 	/* Check whether window is out of bounds */
 	if (*x2 - hw < 0.0f || nc2 - (*x2 + hw) < one_plus_eps ||
@@ -1225,25 +2283,31 @@ static int _am_trackFeatureAffine(
 	if ( (*x2 - old_x2) > mdd || (*y2 - old_y2) > mdd )
 		status = KLT_OOB;
 
-	/* Check whether residue is too large */
+	/* Check whether residue is too large.  The difference window of */
+	/* the last iteration decides if the last step converged and the  */
+	/* residue is far enough from the threshold for the step not to   */
+	/* matter; otherwise the window is resampled                      */
 	if (status == KLT_TRACKED)  {
-		if (!affine_map) {
-			_computeIntensityDifference(img1, img2, x1, y1, *x2, *y2,
-			                            width, height, imgdiff);
-		} else {
-			_am_computeIntensityDifferenceAffine(img1, img2, x1, y1, *x2, *y2,  *Axx, *Ayx , *Axy, *Ayy,
-			                                     width, height, imgdiff);
+		float limit = max_residue * (width * height);
+		float residue = _sumAbsFloatWindow(imgdiff, width, height);
+		if (change < 0.0f || !convergence ||
+		    fabs(residue - limit) <= RESIDUE_ESTIMATE_MARGIN * change)  {
+			if (!affine_map) {
+				_computeIntensityDifference(img1, img2, x1, y1, *x2, *y2,
+				                            width, height, imgdiff);
+			} else {
+				_am_computeIntensityDifferenceAffine(img1, img2, x1, y1, *x2, *y2,  *Axx, *Ayx , *Axy, *Ayy,
+				                                     width, height, imgdiff);
+			}
+			residue = _sumAbsFloatWindow(imgdiff, width, height);
 		}
 #ifdef DEBUG_AFFINE_MAPPING
-		printf("iter = %d final_res = %f\n", iteration, _sumAbsFloatWindow(imgdiff, width, height) / (width * height));
+		printf("iter = %d final_res = %f\n", iteration, residue / (width * height));
 #endif
-		if (_sumAbsFloatWindow(imgdiff, width, height) / (width * height) > max_residue)
+		if (residue / (width * height) > max_residue)
 			status = KLT_LARGE_RESIDUE;
 	}
 
-	/* Free memory */
-	free(imgdiff);  free(gradx);  free(grady);
-
 #ifdef DEBUG_AFFINE_MAPPING
 	printf("iter = %d status=%d\n", iteration, status);
 	_KLTFreeFloatImage( aff_diff_win );
@@ -1260,32 +2324,607 @@ static int _am_trackFeatureAffine(
 
 
 /*********************************************************************
- * KLTTrackFeatures
+ * _getThreadPool
  *
- * Tracks feature points from one image to the next.
+ * Returns the pool of threads used for tracking, creating it the
+ * first time and whenever tc->nThreads changes.  Returns NULL if the
+ * features are to be tracked in the calling thread.
  */
 
-void KLTTrackFeatures(
+static _KLT_ThreadPool _getThreadPool(
+        KLT_TrackingContext tc)
+{
+	int nThreads = (tc->nThreads > 0) ? tc->nThreads : _KLTNumberOfCores();
+
+	if (tc->thread_pool != NULL &&
+	    _KLTThreadPoolSize((_KLT_ThreadPool) tc->thread_pool) != nThreads)  {
+		_KLTFreeThreadPool((_KLT_ThreadPool) tc->thread_pool);
+		tc->thread_pool = NULL;
+	}
+	if (tc->thread_pool == NULL && nThreads > 1)
+		tc->thread_pool = _KLTCreateThreadPool(nThreads);
+
+	return (_KLT_ThreadPool) tc->thread_pool;
+}
+
+
+/*********************************************************************
+ * _TrackJob
+ *
+ * Everything needed to track the features of a view.  It is shared
+ * read-only by all threads; each feature is written only by the
+ * thread that tracks it, so the results do not depend on the number
+ * of threads or on the order in which features are tracked.
+ */
+
+#define TRACK_GRAIN  8   /* # of features taken by a thread at a time */
+
+typedef struct  {
+	KLT_TrackingContext tc;
+	_KLT_FeatureView features;
+	int ncols, nrows;
+	_KLT_Pyramid pyramid1, pyramid1_gradx, pyramid1_grady;
+	_KLT_Pyramid pyramid2, pyramid2_gradx, pyramid2_grady;
+	_KLT_FixedPyramid fixed1, fixed1_gradx, fixed1_grady;   /* NULL unless */
+	_KLT_FixedPyramid fixed2, fixed2_gradx, fixed2_grady;   /* tracking in fixed point */
+	KLT_BOOL roi;           /* whether the pyramids are only computed around the features */
+	_KLT_TileBuilder tiles1, tiles2;   /* NULL unless gradients are computed on demand */
+	const _WindowKernels *kernels;     /* for the precision of the pyramids */
+	int wsize;              /* # of floats in one scratch window */
+	float *scratch;         /* three scratch windows per thread */
+}  _TrackJob;
+
+
+/*********************************************************************
+ * REGIONS OF INTEREST
+ *
+ * With roiPyramids, the pyramids of the second image are only computed
+ * where the features may be found, that is, at each level, within the
+ * window plus the search range at that level (and a few pixels of
+ * slack for the Newton steps) of the location of the feature in the
+ * first image; those of the first image only under the windows.  A
+ * feature that would be found further away is lost as out of bounds.
+ */
+
+#define ROI_SLACK  2.0f   /* pixels searched beyond the search range at each level */
+
+
+/*********************************************************************
+ * _levelLocation
+ *
+ * Returns coordinate x of level 0 at the given level, computed as
+ * _trackFeatureAtIndex does.
+ */
+
+static float _levelLocation(
+        KLT_TrackingContext tc,
+        float x,
+        int level)
+{
+	float subsampling = (float) tc->subsampling;
+	int r;
+
+	for (r = tc->nPyramidLevels - 1 ; r >= 0 ; r--)
+		x /= subsampling;
+	for (r = tc->nPyramidLevels - 1 ; r >= level ; r--)
+		x *= subsampling;
+	return x;
+}
+
+
+/*********************************************************************
+ * _searchRange
+ *
+ * Returns the largest displacement, at level 0, that the pyramid of tc
+ * lets a feature be tracked over: half the window at each level,
+ * scaled up to level 0.  This is the search_range KLTChangeTCPyramid
+ * chooses the pyramid for, rounded up, but follows nPyramidLevels and
+ * subsampling when they are set by hand.
+ */
+
+static float _searchRange(
+        KLT_TrackingContext tc)
+{
+	float range = min(tc->window_width, tc->window_height) / 2.0f;
+	float scale = 1.0f;
+	float sum = 0.0f;
+	int r;
+
+	for (r = 0 ; r < tc->nPyramidLevels ; r++)  {
+		sum += scale;
+		scale *= tc->subsampling;
+	}
+	return range * sum;
+}
+
+
+/*********************************************************************
+ * _setupSearchBox
+ *
+ * Computes the search box, at the given level, of the feature at
+ * (x,y) in the first image at that level.
+ */
+
+static void _setupSearchBox(
+        _TrackJob *job,
+        float x, float y,
+        int level,
+        _SearchBox *box)      /* output */
+{
+	KLT_TrackingContext tc = job->tc;
+	float ncols = (float) job->pyramid2->ncols[level];
+	float nrows = (float) job->pyramid2->nrows[level];
+	float margin = _searchRange(tc);
+	int r;
+
+	if (!job->roi)  {
+		box->x0 = box->y0 = 0.0f;
+		box->x1 = ncols;  box->y1 = nrows;
+		return;
+	}
+
+	for (r = 0 ; r < level ; r++)
+		margin /= tc->subsampling;
+	margin += ROI_SLACK;
+	box->x0 = max(x - tc->window_width/2 - margin, 0.0f);
+	box->y0 = max(y - tc->window_height/2 - margin, 0.0f);
+	box->x1 = min(x + tc->window_width/2 + 1 + margin, ncols);
+	box->y1 = min(y + tc->window_height/2 + 1 + margin, nrows);
+}
+
+
+/*********************************************************************
+ * _computeRegionsOfInterest
+ *
+ * Computes the tiles of the pyramids of both images that the features
+ * of the job may be tracked on.
+ */
+
+static void _computeRegionsOfInterest(
+        _TrackJob *job,
+        KLT_PixelType *img1,
+        KLT_PixelType *img2)
+{
+	KLT_TrackingContext tc = job->tc;
+	_KLT_FeatureView features = job->features;
+	int nlevels = tc->nPyramidLevels;
+	int hw = tc->window_width / 2, hh = tc->window_height / 2;
+	int *regions1, *regions2, *p1, *p2;
+	int indx, r;
+
+	regions1 = (int *) malloc(2 * 5 * features->nFeatures * nlevels * sizeof(int));
+	if (regions1 == NULL)
+		KLTError("(KLTTrackFeatures) Out of memory");
+	regions2 = regions1 + 5 * features->nFeatures * nlevels;
+	p1 = regions1;  p2 = regions2;
+
+	for (indx = 0 ; indx < features->nFeatures ; indx++)  {
+		if (FV_VAL(features, indx) < 0)  continue;
+		for (r = 0 ; r < nlevels ; r++)  {
+			float x = _levelLocation(tc, FV_X(features, indx), r);
+			float y = _levelLocation(tc, FV_Y(features, indx), r);
+			_SearchBox box;
+
+			/* The window, and the neighbours it is interpolated from, */
+			/* with a pixel to spare for rounding */
+			p1[0] = r;
+			p1[1] = (int) floor(x - hw) - 1;  p1[2] = (int) floor(y - hh) - 1;
+			p1[3] = (int) floor(x + hw) + 3;  p1[4] = (int) floor(y + hh) + 3;
+			p1 += 5;
+
+			_setupSearchBox(job, x, y, r, &box);
+			p2[0] = r;
+			p2[1] = (int) floor(box.x0) - 1;  p2[2] = (int) floor(box.y0) - 1;
+			p2[3] = (int) ceil(box.x1) + 1;  p2[4] = (int) ceil(box.y1) + 1;
+			p2 += 5;
+		}
+	}
+
+	_KLT_PROFILE_START(tpyr);
+	_KLTComputePyramidRegions(img1, _KLTComputeSmoothSigma(tc),
+	                          tc->pyramid_sigma_fact, tc->grad_sigma,
+	                          job->pyramid1, job->pyramid1_gradx, job->pyramid1_grady,
+	                          regions1, (p1 - regions1) / 5);
+	_KLTComputePyramidRegions(img2, _KLTComputeSmoothSigma(tc),
+	                          tc->pyramid_sigma_fact, tc->grad_sigma,
+	                          job->pyramid2, job->pyramid2_gradx, job->pyramid2_grady,
+	                          regions2, (p2 - regions2) / 5);
+	_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_PYRAMID, tpyr);
+	free(regions1);
+}
+
+
+/*********************************************************************
+ * _releaseAffineTemplates
+ *
+ * Detaches the affine templates of a lost feature.  They live in the
+ * slot of the feature in the slab of its list, which is reused when
+ * the feature is next tracked successfully.
+ */
+
+static void _releaseAffineTemplates(
+        KLT_Feature feat)
+{
+	feat->aff_img = NULL;
+	feat->aff_img_gradx = NULL;
+	feat->aff_img_grady = NULL;
+}
+
+
+/*********************************************************************
+ * _recordFeature
+ *
+ * Records the result of tracking feature indx through the pyramids,
+ * after checking its consistency with the affine mapping if requested.
+ * (xloc,yloc) is the location of the feature in the first image and
+ * (xlocout,ylocout) the tracked location in the second image.
+ */
+
+static void _recordFeature(
+        _TrackJob *job,
+        int indx,
+        int val,
+        float xloc, float yloc,
+        float xlocout, float ylocout,
+        _FloatWindow imgdiff,   /* scratch windows */
+        _FloatWindow gradx,
+        _FloatWindow grady,
+        _KLT_ProfileTimes *times)
+{
+	KLT_TrackingContext tc = job->tc;
+	_KLT_FeatureView features = job->features;
+	KLT_FeatureRec rec;
+	KLT_Feature feat = &rec;
+	KLT_BOOL lost;
+
+	if (_outOfBounds(xlocout, ylocout, job->ncols, job->nrows, tc->borderx, tc->bordery))
+		val = KLT_OOB;
+	lost = (val == KLT_OOB || val == KLT_SMALL_DET ||
+	        val == KLT_LARGE_RESIDUE || val == KLT_MAX_ITERATIONS);
+
+	/* Without the affine check, only the hot fields are written (and
+	 * the templates of a lost feature detached, in case some were
+	 * kept while the check was on) */
+	if (tc->affineConsistencyCheck < 0)  {
+		FV_X(features, indx) = lost ? -1.0f : xlocout;
+		FV_Y(features, indx) = lost ? -1.0f : ylocout;
+		FV_VAL(features, indx) = lost ? val : KLT_TRACKED;
+		if (lost && FV_AFF_IMG(features, indx) != NULL)  {
+			FV_AFF_IMG(features, indx) = NULL;
+			FV_AFF_IMG_GRADX(features, indx) = NULL;
+			FV_AFF_IMG_GRADY(features, indx) = NULL;
+		}
+		return;
+	}
+
+	_KLTLoadFeature(features, indx, feat);
+
+	if (lost)  {
+		feat->x   = -1.0;
+		feat->y   = -1.0;
+		feat->val = val;
+		_releaseAffineTemplates(feat);
+	} else  {
+		feat->x = xlocout;
+		feat->y = ylocout;
+		feat->val = KLT_TRACKED;
+		if (tc->affineConsistencyCheck >= 0 && val == KLT_TRACKED)  { /*for affine mapping*/
+			int border = _KLT_AFFINE_BORDER; /* add border for interpolation */
+			_KLT_PROFILE_START(taffine);
+
+#ifdef DEBUG_AFFINE_MAPPING
+			glob_index = indx;
+#endif
+
+			if (!feat->aff_img) {
+				/* save image and gradient for each feature at finest resolution after first successful track */
+				_KLTTakeAffineSlot(*features->slab, indx,
+				                   tc->affine_window_width + border, tc->affine_window_height + border,
+				                   job->pyramid1->img[0]->half != NULL,
+				                   &feat->aff_img, &feat->aff_img_gradx, &feat->aff_img_grady);
+				_am_getSubFloatImage(job->pyramid1->img[0], xloc, yloc, feat->aff_img);
+				_am_getSubFloatImage(job->pyramid1_gradx->img[0], xloc, yloc, feat->aff_img_gradx);
+				_am_getSubFloatImage(job->pyramid1_grady->img[0], xloc, yloc, feat->aff_img_grady);
+				feat->aff_x = xloc - (int) xloc + (tc->affine_window_width + border) / 2;
+				feat->aff_y = yloc - (int) yloc + (tc->affine_window_height + border) / 2;;
+			} else {
+				/* affine tracking */
+				val = _am_trackFeatureAffine(feat->aff_x, feat->aff_y,
+				                             &xlocout, &ylocout,
+				                             feat->aff_img,
+				                             feat->aff_img_gradx,
+				                             feat->aff_img_grady,
+				                             job->pyramid2->img[0],
+				                             job->pyramid2_gradx->img[0], job->pyramid2_grady->img[0],
+				                             tc->affine_window_width, tc->affine_window_height,
+				                             tc->step_factor,
+				                             tc->affine_max_iterations,
+				                             tc->min_determinant,
+				                             tc->min_displacement,
+				                             tc->affine_min_displacement,
+				                             tc->affine_max_residue,
+				                             tc->lighting_insensitive,
+				                             tc->affineConsistencyCheck,
+				                             tc->affine_max_displacement_differ,
+				                             &feat->aff_Axx,
+				                             &feat->aff_Ayx,
+				                             &feat->aff_Axy,
+				                             &feat->aff_Ayy,
+				                             imgdiff, gradx, grady
+				                            );
+				feat->val = val;
+				if (val != KLT_TRACKED) {
+					feat->x   = -1.0;
+					feat->y   = -1.0;
+					feat->aff_x = -1.0;
+					feat->aff_y = -1.0;
+					/* release image and gradient for lost feature */
+					_releaseAffineTemplates(feat);
+				} else {
+					/*feat->x = xlocout;*/
+					/*feat->y = ylocout;*/
+				}
+			}
+			_KLT_PROFILE_LAP(times, KLT_STAGE_AFFINE, taffine);
+		}
+
+	}
+
+	_KLTStoreFeature(features, indx, feat);
+}
+
+
+/*********************************************************************
+ * _trackFeatureAtIndex
+ *
+ * Tracks feature indx of the view through the pyramids and records
+ * the result in the feature.  The time spent is summed into times.
+ */
+
+static void _trackFeatureAtIndex(
+        _TrackJob *job,
+        int indx,
+        _FloatWindow imgdiff,   /* scratch windows */
+        _FloatWindow gradx,
+        _FloatWindow grady,
+        _KLT_ProfileTimes *times)
+{
+	KLT_TrackingContext tc = job->tc;
+	float subsampling = (float) tc->subsampling;
+	float xloc, yloc, xlocout, ylocout;
+	int val = 0;
+	int r;
+
+	/* Only track features that are not lost */
+	if (FV_VAL(job->features, indx) < 0)  return;
+
+	xloc = FV_X(job->features, indx);
+	yloc = FV_Y(job->features, indx);
+
+	/* Transform location to coarsest resolution */
+	for (r = tc->nPyramidLevels - 1 ; r >= 0 ; r--)  {
+		xloc /= subsampling;  yloc /= subsampling;
+	}
+	xlocout = xloc;  ylocout = yloc;
+
+	/* Beginning with coarsest resolution, do ... */
+	for (r = tc->nPyramidLevels - 1 ; r >= 0 ; r--)  {
+
+		/* Track feature at current resolution */
+		_KLT_PROFILE_START(tlevel);
+		xloc *= subsampling;  yloc *= subsampling;
+		xlocout *= subsampling;  ylocout *= subsampling;
+
+		if (job->fixed1 != NULL)
+			val = _trackFeatureFixed(xloc, yloc,
+			                         &xlocout, &ylocout,
+			                         job->fixed1->img[r],
+			                         job->fixed1_gradx->img[r], job->fixed1_grady->img[r],
+			                         job->fixed2->img[r],
+			                         job->fixed2_gradx->img[r], job->fixed2_grady->img[r],
+			                         tc->window_width, tc->window_height,
+			                         tc->step_factor,
+			                         tc->max_iterations,
+			                         tc->min_determinant,
+			                         tc->min_displacement,
+			                         tc->max_residue,
+			                         r == 0);
+		else  {
+			_SearchBox box;
+			_TileFetch fetch;
+			_setupSearchBox(job, xloc, yloc, r, &box);
+			fetch.tiles1 = job->tiles1;
+			fetch.tiles2 = job->tiles2;
+			fetch.level = r;
+			fetch.times = times;
+			val = _trackFeature(xloc, yloc,
+			                    &xlocout, &ylocout,
+			                    job->pyramid1->img[r],
+			                    job->pyramid1_gradx->img[r], job->pyramid1_grady->img[r],
+			                    job->pyramid2->img[r],
+			                    job->pyramid2_gradx->img[r], job->pyramid2_grady->img[r],
+			                    &box, job->tiles1 != NULL ? &fetch : NULL,
+			                    job->kernels,
+			                    tc->window_width, tc->window_height,
+			                    tc->step_factor,
+			                    tc->max_iterations,
+			                    tc->min_determinant,
+			                    tc->min_displacement,
+			                    tc->max_residue,
+			                    tc->lighting_insensitive,
+			                    r == 0,   /* coarser results are superseded */
+			                    imgdiff, gradx, grady);
+		}
+		_KLT_PROFILE_LAP(times, _KLT_PROFILE_LEVEL(r), tlevel);
+
+		if (val == KLT_SMALL_DET || val == KLT_OOB)
+			break;
+	}
+
+	_recordFeature(job, indx, val, xloc, yloc, xlocout, ylocout,
+	               imgdiff, gradx, grady, times);
+}
+
+
+/*********************************************************************
+ * _trackFeatureGroup
+ *
+ * Tracks the n (at most LOCKSTEP_LANES) features listed in indx
+ * through the pyramids in lockstep, and records the results.  The
+ * time spent is summed into times.
+ */
+
+static void _trackFeatureGroup(
+        _TrackJob *job,
+        const int *indx,
+        int n,
+        _FloatWindow imgdiff,   /* scratch windows */
+        _FloatWindow gradx,
+        _FloatWindow grady,
+        _KLT_ProfileTimes *times)
+{
+	KLT_TrackingContext tc = job->tc;
+	float subsampling = (float) tc->subsampling;
+	float xloc[LOCKSTEP_LANES], yloc[LOCKSTEP_LANES];
+	float xlocout[LOCKSTEP_LANES], ylocout[LOCKSTEP_LANES];
+	_SearchBox box[LOCKSTEP_LANES];
+	_TileFetch fetch;
+	int val[LOCKSTEP_LANES];
+	int l, r;
+
+	for (l = 0 ; l < LOCKSTEP_LANES ; l++)  {
+		if (l < n)  {
+			xloc[l] = FV_X(job->features, indx[l]);
+			yloc[l] = FV_Y(job->features, indx[l]);
+			/* Transform location to coarsest resolution */
+			for (r = tc->nPyramidLevels - 1 ; r >= 0 ; r--)  {
+				xloc[l] /= subsampling;  yloc[l] /= subsampling;
+			}
+			val[l] = KLT_TRACKED;
+		} else  {
+			xloc[l] = yloc[l] = 0.0f;
+			val[l] = KLT_NOT_FOUND;   /* empty lane */
+		}
+		xlocout[l] = xloc[l];  ylocout[l] = yloc[l];
+	}
+
+	/* Beginning with coarsest resolution, do ... */
+	for (r = tc->nPyramidLevels - 1 ; r >= 0 ; r--)  {
+
+		/* Lanes lost at a coarser level are not tracked any further */
+		_KLT_PROFILE_START(tlevel);
+		for (l = 0 ; l < LOCKSTEP_LANES ; l++)  {
+			if (val[l] == KLT_SMALL_DET || val[l] == KLT_OOB ||
+			    val[l] == KLT_NOT_FOUND)  continue;
+			xloc[l] *= subsampling;  yloc[l] *= subsampling;
+			xlocout[l] *= subsampling;  ylocout[l] *= subsampling;
+			val[l] = KLT_TRACKED;
+		}
+		for (l = 0 ; l < LOCKSTEP_LANES ; l++)
+			_setupSearchBox(job, xloc[l], yloc[l], r, &box[l]);
+		fetch.tiles1 = job->tiles1;
+		fetch.tiles2 = job->tiles2;
+		fetch.level = r;
+		fetch.times = times;
+
+		job->kernels->trackFeatureLanes(xloc, yloc, xlocout, ylocout, val,
+		                                job->pyramid1->img[r],
+		                                job->pyramid1_gradx->img[r], job->pyramid1_grady->img[r],
+		                                job->pyramid2->img[r],
+		                                job->pyramid2_gradx->img[r], job->pyramid2_grady->img[r],
+		                                box, job->tiles1 != NULL ? &fetch : NULL,
+		                                tc->window_width, tc->window_height,
+		                                tc->step_factor,
+		                                tc->max_iterations,
+		                                tc->min_determinant,
+		                                tc->min_displacement,
+		                                tc->max_residue,
+		                                r == 0);   /* coarser results are superseded */
+		_KLT_PROFILE_LAP(times, _KLT_PROFILE_LEVEL(r), tlevel);
+	}
+
+	for (l = 0 ; l < n ; l++)
+		_recordFeature(job, indx[l], val[l], xloc[l], yloc[l],
+		               xlocout[l], ylocout[l], imgdiff, gradx, grady, times);
+}
+
+
+/*********************************************************************
+ * _trackFeatureRange
+ *
+ * Called by _KLTParallelFor for the features [begin, end).  The times
+ * of the features are summed, and added to the profile once.
+ */
+
+static void _trackFeatureRange(
+        void *arg,
+        int begin,
+        int end,
+        int thread)
+{
+	_TrackJob *job = (_TrackJob *) arg;
+	float *scratch = job->scratch + 3 * job->wsize * thread;
+	_KLT_ProfileTimes times = {{0}};
+	int group[LOCKSTEP_LANES];
+	int n = 0;
+	int indx;
+
+	/* Lighting-insensitive and fixed-point tracking have no lockstep kernel */
+	if (!job->tc->lockstepTracking || job->tc->lighting_insensitive ||
+	    job->fixed1 != NULL)  {
+		for (indx = begin ; indx < end ; indx++)
+			_trackFeatureAtIndex(job, indx,
+			                     scratch, scratch + job->wsize, scratch + 2 * job->wsize,
+			                     &times);
+	} else  {
+		/* Gather the features that are not lost into groups of lanes */
+		for (indx = begin ; indx < end ; indx++)  {
+			if (FV_VAL(job->features, indx) < 0)  continue;
+			group[n++] = indx;
+			if (n == LOCKSTEP_LANES)  {
+				_trackFeatureGroup(job, group, n,
+				                   scratch, scratch + job->wsize, scratch + 2 * job->wsize,
+				                   &times);
+				n = 0;
+			}
+		}
+		if (n > 0)
+			_trackFeatureGroup(job, group, n,
+			                   scratch, scratch + job->wsize, scratch + 2 * job->wsize,
+			                   &times);
+	}
+
+	_KLTProfileFlush(job->tc->profile, &times);
+}
+
+
+
+/*********************************************************************
+ * _trackFeatures
+ *
+ * Tracks the features of a view from one image to the next.
+ */
+
+static void _trackFeatures(
         KLT_TrackingContext tc,
         KLT_PixelType *img1,
         KLT_PixelType *img2,
         int ncols,
         int nrows,
-        KLT_FeatureList featurelist)
+        _KLT_FeatureView features)
 {
-	_KLT_FloatImage tmpimg, floatimg1, floatimg2;
+	_KLT_FloatImage tmpimg, floatimg1, floatimg2 = NULL;
 	_KLT_Pyramid pyramid1, pyramid1_gradx, pyramid1_grady,
 	             pyramid2, pyramid2_gradx, pyramid2_grady;
+	_KLT_FixedPyramid fixed_last, fixed_last_gradx, fixed_last_grady;
 	float subsampling = (float) tc->subsampling;
-	float xloc, yloc, xlocout, ylocout;
-	int val = 0;
-	int indx, r;
 	KLT_BOOL floatimg1_created = FALSE;
+	KLT_BOOL tiled, roi, lazy;
 	int i;
 
-	if (KLT_verbose >= 1)  {
+	if (tc->verbose >= 1)  {
 		fprintf(stderr,  "(KLT) Tracking %d features in a %d by %d image...  ",
-		        KLTCountRemainingFeatures(featurelist), ncols, nrows);
+		        _KLTCountRemainingFeatures(features), ncols, nrows);
 		fflush(stderr);
 	}
 
@@ -1311,9 +2950,36 @@ void KLTTrackFeatures(
 		           "Changing to %d.\n", tc->window_height);
 	}
 
+	/* The pyramids are computed in tiles, around the features or as */
+	/* windows read them, in float only */
+	tiled = !tc->fixedPointTracking && !tc->halfPrecisionPyramids &&
+	        tc->affineConsistencyCheck < 0;
+	roi = tc->roiPyramids && tiled;
+	lazy = tc->lazyGradients && tiled;
+
 	/* Create temporary image */
 	tmpimg = _KLTCreateFloatImage(ncols, nrows);
 
+	/* The pyramids of the last image are stale if they are not stored */
+	/* as requested */
+	if (tc->pyramid_last != NULL &&
+	    (((_KLT_Pyramid) tc->pyramid_last)->img[0]->half != NULL) !=
+	    (tc->halfPrecisionPyramids != FALSE))  {
+		_KLTFreePyramid((_KLT_Pyramid) tc->pyramid_last);
+		_KLTFreePyramid((_KLT_Pyramid) tc->pyramid_last_gradx);
+		_KLTFreePyramid((_KLT_Pyramid) tc->pyramid_last_grady);
+		tc->pyramid_last = NULL;
+		tc->pyramid_last_gradx = NULL;
+		tc->pyramid_last_grady = NULL;
+	}
+
+	/* Fixed-point copies of the pyramids of the last image, reused */
+	/* below if the pyramids themselves are, freed otherwise        */
+	fixed_last = (_KLT_FixedPyramid) tc->fixed_last;
+	fixed_last_gradx = (_KLT_FixedPyramid) tc->fixed_last_gradx;
+	fixed_last_grady = (_KLT_FixedPyramid) tc->fixed_last_grady;
+	tc->fixed_last = tc->fixed_last_gradx = tc->fixed_last_grady = NULL;
+
 	/* Process first image by converting to float, smoothing, computing */
 	/* pyramid, and computing gradient pyramids */
 	if (tc->sequentialMode && tc->pyramid_last != NULL) {
@@ -1326,37 +2992,115 @@ void KLTTrackFeatures(
 			         ncols, nrows, pyramid1->ncols[0], pyramid1->nrows[0]);
 		assert(pyramid1_gradx != NULL);
 		assert(pyramid1_grady != NULL);
+		if (!roi && !lazy)  {
+			_KLT_PROFILE_START(tpyr);
+			_KLTCompletePyramids(img1, _KLTComputeSmoothSigma(tc),
+			                     tc->pyramid_sigma_fact, tc->grad_sigma,
+			                     pyramid1, pyramid1_gradx, pyramid1_grady);
+			_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_PYRAMID, tpyr);
+		}
+	} else if (_KLTTakePreparedFrame(tc, img1, ncols, nrows,
+	                                 &pyramid1, &pyramid1_gradx, &pyramid1_grady))  {
+		/* Built ahead by KLTPrepareFrame */
+	} else if (roi)  {
+		pyramid1 = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+		pyramid1_gradx = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+		pyramid1_grady = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+		_KLTTilePyramid(pyramid1);
+		_KLTTilePyramid(pyramid1_gradx);
+		_KLTTilePyramid(pyramid1_grady);
 	} else {
 		floatimg1_created = TRUE;
 		floatimg1 = _KLTCreateFloatImage(ncols, nrows);
+		_KLT_PROFILE_START(tfloat);
 		_KLTToFloatImage(img1, ncols, nrows, tmpimg);
+		_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_TO_FLOAT, tfloat);
+		_KLT_PROFILE_START(tsmooth);
 		_KLTComputeSmoothedImage(tmpimg, _KLTComputeSmoothSigma(tc), floatimg1);
-		pyramid1 = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
-		_KLTComputePyramid(floatimg1, pyramid1, tc->pyramid_sigma_fact);
-		pyramid1_gradx = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
-		pyramid1_grady = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
-		for (i = 0 ; i < tc->nPyramidLevels ; i++)
-			_KLTComputeGradients(pyramid1->img[i], tc->grad_sigma,
-			                     pyramid1_gradx->img[i],
-			                     pyramid1_grady->img[i]);
+		_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_SMOOTH, tsmooth);
+		if (tc->halfPrecisionPyramids)  {
+			pyramid1 = _KLTCreateHalfPyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+			pyramid1_gradx = _KLTCreateHalfPyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+			pyramid1_grady = _KLTCreateHalfPyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+			_KLTComputeHalfPyramids(floatimg1, tc->pyramid_sigma_fact, tc->grad_sigma,
+			                        pyramid1, pyramid1_gradx, pyramid1_grady, tc->profile);
+		} else  {
+			pyramid1 = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+			_KLT_PROFILE_START(tpyr);
+			_KLTComputePyramid(floatimg1, pyramid1, tc->pyramid_sigma_fact);
+			_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_PYRAMID, tpyr);
+			pyramid1_gradx = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+			pyramid1_grady = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+			if (lazy)  {
+				_KLTTilePyramid(pyramid1_gradx);
+				_KLTTilePyramid(pyramid1_grady);
+			} else  {
+				_KLT_PROFILE_START(tgrad);
+				for (i = 0 ; i < tc->nPyramidLevels ; i++)
+					_KLTComputeGradients(pyramid1->img[i], tc->grad_sigma,
+					                     pyramid1_gradx->img[i],
+					                     pyramid1_grady->img[i]);
+				_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_GRADIENTS, tgrad);
+			}
+		}
 	}
 
-	/* Do the same thing with second image */
-	floatimg2 = _KLTCreateFloatImage(ncols, nrows);
-	_KLTToFloatImage(img2, ncols, nrows, tmpimg);
-	_KLTComputeSmoothedImage(tmpimg, _KLTComputeSmoothSigma(tc), floatimg2);
-	pyramid2 = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
-	_KLTComputePyramid(floatimg2, pyramid2, tc->pyramid_sigma_fact);
-	pyramid2_gradx = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
-	pyramid2_grady = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
-	for (i = 0 ; i < tc->nPyramidLevels ; i++)
-		_KLTComputeGradients(pyramid2->img[i], tc->grad_sigma,
-		                     pyramid2_gradx->img[i],
-		                     pyramid2_grady->img[i]);
+	/* Do the same thing with second image, unless built ahead */
+	/* by KLTPrepareFrame */
+	if (!_KLTTakePreparedFrame(tc, img2, ncols, nrows,
+	                           &pyramid2, &pyramid2_gradx, &pyramid2_grady))  {
+		if (roi)  {
+			pyramid2 = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+			pyramid2_gradx = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+			pyramid2_grady = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+			_KLTTilePyramid(pyramid2);
+			_KLTTilePyramid(pyramid2_gradx);
+			_KLTTilePyramid(pyramid2_grady);
+		} else  {
+			floatimg2 = _KLTCreateFloatImage(ncols, nrows);
+			_KLT_PROFILE_START(tfloat);
+			_KLTToFloatImage(img2, ncols, nrows, tmpimg);
+			_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_TO_FLOAT, tfloat);
+			_KLT_PROFILE_START(tsmooth);
+			_KLTComputeSmoothedImage(tmpimg, _KLTComputeSmoothSigma(tc), floatimg2);
+			_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_SMOOTH, tsmooth);
+			if (tc->halfPrecisionPyramids)  {
+				pyramid2 = _KLTCreateHalfPyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+				pyramid2_gradx = _KLTCreateHalfPyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+				pyramid2_grady = _KLTCreateHalfPyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+				_KLTComputeHalfPyramids(floatimg2, tc->pyramid_sigma_fact, tc->grad_sigma,
+				                        pyramid2, pyramid2_gradx, pyramid2_grady, tc->profile);
+			} else  {
+				pyramid2 = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+				_KLT_PROFILE_START(tpyr);
+				_KLTComputePyramid(floatimg2, pyramid2, tc->pyramid_sigma_fact);
+				_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_PYRAMID, tpyr);
+				pyramid2_gradx = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+				pyramid2_grady = _KLTCreatePyramid(ncols, nrows, (int) subsampling, tc->nPyramidLevels);
+				if (lazy)  {
+					_KLTTilePyramid(pyramid2_gradx);
+					_KLTTilePyramid(pyramid2_grady);
+				} else  {
+					_KLT_PROFILE_START(tgrad);
+					for (i = 0 ; i < tc->nPyramidLevels ; i++)
+						_KLTComputeGradients(pyramid2->img[i], tc->grad_sigma,
+						                     pyramid2_gradx->img[i],
+						                     pyramid2_grady->img[i]);
+					_KLT_PROFILE_STOP(tc->profile, KLT_STAGE_GRADIENTS, tgrad);
+				}
+			}
+		}
+	}
 
 	/* Write internal images */
 	if (tc->writeInternalImages)  {
 		char fname[80];
+		_KLTCompletePyramids(img1, _KLTComputeSmoothSigma(tc),
+		                     tc->pyramid_sigma_fact, tc->grad_sigma,
+		                     pyramid1, pyramid1_gradx, pyramid1_grady);
+		_KLTCompletePyramids(img2, _KLTComputeSmoothSigma(tc),
+		                     tc->pyramid_sigma_fact, tc->grad_sigma,
+		                     pyramid2, pyramid2_gradx, pyramid2_grady);
 		for (i = 0 ; i < tc->nPyramidLevels ; i++)  {
 			sprintf(fname, "kltimg_tf_i%d.pgm", i);
 			_KLTWriteFloatImageToPGM(pyramid1->img[i], fname);
@@ -1373,166 +3117,103 @@ void KLTTrackFeatures(
 		}
 	}
 
-	/* For each feature, do ... */
-	for (indx = 0 ; indx < featurelist->nFeatures ; indx++)  {
-
-		/* Only track features that are not lost */
-		if (featurelist->feature[indx]->val >= 0)  {
-
-			xloc = featurelist->feature[indx]->x;
-			yloc = featurelist->feature[indx]->y;
-
-			/* Transform location to coarsest resolution */
-			for (r = tc->nPyramidLevels - 1 ; r >= 0 ; r--)  {
-				xloc /= subsampling;  yloc /= subsampling;
+	/* Track the features, on several threads if requested */
+	{
+		_TrackJob job;
+		_KLT_ThreadPool pool = _getThreadPool(tc);
+		int nThreads = _KLTThreadPoolSize(pool);
+		int wsize = max(tc->window_width * tc->window_height,
+		                tc->affine_window_width * tc->affine_window_height);
+
+		job.tc = tc;
+		job.features = features;
+		job.ncols = ncols;
+		job.nrows = nrows;
+		job.pyramid1 = pyramid1;
+		job.pyramid1_gradx = pyramid1_gradx;
+		job.pyramid1_grady = pyramid1_grady;
+		job.pyramid2 = pyramid2;
+		job.pyramid2_gradx = pyramid2_gradx;
+		job.pyramid2_grady = pyramid2_grady;
+		job.fixed1 = job.fixed1_gradx = job.fixed1_grady = NULL;
+		job.fixed2 = job.fixed2_gradx = job.fixed2_grady = NULL;
+		job.roi = roi;
+		job.tiles1 = job.tiles2 = NULL;
+		job.kernels = (pyramid1->img[0]->half != NULL) ? &_halfKernels : &_floatKernels;
+		job.wsize = wsize;
+		job.scratch = _allocateFloatWindow(3 * wsize, nThreads);
+
+		/* Only compute the pyramids where the features will be tracked, */
+		/* up front or as they are tracked */
+		if (lazy)  {
+			job.tiles1 = _KLTCreateTileBuilder(img1, _KLTComputeSmoothSigma(tc),
+			                                   tc->pyramid_sigma_fact, tc->grad_sigma,
+			                                   pyramid1, pyramid1_gradx, pyramid1_grady);
+			job.tiles2 = _KLTCreateTileBuilder(img2, _KLTComputeSmoothSigma(tc),
+			                                   tc->pyramid_sigma_fact, tc->grad_sigma,
+			                                   pyramid2, pyramid2_gradx, pyramid2_grady);
+		} else if (roi)
+			_computeRegionsOfInterest(&job, img1, img2);
+
+		/* Fixed-point copies of the pyramids, of the first image kept */
+		/* from the last call in sequential mode.  Lighting-insensitive */
+		/* tracking and larger windows are done in float                */
+		if (tc->fixedPointTracking && !tc->lighting_insensitive)  {
+			if (tc->window_width * tc->window_height > FIXED_MAX_WINDOW)
+				KLTWarning("Tracking context's window is too large for fixed-point "
+				           "tracking (at most %d pixels).  Tracking in float.\n",
+				           FIXED_MAX_WINDOW);
+			else  {
+				if (fixed_last != NULL && pyramid1 == tc->pyramid_last)  {
+					job.fixed1 = fixed_last;
+					job.fixed1_gradx = fixed_last_gradx;
+					job.fixed1_grady = fixed_last_grady;
+					fixed_last = NULL;
+				} else  {
+					job.fixed1 = _KLTCreateFixedPyramid(pyramid1, FIXED_IMG_BITS);
+					job.fixed1_gradx = _KLTCreateFixedPyramid(pyramid1_gradx, FIXED_IMG_BITS);
+					job.fixed1_grady = _KLTCreateFixedPyramid(pyramid1_grady, FIXED_IMG_BITS);
+				}
+				job.fixed2 = _KLTCreateFixedPyramid(pyramid2, FIXED_IMG_BITS);
+				job.fixed2_gradx = _KLTCreateFixedPyramid(pyramid2_gradx, FIXED_IMG_BITS);
+				job.fixed2_grady = _KLTCreateFixedPyramid(pyramid2_grady, FIXED_IMG_BITS);
 			}
-			xlocout = xloc;  ylocout = yloc;
+		}
 
-			/* Beginning with coarsest resolution, do ... */
-			for (r = tc->nPyramidLevels - 1 ; r >= 0 ; r--)  {
+		/* Templates are taken from the slab while tracking */
+		if (tc->affineConsistencyCheck >= 0)
+			_KLTReserveAffineSlab(features->slab, features->nFeatures,
+			                      tc->affine_window_width + _KLT_AFFINE_BORDER,
+			                      tc->affine_window_height + _KLT_AFFINE_BORDER);
 
-				/* Track feature at current resolution */
-				xloc *= subsampling;  yloc *= subsampling;
-				xlocout *= subsampling;  ylocout *= subsampling;
-
-				val = _trackFeature(xloc, yloc,
-				                    &xlocout, &ylocout,
-				                    pyramid1->img[r],
-				                    pyramid1_gradx->img[r], pyramid1_grady->img[r],
-				                    pyramid2->img[r],
-				                    pyramid2_gradx->img[r], pyramid2_grady->img[r],
-				                    tc->window_width, tc->window_height,
-				                    tc->step_factor,
-				                    tc->max_iterations,
-				                    tc->min_determinant,
-				                    tc->min_displacement,
-				                    tc->max_residue,
-				                    tc->lighting_insensitive);
-
-				if (val == KLT_SMALL_DET || val == KLT_OOB)
-					break;
-			}
+		_KLTParallelFor(pool, features->nFeatures, TRACK_GRAIN,
+		                _trackFeatureRange, &job);
 
-			/* Record feature */
-			if (val == KLT_OOB) {
-				featurelist->feature[indx]->x   = -1.0;
-				featurelist->feature[indx]->y   = -1.0;
-				featurelist->feature[indx]->val = KLT_OOB;
-				if ( featurelist->feature[indx]->aff_img ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img);
-				if ( featurelist->feature[indx]->aff_img_gradx ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_gradx);
-				if ( featurelist->feature[indx]->aff_img_grady ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_grady);
-				featurelist->feature[indx]->aff_img = NULL;
-				featurelist->feature[indx]->aff_img_gradx = NULL;
-				featurelist->feature[indx]->aff_img_grady = NULL;
-
-			} else if (_outOfBounds(xlocout, ylocout, ncols, nrows, tc->borderx, tc->bordery))  {
-				featurelist->feature[indx]->x   = -1.0;
-				featurelist->feature[indx]->y   = -1.0;
-				featurelist->feature[indx]->val = KLT_OOB;
-				if ( featurelist->feature[indx]->aff_img ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img);
-				if ( featurelist->feature[indx]->aff_img_gradx ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_gradx);
-				if ( featurelist->feature[indx]->aff_img_grady ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_grady);
-				featurelist->feature[indx]->aff_img = NULL;
-				featurelist->feature[indx]->aff_img_gradx = NULL;
-				featurelist->feature[indx]->aff_img_grady = NULL;
-			} else if (val == KLT_SMALL_DET)  {
-				featurelist->feature[indx]->x   = -1.0;
-				featurelist->feature[indx]->y   = -1.0;
-				featurelist->feature[indx]->val = KLT_SMALL_DET;
-				if ( featurelist->feature[indx]->aff_img ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img);
-				if ( featurelist->feature[indx]->aff_img_gradx ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_gradx);
-				if ( featurelist->feature[indx]->aff_img_grady ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_grady);
-				featurelist->feature[indx]->aff_img = NULL;
-				featurelist->feature[indx]->aff_img_gradx = NULL;
-				featurelist->feature[indx]->aff_img_grady = NULL;
-			} else if (val == KLT_LARGE_RESIDUE)  {
-				featurelist->feature[indx]->x   = -1.0;
-				featurelist->feature[indx]->y   = -1.0;
-				featurelist->feature[indx]->val = KLT_LARGE_RESIDUE;
-				if ( featurelist->feature[indx]->aff_img ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img);
-				if ( featurelist->feature[indx]->aff_img_gradx ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_gradx);
-				if ( featurelist->feature[indx]->aff_img_grady ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_grady);
-				featurelist->feature[indx]->aff_img = NULL;
-				featurelist->feature[indx]->aff_img_gradx = NULL;
-				featurelist->feature[indx]->aff_img_grady = NULL;
-			} else if (val == KLT_MAX_ITERATIONS)  {
-				featurelist->feature[indx]->x   = -1.0;
-				featurelist->feature[indx]->y   = -1.0;
-				featurelist->feature[indx]->val = KLT_MAX_ITERATIONS;
-				if ( featurelist->feature[indx]->aff_img ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img);
-				if ( featurelist->feature[indx]->aff_img_gradx ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_gradx);
-				if ( featurelist->feature[indx]->aff_img_grady ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_grady);
-				featurelist->feature[indx]->aff_img = NULL;
-				featurelist->feature[indx]->aff_img_gradx = NULL;
-				featurelist->feature[indx]->aff_img_grady = NULL;
+		free(job.scratch);
+		if (job.tiles1 != NULL)  {
+			_KLTFreeTileBuilder(job.tiles1);
+			_KLTFreeTileBuilder(job.tiles2);
+		}
+		if (job.fixed1 != NULL)  {
+			_KLTFreeFixedPyramid(job.fixed1);
+			_KLTFreeFixedPyramid(job.fixed1_gradx);
+			_KLTFreeFixedPyramid(job.fixed1_grady);
+			if (tc->sequentialMode)  {
+				tc->fixed_last = job.fixed2;
+				tc->fixed_last_gradx = job.fixed2_gradx;
+				tc->fixed_last_grady = job.fixed2_grady;
 			} else  {
-				featurelist->feature[indx]->x = xlocout;
-				featurelist->feature[indx]->y = ylocout;
-				featurelist->feature[indx]->val = KLT_TRACKED;
-				if (tc->affineConsistencyCheck >= 0 && val == KLT_TRACKED)  { /*for affine mapping*/
-					int border = 2; /* add border for interpolation */
-
-#ifdef DEBUG_AFFINE_MAPPING
-					glob_index = indx;
-#endif
-
-					if (!featurelist->feature[indx]->aff_img) {
-						/* save image and gradient for each feature at finest resolution after first successful track */
-						featurelist->feature[indx]->aff_img = _KLTCreateFloatImage((tc->affine_window_width + border), (tc->affine_window_height + border));
-						featurelist->feature[indx]->aff_img_gradx = _KLTCreateFloatImage((tc->affine_window_width + border), (tc->affine_window_height + border));
-						featurelist->feature[indx]->aff_img_grady = _KLTCreateFloatImage((tc->affine_window_width + border), (tc->affine_window_height + border));
-						_am_getSubFloatImage(pyramid1->img[0], xloc, yloc, featurelist->feature[indx]->aff_img);
-						_am_getSubFloatImage(pyramid1_gradx->img[0], xloc, yloc, featurelist->feature[indx]->aff_img_gradx);
-						_am_getSubFloatImage(pyramid1_grady->img[0], xloc, yloc, featurelist->feature[indx]->aff_img_grady);
-						featurelist->feature[indx]->aff_x = xloc - (int) xloc + (tc->affine_window_width + border) / 2;
-						featurelist->feature[indx]->aff_y = yloc - (int) yloc + (tc->affine_window_height + border) / 2;;
-					} else {
-						/* affine tracking */
-						val = _am_trackFeatureAffine(featurelist->feature[indx]->aff_x, featurelist->feature[indx]->aff_y,
-						                             &xlocout, &ylocout,
-						                             featurelist->feature[indx]->aff_img,
-						                             featurelist->feature[indx]->aff_img_gradx,
-						                             featurelist->feature[indx]->aff_img_grady,
-						                             pyramid2->img[0],
-						                             pyramid2_gradx->img[0], pyramid2_grady->img[0],
-						                             tc->affine_window_width, tc->affine_window_height,
-						                             tc->step_factor,
-						                             tc->affine_max_iterations,
-						                             tc->min_determinant,
-						                             tc->min_displacement,
-						                             tc->affine_min_displacement,
-						                             tc->affine_max_residue,
-						                             tc->lighting_insensitive,
-						                             tc->affineConsistencyCheck,
-						                             tc->affine_max_displacement_differ,
-						                             &featurelist->feature[indx]->aff_Axx,
-						                             &featurelist->feature[indx]->aff_Ayx,
-						                             &featurelist->feature[indx]->aff_Axy,
-						                             &featurelist->feature[indx]->aff_Ayy
-						                            );
-						featurelist->feature[indx]->val = val;
-						if (val != KLT_TRACKED) {
-							featurelist->feature[indx]->x   = -1.0;
-							featurelist->feature[indx]->y   = -1.0;
-							featurelist->feature[indx]->aff_x = -1.0;
-							featurelist->feature[indx]->aff_y = -1.0;
-							/* free image and gradient for lost feature */
-							_KLTFreeFloatImage(featurelist->feature[indx]->aff_img);
-							_KLTFreeFloatImage(featurelist->feature[indx]->aff_img_gradx);
-							_KLTFreeFloatImage(featurelist->feature[indx]->aff_img_grady);
-							featurelist->feature[indx]->aff_img = NULL;
-							featurelist->feature[indx]->aff_img_gradx = NULL;
-							featurelist->feature[indx]->aff_img_grady = NULL;
-						} else {
-							/*featurelist->feature[indx]->x = xlocout;*/
-							/*featurelist->feature[indx]->y = ylocout;*/
-						}
-					}
-				}
-
+				_KLTFreeFixedPyramid(job.fixed2);
+				_KLTFreeFixedPyramid(job.fixed2_gradx);
+				_KLTFreeFixedPyramid(job.fixed2_grady);
 			}
 		}
 	}
+	if (fixed_last != NULL)  {
+		_KLTFreeFixedPyramid(fixed_last);
+		_KLTFreeFixedPyramid(fixed_last_gradx);
+		_KLTFreeFixedPyramid(fixed_last_grady);
+	}
 
 	if (tc->sequentialMode)  {
 		tc->pyramid_last = pyramid2;
@@ -1547,14 +3228,14 @@ void KLTTrackFeatures(
 	/* Free memory */
 	_KLTFreeFloatImage(tmpimg);
 	if (floatimg1_created)  _KLTFreeFloatImage(floatimg1);
-	_KLTFreeFloatImage(floatimg2);
+	if (floatimg2 != NULL)  _KLTFreeFloatImage(floatimg2);
 	_KLTFreePyramid(pyramid1);
 	_KLTFreePyramid(pyramid1_gradx);
 	_KLTFreePyramid(pyramid1_grady);
 
-	if (KLT_verbose >= 1)  {
+	if (tc->verbose >= 1)  {
 		fprintf(stderr,  "\n\t%d features successfully tracked.\n",
-		        KLTCountRemainingFeatures(featurelist));
+		        _KLTCountRemainingFeatures(features));
 		if (tc->writeInternalImages)
 			fprintf(stderr,  "\tWrote images to 'kltimg_tf*.pgm'.\n");
 		fflush(stderr);
@@ -1563,3 +3244,40 @@ void KLTTrackFeatures(
 }
 
 
+/*********************************************************************
+ * KLTTrackFeatures
+ * KLTTrackFeatureArrays
+ *
+ * Tracks feature points from one image to the next.
+ */
+
+void KLTTrackFeatures(
+        KLT_TrackingContext tc,
+        KLT_PixelType *img1,
+        KLT_PixelType *img2,
+        int ncols,
+        int nrows,
+        KLT_FeatureList featurelist)
+{
+	_KLT_FeatureViewRec view;
+
+	_KLTOpenFeatureListView(featurelist, &view);
+	_trackFeatures(tc, img1, img2, ncols, nrows, &view);
+}
+
+
+void KLTTrackFeatureArrays(
+        KLT_TrackingContext tc,
+        KLT_PixelType *img1,
+        KLT_PixelType *img2,
+        int ncols,
+        int nrows,
+        KLT_FeatureArrays fa)
+{
+	_KLT_FeatureViewRec view;
+
+	_KLTViewFeatureArrays(fa, &view);
+	_trackFeatures(tc, img1, img2, ncols, nrows, &view);
+}
+
+
@@ -0,0 +1,157 @@
+/*********************************************************************
+ * trackSequence.c
+ *
+ * Tracks features through a whole sequence of frames in one call.
+ * The tracking context is put in sequential mode for the duration,
+ * so that the pyramids of each frame are built once and kept for the
+ * next pair, and the pyramids of the next frame are built by
+ * KLTPrepareFrame while the features are tracked into the current
+ * one.  Per-frame messages are turned off; a single line is printed
+ * at the end instead.
+ *********************************************************************/
+
+/* Standard includes */
+#include <limits.h>		/* INT_MAX */
+#include <stdio.h>
+
+/* Our includes */
+#include "error.h"
+#include "klt.h"
+
+
+typedef struct  {
+  KLT_PixelType **imgs;
+  int nImages;
+  int next;
+}  _ImageArray;
+
+
+/*********************************************************************
+ * _nextImage
+ * _keepImage
+ *
+ * Frame functions over an array of images, which are not released.
+ */
+
+static KLT_PixelType *_nextImage(
+  void *arg)
+{
+  _ImageArray *a = (_ImageArray *) arg;
+
+  return (a->next < a->nImages) ? a->imgs[a->next++] : NULL;
+}
+
+
+static void _keepImage(
+  void *arg,
+  KLT_PixelType *img)
+{
+}
+
+
+/*********************************************************************
+ * KLTTrackFeatureSource
+ *
+ * Tracks the features of fl, which are in the first frame returned
+ * by next (e.g., selected there by KLTSelectGoodFeatures), through
+ * every frame that follows until next returns NULL.  The features
+ * of frame i are stored in column i of ft, if ft is not NULL, and
+ * the lost ones are replaced after each frame if replace is TRUE.
+ * With ft, no more than ft->nFrames frames are read; the rest are
+ * left with the source.
+ * Each frame is passed to release (may be NULL) once it is no longer
+ * needed; at most three frames are held at a time.
+ *
+ * On return, tc is back in its own mode; if it is in sequential
+ * mode, it holds the pyramids of the last frame.  Returns the number
+ * of frames read.
+ */
+
+int KLTTrackFeatureSource(
+  KLT_TrackingContext tc,
+  KLT_NextFrameFunc next,
+  KLT_ReleaseFrameFunc release,
+  void *arg,
+  int ncols,
+  int nrows,
+  KLT_FeatureList fl,
+  KLT_FeatureTable ft,
+  KLT_BOOL replace)
+{
+  KLT_BOOL sequentialMode = tc->sequentialMode;
+  int verbose = tc->verbose;
+  int nFrames = (ft != NULL) ? ft->nFrames : INT_MAX;
+  KLT_PixelType *img1, *img2, *img3;
+  int i;
+
+  if (nFrames < 1)
+    KLTError("(KLTTrackFeatureSource) Feature table has no frames");
+  if (release == NULL)  release = _keepImage;
+  if ((img1 = next(arg)) == NULL)  return 0;
+
+  /* The first frame need not be the last one tracked with tc */
+  if (tc->pyramid_last != NULL)  KLTStopSequentialMode(tc);
+  tc->sequentialMode = TRUE;
+  tc->verbose = 0;
+
+  img2 = (nFrames > 1) ? next(arg) : NULL;
+  if (img2 != NULL)
+    KLTPrepareFrame(tc, img2, ncols, nrows);
+  if (ft != NULL)
+    KLTStoreFeatureList(fl, ft, 0);
+
+  for (i = 1 ; img2 != NULL ; i++)  {
+    img3 = (i + 1 < nFrames) ? next(arg) : NULL;
+    if (img3 != NULL)
+      KLTPrepareFrame(tc, img3, ncols, nrows);
+    KLTTrackFeatures(tc, img1, img2, ncols, nrows, fl);
+    if (replace)
+      KLTReplaceLostFeatures(tc, img2, ncols, nrows, fl);
+    if (ft != NULL)
+      KLTStoreFeatureList(fl, ft, i);
+    release(arg, img1);
+    img1 = img2;  img2 = img3;
+  }
+  release(arg, img1);
+
+  tc->verbose = verbose;
+  if (!sequentialMode && tc->pyramid_last != NULL)
+    KLTStopSequentialMode(tc);
+  tc->sequentialMode = sequentialMode;
+
+  if (tc->verbose >= 1)
+    fprintf(stderr, "(KLT) Tracked %d features through %d frames, "
+            "%d remaining\n", fl->nFeatures, i, KLTCountRemainingFeatures(fl));
+
+  return i;
+}
+
+
+/*********************************************************************
+ * KLTTrackFeatureSequence
+ *
+ * Same, through the nImages frames of imgs, which must all fit in ft
+ * if it is not NULL.
+ */
+
+int KLTTrackFeatureSequence(
+  KLT_TrackingContext tc,
+  KLT_PixelType **imgs,
+  int nImages,
+  int ncols,
+  int nrows,
+  KLT_FeatureList fl,
+  KLT_FeatureTable ft,
+  KLT_BOOL replace)
+{
+  _ImageArray a;
+
+  if (ft != NULL && nImages > ft->nFrames)
+    KLTError("(KLTTrackFeatureSequence) Feature table has %d frames, "
+             "fewer than the %d images", ft->nFrames, nImages);
+  a.imgs = imgs;
+  a.nImages = nImages;
+  a.next = 0;
+  return KLTTrackFeatureSource(tc, _nextImage, NULL, &a,
+                               ncols, nrows, fl, ft, replace);
+}
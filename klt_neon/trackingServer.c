@@ -0,0 +1,374 @@
+/*********************************************************************
+ * trackingServer.c
+ *
+ * Tracks the features of several streams (e.g., cameras) on one
+ * fixed pool of worker threads.  Each stream has its own tracking
+ * context and feature list, and a queue of submitted frames.  A
+ * stream with frames waiting sits in a ready list; a worker takes
+ * the stream at the front, tracks its oldest frame, and puts the
+ * stream back at the end of the list if more frames are waiting.
+ * The frames of a stream are therefore tracked one at a time and in
+ * order, while those of different streams are tracked in parallel
+ * and interleave in round-robin fashion.
+ *********************************************************************/
+
+/* Standard includes */
+#include <pthread.h>
+#include <stdlib.h>   /* malloc(), realloc() */
+#include <time.h>     /* clock_gettime() */
+
+/* Our includes */
+#include "error.h"
+#include "klt.h"
+#include "threadPool.h"   /* _KLTNumberOfCores() */
+
+
+typedef struct  {
+  KLT_TrackingContext tc;
+  KLT_FeatureList fl;
+  int ncols, nrows;
+  KLT_StreamCallback callback;
+  void *arg;
+
+  KLT_PixelType **queue;      /* frames submitted, oldest first (ring) */
+  double *submitted;          /* time of submission of each */
+  int head, count;            /* the oldest frame stays queued until tracked */
+  int maxPending;
+  KLT_PixelType *last;        /* frame tracked last */
+  int nSubmitted, nDone;
+  KLT_BOOL scheduled;         /* whether in the ready list or being tracked */
+  int next;                   /* next stream in the ready list */
+
+  /* Counters */
+  double first;               /* time of the first submission */
+  double lastDone;            /* time the last frame was tracked */
+  double sumLatency, maxLatency;
+  double busyTime;
+}  _Stream;
+
+struct _KLT_TrackingServerRec  {
+  int nThreads;
+  pthread_t *threads;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work;        /* signalled when a stream becomes ready */
+  pthread_cond_t progress;    /* signalled when a frame has been tracked */
+  _Stream **streams;
+  int nStreams;
+  int readyHead, readyTail;   /* ready list, linked through next */
+  KLT_BOOL shutdown;
+};
+
+
+/*********************************************************************
+ * _now
+ *
+ * Monotonic time, in milliseconds.
+ */
+
+static double _now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec * 1e-6;
+}
+
+
+/*********************************************************************
+ * _makeReady
+ *
+ * Appends a stream to the ready list.  The lock must be held.
+ */
+
+static void _makeReady(
+  KLT_TrackingServer ts,
+  int stream)
+{
+  ts->streams[stream]->next = -1;
+  if (ts->readyTail < 0)  ts->readyHead = stream;
+  else  ts->streams[ts->readyTail]->next = stream;
+  ts->readyTail = stream;
+  pthread_cond_signal(&ts->work);
+}
+
+
+/*********************************************************************
+ * _workerThread
+ */
+
+static void *_workerThread(
+  void *arg)
+{
+  KLT_TrackingServer ts = (KLT_TrackingServer) arg;
+  KLT_PixelType *img;
+  _Stream *s;
+  double start, end;
+  int stream, frame;
+
+  pthread_mutex_lock(&ts->lock);
+  for (;;)  {
+    while (ts->readyHead < 0 && !ts->shutdown)
+      pthread_cond_wait(&ts->work, &ts->lock);
+    if (ts->readyHead < 0)  break;   /* shutting down */
+    stream = ts->readyHead;
+    s = ts->streams[stream];
+    ts->readyHead = s->next;
+    if (ts->readyHead < 0)  ts->readyTail = -1;
+    img = s->queue[s->head];
+    frame = s->nDone;
+    pthread_mutex_unlock(&ts->lock);
+
+    /* Track without holding the lock; no other worker touches the stream */
+    start = _now();
+    if (frame == 0)
+      KLTSelectGoodFeatures(s->tc, img, s->ncols, s->nrows, s->fl);
+    else
+      KLTTrackFeatures(s->tc, s->last, img, s->ncols, s->nrows, s->fl);
+    if (s->callback != NULL)
+      s->callback(s->arg, frame, img, s->fl);
+    s->last = img;
+    end = _now();
+
+    pthread_mutex_lock(&ts->lock);
+    s->busyTime += end - start;
+    s->sumLatency += end - s->submitted[s->head];
+    if (end - s->submitted[s->head] > s->maxLatency)
+      s->maxLatency = end - s->submitted[s->head];
+    s->lastDone = end;
+    s->nDone++;
+    s->head = (s->head + 1) % s->maxPending;
+    s->count--;
+    if (s->count > 0)  _makeReady(ts, stream);
+    else  s->scheduled = FALSE;
+    pthread_cond_broadcast(&ts->progress);
+  }
+  pthread_mutex_unlock(&ts->lock);
+
+  return NULL;
+}
+
+
+/*********************************************************************
+ * KLTCreateTrackingServer
+ *
+ * Starts nThreads workers (all cores if nThreads <= 0).
+ */
+
+KLT_TrackingServer KLTCreateTrackingServer(
+  int nThreads)
+{
+  KLT_TrackingServer ts;
+  int i;
+
+  if (nThreads <= 0)  nThreads = _KLTNumberOfCores();
+
+  ts = (KLT_TrackingServer) malloc(sizeof(struct _KLT_TrackingServerRec));
+  if (ts == NULL)
+    KLTError("(KLTCreateTrackingServer) Out of memory");
+  ts->nThreads = nThreads;
+  ts->threads = (pthread_t *) malloc(nThreads * sizeof(pthread_t));
+  if (ts->threads == NULL)
+    KLTError("(KLTCreateTrackingServer) Out of memory");
+  pthread_mutex_init(&ts->lock, NULL);
+  pthread_cond_init(&ts->work, NULL);
+  pthread_cond_init(&ts->progress, NULL);
+  ts->streams = NULL;
+  ts->nStreams = 0;
+  ts->readyHead = ts->readyTail = -1;
+  ts->shutdown = FALSE;
+
+  for (i = 0 ; i < nThreads ; i++)
+    if (pthread_create(&ts->threads[i], NULL, _workerThread, ts) != 0)
+      KLTError("(KLTCreateTrackingServer) Can't start worker thread");
+
+  return ts;
+}
+
+
+/*********************************************************************
+ * KLTFreeTrackingServer
+ *
+ * Waits until all the frames submitted have been tracked, then stops
+ * the workers.  The contexts and feature lists of the streams are
+ * left to the caller.
+ */
+
+void KLTFreeTrackingServer(
+  KLT_TrackingServer ts)
+{
+  int i;
+
+  for (i = 0 ; i < ts->nStreams ; i++)
+    KLTWaitStream(ts, i);
+
+  pthread_mutex_lock(&ts->lock);
+  ts->shutdown = TRUE;
+  pthread_cond_broadcast(&ts->work);
+  pthread_mutex_unlock(&ts->lock);
+  for (i = 0 ; i < ts->nThreads ; i++)
+    pthread_join(ts->threads[i], NULL);
+
+  for (i = 0 ; i < ts->nStreams ; i++)  {
+    free(ts->streams[i]->queue);
+    free(ts->streams[i]->submitted);
+    free(ts->streams[i]);
+  }
+  free(ts->streams);
+  free(ts->threads);
+  pthread_mutex_destroy(&ts->lock);
+  pthread_cond_destroy(&ts->work);
+  pthread_cond_destroy(&ts->progress);
+  free(ts);
+}
+
+
+/*********************************************************************
+ * KLTAddStream
+ *
+ * Adds a stream of ncols x nrows frames, whose features are selected
+ * in the first frame and tracked through the others with tc, into
+ * fl.  At most maxPending frames may be submitted and not yet
+ * tracked.  After each frame, callback (if not NULL) is called on the
+ * worker with the frame number, image and features; it may use tc
+ * and fl, e.g. to store the features or to replace the lost ones.
+ *
+ * Each frame is tracked by a single worker, so tc->nThreads is set
+ * to one.  Returns the number of the stream.
+ */
+
+int KLTAddStream(
+  KLT_TrackingServer ts,
+  KLT_TrackingContext tc,
+  KLT_FeatureList fl,
+  int ncols,
+  int nrows,
+  int maxPending,
+  KLT_StreamCallback callback,
+  void *arg)
+{
+  _Stream *s;
+  _Stream **streams;
+  int stream;
+
+  if (maxPending < 1)
+    KLTError("(KLTAddStream) maxPending must be positive, not %d", maxPending);
+
+  s = (_Stream *) malloc(sizeof(_Stream));
+  if (s == NULL)
+    KLTError("(KLTAddStream) Out of memory");
+  s->tc = tc;
+  s->fl = fl;
+  s->ncols = ncols;
+  s->nrows = nrows;
+  s->callback = callback;
+  s->arg = arg;
+  s->queue = (KLT_PixelType **) malloc(maxPending * sizeof(KLT_PixelType *));
+  s->submitted = (double *) malloc(maxPending * sizeof(double));
+  if (s->queue == NULL || s->submitted == NULL)
+    KLTError("(KLTAddStream) Out of memory");
+  s->head = s->count = 0;
+  s->maxPending = maxPending;
+  s->last = NULL;
+  s->nSubmitted = s->nDone = 0;
+  s->scheduled = FALSE;
+  s->next = -1;
+  s->first = s->lastDone = 0.0;
+  s->sumLatency = s->maxLatency = s->busyTime = 0.0;
+  tc->nThreads = 1;
+
+  pthread_mutex_lock(&ts->lock);
+  streams = (_Stream **) realloc(ts->streams,
+                                 (ts->nStreams + 1) * sizeof(_Stream *));
+  if (streams == NULL)
+    KLTError("(KLTAddStream) Out of memory");
+  ts->streams = streams;
+  stream = ts->nStreams++;
+  ts->streams[stream] = s;
+  pthread_mutex_unlock(&ts->lock);
+
+  return stream;
+}
+
+
+/*********************************************************************
+ * KLTSubmitFrame
+ *
+ * Queues the next frame of a stream, waiting if maxPending frames
+ * are already queued.  The image must be left untouched until the
+ * next frame of the stream has been tracked (i.e., until its
+ * callback), or the stream has been waited for.
+ */
+
+void KLTSubmitFrame(
+  KLT_TrackingServer ts,
+  int stream,
+  KLT_PixelType *img)
+{
+  _Stream *s;
+
+  pthread_mutex_lock(&ts->lock);
+  if (stream < 0 || stream >= ts->nStreams)
+    KLTError("(KLTSubmitFrame) No stream %d", stream);
+  s = ts->streams[stream];
+  while (s->count == s->maxPending)
+    pthread_cond_wait(&ts->progress, &ts->lock);
+  s->submitted[(s->head + s->count) % s->maxPending] = _now();
+  s->queue[(s->head + s->count) % s->maxPending] = img;
+  s->count++;
+  if (s->nSubmitted++ == 0)  s->first = _now();
+  if (!s->scheduled)  {
+    s->scheduled = TRUE;
+    _makeReady(ts, stream);
+  }
+  pthread_mutex_unlock(&ts->lock);
+}
+
+
+/*********************************************************************
+ * KLTWaitStream
+ *
+ * Waits until all the frames submitted to a stream have been tracked.
+ */
+
+void KLTWaitStream(
+  KLT_TrackingServer ts,
+  int stream)
+{
+  pthread_mutex_lock(&ts->lock);
+  if (stream < 0 || stream >= ts->nStreams)
+    KLTError("(KLTWaitStream) No stream %d", stream);
+  while (ts->streams[stream]->count > 0)
+    pthread_cond_wait(&ts->progress, &ts->lock);
+  pthread_mutex_unlock(&ts->lock);
+}
+
+
+/*********************************************************************
+ * KLTGetStreamStats
+ *
+ * Latencies run from the submission of a frame to the return of its
+ * callback; the throughput is over the time from the first
+ * submission to the last frame tracked.
+ */
+
+void KLTGetStreamStats(
+  KLT_TrackingServer ts,
+  int stream,
+  KLT_StreamStats stats)
+{
+  _Stream *s;
+
+  pthread_mutex_lock(&ts->lock);
+  if (stream < 0 || stream >= ts->nStreams)
+    KLTError("(KLTGetStreamStats) No stream %d", stream);
+  s = ts->streams[stream];
+  stats->nFrames = s->nDone;
+  stats->nPending = s->count;
+  stats->meanLatency = (s->nDone > 0) ? s->sumLatency / s->nDone : 0.0;
+  stats->maxLatency = s->maxLatency;
+  stats->busyTime = s->busyTime;
+  stats->framesPerSecond = (s->nDone > 0 && s->lastDone > s->first) ?
+    s->nDone * 1000.0 / (s->lastDone - s->first) : 0.0;
+  pthread_mutex_unlock(&ts->lock);
+}
@@ -0,0 +1,115 @@
+/**********************************************************************
+Measures the compressed trajectory format against the binary and text
+feature tables.  A feature table (features.ft, as written by klt, by
+default) is encoded into a trajectory file and decoded from it
+repeatedly; the throughput of both, the sizes of the three formats and
+the largest error of the decoded locations are reported.
+
+Usage: klt_trajectory [table [fractionBits [nRepeats]]]
+**********************************************************************/
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "klt.h"
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static long fileSize(const char *fname)
+{
+    struct stat st;
+
+    return (stat(fname, &st) == 0) ? (long) st.st_size : -1;
+}
+
+int main(int argc, char ** argv)
+{
+    char *fname = (argc > 1) ? argv[1] : "features.ft";
+    int fractionBits = (argc > 2) ? atoi(argv[2]) : 4;
+    int nRepeats = (argc > 3) ? atoi(argv[3]) : 20;
+    KLT_FeatureTable ft;
+    KLT_FeatureList fl;
+    KLT_TrajectoryWriter tw;
+    KLT_TrajectoryReader tr;
+    long binSize, txtSize, fzSize;
+    double t, tEncode = 0.0, tDecode = 0.0;
+    double err, maxerr = 0.0;
+    int nMismatch = 0;
+    int nFrames;
+    int i, j, r;
+
+    ft = KLTReadFeatureTable(NULL, fname);
+    fl = KLTCreateFeatureList(ft->nFeatures);
+
+    KLTWriteFeatureTable(ft, "trajectory_bench.ft", NULL);
+    KLTWriteFeatureTable(ft, "trajectory_bench.txt", "%5.1f");
+    binSize = fileSize("trajectory_bench.ft");
+    txtSize = fileSize("trajectory_bench.txt");
+
+    for (r = 0 ; r < nRepeats ; r++)
+    {
+        t = now();
+        tw = KLTCreateTrajectoryWriter("trajectory_bench.fz", ft->nFeatures,
+                                       fractionBits);
+        for (i = 0 ; i < ft->nFrames ; i++)
+        {
+            KLTExtractFeatureList(fl, ft, i);
+            KLTEncodeFeatureList(fl, tw);
+        }
+        KLTFreeTrajectoryWriter(tw);
+        tEncode += now() - t;
+
+        t = now();
+        tr = KLTOpenTrajectoryReader("trajectory_bench.fz");
+        for (nFrames = 0 ; KLTDecodeFeatureList(fl, tr) ; nFrames++)
+        {
+            /* Checked on the last pass only, outside of the timing */
+            if (r < nRepeats - 1)  continue;
+            tDecode += now() - t;
+            for (j = 0 ; j < ft->nFeatures ; j++)
+            {
+                if (fl->feature[j]->val != ft->feature[j][nFrames]->val)
+                    nMismatch++;
+                err = fabs(fl->feature[j]->x - ft->feature[j][nFrames]->x);
+                if (err > maxerr)  maxerr = err;
+                err = fabs(fl->feature[j]->y - ft->feature[j][nFrames]->y);
+                if (err > maxerr)  maxerr = err;
+            }
+            t = now();
+        }
+        KLTCloseTrajectoryReader(tr);
+        tDecode += now() - t;
+        if (nFrames != ft->nFrames)
+        {
+            fprintf(stderr, "Decoded %d frames instead of %d\n", nFrames, ft->nFrames);
+            return 1;
+        }
+    }
+    fzSize = fileSize("trajectory_bench.fz");
+
+    printf("%d frames of %d features, %d fraction bits\n",
+           ft->nFrames, ft->nFeatures, fractionBits);
+    printf("size: binary %ld, text %ld, trajectory %ld bytes "
+           "(%.2fx, %.2fx smaller)\n", binSize, txtSize, fzSize,
+           (double) binSize / fzSize, (double) txtSize / fzSize);
+    printf("encode: %.1f MB/s, decode: %.1f MB/s (of binary table)\n",
+           binSize * nRepeats / tEncode / 1e6, binSize * nRepeats / tDecode / 1e6);
+    printf("max location error: %g (bound %g), val mismatches: %d\n",
+           maxerr, ldexp(1.0, -(fractionBits + 1)), nMismatch);
+
+    remove("trajectory_bench.ft");
+    remove("trajectory_bench.txt");
+    remove("trajectory_bench.fz");
+    KLTFreeFeatureList(fl);
+    KLTFreeFeatureTable(ft);
+
+    return (nMismatch == 0) ? 0 : 1;
+}
@@ -0,0 +1,405 @@
+/*********************************************************************
+ * trajectoryCodec.c
+ *
+ * Compressed storage of feature trajectories, written and read one
+ * frame at a time.  Locations are quantized to fixed point with
+ * fractionBits bits after the binary point, and each feature is
+ * coded relative to its state in the previous frame:
+ *
+ *   varint(n << 1 | 1)              the next n features are unchanged
+ *                                   (e.g., lost features, which keep
+ *                                   their location and val)
+ *   varint(zigzag(dval) << 1),      the feature changed by dval, dx
+ *   varint(zigzag(dx)),             and dy; dx and dy are in units of
+ *   varint(zigzag(dy))              2^-fractionBits pixel
+ *
+ * where varints are little-endian base-128 and zigzag maps signed
+ * values to unsigned ones (0, -1, 1, -2, ... to 0, 1, 2, 3, ...).
+ * Runs do not cross frames.  Before the first frame, every feature
+ * is at (0,0) with val 0.
+ *
+ * File: "KLTFZ1", nFeatures, fractionBits, then the frames.
+ *********************************************************************/
+
+/* Standard includes */
+#include <math.h>     /* floor() */
+#include <stdint.h>   /* int64_t, uint64_t */
+#include <stdio.h>
+#include <stdlib.h>   /* malloc() */
+#include <string.h>   /* memcmp() */
+
+/* Our includes */
+#include "error.h"
+#include "featureView.h"
+#include "klt.h"
+
+#define HEADERLENGTH  6
+#define READBUFSIZE   65536
+#define MAXRECORDSIZE (3 * 10)   /* three varints of 64 bits */
+
+extern int KLT_verbose;
+
+static char header_fz[HEADERLENGTH+1] = "KLTFZ1";
+
+/* State of a feature in the previous frame */
+typedef struct  {
+  int64_t qx, qy;
+  int64_t val;
+}  _CodedFeature;
+
+struct _KLT_TrajectoryWriterRec  {
+  FILE *fp;
+  int nFeatures;
+  float scale;                /* 2^fractionBits */
+  _CodedFeature *last;
+  unsigned char *buf;         /* one encoded frame */
+};
+
+struct _KLT_TrajectoryReaderRec  {
+  FILE *fp;
+  int nFeatures;
+  float scale;
+  _CodedFeature *last;
+  unsigned char *buf;         /* read ahead from the file */
+  int pos, len;
+};
+
+
+/*********************************************************************
+ * _putVarint
+ * _zigzag
+ * _unzigzag
+ */
+
+static unsigned char *_putVarint(
+  unsigned char *ptr,
+  uint64_t v)
+{
+  while (v >= 0x80)  {
+    *ptr++ = (unsigned char) (v | 0x80);
+    v >>= 7;
+  }
+  *ptr++ = (unsigned char) v;
+  return ptr;
+}
+
+static uint64_t _zigzag(
+  int64_t v)
+{
+  return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t _unzigzag(
+  uint64_t v)
+{
+  return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static int64_t _quantize(
+  KLT_locType x,
+  float scale)
+{
+  return (int64_t) floor(x * scale + 0.5);
+}
+
+
+/*********************************************************************
+ * KLTCreateTrajectoryWriter
+ *
+ * Locations are written to within 2^-(fractionBits+1) pixel; e.g.,
+ * fractionBits = 4 keeps them to 1/32 pixel.
+ */
+
+KLT_TrajectoryWriter KLTCreateTrajectoryWriter(
+  char *fname,
+  int nFeatures,
+  int fractionBits)
+{
+  KLT_TrajectoryWriter tw;
+  int i;
+
+  /* A frame of no features would be coded as no bytes at all, and */
+  /* could not be told from the end of the file */
+  if (nFeatures < 1)
+    KLTError("(KLTCreateTrajectoryWriter) At least one feature is needed, "
+             "not %d", nFeatures);
+  if (fractionBits < 0 || fractionBits > 20)
+    KLTError("(KLTCreateTrajectoryWriter) fractionBits must be between 0 and 20, "
+             "not %d", fractionBits);
+
+  tw = (KLT_TrajectoryWriter) malloc(sizeof(struct _KLT_TrajectoryWriterRec));
+  if (tw == NULL)
+    KLTError("(KLTCreateTrajectoryWriter) Out of memory");
+  tw->fp = fopen(fname, "wb");
+  if (tw->fp == NULL)
+    KLTError("(KLTCreateTrajectoryWriter) Can't open file '%s' for writing",
+             fname);
+  tw->nFeatures = nFeatures;
+  tw->scale = (float) (1 << fractionBits);
+  tw->last = (_CodedFeature *) malloc(nFeatures * sizeof(_CodedFeature));
+  tw->buf = (unsigned char *) malloc(nFeatures * MAXRECORDSIZE + 1);
+  if (tw->last == NULL || tw->buf == NULL)
+    KLTError("(KLTCreateTrajectoryWriter) Out of memory");
+  for (i = 0 ; i < nFeatures ; i++)
+    tw->last[i].qx = tw->last[i].qy = tw->last[i].val = 0;
+
+  fwrite(header_fz, sizeof(char), HEADERLENGTH, tw->fp);
+  fwrite(&nFeatures, sizeof(int), 1, tw->fp);
+  fwrite(&fractionBits, sizeof(int), 1, tw->fp);
+
+  return tw;
+}
+
+
+/*********************************************************************
+ * KLTFreeTrajectoryWriter
+ */
+
+void KLTFreeTrajectoryWriter(
+  KLT_TrajectoryWriter tw)
+{
+  if (fclose(tw->fp) != 0)
+    KLTError("(KLTFreeTrajectoryWriter) Can't write trajectory file");
+  free(tw->last);
+  free(tw->buf);
+  free(tw);
+}
+
+
+/*********************************************************************
+ * _encodeFeatures
+ */
+
+static void _encodeFeatures(
+  _KLT_FeatureView view,
+  KLT_TrajectoryWriter tw)
+{
+  unsigned char *ptr = tw->buf;
+  _CodedFeature cur, *last;
+  int run = 0;
+  int i;
+
+  if (view->nFeatures != tw->nFeatures)
+    KLTError("(KLTEncodeFeatures) FeatureList and TrajectoryWriter must "
+             "have the same number of features");
+
+  for (i = 0 ; i < view->nFeatures ; i++)  {
+    last = &tw->last[i];
+    cur.qx = _quantize(FV_X(view, i), tw->scale);
+    cur.qy = _quantize(FV_Y(view, i), tw->scale);
+    cur.val = FV_VAL(view, i);
+    if (cur.qx == last->qx && cur.qy == last->qy && cur.val == last->val)  {
+      run++;
+      continue;
+    }
+    if (run > 0)  {
+      ptr = _putVarint(ptr, ((uint64_t) run << 1) | 1);
+      run = 0;
+    }
+    ptr = _putVarint(ptr, _zigzag(cur.val - last->val) << 1);
+    ptr = _putVarint(ptr, _zigzag(cur.qx - last->qx));
+    ptr = _putVarint(ptr, _zigzag(cur.qy - last->qy));
+    *last = cur;
+  }
+  if (run > 0)
+    ptr = _putVarint(ptr, ((uint64_t) run << 1) | 1);
+
+  if (fwrite(tw->buf, 1, ptr - tw->buf, tw->fp) != (size_t) (ptr - tw->buf))
+    KLTError("(KLTEncodeFeatures) Can't write trajectory file");
+}
+
+
+/*********************************************************************
+ * KLTEncodeFeatureList
+ * KLTEncodeFeatureArrays
+ *
+ * Appends the features as the next frame.
+ */
+
+void KLTEncodeFeatureList(
+  KLT_FeatureList fl,
+  KLT_TrajectoryWriter tw)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTOpenFeatureListView(fl, &view);
+  _encodeFeatures(&view, tw);
+}
+
+
+void KLTEncodeFeatureArrays(
+  KLT_FeatureArrays fa,
+  KLT_TrajectoryWriter tw)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTViewFeatureArrays(fa, &view);
+  _encodeFeatures(&view, tw);
+}
+
+
+/*********************************************************************
+ * KLTOpenTrajectoryReader
+ */
+
+KLT_TrajectoryReader KLTOpenTrajectoryReader(
+  char *fname)
+{
+  KLT_TrajectoryReader tr;
+  char header[HEADERLENGTH];
+  int fractionBits;
+  int i;
+
+  tr = (KLT_TrajectoryReader) malloc(sizeof(struct _KLT_TrajectoryReaderRec));
+  if (tr == NULL)
+    KLTError("(KLTOpenTrajectoryReader) Out of memory");
+  tr->fp = fopen(fname, "rb");
+  if (tr->fp == NULL)
+    KLTError("(KLTOpenTrajectoryReader) Can't open file '%s' for reading",
+             fname);
+  if (fread(header, sizeof(char), HEADERLENGTH, tr->fp) != HEADERLENGTH ||
+      memcmp(header, header_fz, HEADERLENGTH) != 0 ||
+      fread(&tr->nFeatures, sizeof(int), 1, tr->fp) != 1 ||
+      fread(&fractionBits, sizeof(int), 1, tr->fp) != 1 ||
+      tr->nFeatures < 1 || fractionBits < 0 || fractionBits > 20)
+    KLTError("(KLTOpenTrajectoryReader) File '%s' is not a trajectory file",
+             fname);
+  tr->scale = (float) (1 << fractionBits);
+  tr->last = (_CodedFeature *) malloc(tr->nFeatures * sizeof(_CodedFeature));
+  tr->buf = (unsigned char *) malloc(READBUFSIZE);
+  if (tr->last == NULL || tr->buf == NULL)
+    KLTError("(KLTOpenTrajectoryReader) Out of memory");
+  for (i = 0 ; i < tr->nFeatures ; i++)
+    tr->last[i].qx = tr->last[i].qy = tr->last[i].val = 0;
+  tr->pos = tr->len = 0;
+
+  return tr;
+}
+
+
+/*********************************************************************
+ * KLTCloseTrajectoryReader
+ */
+
+void KLTCloseTrajectoryReader(
+  KLT_TrajectoryReader tr)
+{
+  fclose(tr->fp);
+  free(tr->last);
+  free(tr->buf);
+  free(tr);
+}
+
+
+/*********************************************************************
+ * _getVarint
+ *
+ * Returns FALSE at the end of the file.
+ */
+
+static KLT_BOOL _getVarint(
+  KLT_TrajectoryReader tr,
+  uint64_t *v)
+{
+  int shift = 0;
+  unsigned char byte;
+
+  *v = 0;
+  do  {
+    if (tr->pos == tr->len)  {
+      tr->len = (int) fread(tr->buf, 1, READBUFSIZE, tr->fp);
+      tr->pos = 0;
+      if (tr->len == 0)  {
+        if (shift > 0)
+          KLTError("(KLTDecodeFeatures) Trajectory file is truncated");
+        return FALSE;
+      }
+    }
+    byte = tr->buf[tr->pos++];
+    if (shift > 63)
+      KLTError("(KLTDecodeFeatures) Trajectory file is corrupted");
+    *v |= (uint64_t) (byte & 0x7f) << shift;
+    shift += 7;
+  }  while (byte & 0x80);
+
+  return TRUE;
+}
+
+
+/*********************************************************************
+ * _decodeFeatures
+ */
+
+static KLT_BOOL _decodeFeatures(
+  _KLT_FeatureView view,
+  KLT_TrajectoryReader tr)
+{
+  _CodedFeature *last;
+  uint64_t code, dx, dy;
+  int64_t run = 0;
+  int i;
+
+  if (view->nFeatures != tr->nFeatures)
+    KLTError("(KLTDecodeFeatures) FeatureList and TrajectoryReader must "
+             "have the same number of features");
+
+  for (i = 0 ; i < view->nFeatures ; i++)  {
+    last = &tr->last[i];
+    if (run == 0)  {
+      if (!_getVarint(tr, &code))  {
+        if (i > 0)
+          KLTError("(KLTDecodeFeatures) Trajectory file is truncated");
+        return FALSE;   /* end of file, between frames */
+      }
+      if (code & 1)  {
+        run = (int64_t) (code >> 1);
+        if (run < 1 || run > view->nFeatures - i)
+          KLTError("(KLTDecodeFeatures) Trajectory file is corrupted");
+      }  else  {
+        if (!_getVarint(tr, &dx) || !_getVarint(tr, &dy))
+          KLTError("(KLTDecodeFeatures) Trajectory file is truncated");
+        last->val += _unzigzag(code >> 1);
+        last->qx += _unzigzag(dx);
+        last->qy += _unzigzag(dy);
+      }
+    }
+    if (run > 0)  run--;
+    FV_X(view, i) = (KLT_locType) (last->qx / tr->scale);
+    FV_Y(view, i) = (KLT_locType) (last->qy / tr->scale);
+    FV_VAL(view, i) = (int) last->val;
+  }
+  if (run != 0)
+    KLTError("(KLTDecodeFeatures) Trajectory file is corrupted");
+
+  return TRUE;
+}
+
+
+/*********************************************************************
+ * KLTDecodeFeatureList
+ * KLTDecodeFeatureArrays
+ *
+ * Reads the next frame into the features; returns FALSE, leaving
+ * them untouched, once all the frames have been read.
+ */
+
+KLT_BOOL KLTDecodeFeatureList(
+  KLT_FeatureList fl,
+  KLT_TrajectoryReader tr)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTOpenFeatureListView(fl, &view);
+  return _decodeFeatures(&view, tr);
+}
+
+
+KLT_BOOL KLTDecodeFeatureArrays(
+  KLT_FeatureArrays fa,
+  KLT_TrajectoryReader tr)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTViewFeatureArrays(fa, &view);
+  return _decodeFeatures(&view, tr);
+}
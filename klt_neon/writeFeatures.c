@@ -7,85 +7,425 @@
 /* Standard includes */
 #include <assert.h>
 #include <ctype.h>		/* isdigit() */
+#include <fcntl.h>		/* open() */
+#include <limits.h>		/* INT_MAX */
+#include <math.h>		/* rint() */
+#include <pthread.h>
+#include <stdint.h>		/* int64_t */
 #include <stdio.h>		/* sprintf(), fprintf(), sscanf(), fscanf() */
 #include <stdlib.h>		/* malloc() */
 #include <string.h>		/* memcpy(), strcmp() */
+#include <sys/mman.h>		/* mmap() */
+#include <sys/stat.h>		/* fstat() */
+#include <unistd.h>		/* close() */
 
 /* Our includes */
 #include "base.h"
 #include "error.h"
-#include "pnmio.h"		/* ppmWriteFileRGB() */
+#include "featureView.h"
+#include "pnmio.h"		/* ppmWriteFileInterleaved() */
 #include "klt.h"
+#include "writeFeatures.h"
+#include "threadPool.h"
 
 #define BINHEADERLENGTH	6
+#define TXTBLOCKSIZE	(4 << 20)	/* bytes of text formatted at once */
 
 extern int KLT_verbose;
 
 typedef enum {FEATURE_LIST, FEATURE_HISTORY, FEATURE_TABLE} structureType;
 
+static KLT_FeatureTable _readColumnarTable(
+  KLT_FeatureTable ft_in,
+  char *fname);
+
 static char warning_line[] = "!!! Warning:  This is a KLT data file.  "
                              "Do not modify below this line !!!\n";
 static char binheader_fl[BINHEADERLENGTH+1] = "KLTFL1";
 static char binheader_fh[BINHEADERLENGTH+1] = "KLTFH1";
 static char binheader_ft[BINHEADERLENGTH+1] = "KLTFT1";
+static char binheader_fs[BINHEADERLENGTH+1] = "KLTFS1";  /* feature streams */
+static char binheader_fc[BINHEADERLENGTH+1] = "KLTFC1";  /* columnar */
 
 /*********************************************************************
- * KLTWriteFeatureListToPPM
+ * _greyToRGB
+ * _drawMarker
+ *
+ * An overlay is drawn into a single image of RGB triplets: the grey
+ * image is expanded once, then each feature is marked by a red 3x3
+ * square.
  */
 
-void KLTWriteFeatureListToPPM(
-  KLT_FeatureList featurelist,
+static void _greyToRGB(
+  KLT_PixelType *greyimg,
+  int npixels,
+  uchar *rgbimg)
+{
+  int i;
+
+  for (i = 0 ; i < npixels ; i++)  {
+    rgbimg[0] = rgbimg[1] = rgbimg[2] = greyimg[i];
+    rgbimg += 3;
+  }
+}
+
+
+static void _drawMarker(
+  uchar *rgbimg,
+  int ncols,
+  int nrows,
+  KLT_locType fx,
+  KLT_locType fy)
+{
+  int x = (int) (fx + 0.5);
+  int y = (int) (fy + 0.5);
+  uchar *ptr;
+  int xx, yy;
+
+  for (yy = y - 1 ; yy <= y + 1 ; yy++)
+    for (xx = x - 1 ; xx <= x + 1 ; xx++)  
+      if (xx >= 0 && yy >= 0 && xx < ncols && yy < nrows)  {
+        ptr = rgbimg + 3 * (yy * ncols + xx);
+        ptr[0] = 255;
+        ptr[1] = 0;
+        ptr[2] = 0;
+      }
+}
+
+
+/*********************************************************************
+ * _writeFeaturesToPPM
+ */
+
+static void _writeFeaturesToPPM(
+  _KLT_FeatureView view,
   KLT_PixelType *greyimg,
   int ncols,
   int nrows,
   char *filename)
 {
-  int nbytes = ncols * nrows * sizeof(char);
-  uchar *redimg, *grnimg, *bluimg;
-  int offset;
-  int x, y, xx, yy;
+  uchar *rgbimg;
   int i;
 	
   if (KLT_verbose >= 1) 
     fprintf(stderr, "(KLT) Writing %d features to PPM file: '%s'\n", 
-            KLTCountRemainingFeatures(featurelist), filename);
+            _KLTCountRemainingFeatures(view), filename);
 
-  /* Allocate memory for component images */
-  redimg = (uchar *)  malloc(nbytes);
-  grnimg = (uchar *)  malloc(nbytes);
-  bluimg = (uchar *)  malloc(nbytes);
-  if (redimg == NULL || grnimg == NULL || bluimg == NULL)
+  /* Allocate memory for interleaved image */
+  rgbimg = (uchar *)  malloc(3 * ncols * nrows * sizeof(uchar));
+  if (rgbimg == NULL)
     KLTError("(KLTWriteFeaturesToPPM)  Out of memory\n");
 
-  /* Copy grey image to component images */
+  /* Copy grey image to all components */
   if (sizeof(KLT_PixelType) != 1)
     KLTWarning("(KLTWriteFeaturesToPPM)  KLT_PixelType is not uchar");
-  memcpy(redimg, greyimg, nbytes);
-  memcpy(grnimg, greyimg, nbytes);
-  memcpy(bluimg, greyimg, nbytes);
+  _greyToRGB(greyimg, ncols * nrows, rgbimg);
 	
   /* Overlay features in red */
-  for (i = 0 ; i < featurelist->nFeatures ; i++)
-    if (featurelist->feature[i]->val >= 0)  {
-      x = (int) (featurelist->feature[i]->x + 0.5);
-      y = (int) (featurelist->feature[i]->y + 0.5);
-      for (yy = y - 1 ; yy <= y + 1 ; yy++)
-        for (xx = x - 1 ; xx <= x + 1 ; xx++)  
-          if (xx >= 0 && yy >= 0 && xx < ncols && yy < nrows)  {
-            offset = yy * ncols + xx;
-            *(redimg + offset) = 255;
-            *(grnimg + offset) = 0;
-            *(bluimg + offset) = 0;
-          }
-    }
+  for (i = 0 ; i < view->nFeatures ; i++)
+    if (FV_VAL(view, i) >= 0)
+      _drawMarker(rgbimg, ncols, nrows, FV_X(view, i), FV_Y(view, i));
 	
   /* Write to PPM file */
-  ppmWriteFileRGB(filename, redimg, grnimg, bluimg, ncols, nrows);
+  ppmWriteFileInterleaved(filename, rgbimg, ncols, nrows);
 
   /* Free memory */
-  free(redimg);
-  free(grnimg);
-  free(bluimg);
+  free(rgbimg);
+}
+
+
+/*********************************************************************
+ * KLTWriteFeatureListToPPM
+ * KLTWriteFeatureArraysToPPM
+ */
+
+void KLTWriteFeatureListToPPM(
+  KLT_FeatureList featurelist,
+  KLT_PixelType *greyimg,
+  int ncols,
+  int nrows,
+  char *filename)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTOpenFeatureListView(featurelist, &view);
+  _writeFeaturesToPPM(&view, greyimg, ncols, nrows, filename);
+}
+
+
+void KLTWriteFeatureArraysToPPM(
+  KLT_FeatureArrays fa,
+  KLT_PixelType *greyimg,
+  int ncols,
+  int nrows,
+  char *filename)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTViewFeatureArrays(fa, &view);
+  _writeFeaturesToPPM(&view, greyimg, ncols, nrows, filename);
+}
+
+
+/*********************************************************************
+ * Overlay writer
+ *
+ * Writes feature overlays to PPM files on a thread of its own.  A
+ * call to queue an overlay only copies the grey image and the
+ * locations of the tracked features into a free slot; the overlay
+ * is drawn and written by the thread, which then recycles the slot.
+ * When all slots are taken, the call waits for one to be recycled
+ * or, with dropFrames, replaces the overlay queued last, which is
+ * then never written.
+ */
+
+typedef struct  {
+  KLT_PixelType *greyimg;
+  uchar *rgbimg;
+  KLT_locType *xy;          /* locations of the tracked features */
+  int nMarkers, maxMarkers;
+  char *filename;
+}  _OverlaySlot;
+
+struct _KLT_OverlayWriterRec  {
+  int ncols, nrows;
+  KLT_BOOL dropFrames;
+  int nSlots;
+  _OverlaySlot *slots;
+  int *queue;               /* slots to write, in order (ring) */
+  int head, count;
+  int *freelist;
+  int nFree;
+  int nDropped;
+
+  pthread_mutex_t lock;
+  pthread_cond_t queued;    /* signalled when an overlay is queued */
+  pthread_cond_t freed;     /* signalled when a slot is recycled */
+  KLT_BOOL closing;
+  pthread_t thread;
+};
+
+
+static void *_overlayThread(
+  void *arg)
+{
+  KLT_OverlayWriter ow = (KLT_OverlayWriter) arg;
+  _OverlaySlot *slot;
+  int b, i;
+
+  pthread_mutex_lock(&ow->lock);
+  for (;;)  {
+    while (ow->count == 0 && !ow->closing)
+      pthread_cond_wait(&ow->queued, &ow->lock);
+    if (ow->count == 0)  break;   /* closing, and all written */
+    b = ow->queue[ow->head];
+    ow->head = (ow->head + 1) % ow->nSlots;
+    ow->count--;
+    pthread_mutex_unlock(&ow->lock);
+
+    slot = &ow->slots[b];
+    _greyToRGB(slot->greyimg, ow->ncols * ow->nrows, slot->rgbimg);
+    for (i = 0 ; i < slot->nMarkers ; i++)
+      _drawMarker(slot->rgbimg, ow->ncols, ow->nrows,
+                  slot->xy[2*i], slot->xy[2*i+1]);
+    ppmWriteFileInterleaved(slot->filename, slot->rgbimg, ow->ncols, ow->nrows);
+
+    pthread_mutex_lock(&ow->lock);
+    ow->freelist[ow->nFree++] = b;
+    pthread_cond_signal(&ow->freed);
+  }
+  pthread_mutex_unlock(&ow->lock);
+  return NULL;
+}
+
+
+/*********************************************************************
+ * KLTCreateOverlayWriter
+ *
+ * nBuffers is the number of overlays that may be queued or being
+ * written at once.
+ */
+
+KLT_OverlayWriter KLTCreateOverlayWriter(
+  int ncols,
+  int nrows,
+  int nBuffers,
+  KLT_BOOL dropFrames)
+{
+  KLT_OverlayWriter ow;
+  int i;
+
+  if (nBuffers < 1)
+    KLTError("(KLTCreateOverlayWriter) At least one buffer is needed, not %d",
+             nBuffers);
+
+  ow = (KLT_OverlayWriter) malloc(sizeof(struct _KLT_OverlayWriterRec));
+  if (ow == NULL)
+    KLTError("(KLTCreateOverlayWriter)  Out of memory");
+  ow->ncols = ncols;
+  ow->nrows = nrows;
+  ow->dropFrames = dropFrames;
+  ow->nSlots = nBuffers;
+  ow->slots = (_OverlaySlot *) malloc(nBuffers * sizeof(_OverlaySlot));
+  ow->queue = (int *) malloc(nBuffers * sizeof(int));
+  ow->freelist = (int *) malloc(nBuffers * sizeof(int));
+  if (ow->slots == NULL || ow->queue == NULL || ow->freelist == NULL)
+    KLTError("(KLTCreateOverlayWriter)  Out of memory");
+  for (i = 0 ; i < nBuffers ; i++)  {
+    ow->slots[i].greyimg = (KLT_PixelType *) malloc(ncols * nrows * sizeof(KLT_PixelType));
+    ow->slots[i].rgbimg = (uchar *) malloc(3 * ncols * nrows * sizeof(uchar));
+    if (ow->slots[i].greyimg == NULL || ow->slots[i].rgbimg == NULL)
+      KLTError("(KLTCreateOverlayWriter)  Out of memory");
+    ow->slots[i].xy = NULL;
+    ow->slots[i].nMarkers = ow->slots[i].maxMarkers = 0;
+    ow->slots[i].filename = NULL;
+    ow->freelist[i] = nBuffers - 1 - i;
+  }
+  ow->head = ow->count = 0;
+  ow->nFree = nBuffers;
+  ow->nDropped = 0;
+  ow->closing = FALSE;
+
+  pthread_mutex_init(&ow->lock, NULL);
+  pthread_cond_init(&ow->queued, NULL);
+  pthread_cond_init(&ow->freed, NULL);
+  if (pthread_create(&ow->thread, NULL, _overlayThread, ow) != 0)
+    KLTError("(KLTCreateOverlayWriter) Cannot start the writer thread");
+
+  return ow;
+}
+
+
+/*********************************************************************
+ * KLTFreeOverlayWriter
+ *
+ * Waits for the queued overlays to be written.
+ */
+
+void KLTFreeOverlayWriter(
+  KLT_OverlayWriter ow)
+{
+  int i;
+
+  pthread_mutex_lock(&ow->lock);
+  ow->closing = TRUE;
+  pthread_cond_signal(&ow->queued);
+  pthread_mutex_unlock(&ow->lock);
+  pthread_join(ow->thread, NULL);
+
+  if (KLT_verbose >= 1 && ow->nDropped > 0)
+    fprintf(stderr, "(KLT) %d overlays were dropped\n", ow->nDropped);
+
+  pthread_mutex_destroy(&ow->lock);
+  pthread_cond_destroy(&ow->queued);
+  pthread_cond_destroy(&ow->freed);
+  for (i = 0 ; i < ow->nSlots ; i++)  {
+    free(ow->slots[i].greyimg);
+    free(ow->slots[i].rgbimg);
+    free(ow->slots[i].xy);
+    free(ow->slots[i].filename);
+  }
+  free(ow->slots);
+  free(ow->queue);
+  free(ow->freelist);
+  free(ow);
+}
+
+
+/*********************************************************************
+ * _queueFeaturesToPPM
+ */
+
+static void _queueFeaturesToPPM(
+  KLT_OverlayWriter ow,
+  _KLT_FeatureView view,
+  KLT_PixelType *greyimg,
+  char *filename)
+{
+  _OverlaySlot *slot;
+  int n = _KLTCountRemainingFeatures(view);
+  int b, i;
+
+  if (KLT_verbose >= 1) 
+    fprintf(stderr, "(KLT) Queueing %d features for PPM file: '%s'\n", 
+            n, filename);
+
+  /* Take a free slot, or the last one queued */
+  pthread_mutex_lock(&ow->lock);
+  while (ow->nFree == 0 && !(ow->dropFrames && ow->count > 0))
+    pthread_cond_wait(&ow->freed, &ow->lock);
+  if (ow->nFree > 0)
+    b = ow->freelist[--ow->nFree];
+  else  {
+    ow->count--;
+    b = ow->queue[(ow->head + ow->count) % ow->nSlots];
+    ow->nDropped++;
+  }
+  pthread_mutex_unlock(&ow->lock);
+
+  /* Fill it */
+  slot = &ow->slots[b];
+  memcpy(slot->greyimg, greyimg, ow->ncols * ow->nrows * sizeof(KLT_PixelType));
+  if (n > slot->maxMarkers)  {
+    free(slot->xy);
+    slot->xy = (KLT_locType *) malloc(2 * n * sizeof(KLT_locType));
+    if (slot->xy == NULL)
+      KLTError("(KLTQueueFeaturesToPPM)  Out of memory");
+    slot->maxMarkers = n;
+  }
+  slot->nMarkers = 0;
+  for (i = 0 ; i < view->nFeatures ; i++)
+    if (FV_VAL(view, i) >= 0)  {
+      slot->xy[2*slot->nMarkers] = FV_X(view, i);
+      slot->xy[2*slot->nMarkers+1] = FV_Y(view, i);
+      slot->nMarkers++;
+    }
+  free(slot->filename);
+  slot->filename = (char *) malloc(strlen(filename) + 1);
+  if (slot->filename == NULL)
+    KLTError("(KLTQueueFeaturesToPPM)  Out of memory");
+  strcpy(slot->filename, filename);
+
+  pthread_mutex_lock(&ow->lock);
+  ow->queue[(ow->head + ow->count) % ow->nSlots] = b;
+  ow->count++;
+  pthread_cond_signal(&ow->queued);
+  pthread_mutex_unlock(&ow->lock);
+}
+
+
+/*********************************************************************
+ * KLTQueueFeatureListToPPM
+ * KLTQueueFeatureArraysToPPM
+ *
+ * Same as KLTWriteFeatureListToPPM and KLTWriteFeatureArraysToPPM,
+ * but the file is written by the overlay writer.  The features and
+ * the image may be changed as soon as the call returns.
+ */
+
+void KLTQueueFeatureListToPPM(
+  KLT_OverlayWriter ow,
+  KLT_FeatureList featurelist,
+  KLT_PixelType *greyimg,
+  char *filename)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTOpenFeatureListView(featurelist, &view);
+  _queueFeaturesToPPM(ow, &view, greyimg, filename);
+}
+
+
+void KLTQueueFeatureArraysToPPM(
+  KLT_OverlayWriter ow,
+  KLT_FeatureArrays fa,
+  KLT_PixelType *greyimg,
+  char *filename)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTViewFeatureArrays(fa, &view);
+  _queueFeaturesToPPM(ow, &view, greyimg, filename);
 }
 
 
@@ -291,13 +631,268 @@ static void _printFeatureTxt(
 }
 
 
+/*********************************************************************
+ * _parseFixedFormat
+ *
+ * Recognizes the formats that _formatFeatureTxt writes without
+ * printf: "%<width>.<precision>f", with a precision of at most 9,
+ * and "%<width>d", with no flags.  Returns FALSE for any other
+ * format, which is then written with fprintf.
+ */
+
+typedef struct  {
+  int width;
+  int prec;
+  char type;
+}  _TxtFormat;
+
+static KLT_BOOL _parseFixedFormat(
+  char *fmt,
+  _TxtFormat *f)
+{
+  char *ptr = fmt + 1;
+
+  if (fmt[0] != '%' || *ptr == '0')  return FALSE;
+  f->width = 0;
+  while (isdigit(*ptr) && f->width < 1000)
+    f->width = 10 * f->width + (*ptr++ - '0');
+  f->prec = -1;
+  if (*ptr == '.')  {
+    ptr++;
+    f->prec = 0;
+    while (isdigit(*ptr) && f->prec < 1000)
+      f->prec = 10 * f->prec + (*ptr++ - '0');
+  }
+  f->type = *ptr++;
+  if (*ptr != '\0')  return FALSE;
+  if (f->type == 'f')  {
+    if (f->prec < 0)  f->prec = 6;
+    return f->prec <= 9;
+  }
+  return f->type == 'd' && f->prec < 0;
+}
+
+
+/*********************************************************************
+ * _formatInteger
+ * _formatFixed
+ *
+ * Write, like "%<width>d" and "%<width>.<prec>f", the number to ptr,
+ * and return the end of the string (not terminated).  A float times
+ * 10^prec is exact in double precision for prec <= 9, so rint()
+ * rounds it as printf does; numbers beyond 1e9 are left to sprintf.
+ */
+
+static char *_formatInteger(
+  char *ptr,
+  int integer,
+  int width)
+{
+  char digits[16];
+  unsigned int u = (integer < 0) ? 0u - (unsigned int) integer
+                                 : (unsigned int) integer;
+  int n = 0;
+  int len;
+
+  do  {
+    digits[n++] = (char) ('0' + u % 10);
+    u /= 10;
+  }  while (u > 0);
+  len = n + (integer < 0);
+  while (len++ < width)  *ptr++ = ' ';
+  if (integer < 0)  *ptr++ = '-';
+  while (n > 0)  *ptr++ = digits[--n];
+  return ptr;
+}
+
+
+static char *_formatFixed(
+  char *ptr,
+  float x,
+  int width,
+  int prec)
+{
+  static const double pow10[10] = {1e0, 1e1, 1e2, 1e3, 1e4,
+                                   1e5, 1e6, 1e7, 1e8, 1e9};
+  char digits[24];
+  int64_t u;
+  int n = 0;
+  int len;
+
+  if (!(fabs(x) < 1e9))
+    return ptr + sprintf(ptr, "%*.*f", width, prec, (double) x);
+
+  u = (int64_t) rint(fabs((double) x) * pow10[prec]);
+  for ( ; n < prec ; n++)  {
+    digits[n] = (char) ('0' + u % 10);
+    u /= 10;
+  }
+  if (prec > 0)  digits[n++] = '.';
+  do  {
+    digits[n++] = (char) ('0' + u % 10);
+    u /= 10;
+  }  while (u > 0);
+  len = n + (signbit(x) != 0);
+  while (len++ < width)  *ptr++ = ' ';
+  if (signbit(x))  *ptr++ = '-';
+  while (n > 0)  *ptr++ = digits[--n];
+  return ptr;
+}
+
+
+/*********************************************************************
+ * _formatFeatureTxt
+ *
+ * Same output as _printFeatureTxt with the format built from f.
+ */
+
+static char *_formatFeatureTxt(
+  char *ptr,
+  KLT_Feature feat,
+  const _TxtFormat *f)
+{
+  *ptr++ = '(';
+  if (f->type == 'f')  {
+    ptr = _formatFixed(ptr, (float) feat->x, f->width, f->prec);
+    *ptr++ = ',';
+    ptr = _formatFixed(ptr, (float) feat->y, f->width, f->prec);
+  } else  {
+    /* Round x & y to nearest integer, unless negative */
+    float x = feat->x;
+    float y = feat->y;
+    if (x >= 0.0) x += 0.5;
+    if (y >= 0.0) y += 0.5;
+    ptr = _formatInteger(ptr, (int) x, f->width);
+    *ptr++ = ',';
+    ptr = _formatInteger(ptr, (int) y, f->width);
+  }
+  *ptr++ = ')';
+  *ptr++ = '=';
+  ptr = _formatInteger(ptr, feat->val, 5);
+  *ptr++ = ' ';
+  return ptr;
+}
+
+
+/*********************************************************************
+ * _writeTableTxt
+ *
+ * Writes the rows of a text feature table in blocks: the rows of a
+ * block are formatted in parallel, each into a slot large enough for
+ * any row, and then written in order.
+ */
+
+typedef struct  {
+  KLT_FeatureTable ft;
+  const _TxtFormat *f;
+  int first;		/* first row of the block */
+  size_t slot;		/* bytes reserved per row */
+  char *buf;
+  size_t *len;		/* bytes written per row */
+}  _TxtBlock;
+
+static void _formatRows(
+  void *arg,
+  int begin,
+  int end,
+  int thread)
+{
+  _TxtBlock *b = (_TxtBlock *) arg;
+  char *start, *ptr;
+  int i, j;
+
+  for (j = begin ; j < end ; j++)  {
+    start = ptr = b->buf + j * b->slot;
+    ptr = _formatInteger(ptr, b->first + j, 7);
+    memcpy(ptr, " | ", 3);
+    ptr += 3;
+    for (i = 0 ; i < b->ft->nFrames ; i++)
+      ptr = _formatFeatureTxt(ptr, b->ft->feature[b->first + j][i], b->f);
+    *ptr++ = '\n';
+    b->len[j] = ptr - start;
+  }
+}
+
+
+static void _writeTableTxt(
+  FILE *fp,
+  KLT_FeatureTable ft,
+  const _TxtFormat *f)
+{
+  _KLT_ThreadPool pool = NULL;
+  _TxtBlock b;
+  int width = (f->width > 64) ? f->width : 64;
+  int nRows, j;
+
+  b.ft = ft;
+  b.f = f;
+  b.slot = 16 + (size_t) ft->nFrames * (2 * width + 16);
+  nRows = TXTBLOCKSIZE / b.slot;
+  if (nRows < 1)  nRows = 1;
+  if (nRows > ft->nFeatures)  nRows = ft->nFeatures;
+  b.buf = (char *) malloc(nRows * b.slot);
+  b.len = (size_t *) malloc(nRows * sizeof(size_t));
+  if (b.buf == NULL || b.len == NULL)
+    KLTError("(KLTWriteFeatureTable) Out of memory");
+
+  /* Threads pay off only for tables of more than a block */
+  if (nRows < ft->nFeatures && _KLTNumberOfCores() > 1)
+    pool = _KLTCreateThreadPool(_KLTNumberOfCores());
+
+  for (b.first = 0 ; b.first < ft->nFeatures ; b.first += nRows)  {
+    int n = ft->nFeatures - b.first;
+    if (n > nRows)  n = nRows;
+    _KLTParallelFor(pool, n, 16, _formatRows, &b);
+    for (j = 0 ; j < n ; j++)
+      fwrite(b.buf + j * b.slot, 1, b.len[j], fp);
+  }
+
+  if (pool != NULL)  _KLTFreeThreadPool(pool);
+  free(b.buf);
+  free(b.len);
+}
+
+
+/*********************************************************************
+ * _KLTWriteFeatureBin
+ *
+ * Writes one (x,y)=val record, field by field, as the binary files
+ * are read.  Returns 0 if it could not be written in full.
+ */
+
+int _KLTWriteFeatureBin(
+  FILE *fp,
+  KLT_locType x,
+  KLT_locType y,
+  int val)
+{
+  return fwrite(&x, sizeof(KLT_locType), 1, fp) == 1 &&
+         fwrite(&y, sizeof(KLT_locType), 1, fp) == 1 &&
+         fwrite(&val, sizeof(int), 1, fp) == 1;
+}
+
+
 static void _printFeatureBin(
   FILE *fp,
   KLT_Feature feat)
 {
-  fwrite(&(feat->x), sizeof(KLT_locType), 1, fp);
-  fwrite(&(feat->y), sizeof(KLT_locType), 1, fp);
-  fwrite(&(feat->val), sizeof(int), 1, fp);
+  _KLTWriteFeatureBin(fp, feat->x, feat->y, feat->val);
+}
+
+
+/*********************************************************************
+ * _KLTWriteFeatureStreamHeader
+ *
+ * Begins a feature stream file; its frames of nFeatures records each
+ * follow, and run to the end of the file.
+ */
+
+void _KLTWriteFeatureStreamHeader(
+  FILE *fp,
+  int nFeatures)
+{
+  fwrite(binheader_fs, sizeof(char), BINHEADERLENGTH, fp);
+  fwrite(&nFeatures, sizeof(int), 1, fp);
 }
 
 
@@ -312,6 +907,7 @@ static void _printShutdown(
 
 /*********************************************************************
  * KLTWriteFeatureList()
+ * KLTWriteFeatureArrays()
  * KLTWriteFeatureHistory()
  * KLTWriteFeatureTable()
  * 
@@ -323,14 +919,15 @@ static void _printShutdown(
  *        if NULL, and if fname is not NULL, then write to binary file.
  */
 
-void KLTWriteFeatureList(
-  KLT_FeatureList fl,
+static void _writeFeatures(
+  _KLT_FeatureView view,
   char *fname, 
   char *fmt)
 {
   FILE *fp;
   char format[100];
   char type;
+  KLT_FeatureRec feat;
   int i;
 
   if (KLT_verbose >= 1 && fname != NULL)  {
@@ -341,26 +938,56 @@ void KLTWriteFeatureList(
 
   if (fmt != NULL) {  /* text file or stderr */
     fp = _printSetupTxt(fname, fmt, format, &type);
-    _printHeader(fp, format, FEATURE_LIST, 0, fl->nFeatures);
+    _printHeader(fp, format, FEATURE_LIST, 0, view->nFeatures);
 	
-    for (i = 0 ; i < fl->nFeatures ; i++)  {
+    for (i = 0 ; i < view->nFeatures ; i++)  {
+      feat.x = FV_X(view, i);
+      feat.y = FV_Y(view, i);
+      feat.val = FV_VAL(view, i);
       fprintf(fp, "%7d | ", i);
-      _printFeatureTxt(fp, fl->feature[i], format, type);
+      _printFeatureTxt(fp, &feat, format, type);
       fprintf(fp, "\n");
     }
     _printShutdown(fp);
   } else {  /* binary file */
     fp = _printSetupBin(fname);
     fwrite(binheader_fl, sizeof(char), BINHEADERLENGTH, fp); 
-    fwrite(&(fl->nFeatures), sizeof(int), 1, fp);
-    for (i = 0 ; i < fl->nFeatures ; i++)  {
-      _printFeatureBin(fp, fl->feature[i]);
+    fwrite(&(view->nFeatures), sizeof(int), 1, fp);
+    for (i = 0 ; i < view->nFeatures ; i++)  {
+      feat.x = FV_X(view, i);
+      feat.y = FV_Y(view, i);
+      feat.val = FV_VAL(view, i);
+      _printFeatureBin(fp, &feat);
     }
     fclose(fp);
   }
 }
 
 
+void KLTWriteFeatureList(
+  KLT_FeatureList fl,
+  char *fname, 
+  char *fmt)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTOpenFeatureListView(fl, &view);
+  _writeFeatures(&view, fname, fmt);
+}
+
+
+void KLTWriteFeatureArrays(
+  KLT_FeatureArrays fa,
+  char *fname, 
+  char *fmt)
+{
+  _KLT_FeatureViewRec view;
+
+  _KLTViewFeatureArrays(fa, &view);
+  _writeFeatures(&view, fname, fmt);
+}
+
+
 void KLTWriteFeatureHistory(
   KLT_FeatureHistory fh,
   char *fname, 
@@ -408,6 +1035,7 @@ void KLTWriteFeatureTable(
   FILE *fp;
   char format[100];
   char type;
+  _TxtFormat f;
   int i, j;
 
   if (KLT_verbose >= 1 && fname != NULL)  {
@@ -420,11 +1048,15 @@ void KLTWriteFeatureTable(
     fp = _printSetupTxt(fname, fmt, format, &type);
     _printHeader(fp, format, FEATURE_TABLE, ft->nFrames, ft->nFeatures);
 
-    for (j = 0 ; j < ft->nFeatures ; j++)  {
-      fprintf(fp, "%7d | ", j);
-      for (i = 0 ; i < ft->nFrames ; i++)
-        _printFeatureTxt(fp, ft->feature[j][i], format, type);
-      fprintf(fp, "\n");
+    if (_parseFixedFormat(fmt, &f) && ft->nFrames > 0 && ft->nFeatures > 0)
+      _writeTableTxt(fp, ft, &f);
+    else  {
+      for (j = 0 ; j < ft->nFeatures ; j++)  {
+        fprintf(fp, "%7d | ", j);
+        for (i = 0 ; i < ft->nFrames ; i++)
+          _printFeatureTxt(fp, ft->feature[j][i], format, type);
+        fprintf(fp, "\n");
+      }
     }
     _printShutdown(fp);
   } else {  /* binary file */
@@ -443,15 +1075,251 @@ void KLTWriteFeatureTable(
 
 
 
+static void _readFeatureTxt(
+  FILE *fp,
+  KLT_Feature feat)
+{
+  int ch;
+
+  while ((ch = fgetc(fp)) != '(')
+    if (ch == EOF)
+      KLTError("(_readFeatures) File is truncated -- (Expected a feature)");
+  if(fscanf(fp, "%f,%f)=%d", &(feat->x), &(feat->y), &(feat->val)) != 3)
+      KLTError("fscanf failed ");
+}
+
+
+static void _readFeatureBin(
+  FILE *fp,
+  KLT_Feature feat)
+{
+  if(!fread(&(feat->x), sizeof(KLT_locType), 1, fp) ) KLTError("fread failed "); 
+  if(!fread(&(feat->y), sizeof(KLT_locType), 1, fp)) KLTError("fread failed ");
+  if(!fread(&(feat->val), sizeof(int), 1, fp)) KLTError("fread failed ");
+}
+
+
+/*********************************************************************
+ * _scanInteger
+ * _scanFloat
+ * _scanFeatureTxt
+ *
+ * Parse the text of a feature, "(x,y)=val", in place.  Each returns
+ * FALSE, without moving the cursor, if the text is malformed.  A
+ * number of at most 7 significant digits and 10 decimals is exact in
+ * single precision, as is the power of ten it is divided by, so the
+ * division rounds it as strtof does; other numbers go to strtof.
+ */
+
+typedef struct  {
+  const char *ptr;
+  const char *end;
+}  _TxtCursor;
+
+static void _skipBlanks(
+  _TxtCursor *c)
+{
+  while (c->ptr < c->end && (*c->ptr == ' ' || *c->ptr == '\t'))
+    c->ptr++;
+}
+
+
+static KLT_BOOL _scanChar(
+  _TxtCursor *c,
+  char ch)
+{
+  _skipBlanks(c);
+  if (c->ptr == c->end || *c->ptr != ch)  return FALSE;
+  c->ptr++;
+  return TRUE;
+}
+
+
+static KLT_BOOL _scanInteger(
+  _TxtCursor *c,
+  int *integer)
+{
+  const char *ptr;
+  int64_t v = 0;
+  KLT_BOOL neg = FALSE;
+
+  _skipBlanks(c);
+  ptr = c->ptr;
+  if (ptr < c->end && (*ptr == '-' || *ptr == '+'))
+    neg = (*ptr++ == '-');
+  if (ptr == c->end || !isdigit((uchar) *ptr))  return FALSE;
+  while (ptr < c->end && isdigit((uchar) *ptr))  {
+    v = 10 * v + (*ptr++ - '0');
+    if (v > (int64_t) INT_MAX + 1)  return FALSE;
+  }
+  if (neg)  v = -v;
+  if (v > INT_MAX)  return FALSE;
+  *integer = (int) v;
+  c->ptr = ptr;
+  return TRUE;
+}
+
+
+static KLT_BOOL _scanFloat(
+  _TxtCursor *c,
+  KLT_locType *x)
+{
+  static const float pow10[11] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                  1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+  const char *ptr;
+  char buf[64], *bufend;
+  uint64_t m = 0;
+  int nDigits = 0, nDecimals = 0;
+  KLT_BOOL neg = FALSE;
+  int n;
+
+  _skipBlanks(c);
+  ptr = c->ptr;
+  if (ptr < c->end && (*ptr == '-' || *ptr == '+'))
+    neg = (*ptr++ == '-');
+  for ( ; ptr < c->end && isdigit((uchar) *ptr) ; ptr++, nDigits++)
+    if (nDigits < 18)  m = 10 * m + (*ptr - '0');
+  if (ptr < c->end && *ptr == '.')
+    for (ptr++ ; ptr < c->end && isdigit((uchar) *ptr) ; ptr++, nDecimals++)
+      if (nDigits + nDecimals < 18)  m = 10 * m + (*ptr - '0');
+
+  if (nDigits + nDecimals > 0 && nDigits + nDecimals < 18 &&
+      m < (1 << 24) && nDecimals <= 10 &&
+      (ptr == c->end || !isalnum((uchar) *ptr)))  {
+    float f = (float) m / pow10[nDecimals];
+    *x = neg ? -f : f;
+    c->ptr = ptr;
+    return TRUE;
+  }
+
+  /* Exponents, infinities, NaNs and long numbers */
+  for (n = 0 ; c->ptr + n < c->end && n < (int) sizeof(buf) - 1 ; n++)  {
+    char ch = c->ptr[n];
+    if (ch == ',' || ch == ')' || isspace((uchar) ch))  break;
+    buf[n] = ch;
+  }
+  buf[n] = '\0';
+  *x = strtof(buf, &bufend);
+  if (n == 0 || bufend != buf + n)  return FALSE;
+  c->ptr += n;
+  return TRUE;
+}
+
+
+static KLT_BOOL _scanFeatureTxt(
+  _TxtCursor *c,
+  KLT_Feature feat)
+{
+  _TxtCursor save = *c;
+
+  if (_scanChar(c, '(') && _scanFloat(c, &feat->x) &&
+      _scanChar(c, ',') && _scanFloat(c, &feat->y) &&
+      _scanChar(c, ')') && _scanChar(c, '=') && _scanInteger(c, &feat->val))
+    return TRUE;
+  *c = save;
+  return FALSE;
+}
+
+
+/*********************************************************************
+ * _TxtFile
+ * _skipPast
+ * _scanWord
+ * _expectWord
+ *
+ * A text feature file is mapped into memory; its header is parsed
+ * there, and the cursor is left at the body.  _skipPast moves the
+ * cursor past the next ch, and returns FALSE if there is none.
+ * _scanWord reads the next run of non-blank characters, as
+ * fscanf("%s") does.
+ */
+
+typedef struct  {
+  void *addr;
+  size_t length;
+  _TxtCursor c;
+}  _TxtFile;
+
+static KLT_BOOL _skipPast(
+  _TxtCursor *c,
+  char ch)
+{
+  const char *p = memchr(c->ptr, ch, c->end - c->ptr);
+
+  if (p == NULL)  return FALSE;
+  c->ptr = p + 1;
+  return TRUE;
+}
+
+
+static void _scanWord(
+  _TxtCursor *c,
+  char *word,
+  int length)
+{
+  int n = 0;
+
+  while (c->ptr < c->end && isspace((uchar) *c->ptr))  c->ptr++;
+  while (c->ptr < c->end && !isspace((uchar) *c->ptr) && n < length - 1)
+    word[n++] = *c->ptr++;
+  word[n] = '\0';
+}
+
+
+static void _expectWord(
+  _TxtCursor *c,
+  const char *expected)
+{
+#define LINELENGTH 100
+  char word[LINELENGTH];
+
+  _scanWord(c, word, LINELENGTH);
+  if (word[0] == '\0')
+    KLTError("(_readFeatures) File is truncated -- (Expected '%s')",
+             expected);
+  if (strcmp(word, expected) != 0)
+    KLTError("(_readFeatures) File is corrupted -- "
+             "(Expected '%s', found '%s' instead)", expected, word);
+#undef LINELENGTH
+}
+
+
+static void _scanHeaderInteger(
+  _TxtCursor *c,
+  int *integer)
+{
+  while (c->ptr < c->end && isspace((uchar) *c->ptr))  c->ptr++;
+  if (!_scanInteger(c, integer))
+    KLTError("(_readFeatures) File is %s -- (Expected a number)",
+             (c->ptr == c->end) ? "truncated" : "corrupted");
+}
+
+
+/*********************************************************************
+ * _readHeader
+ *
+ * Reads the header of a feature file.  The header of a binary file is
+ * read from fp, which is left at the data.  That of a text file is
+ * parsed from a mapping of the file; if txt is not NULL, the mapping
+ * is returned there, with its cursor at the data, for the caller to
+ * unmap; otherwise, fp is moved to the data.
+ */
+
 static structureType _readHeader(
   FILE *fp,
   int *nFrames,
   int *nFeatures,
-  KLT_BOOL *binary)
+  KLT_BOOL *binary,
+  KLT_BOOL *streamed,	/* whether table is stored frame by frame */
+  _TxtFile *txt)	/* output, if not NULL */
 {
 #define LINELENGTH 100
   char line[LINELENGTH];
   structureType id;
+  struct stat st;
+  _TxtFile file;
+  const char *eol;
+  size_t warning_length = strlen(warning_line);
 	
   /* If file is binary, then read data and return */
   if(!fread(line, sizeof(char), BINHEADERLENGTH, fp) ) KLTError("fread failed ");
@@ -473,31 +1341,64 @@ static structureType _readHeader(
     if(!fread(nFeatures, sizeof(int), 1, fp) ) KLTError("fread failed ");
     *binary = TRUE;
     return FEATURE_TABLE;
-
-    /* If file is NOT binary, then continue.*/
-  } else {
-    rewind(fp);
-    *binary = FALSE;
+  } else if (strcmp(line, binheader_fs) == 0)  {
+    long start, end;
+    assert(nFrames != NULL);
+    assert(nFeatures != NULL);
+    if(!fread(nFeatures, sizeof(int), 1, fp) ) KLTError("fread failed ");
+    /* The frames run to the end of the file */
+    start = ftell(fp);
+    fseek(fp, 0, SEEK_END);
+    end = ftell(fp);
+    fseek(fp, start, SEEK_SET);
+    *nFrames = (*nFeatures > 0) ?
+      (int) ((end - start) / (*nFeatures * (2*sizeof(KLT_locType) + sizeof(int)))) : 0;
+    *binary = TRUE;
+    if (streamed != NULL)  *streamed = TRUE;
+    return FEATURE_TABLE;
   }
 
+  /* If file is NOT binary, then map it */
+  *binary = FALSE;
+  if (fstat(fileno(fp), &st) != 0)
+    KLTError("(_readFeatures) Can't read file");
+  file.length = st.st_size;
+  file.addr = mmap(NULL, file.length, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+  if (file.addr == MAP_FAILED)
+    KLTError("(_readFeatures) Can't map file");
+  madvise(file.addr, file.length, MADV_SEQUENTIAL);
+  file.c.ptr = (const char *) file.addr;
+  file.c.end = (const char *) file.addr + file.length;
+
   /* Skip comments until warning line */
-  while (strcmp(line, warning_line) != 0)  {
-    if(fgets(line, LINELENGTH, fp) == NULL) KLTError("fgets failed ");
-    if (feof(fp))
+  for (;;)  {
+    eol = memchr(file.c.ptr, '\n', file.c.end - file.c.ptr);
+    if (eol == NULL)
       KLTError("(_readFeatures) File is corrupted -- Couldn't find line:\n"
                "\t%s\n", warning_line);
+    if ((size_t) (eol + 1 - file.c.ptr) == warning_length &&
+        memcmp(file.c.ptr, warning_line, warning_length) == 0)
+      break;
+    file.c.ptr = eol + 1;
   }
+  file.c.ptr = eol + 1;
 
   /* Read 'Feature List', 'Feature History', or 'Feature Table' */
-  while (fgetc(fp) != '-');
-  while (fgetc(fp) != '\n');
-  if(fgets(line, LINELENGTH, fp) == NULL) KLTError("fgets failed ");
-  if (strcmp(line, "KLT Feature List\n") == 0) id = FEATURE_LIST;
-  else if (strcmp(line, "KLT Feature History\n") == 0) id = FEATURE_HISTORY;
-  else if (strcmp(line, "KLT Feature Table\n") == 0) id = FEATURE_TABLE;
+  if (!_skipPast(&file.c, '-') || !_skipPast(&file.c, '\n'))
+    KLTError("(_readFeatures) File is truncated -- (Expected the type of data)");
+  eol = memchr(file.c.ptr, '\n', file.c.end - file.c.ptr);
+  if (eol == NULL)  eol = file.c.end;
+  if (eol > file.c.ptr && eol[-1] == '\r')  eol--;
+  if (eol - file.c.ptr == 16 && memcmp(file.c.ptr, "KLT Feature List", 16) == 0)
+    id = FEATURE_LIST;
+  else if (eol - file.c.ptr == 19 && memcmp(file.c.ptr, "KLT Feature History", 19) == 0)
+    id = FEATURE_HISTORY;
+  else if (eol - file.c.ptr == 17 && memcmp(file.c.ptr, "KLT Feature Table", 17) == 0)
+    id = FEATURE_TABLE;
   else
     KLTError("(_readFeatures) File is corrupted -- (Not 'KLT Feature List', "
              "'KLT Feature History', or 'KLT Feature Table')");
+  file.c.ptr = eol;
 
   /* If there's an incompatibility between the type of file */
   /* and the parameters passed, exit now before we attempt */
@@ -505,76 +1406,78 @@ static structureType _readHeader(
   /* detect and handle this error. */
   if ((id == FEATURE_LIST && nFeatures == NULL) ||
       (id == FEATURE_HISTORY && nFrames == NULL) ||
-      (id == FEATURE_TABLE && (nFeatures == NULL || nFrames == NULL)))
+      (id == FEATURE_TABLE && (nFeatures == NULL || nFrames == NULL)))  {
+    munmap(file.addr, file.length);
     return id;
+  }
 
   /* Read nFeatures and nFrames */
-  while (fgetc(fp) != '-');
-  while (fgetc(fp) != '\n');
-  if(fscanf(fp, "%s", line) <= 0)  KLTError("fscanf failed ");
-  if (id == FEATURE_LIST)  {
-    if (strcmp(line, "nFeatures") != 0)
-      KLTError("(_readFeatures) File is corrupted -- "
-               "(Expected 'nFeatures', found '%s' instead)", line);
-  } else if (strcmp(line, "nFrames") != 0)
-    KLTError("(_readFeatures) File is corrupted -- "
-             "(Expected 'nFrames', found '%s' instead)", line);
-  if(fscanf(fp, "%s", line) <= 0)  KLTError("fscanf failed ");
-  if (strcmp(line, "=") != 0)
-    KLTError("(_readFeatures) File is corrupted -- "
-             "(Expected '=', found '%s' instead)", line);
-  if (id == FEATURE_LIST)
-  {
-      if(fscanf(fp, "%d", nFeatures) <= 0)  KLTError("fscanf failed ");
-  }
-  else 
-  {
-      if(fscanf(fp, "%d", nFrames ) <= 0)  KLTError("fscanf failed ");
-  }
+  if (!_skipPast(&file.c, '-') || !_skipPast(&file.c, '\n'))
+    KLTError("(_readFeatures) File is truncated -- (Expected the size of data)");
+  _expectWord(&file.c, (id == FEATURE_LIST) ? "nFeatures" : "nFrames");
+  _expectWord(&file.c, "=");
+  _scanHeaderInteger(&file.c, (id == FEATURE_LIST) ? nFeatures : nFrames);
 
   /* If 'Feature Table', then also get nFeatures */
   if (id == FEATURE_TABLE)  {
-    if(fscanf(fp, "%s", line ) <= 0)  KLTError("fscanf failed ");
-    if (strcmp(line, ",") != 0)
-      KLTError("(_readFeatures) File '%s' is corrupted -- "
-               "(Expected 'comma', found '%s' instead)", line);
-    if( fscanf(fp, "%s", line) <= 0)  KLTError("fscanf failed ");
-    if (strcmp(line, "nFeatures") != 0)
-      KLTError("(_readFeatures) File '%s' is corrupted -- "
-               "(2 Expected 'nFeatures ', found '%s' instead)", line);
-    if(fscanf(fp, "%s", line) <= 0)  KLTError("fscanf failed ");
-    if (strcmp(line, "=") != 0)
-      KLTError("(_readFeatures) File '%s' is corrupted -- "
-               "(2 Expected '= ', found '%s' instead)", line);
-    if(fscanf(fp, "%d", nFeatures) <= 0)  KLTError("fscanf failed ");
+    _expectWord(&file.c, ",");
+    _expectWord(&file.c, "nFeatures");
+    _expectWord(&file.c, "=");
+    _scanHeaderInteger(&file.c, nFeatures);
   }
 
   /* Skip junk before data */
-  while (fgetc(fp) != '-');
-  while (fgetc(fp) != '\n');
+  if (!_skipPast(&file.c, '-') || !_skipPast(&file.c, '\n'))
+    KLTError("(_readFeatures) File is truncated -- (Expected the data)");
 
+  if (txt != NULL)
+    *txt = file;
+  else  {
+    fseek(fp, file.c.ptr - (const char *) file.addr, SEEK_SET);
+    munmap(file.addr, file.length);
+  }
   return id;
 #undef LINELENGTH
 }
 
 
-static void _readFeatureTxt(
-  FILE *fp,
-  KLT_Feature feat)
-{
-  while (fgetc(fp) != '(');
-  if(fscanf(fp, "%f,%f)=%d", &(feat->x), &(feat->y), &(feat->val)) )
-      KLTError("fscanf failed ");
-}
-
+/*********************************************************************
+ * _readTableTxt
+ *
+ * Reads the rows of a text feature table, from the cursor of the
+ * mapping its header was read from.  Every row must hold its index,
+ * '|', and exactly nFrames features.
+ */
 
-static void _readFeatureBin(
-  FILE *fp,
-  KLT_Feature feat)
+static void _readTableTxt(
+  _TxtFile *txt,
+  KLT_FeatureTable ft,
+  char *fname)
 {
-  if(!fread(&(feat->x), sizeof(KLT_locType), 1, fp) ) KLTError("fread failed "); 
-  if(!fread(&(feat->y), sizeof(KLT_locType), 1, fp)) KLTError("fread failed ");
-  if(!fread(&(feat->val), sizeof(int), 1, fp)) KLTError("fread failed ");
+  _TxtCursor c = txt->c;
+  int indx;
+  int i, j;
+
+  for (j = 0 ; j < ft->nFeatures ; j++)  {
+    while (c.ptr < c.end && isspace((uchar) *c.ptr))  c.ptr++;
+    if (c.ptr == c.end)
+      KLTError("(KLTReadFeatureTable) File '%s' is truncated", fname);
+    if (!_scanInteger(&c, &indx) || !_scanChar(&c, '|'))
+      KLTError("(KLTReadFeatureTable) File '%s' is corrupted -- "
+               "(Expected index of feature %d)", fname, j);
+    if (indx != j) 
+      KLTError("(KLTReadFeatureTable) Bad index at j = %d"
+               "-- %d", j, indx);
+    for (i = 0 ; i < ft->nFrames ; i++)
+      if (!_scanFeatureTxt(&c, ft->feature[j][i]))
+        KLTError("(KLTReadFeatureTable) File '%s' is corrupted -- "
+                 "(Bad entry for feature %d, frame %d)", fname, j, i);
+    _skipBlanks(&c);
+    if (c.ptr < c.end && *c.ptr == '\r')  c.ptr++;
+    if (c.ptr < c.end && *c.ptr++ != '\n')
+      KLTError("(KLTReadFeatureTable) File '%s' is corrupted -- "
+               "(Feature %d has more than %d frames)", fname, j, ft->nFrames);
+  }
 }
 
 
@@ -604,7 +1507,7 @@ KLT_FeatureList KLTReadFeatureList(
                             "for reading", fname);
   if (KLT_verbose >= 1) 
     fprintf(stderr,  "(KLT) Reading feature list from '%s'\n", fname);
-  id = _readHeader(fp, NULL, &nFeatures, &binary);
+  id = _readHeader(fp, NULL, &nFeatures, &binary, NULL, NULL);
   if (id != FEATURE_LIST) 
     KLTError("(KLTReadFeatureList) File '%s' does not contain "
              "a FeatureList", fname);
@@ -656,7 +1559,7 @@ KLT_FeatureHistory KLTReadFeatureHistory(
   if (fp == NULL)  KLTError("(KLTReadFeatureHistory) Can't open file '%s' "
                             "for reading", fname);
   if (KLT_verbose >= 1) fprintf(stderr,  "(KLT) Reading feature history from '%s'\n", fname);
-  id = _readHeader(fp, &nFrames, NULL, &binary);
+  id = _readHeader(fp, &nFrames, NULL, &binary, NULL, NULL);
   if (id != FEATURE_HISTORY) KLTError("(KLTReadFeatureHistory) File '%s' does not contain "
                                       "a FeatureHistory", fname);
 
@@ -701,15 +1604,25 @@ KLT_FeatureTable KLTReadFeatureTable(
   int nFrames;
   int nFeatures;
   structureType id;
-  int indx;
   KLT_BOOL binary; 		/* whether file is binary or text */
+  KLT_BOOL streamed = FALSE;
+  _TxtFile txt;
+  char magic[BINHEADERLENGTH];
   int i, j;
 
   fp = fopen(fname, "rb");
   if (fp == NULL)  KLTError("(KLTReadFeatureTable) Can't open file '%s' "
                             "for reading", fname);
+
+  /* Columnar files are mapped rather than read */
+  if (fread(magic, 1, BINHEADERLENGTH, fp) == BINHEADERLENGTH &&
+      memcmp(magic, binheader_fc, BINHEADERLENGTH) == 0)  {
+    fclose(fp);
+    return _readColumnarTable(ft_in, fname);
+  }
+  rewind(fp);
   if (KLT_verbose >= 1) fprintf(stderr,  "(KLT) Reading feature table from '%s'\n", fname);
-  id = _readHeader(fp, &nFrames, &nFeatures, &binary);
+  id = _readHeader(fp, &nFrames, &nFeatures, &binary, &streamed, &txt);
   if (id != FEATURE_TABLE) KLTError("(KLTReadFeatureTable) File '%s' does not contain "
                                     "a FeatureTable", fname);
 
@@ -728,13 +1641,12 @@ KLT_FeatureTable KLTReadFeatureTable(
   }
 
   if (!binary) {  /* text file */
-    for (j = 0 ; j < ft->nFeatures ; j++)  {
-      if( fscanf(fp, "%d |", &indx) <= 0)  KLTError("fscanf failed ");
-      if (indx != j) 
-        KLTError("(KLTReadFeatureTable) Bad index at j = %d"
-                 "-- %d", j, indx);
-      for (i = 0 ; i < ft->nFrames ; i++)
-        _readFeatureTxt(fp, ft->feature[j][i]);
+    _readTableTxt(&txt, ft, fname);
+    munmap(txt.addr, txt.length);
+  } else if (streamed) {  /* binary file written by a feature stream */
+    for (i = 0 ; i < ft->nFrames ; i++)  {
+      for (j = 0 ; j < ft->nFeatures ; j++)
+        _readFeatureBin(fp, ft->feature[j][i]);
     }
   } else {  /* binary file */
     for (j = 0 ; j < ft->nFeatures ; j++)  {
@@ -748,3 +1660,302 @@ KLT_FeatureTable KLTReadFeatureTable(
   return ft;
 }
 
+
+
+/*********************************************************************
+ * Columnar feature files
+ *
+ * A feature table stored frame by frame, each frame as a block of
+ * the x[], y[] and val[] arrays of its features, with an index of
+ * the block offsets at the end of the file.  Reading maps the file
+ * into memory, so that a frame or the trajectory of a feature can be
+ * read without going through the rest of the file.  All values are
+ * stored in the byte order of the machine that wrote them.
+ *
+ *   "KLTFC1", 2 zero bytes, nFrames, nFeatures     (16 bytes)
+ *   nFrames frame blocks                           (12*nFeatures bytes each)
+ *   padding to a multiple of 8 bytes
+ *   nFrames 64-bit block offsets                   (index)
+ *   64-bit offset of the index, "KLTFCIDX"         (16 bytes)
+ */
+
+#define COLHEADERLENGTH  16
+#define COLTRAILERLENGTH 16
+
+static char coltrailer[8+1] = "KLTFCIDX";
+
+typedef struct  {
+  void *addr;
+  size_t length;
+  const int64_t *index;      /* block offset of every frame */
+}  _ColumnarFile;
+
+
+/*********************************************************************
+ * KLTWriteFeatureTableColumnar
+ */
+
+void KLTWriteFeatureTableColumnar(
+  KLT_FeatureTable ft,
+  char *fname)
+{
+  FILE *fp;
+  char header[COLHEADERLENGTH];
+  int nFeatures = ft->nFeatures;
+  size_t blocksize = nFeatures * (2*sizeof(KLT_locType) + sizeof(int));
+  char *block;
+  KLT_locType *x, *y;
+  int *val;
+  int64_t *index, offset;
+  static const char zeros[8] = {0};
+  int i, j;
+
+  if (KLT_verbose >= 1)
+    fprintf(stderr, "(KLT) Writing feature table to columnar file: '%s'\n",
+            fname);
+
+  fp = _printSetupBin(fname);
+  block = (char *) malloc(blocksize + 1);
+  index = (int64_t *) malloc((ft->nFrames + 1) * sizeof(int64_t));
+  if (block == NULL || index == NULL)
+    KLTError("(KLTWriteFeatureTableColumnar) Out of memory");
+  x = (KLT_locType *) block;
+  y = x + nFeatures;
+  val = (int *) (y + nFeatures);
+
+  memset(header, 0, COLHEADERLENGTH);
+  memcpy(header, binheader_fc, BINHEADERLENGTH);
+  memcpy(header + 8, &ft->nFrames, sizeof(int));
+  memcpy(header + 12, &ft->nFeatures, sizeof(int));
+  fwrite(header, 1, COLHEADERLENGTH, fp);
+  offset = COLHEADERLENGTH;
+
+  /* Frame blocks, gathered column by column */
+  for (i = 0 ; i < ft->nFrames ; i++)  {
+    for (j = 0 ; j < nFeatures ; j++)  {
+      x[j] = ft->feature[j][i]->x;
+      y[j] = ft->feature[j][i]->y;
+      val[j] = ft->feature[j][i]->val;
+    }
+    fwrite(block, 1, blocksize, fp);
+    index[i] = offset;
+    offset += blocksize;
+  }
+
+  /* Index and trailer */
+  fwrite(zeros, 1, (size_t) ((8 - offset % 8) % 8), fp);
+  offset += (8 - offset % 8) % 8;
+  fwrite(index, sizeof(int64_t), ft->nFrames, fp);
+  fwrite(&offset, sizeof(int64_t), 1, fp);
+  fwrite(coltrailer, 1, 8, fp);
+  if (ferror(fp))
+    KLTError("(KLTWriteFeatureTableColumnar) Can't write to file '%s'", fname);
+  fclose(fp);
+
+  free(block);
+  free(index);
+}
+
+
+/*********************************************************************
+ * KLTOpenFeatureFile
+ *
+ * Maps a columnar feature file and checks its index; nothing else
+ * is read until frames or trajectories are extracted.
+ */
+
+KLT_FeatureFile KLTOpenFeatureFile(
+  char *fname)
+{
+  KLT_FeatureFile ff;
+  _ColumnarFile *cf;
+  const char *base;
+  struct stat st;
+  int64_t indexoffset;
+  size_t blocksize;
+  int fd, i;
+
+  if (KLT_verbose >= 1)
+    fprintf(stderr, "(KLT) Opening columnar feature file '%s'\n", fname);
+
+  if ( (fd = open(fname, O_RDONLY)) < 0)
+    KLTError("(KLTOpenFeatureFile) Can't open file '%s' for reading", fname);
+  if (fstat(fd, &st) != 0 ||
+      st.st_size < COLHEADERLENGTH + COLTRAILERLENGTH)
+    KLTError("(KLTOpenFeatureFile) File '%s' is too short", fname);
+  cf = (_ColumnarFile *) malloc(sizeof(_ColumnarFile));
+  ff = (KLT_FeatureFile) malloc(sizeof(KLT_FeatureFileRec));
+  if (cf == NULL || ff == NULL)
+    KLTError("(KLTOpenFeatureFile) Out of memory");
+  cf->length = (size_t) st.st_size;
+  cf->addr = mmap(NULL, cf->length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (cf->addr == MAP_FAILED)
+    KLTError("(KLTOpenFeatureFile) Can't map file '%s'", fname);
+  base = (const char *) cf->addr;
+
+  /* Header and trailer */
+  if (memcmp(base, binheader_fc, BINHEADERLENGTH) != 0 ||
+      memcmp(base + cf->length - 8, coltrailer, 8) != 0)
+    KLTError("(KLTOpenFeatureFile) File '%s' is not a columnar feature file",
+             fname);
+  memcpy(&ff->nFrames, base + 8, sizeof(int));
+  memcpy(&ff->nFeatures, base + 12, sizeof(int));
+  memcpy(&indexoffset, base + cf->length - COLTRAILERLENGTH, sizeof(int64_t));
+  blocksize = ff->nFeatures * (2*sizeof(KLT_locType) + sizeof(int));
+  if (ff->nFrames < 0 || ff->nFeatures < 0 || indexoffset % 8 != 0 ||
+      indexoffset < COLHEADERLENGTH ||
+      (size_t) indexoffset + ff->nFrames * sizeof(int64_t) + COLTRAILERLENGTH
+        != cf->length)
+    KLTError("(KLTOpenFeatureFile) File '%s' is corrupted -- bad index", fname);
+  cf->index = (const int64_t *) (base + indexoffset);
+  for (i = 0 ; i < ff->nFrames ; i++)
+    if (cf->index[i] < COLHEADERLENGTH ||
+        (size_t) cf->index[i] + blocksize > (size_t) indexoffset)
+      KLTError("(KLTOpenFeatureFile) File '%s' is corrupted -- "
+               "bad offset of frame %d", fname, i);
+
+  madvise(cf->addr, cf->length, MADV_RANDOM);
+  ff->mapping = cf;
+  return ff;
+}
+
+
+/*********************************************************************
+ * KLTCloseFeatureFile
+ */
+
+void KLTCloseFeatureFile(
+  KLT_FeatureFile ff)
+{
+  _ColumnarFile *cf = (_ColumnarFile *) ff->mapping;
+
+  munmap(cf->addr, cf->length);
+  free(cf);
+  free(ff);
+}
+
+
+/*********************************************************************
+ * _frameBlock
+ *
+ * Returns the x[], y[] and val[] arrays of a frame, in place.
+ */
+
+static void _frameBlock(
+  KLT_FeatureFile ff,
+  int frame,
+  const KLT_locType **x,
+  const KLT_locType **y,
+  const int **val)
+{
+  _ColumnarFile *cf = (_ColumnarFile *) ff->mapping;
+
+  *x = (const KLT_locType *) ((const char *) cf->addr + cf->index[frame]);
+  *y = *x + ff->nFeatures;
+  *val = (const int *) (*y + ff->nFeatures);
+}
+
+
+/*********************************************************************
+ * KLTExtractFeatureFileList
+ * KLTExtractFeatureFileHistory
+ *
+ * Same as KLTExtractFeatureList and KLTExtractFeatureHistory, from
+ * an open columnar file: the first reads one frame block, the
+ * second one value per block.
+ */
+
+void KLTExtractFeatureFileList(
+  KLT_FeatureList fl,
+  KLT_FeatureFile ff,
+  int frame)
+{
+  const KLT_locType *x, *y;
+  const int *val;
+  int feat;
+
+  if (frame < 0 || frame >= ff->nFrames)
+    KLTError("(KLTExtractFeatureFileList) Frame number %d is not between 0 and %d",
+             frame, ff->nFrames - 1);
+
+  if (fl->nFeatures != ff->nFeatures)
+    KLTError("(KLTExtractFeatureFileList) FeatureList and FeatureFile must "
+             "have the same number of features");
+
+  _frameBlock(ff, frame, &x, &y, &val);
+  for (feat = 0 ; feat < fl->nFeatures ; feat++)  {
+    fl->feature[feat]->x   = x[feat];
+    fl->feature[feat]->y   = y[feat];
+    fl->feature[feat]->val = val[feat];
+  }
+}
+
+
+void KLTExtractFeatureFileHistory(
+  KLT_FeatureHistory fh,
+  KLT_FeatureFile ff,
+  int feat)
+{
+  const KLT_locType *x, *y;
+  const int *val;
+  int frame;
+
+  if (feat < 0 || feat >= ff->nFeatures)
+    KLTError("(KLTExtractFeatureFileHistory) Feature number %d is not between 0 and %d",
+             feat, ff->nFeatures - 1);
+
+  if (fh->nFrames != ff->nFrames)
+    KLTError("(KLTExtractFeatureFileHistory) FeatureHistory and FeatureFile must "
+             "have the same number of frames");
+
+  for (frame = 0 ; frame < fh->nFrames ; frame++)  {
+    _frameBlock(ff, frame, &x, &y, &val);
+    fh->feature[frame]->x   = x[feat];
+    fh->feature[frame]->y   = y[feat];
+    fh->feature[frame]->val = val[feat];
+  }
+}
+
+
+/*********************************************************************
+ * _readColumnarTable
+ *
+ * Reads a whole columnar file for KLTReadFeatureTable.
+ */
+
+static KLT_FeatureTable _readColumnarTable(
+  KLT_FeatureTable ft_in,
+  char *fname)
+{
+  KLT_FeatureFile ff;
+  KLT_FeatureTable ft;
+  const KLT_locType *x, *y;
+  const int *val;
+  int i, j;
+
+  ff = KLTOpenFeatureFile(fname);
+  if (ft_in == NULL)
+    ft = KLTCreateFeatureTable(ff->nFrames, ff->nFeatures);
+  else  {
+    ft = ft_in;
+    if (ft->nFrames != ff->nFrames || ft->nFeatures != ff->nFeatures)
+      KLTError("(KLTReadFeatureTable) The feature table passed "
+               "does not contain the same number of frames and "
+               "features as the feature table in file '%s' ", fname);
+  }
+
+  madvise(((_ColumnarFile *) ff->mapping)->addr,
+          ((_ColumnarFile *) ff->mapping)->length, MADV_SEQUENTIAL);
+  for (i = 0 ; i < ft->nFrames ; i++)  {
+    _frameBlock(ff, i, &x, &y, &val);
+    for (j = 0 ; j < ft->nFeatures ; j++)  {
+      ft->feature[j][i]->x = x[j];
+      ft->feature[j][i]->y = y[j];
+      ft->feature[j][i]->val = val[j];
+    }
+  }
+
+  KLTCloseFeatureFile(ff);
+  return ft;
+}
@@ -0,0 +1,22 @@
+/*********************************************************************
+ * writeFeatures.h
+ *********************************************************************/
+
+#ifndef _WRITEFEATURES_H_
+#define _WRITEFEATURES_H_
+
+#include <stdio.h>
+#include "klt.h"
+
+/* Binary feature stream files, appended to by KLT_FeatureStream */
+void _KLTWriteFeatureStreamHeader(
+  FILE *fp,
+  int nFeatures);
+
+int _KLTWriteFeatureBin(
+  FILE *fp,
+  KLT_locType x,
+  KLT_locType y,
+  int val);
+
+#endif